@@ -0,0 +1,43 @@
+#!/bin/sh
+# amalgamate.sh -- generate a single file build of linenoise.
+#
+# Usage: ./amalgamate.sh [outdir]
+#
+# Writes linenoise.c and linenoise.h into 'outdir' (default: amalgamation).
+# The header is linenoise.h followed by utf8.h, the source is utf8.c
+# followed by linenoise.c, with the local includes removed. Compiling the
+# library as a single translation unit lets the compiler inline across the
+# encoding functions and drop unused code without LTO; define
+# LINENOISE_BUILTIN_UTF8 to also turn the encoding function pointers into
+# direct calls:
+#
+#   cc -O2 -DLINENOISE_BUILTIN_UTF8 -c amalgamation/linenoise.c
+
+set -e
+cd "$(dirname "$0")"
+out=${1:-amalgamation}
+mkdir -p "$out"
+
+{
+    echo "/* linenoise.h -- amalgamated header, generated by amalgamate.sh."
+    echo " * Do not edit: edit linenoise.h and utf8.h instead. */"
+    echo
+    cat linenoise.h
+    echo
+    cat utf8.h
+} > "$out/linenoise.h"
+
+{
+    echo "/* linenoise.c -- amalgamated source, generated by amalgamate.sh."
+    echo " * Do not edit: edit linenoise.c and utf8.c instead. */"
+    echo
+    echo "#include \"linenoise.h\""
+    for f in utf8.c linenoise.c; do
+        echo
+        echo "/* ==== Begin $f ==== */"
+        echo "#line 1 \"$f\""
+        sed -e 's/^#include "linenoise\.h"$/\/* & *\//' \
+            -e 's/^#include "utf8\.h"$/\/* & *\//' "$f"
+        echo "/* ==== End $f ==== */"
+    done
+} > "$out/linenoise.c"
@@ -0,0 +1,280 @@
+/* bench.c -- end to end benchmark of linenoise on a pseudo terminal.
+ *
+ * A child process runs a typical linenoise loop, with completion, hints,
+ * history and UTF-8 enabled, on the slave side of a PTY. The parent plays
+ * a representative workload on the master side: typing and editing
+ * commands, pasting long lines, browsing the history and completing.
+ * Every key goes through the whole terminal path, so the result includes
+ * reading, dispatching and refreshing.
+ *
+ * Usage: bench [--iterations <n>] [--save <file>] [--compare <file>] [label]
+ *
+ * With --save the keys per second are written to <file>, with --compare
+ * they are compared against a result saved before. This is how the pgo
+ * and lto Makefile targets report their gain against the -Os build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#if defined(__APPLE__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#include <util.h>
+#elif defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+#include "linenoise.h"
+#include "utf8.h"
+
+#define BENCH_PROMPT "\033[32mbench\x1b[0m> "
+#define BENCH_MARKER "\002bench\003"
+/* What the child writes once it is ready for the next line, with the new
+ * line translated by the terminal. */
+#define BENCH_READY BENCH_MARKER "\r\n" BENCH_PROMPT
+
+static const char *commands[] = {
+    "cd", "chmod", "chown", "clear", "cp", "curl", "git", "grep", "gzip",
+    "head", "hostname", "kill", "less", "ls", "make", "mkdir", "mv", "ps",
+    "rm", "rsync", "sed", "sort", "ssh", "tail", "tar", "top", "touch",
+    "uname", "wc", "xargs", NULL
+};
+
+static void completion(const char *buf, linenoiseCompletions *lc) {
+    size_t len = strlen(buf);
+    int j;
+
+    for (j = 0; commands[j]; j++)
+        if (!strncmp(buf,commands[j],len)) linenoiseAddCompletion(lc,commands[j]);
+    linenoiseAddHistoryCompletions(buf,lc);
+}
+
+static char *hints(const char *buf, int *color, int *bold) {
+    *color = 35;
+    *bold = 0;
+    if (!strcasecmp(buf,"git")) return " <command> [<args>]";
+    if (!strcasecmp(buf,"tar")) return " -czf <archive> <files>";
+    return NULL;
+}
+
+/* The linenoise side of the benchmark. */
+static void runChild(void) {
+    char *line;
+
+    linenoiseSetEncodingFunctions(
+        linenoiseUtf8PrevCharLen,
+        linenoiseUtf8NextCharLen,
+        linenoiseUtf8ReadCode);
+    linenoiseSetCompletionCallback(completion);
+    linenoiseSetHintsCallback(hints);
+    linenoiseHistorySetMaxLen(1000);
+    while((line = linenoise(BENCH_PROMPT)) != NULL) {
+        linenoiseHistoryAdd(line);
+        linenoiseFree(line);
+        printf(BENCH_MARKER "\n");
+        fflush(stdout);
+    }
+    exit(0);
+}
+
+/* Growable buffer holding the whole workload. */
+struct workload {
+    char *b;
+    size_t len;
+    int lines;
+};
+
+static void wlAppend(struct workload *wl, const char *s) {
+    size_t len = strlen(s);
+
+    wl->b = realloc(wl->b,wl->len+len);
+    if (wl->b == NULL) exit(1);
+    memcpy(wl->b+wl->len,s,len);
+    wl->len += len;
+}
+
+static void wlEnter(struct workload *wl) {
+    wlAppend(wl,"\r");
+    wl->lines++;
+}
+
+static void buildWorkload(struct workload *wl, int iterations) {
+    char line[512];
+    int j, k;
+
+    for (j = 0; j < iterations; j++) {
+        /* Typing and editing a command. */
+        snprintf(line,sizeof(line),"git commit -m 'change %d: ünïcödé テスト'",j);
+        wlAppend(wl,line);
+        wlAppend(wl,"\001");                            /* ctrl-a */
+        for (k = 0; k < 4; k++) wlAppend(wl,"\x1b[C");  /* right */
+        wlAppend(wl,"-a ");
+        wlAppend(wl,"\x1b" "f" "\x1b" "f" "\x1b" "b");  /* word motion */
+        wlAppend(wl,"\005");                            /* ctrl-e */
+        for (k = 0; k < 3; k++) wlAppend(wl,"\x7f");    /* backspace */
+        wlAppend(wl,"\027");                            /* ctrl-w */
+        wlEnter(wl);
+
+        /* Pasting a long line. */
+        wlAppend(wl,"echo ");
+        for (k = 0; k < 30; k++) wlAppend(wl,"abcdefghij");
+        wlEnter(wl);
+
+        /* Hints. */
+        wlAppend(wl,"git");
+        wlAppend(wl,"\025");                            /* ctrl-u */
+        wlAppend(wl,"tar");
+        wlEnter(wl);
+
+        /* Browsing the history. */
+        for (k = 0; k < 15; k++) wlAppend(wl,"\x1b[A");
+        for (k = 0; k < 10; k++) wlAppend(wl,"\x1b[B");
+        wlEnter(wl);
+
+        /* Completion. */
+        wlAppend(wl,"c\t\t\t");
+        wlEnter(wl);
+    }
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Feed the workload to 'fd' while draining the output. Since linenoise
+ * discards the input typed ahead when it switches the terminal mode, the
+ * keys of every line are only sent once the child is ready for it. */
+static int play(int fd, struct workload *wl) {
+    char buf[16384], tail[sizeof(BENCH_READY)] = {0};
+    size_t written = 0, mlen = strlen(BENCH_READY);
+    int lines = 0, ready = 1;
+
+    while (lines < wl->lines) {
+        struct pollfd pfd;
+        ssize_t n;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN | (ready && written < wl->len ? POLLOUT : 0);
+        if (poll(&pfd,1,5000) <= 0) return -1;
+        if (pfd.revents & POLLIN) {
+            ssize_t j;
+
+            n = read(fd,buf,sizeof(buf));
+            if (n <= 0) return -1;
+            /* Look for the ready sequence, also across reads. */
+            for (j = 0; j < n; j++) {
+                memmove(tail,tail+1,mlen-1);
+                tail[mlen-1] = buf[j];
+                if (!memcmp(tail,BENCH_READY,mlen)) {
+                    lines++;
+                    ready = 1;
+                }
+            }
+        } else if (pfd.revents & POLLOUT) {
+            size_t chunk = wl->len-written;
+            char *enter = memchr(wl->b+written,'\r',chunk);
+
+            /* Keys are typed in small bursts, up to the end of the line. */
+            if (enter) chunk = enter-(wl->b+written)+1;
+            if (chunk > 64) chunk = 64;
+            n = write(fd,wl->b+written,chunk);
+            if (n == -1 && errno != EAGAIN) return -1;
+            if (n > 0) written += n;
+            if (written && wl->b[written-1] == '\r') ready = 0;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct workload wl = { NULL, 0, 0 };
+    struct winsize ws = { 24, 80, 0, 0 };
+    const char *label = "bench", *save = NULL, *compare = NULL;
+    int iterations = 50, fd, status;
+    double start, elapsed, kps;
+    pid_t pid;
+
+    while (argc > 1) {
+        argc--;
+        argv++;
+        if (!strcmp(*argv,"--iterations") && argc > 1) {
+            iterations = atoi(*++argv);
+            argc--;
+        } else if (!strcmp(*argv,"--save") && argc > 1) {
+            save = *++argv;
+            argc--;
+        } else if (!strcmp(*argv,"--compare") && argc > 1) {
+            compare = *++argv;
+            argc--;
+        } else if (*argv[0] != '-') {
+            label = *argv;
+        } else {
+            fprintf(stderr, "Usage: bench [--iterations <n>] [--save <file>] "
+                            "[--compare <file>] [label]\n");
+            exit(1);
+        }
+    }
+
+    buildWorkload(&wl,iterations);
+    pid = forkpty(&fd,NULL,NULL,&ws);
+    if (pid == -1) {
+        perror("forkpty");
+        exit(1);
+    }
+    if (pid == 0) runChild();
+
+    /* Wait for the first prompt before to start the clock. */
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        char buf[256];
+        if (poll(&pfd,1,5000) <= 0 || read(fd,buf,sizeof(buf)) <= 0) {
+            fprintf(stderr, "bench: no prompt\n");
+            exit(1);
+        }
+    }
+    start = now();
+    if (play(fd,&wl) == -1) {
+        fprintf(stderr, "bench: workload did not complete\n");
+        kill(pid,SIGKILL);
+        exit(1);
+    }
+    elapsed = now()-start;
+    kill(pid,SIGKILL);
+    waitpid(pid,&status,0);
+
+    kps = wl.len/elapsed;
+    printf("%-20s %8zu keys %8.3f s %10.0f keys/s %8.2f us/key",
+        label, wl.len, elapsed, kps, elapsed*1e6/wl.len);
+    if (compare) {
+        FILE *fp = fopen(compare,"r");
+        double ref;
+        if (fp && fscanf(fp,"%lf",&ref) == 1)
+            printf(" %+6.1f%% vs %s", (kps/ref-1)*100, compare);
+        if (fp) fclose(fp);
+    }
+    printf("\n");
+    if (save) {
+        FILE *fp = fopen(save,"w");
+        if (fp == NULL) {
+            perror(save);
+            exit(1);
+        }
+        fprintf(fp,"%f\n",kps);
+        fclose(fp);
+    }
+    free(wl.b);
+    return 0;
+}
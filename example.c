@@ -81,8 +81,8 @@ int main(int argc, char **argv) {
      * The call to linenoise() will block as long as the user types something
      * and presses enter.
      *
-     * The typed string is returned as a malloc() allocated string by
-     * linenoise, so the user needs to free() it. */
+     * The typed string is returned as an allocated string by linenoise,
+     * so the user needs to free it with linenoiseFree(). */
 #ifdef UTF8
     while((line = linenoise("\033[32mこんにちは\x1b[0m> ")) != NULL) {
 #else
@@ -100,7 +100,7 @@ int main(int argc, char **argv) {
         } else if (line[0] == '/') {
             printf("Unrecognized command: %s\n", line);
         }
-        free(line);
+        linenoiseFree(line);
     }
     return 0;
 }
@@ -110,9 +110,18 @@
 #include <string.h>
 #include <strings.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include "linenoise.h"
 
 #define LINENOISE_DEFAULT_HISTORY_MAX_LEN 100
@@ -120,16 +129,59 @@
 #define UNUSED(x) (void)(x)
 static const char *unsupported_term[] = {"dumb","cons25","emacs",NULL};
 static linenoiseCompletionCallback *completionCallback = NULL;
+static linenoiseContinuationCallback *continuationCallback = NULL;
+static linenoiseContinuationLexer *continuationLexer = NULL;
+static const void *lexerInit = NULL; /* Lexer state at the buffer start. */
+static size_t lexerStateSize = 0;
 static linenoiseHintsCallback *hintsCallback = NULL;
 static linenoiseFreeHintsCallback *freeHintsCallback = NULL;
 
 static struct termios orig_termios; /* In order to restore at exit.*/
 static int rawmode = 0; /* For atexit() function to check if restore is needed*/
 static int mlmode = 0;  /* Multi line mode. Default is single line. */
+static int bracketmatching = 0; /* Highlight the matching bracket. */
+static char *rprompt = NULL;    /* Right prompt, or NULL. */
+static size_t rpromptcols = 0;  /* Right prompt width in columns. */
+static char *statusline = NULL; /* Status line below the input, or NULL. */
+static size_t statuscols = 0;   /* Status line width in columns. */
+static int layout_changed = 0;  /* Right prompt or status line changed? */
 static int atexit_registered = 0; /* Register atexit just 1 time. */
-static int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
-static int history_len = 0;
-static char **history = NULL;
+static _Atomic int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
+static int history_timestamps = 0; /* Save the timestamps of the entries? */
+static int history_ignorecase = 0; /* Case insensitive dedup and search? */
+static int history_normalize = 0; /* Convert the entries to NFC? */
+
+/* The history is a ring of heap allocated lines that can be read by any
+ * number of threads without locking, while writers serialize on a mutex.
+ * Every entry gets a sequence number that never changes: the live entries
+ * are the ones in the [tail,head) range, and entry 'seq' lives in the slot
+ * seq % max_len. Evicted lines and replaced rings are not freed right away,
+ * see the epoch based reclamation code in the history section. */
+struct historyRing {
+    int max_len;                    /* Number of slots in 'vec'. */
+    _Atomic unsigned long head;     /* Sequence number of the next entry. */
+    _Atomic unsigned long tail;     /* Sequence number of the oldest entry. */
+    _Atomic uint32_t *stamps;       /* Time the entries were added, in
+                                       seconds, parallel to 'vec'. */
+    _Atomic(char *) vec[];          /* Slots, indexed by seq % max_len. */
+};
+static _Atomic(struct historyRing *) history = NULL;
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A sorted array of the offsets of some characters of the edited buffer. */
+struct offsetIndex {
+    size_t *off;        /* Offsets, in increasing order. */
+    size_t len;         /* Number of offsets. */
+    size_t cap;         /* Allocated entries in 'off'. */
+};
+#define LINENOISE_NOMATCH ((size_t)-1)
+
+/* A history entry modified while browsing, shown again as it was left when
+ * the user comes back to it during the same edit. */
+struct historyEdit {
+    int index;          /* History index of the entry. */
+    char *line;         /* Edited text. */
+};
 
 /* The linenoiseState structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
@@ -140,15 +192,51 @@ struct linenoiseState {
     char *buf;          /* Edited line buffer. */
     size_t buflen;      /* Edited line buffer size. */
     const char *prompt; /* Prompt to display. */
+    const char *uprompt; /* Prompt given by the caller, after the segments. */
+    char *segprompt;    /* Prompt with the segments, if any. */
+    size_t pcollen;     /* Prompt width in columns. */
     size_t plen;        /* Prompt length. */
     size_t pos;         /* Current cursor position. */
-    size_t oldcolpos;   /* Previous refresh cursor column position. */
+    size_t oldrpos;     /* Previous refresh cursor row, one based. */
     size_t len;         /* Current edited line length. */
     size_t cols;        /* Number of columns in terminal. */
     size_t maxrows;     /* Maximum num of rows used so far (multiline mode) */
+    struct offsetIndex newlines; /* Offsets of the newlines. */
+    size_t nlines;      /* Number of lines in the buffer, at least one. */
+    struct offsetIndex brackets; /* Offsets of the brackets. */
+    size_t *pairs;      /* Index of the matching bracket of every bracket. */
+    size_t pairscap;    /* Allocated entries in 'pairs'. */
+    int pairsvalid;     /* True if 'pairs' is up to date. */
+    size_t hlpos;       /* Bracket highlighted by the last refresh. */
+    struct offsetIndex words; /* Start and end offsets of the words. */
+    unsigned long gen;  /* Buffer generation, bumped on every edit. */
+    unsigned long wordsgen; /* Buffer generation of 'words'. */
+    int statusshown;    /* Status line shown by the last refresh? */
+    int batch;          /* Skip refreshes while replaying a macro. */
+    const char *compdesc; /* Description of the completion shown, or NULL. */
+    size_t compdescwidth; /* Width in columns of 'compdesc'. */
+    char *lexstates;    /* Lexer state before every line and after the last. */
+    size_t lexvalid;    /* Number of lexer states still valid. */
+    size_t lexcap;      /* Allocated lexer states. */
+    int lexresult;      /* Lexer result for the last line, if still valid. */
     int history_index;  /* The history index we are currently editing. */
+    unsigned long history_head; /* History head when the edit started. */
+    char *saved;        /* Line typed before browsing the history. */
+    struct historyEdit *edits; /* Entries modified while browsing. */
+    size_t nedits;      /* Number of entries in 'edits'. */
 };
 
+/* A key as read from the terminal: the code of the character, its bytes,
+ * and the bytes of the escape sequence following ESC, if any. */
+struct linenoiseKey {
+    int c;              /* Character code. */
+    int nread;          /* Bytes in 'cbuf'. */
+    char cbuf[32];      /* Bytes of the character. */
+    char seq[5];        /* Escape sequence after ESC. */
+    int seqlen;         /* Bytes in 'seq'. */
+};
+#define LINENOISE_EDIT_MORE -2  /* Returned by linenoiseEditKey(). */
+
 enum KEY_ACTION{
 	KEY_NULL = 0,	    /* NULL */
 	CTRL_A = 1,         /* Ctrl+a */
@@ -157,6 +245,7 @@ enum KEY_ACTION{
 	CTRL_D = 4,         /* Ctrl-d */
 	CTRL_E = 5,         /* Ctrl-e */
 	CTRL_F = 6,         /* Ctrl-f */
+	CTRL_G = 7,         /* Ctrl-g */
 	CTRL_H = 8,         /* Ctrl-h */
 	TAB = 9,            /* Tab */
 	LINE_FEED = 10,     /* Line Feed */
@@ -165,9 +254,11 @@ enum KEY_ACTION{
 	ENTER = 13,         /* Enter */
 	CTRL_N = 14,        /* Ctrl-n */
 	CTRL_P = 16,        /* Ctrl-p */
+	CTRL_R = 18,        /* Ctrl-r */
 	CTRL_T = 20,        /* Ctrl-t */
 	CTRL_U = 21,        /* Ctrl+u */
 	CTRL_W = 23,        /* Ctrl+w */
+	CTRL_X = 24,        /* Ctrl+x */
 	ESC = 27,           /* Escape */
 	BACKSPACE =  127    /* Backspace */
 };
@@ -175,28 +266,248 @@ enum KEY_ACTION{
 static void linenoiseAtExit(void);
 int linenoiseHistoryAdd(const char *line);
 static void refreshLine(struct linenoiseState *l);
-
-/* Debugging macro. */
-#if 0
-FILE *lndebug_fp = NULL;
-#define lndebug(...) \
+static size_t promptTextColumnLen(const char *prompt, size_t plen);
+struct historyReader;
+static struct historyReader *historyPin(void);
+static void historyUnpin(struct historyReader *rd);
+static char *historyRingGet(struct historyRing *r, unsigned long seq);
+static unsigned long linenoiseHistoryHead(void);
+static int substrFind(const char *s, size_t len, const char *needle, size_t m);
+static void statsUpdate(const char *line, int delta);
+static void outputFlush(struct linenoiseState *l);
+static void outputBegin(void);
+static void outputEnd(int fd);
+static int promptCompose(struct linenoiseState *l);
+static _Atomic int prompt_changed = 0;  /* Asynchronous segments ready? */
+
+/* Asynchronous output, see linenoisePrintf(). */
+#ifndef LINENOISE_OUTPUT_INTERVAL
+#define LINENOISE_OUTPUT_INTERVAL 50    /* Min milliseconds between batches. */
+#endif
+static _Atomic int output_queued = 0;   /* Lines waiting to be written? */
+static _Atomic int output_wakefd = -1;  /* Pipe waking up the editing thread. */
+static long long output_last = 0;       /* When the last batch was written. */
+
+/* Tracing. Tracepoints write fixed size binary records into an in memory
+ * ring that can be saved with linenoiseTraceSave() and decoded with the
+ * tracedump tool. When tracing is disabled a tracepoint costs a single
+ * test of a global flag. */
+#ifndef LINENOISE_TRACE_SIZE
+#define LINENOISE_TRACE_SIZE 1024   /* Records in the ring, power of two. */
+#endif
+static _Atomic int trace_enabled = 0;
+static linenoiseTraceRecord *trace_ring = NULL;
+static _Atomic unsigned long trace_next = 0;
+static void traceRecord(int event, unsigned long a, unsigned long b,
+                        unsigned long c, unsigned long d, unsigned long e);
+#define lntrace(event,a,b,c,d,e) \
     do { \
-        if (lndebug_fp == NULL) { \
-            lndebug_fp = fopen("/tmp/lndebug.txt","a"); \
-            fprintf(lndebug_fp, \
-            "[%d %d %d] p: %d, rows: %d, rpos: %d, max: %d, oldmax: %d\n", \
-            (int)l->len,(int)l->pos,(int)l->oldcolpos,plen,rows,rpos, \
-            (int)l->maxrows,old_rows); \
-        } \
-        fprintf(lndebug_fp, ", " __VA_ARGS__); \
-        fflush(lndebug_fp); \
+        if (atomic_load_explicit(&trace_enabled,memory_order_relaxed)) \
+            traceRecord(event,a,b,c,d,e); \
     } while (0)
+
+/* Spans measure how long a phase of the handling of a key took: the start
+ * time is taken with traceStart(), that returns 0 when tracing is off, and
+ * traceSpan() records a single LINENOISE_TRACE_SPAN event at the end. */
+enum traceSpanKind {
+    SPAN_READ = 0,          /* Waiting for input. */
+    SPAN_DECODE,            /* Reading and decoding a character. */
+    SPAN_DISPATCH,          /* Handling the key. */
+    SPAN_COMPLETE_LINE,
+    SPAN_COMPLETION_CALLBACK,
+    SPAN_HINTS_CALLBACK,
+    SPAN_REFRESH_SINGLE,
+    SPAN_REFRESH_MULTI,
+    SPAN_KINDS
+};
+static uint64_t traceStart(void);
+static void traceSpan(int kind, uint64_t start, size_t cols, size_t len, size_t pos);
+#define lnspan(kind,start,cols,len,pos) \
+    do { if (start) traceSpan(kind,start,cols,len,pos); } while (0)
+
+/* ============================== Memory pools ============================== */
+
+/* Every allocation names the pool it comes from. Pools are just the heap,
+ * unless linenoise is compiled with LINENOISE_STATIC: then every pool is a
+ * static array, of the size in bytes set by its macro, and the heap is
+ * never used. Memory use is fixed at build time and allocating takes
+ * constant time: blocks are powers of two from 16 bytes, header included,
+ * carved from the array, and once freed they go in a free list for their
+ * size. A pool out of space fails the allocation as an exhausted heap
+ * would, so the API behaves the same. Strings allocated by the caller with
+ * malloc(), like the values of the prompt segments, are still released
+ * with free(). */
+enum lnPoolId {
+    LN_POOL_HISTORY,        /* History entries and ring. */
+    LN_POOL_COMPLETIONS,    /* Completion candidates. */
+    LN_POOL_OUTPUT,         /* Output buffer and asynchronous output. */
+    LN_POOL_EDIT,           /* Edited line state and returned lines. */
+    LN_POOL_MISC,           /* Search, regular expressions, loading... */
+    LN_POOLS
+};
+
+#ifdef LINENOISE_STATIC
+#ifndef LINENOISE_STATIC_HISTORY
+#define LINENOISE_STATIC_HISTORY (64*1024)
+#endif
+#ifndef LINENOISE_STATIC_COMPLETIONS
+#define LINENOISE_STATIC_COMPLETIONS (16*1024)
+#endif
+#ifndef LINENOISE_STATIC_OUTPUT
+#define LINENOISE_STATIC_OUTPUT (16*1024)
+#endif
+#ifndef LINENOISE_STATIC_EDIT
+#define LINENOISE_STATIC_EDIT (32*1024)
+#endif
+#ifndef LINENOISE_STATIC_MISC
+#define LINENOISE_STATIC_MISC (128*1024)
+#endif
+
+#define POOL_HEADER 16      /* Keeps blocks aligned like malloc() does. */
+#define POOL_CLASSES 32     /* Block sizes from 16 bytes. */
+
+static _Alignas(16) unsigned char pool_history[LINENOISE_STATIC_HISTORY];
+static _Alignas(16) unsigned char pool_completions[LINENOISE_STATIC_COMPLETIONS];
+static _Alignas(16) unsigned char pool_output[LINENOISE_STATIC_OUTPUT];
+static _Alignas(16) unsigned char pool_edit[LINENOISE_STATIC_EDIT];
+static _Alignas(16) unsigned char pool_misc[LINENOISE_STATIC_MISC];
+
+static struct lnPool {
+    unsigned char *base;
+    size_t size;
+    size_t used;            /* Bytes carved from the array so far. */
+    void *free[POOL_CLASSES];
+    pthread_mutex_t lock;
+} pools[LN_POOLS] = {
+    { pool_history, sizeof(pool_history), 0, {0}, PTHREAD_MUTEX_INITIALIZER },
+    { pool_completions, sizeof(pool_completions), 0, {0}, PTHREAD_MUTEX_INITIALIZER },
+    { pool_output, sizeof(pool_output), 0, {0}, PTHREAD_MUTEX_INITIALIZER },
+    { pool_edit, sizeof(pool_edit), 0, {0}, PTHREAD_MUTEX_INITIALIZER },
+    { pool_misc, sizeof(pool_misc), 0, {0}, PTHREAD_MUTEX_INITIALIZER }
+};
+
+/* Return the pool 'ptr' was allocated from, or NULL. */
+static struct lnPool *poolOf(void *ptr) {
+    int j;
+
+    for (j = 0; j < LN_POOLS; j++)
+        if ((unsigned char *)ptr >= pools[j].base &&
+            (unsigned char *)ptr < pools[j].base+pools[j].size) return &pools[j];
+    return NULL;
+}
+
+/* Allocate 'size' bytes from the pool 'p': from the free list of the
+ * smallest block that fits, then from the array, then from the free list
+ * of a larger block. Returns NULL when none is available. */
+static void *poolAlloc(struct lnPool *p, size_t size) {
+    unsigned char *block = NULL;
+    int c = 0, k;
+
+    while (((size_t)16 << c) < size+POOL_HEADER)
+        if (++c == POOL_CLASSES) return NULL;
+    pthread_mutex_lock(&p->lock);
+    for (k = c; k < POOL_CLASSES; k++) {
+        if (p->free[k]) {
+            block = p->free[k];
+            p->free[k] = *(void **)block;
+            break;
+        }
+        if (k == c && p->size-p->used >= ((size_t)16 << c)) {
+            block = p->base+p->used;
+            p->used += (size_t)16 << c;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (block == NULL) return NULL;
+    *(size_t *)block = k;
+    return block+POOL_HEADER;
+}
+
+/* Return the block of 'ptr' to the free list of its pool. Pointers not
+ * from a pool were allocated by the caller with malloc(). */
+static void poolFree(void *ptr) {
+    struct lnPool *p = poolOf(ptr);
+    unsigned char *block = (unsigned char *)ptr-POOL_HEADER;
+    size_t c;
+
+    if (ptr == NULL) return;
+    if (p == NULL) {
+        free(ptr);
+        return;
+    }
+    c = *(size_t *)block;
+    pthread_mutex_lock(&p->lock);
+    *(void **)block = p->free[c];
+    p->free[c] = block;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Like realloc(), allocating from the pool 'id' if 'ptr' is NULL, and
+ * from the pool of 'ptr' otherwise. Pointers not from a pool are never
+ * resized: NULL is returned and they are left untouched. */
+static void *poolRealloc(int id, void *ptr, size_t size) {
+    struct lnPool *p = poolOf(ptr);
+    size_t blocksize;
+    void *new;
+
+    if (ptr == NULL) return poolAlloc(&pools[id],size);
+    if (p == NULL) return NULL;
+    blocksize = (size_t)16 << *(size_t *)((unsigned char *)ptr-POOL_HEADER);
+    if (size+POOL_HEADER <= blocksize) return ptr;
+    if ((new = poolAlloc(p,size)) == NULL) return NULL;
+    memcpy(new,ptr,blocksize-POOL_HEADER);
+    poolFree(ptr);
+    return new;
+}
+
+static void *poolCalloc(int id, size_t nmemb, size_t size) {
+    void *p;
+
+    if (size && nmemb > SIZE_MAX/size) return NULL;
+    if ((p = poolAlloc(&pools[id],nmemb*size)) != NULL) memset(p,0,nmemb*size);
+    return p;
+}
+
+static char *poolStrdup(int id, const char *s) {
+    size_t len = strlen(s)+1;
+    char *p = poolAlloc(&pools[id],len);
+
+    if (p) memcpy(p,s,len);
+    return p;
+}
+
+#define lnMalloc(pool,size) poolAlloc(&pools[pool],size)
+#define lnCalloc(pool,nmemb,size) poolCalloc(pool,nmemb,size)
+#define lnRealloc(pool,ptr,size) poolRealloc(pool,ptr,size)
+#define lnStrdup(pool,s) poolStrdup(pool,s)
+#define lnFree(ptr) poolFree(ptr)
 #else
-#define lndebug(fmt, ...)
+#define lnMalloc(pool,size) malloc(size)
+#define lnCalloc(pool,nmemb,size) calloc(nmemb,size)
+#define lnRealloc(pool,ptr,size) realloc(ptr,size)
+#define lnStrdup(pool,s) strdup(s)
+#define lnFree(ptr) free(ptr)
 #endif
 
 /* ========================== Encoding functions ============================= */
 
+#ifdef LINENOISE_BUILTIN_UTF8
+/* The encoding is fixed to UTF-8 at compile time. The encoding functions
+ * are called directly instead of through pointers, so that they can be
+ * inlined in the amalgamated build (see amalgamate.sh) or with LTO. */
+#include "utf8.h"
+#define prevCharLen linenoiseUtf8PrevCharLen
+#define nextCharLen linenoiseUtf8NextCharLen
+#define readCode linenoiseUtf8ReadCode
+
+void linenoiseSetEncodingFunctions(
+    linenoisePrevCharLen *prevCharLenFunc,
+    linenoiseNextCharLen *nextCharLenFunc,
+    linenoiseReadCode *readCodeFunc) {
+    UNUSED(prevCharLenFunc); UNUSED(nextCharLenFunc); UNUSED(readCodeFunc);
+}
+#else
 /* Get byte length and column length of the previous character */
 static size_t defaultPrevCharLen(const char *buf, size_t buf_len, size_t pos, size_t *col_len) {
     UNUSED(buf); UNUSED(buf_len); UNUSED(pos);
@@ -235,6 +546,8 @@ void linenoiseSetEncodingFunctions(
     readCode = readCodeFunc;
 }
 
+#endif
+
 /* Get column length from begining of buffer to current byte position */
 static size_t columnPos(const char *buf, size_t buf_len, size_t pos) {
     size_t ret = 0;
@@ -283,6 +596,32 @@ void linenoiseSetMultiLine(int ml) {
     mlmode = ml;
 }
 
+/* Replace the string 's' with a copy of 'text', or NULL, caching its width
+ * in columns in 'cols'. */
+static void setLayoutString(char **s, size_t *cols, const char *text) {
+    lnFree(*s);
+    *s = text ? lnStrdup(LN_POOL_EDIT,text) : NULL;
+    *cols = *s ? promptTextColumnLen(*s,strlen(*s)) : 0;
+    layout_changed = 1;
+}
+
+/* Set the prompt shown on the right of the line in single line mode, if
+ * there is room for it. NULL removes it. */
+void linenoiseSetRightPrompt(const char *text) {
+    setLayoutString(&rprompt,&rpromptcols,text);
+}
+
+/* Set the status line shown below the edited line, if it fits in the
+ * terminal width. NULL removes it. */
+void linenoiseSetStatusLine(const char *text) {
+    setLayoutString(&statusline,&statuscols,text);
+}
+
+/* Set if the bracket matching the one under the cursor is highlighted. */
+void linenoiseSetBracketMatching(int enable) {
+    bracketmatching = enable;
+}
+
 /* Return true if the terminal name is in the list of terminals we know are
  * not able to understand basic escape sequences. */
 static int isUnsupportedTerm(void) {
@@ -438,1048 +777,6773 @@ static void linenoiseBeep(void) {
     fflush(stderr);
 }
 
-/* ============================== Completion ================================ */
+/* ================================ Tracing ================================= */
 
-/* Free a list of completion option populated by linenoiseAddCompletion(). */
-static void freeCompletions(linenoiseCompletions *lc) {
-    size_t i;
-    for (i = 0; i < lc->len; i++)
-        free(lc->cvec[i]);
-    if (lc->cvec != NULL)
-        free(lc->cvec);
+static const char *trace_event_names[] = {
+    "none", "edit-start", "edit-end", "key", "refresh-single",
+    "refresh-multi", "complete", "history-add", "history-evict",
+    "history-browse", "span", NULL
+};
+
+/* Return the name of a trace event, for decoding tools. */
+const char *linenoiseTraceEventName(int event) {
+    if (event < 0 || event >= LINENOISE_TRACE_EVENTS) return "unknown";
+    return trace_event_names[event];
 }
 
-/* This is an helper function for linenoiseEdit() and is called when the
- * user types the <tab> key in order to complete the string currently in the
- * input.
- *
- * The state of the editing is encapsulated into the pointed linenoiseState
- * structure as described in the structure definition. */
-static int completeLine(struct linenoiseState *ls, char *cbuf, size_t cbuf_len, int *c) {
-    linenoiseCompletions lc = { 0, NULL };
-    int nread = 0, nwritten;
-    *c = 0;
+/* Enable or disable tracing. The ring is allocated the first time tracing
+ * is enabled. Returns -1 if out of memory, otherwise 0. */
+int linenoiseTraceEnable(int enable) {
+    if (enable && trace_ring == NULL) {
+        trace_ring = lnCalloc(LN_POOL_MISC,LINENOISE_TRACE_SIZE,sizeof(*trace_ring));
+        if (trace_ring == NULL) return -1;
+    }
+    atomic_store(&trace_enabled,enable != 0);
+    return 0;
+}
 
-    completionCallback(ls->buf,&lc);
-    if (lc.len == 0) {
-        linenoiseBeep();
-    } else {
-        size_t stop = 0, i = 0;
+static const char *trace_span_names[] = {
+    "read", "decode", "dispatch", "completeLine", "completionCallback",
+    "hintsCallback", "refreshSingleLine", "refreshMultiLine"
+};
 
-        while(!stop) {
-            /* Show completion or original buffer */
-            if (i < lc.len) {
-                struct linenoiseState saved = *ls;
+/* Small per thread number identifying the thread in trace records. */
+static _Thread_local uint16_t trace_tid = 0;
+static _Atomic uint16_t trace_next_tid = 1;
 
-                ls->len = ls->pos = strlen(lc.cvec[i]);
-                ls->buf = lc.cvec[i];
-                refreshLine(ls);
-                ls->len = saved.len;
-                ls->pos = saved.pos;
-                ls->buf = saved.buf;
-            } else {
-                refreshLine(ls);
-            }
+static uint64_t traceNow(void) {
+    struct timespec ts;
 
-            nread = readCode(ls->ifd,cbuf,cbuf_len,c);
-            if (nread <= 0) {
-                freeCompletions(&lc);
-                *c = -1;
-                return nread;
-            }
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
 
-            switch(*c) {
-                case TAB: /* tab */
-                    i = (i+1) % (lc.len+1);
-                    if (i == lc.len) linenoiseBeep();
-                    break;
-                case ESC: /* escape */
-                    /* Re-show original buffer */
-                    if (i < lc.len) refreshLine(ls);
-                    stop = 1;
-                    break;
-                default:
-                    /* Update buffer and return */
-                    if (i < lc.len) {
-                        nwritten = snprintf(ls->buf,ls->buflen,"%s",lc.cvec[i]);
-                        ls->len = ls->pos = nwritten;
-                    }
-                    stop = 1;
-                    break;
-            }
-        }
-    }
+static void traceRecordAt(uint64_t ts, int event, unsigned long a,
+    unsigned long b, unsigned long c, unsigned long d, unsigned long e)
+{
+    unsigned long n = atomic_fetch_add_explicit(&trace_next,1,memory_order_relaxed);
+    linenoiseTraceRecord *rec = &trace_ring[n & (LINENOISE_TRACE_SIZE-1)];
+
+    if (trace_tid == 0) trace_tid = atomic_fetch_add(&trace_next_tid,1);
+    rec->ts = ts;
+    rec->event = event;
+    rec->tid = trace_tid;
+    rec->arg[0] = a;
+    rec->arg[1] = b;
+    rec->arg[2] = c;
+    rec->arg[3] = d;
+    rec->arg[4] = e;
+}
 
-    freeCompletions(&lc);
-    return nread;
+static void traceRecord(int event, unsigned long a, unsigned long b,
+                        unsigned long c, unsigned long d, unsigned long e)
+{
+    traceRecordAt(traceNow(),event,a,b,c,d,e);
 }
 
-/* Register a callback function to be called for tab-completion. */
-void linenoiseSetCompletionCallback(linenoiseCompletionCallback *fn) {
-    completionCallback = fn;
+static uint64_t traceStart(void) {
+    if (!atomic_load_explicit(&trace_enabled,memory_order_relaxed)) return 0;
+    return traceNow();
 }
 
-/* Register a hits function to be called to show hits to the user at the
- * right of the prompt. */
-void linenoiseSetHintsCallback(linenoiseHintsCallback *fn) {
-    hintsCallback = fn;
+/* The duration is recorded in microseconds, so that spans waiting for the
+ * user don't overflow the 32 bit argument: longer ones are clamped. */
+static void traceSpan(int kind, uint64_t start, size_t cols, size_t len, size_t pos) {
+    uint64_t us;
+
+    if (!atomic_load_explicit(&trace_enabled,memory_order_relaxed)) return;
+    us = (traceNow()-start)/1000;
+    if (us > UINT32_MAX) us = UINT32_MAX;
+    traceRecordAt(start,LINENOISE_TRACE_SPAN,kind,us,cols,len,pos);
 }
 
-/* Register a function to free the hints returned by the hints callback
- * registered with linenoiseSetHintsCallback(). */
-void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
-    freeHintsCallback = fn;
+/* Save the trace ring in the specified file, oldest record first. The file
+ * starts with the "LNTRACE1" magic and the number of records as a 32 bit
+ * integer in host byte order. On success 0 is returned otherwise -1. */
+int linenoiseTraceSave(const char *filename) {
+    unsigned long next = atomic_load(&trace_next), first, j;
+    uint32_t count;
+    FILE *fp;
+
+    if (trace_ring == NULL) return -1;
+    fp = fopen(filename,"w");
+    if (fp == NULL) return -1;
+    first = next > LINENOISE_TRACE_SIZE ? next-LINENOISE_TRACE_SIZE : 0;
+    count = next-first;
+    fwrite("LNTRACE1",8,1,fp);
+    fwrite(&count,sizeof(count),1,fp);
+    for (j = first; j < next; j++)
+        fwrite(&trace_ring[j & (LINENOISE_TRACE_SIZE-1)],sizeof(*trace_ring),1,fp);
+    if (fclose(fp) == EOF) return -1;
+    return 0;
 }
 
-/* This function is used by the callback function registered by the user
- * in order to add completion options given the input string when the
- * user typed <tab>. See the example.c source code for a very easy to
- * understand example. */
-void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
-    size_t len = strlen(str);
-    char *copy, **cvec;
+/* Save the trace ring in the Chrome trace event JSON format, that can be
+ * loaded in chrome://tracing or Perfetto. Spans become complete events
+ * with the terminal columns, line length and cursor position as arguments,
+ * all the other records become instant events. On success 0 is returned
+ * otherwise -1. */
+int linenoiseTraceSaveJSON(const char *filename) {
+    unsigned long next = atomic_load(&trace_next), first, j;
+    const char *sep = "";
+    FILE *fp;
 
-    copy = malloc(len+1);
-    if (copy == NULL) return;
-    memcpy(copy,str,len+1);
-    cvec = realloc(lc->cvec,sizeof(char*)*(lc->len+1));
-    if (cvec == NULL) {
-        free(copy);
-        return;
+    if (trace_ring == NULL) return -1;
+    fp = fopen(filename,"w");
+    if (fp == NULL) return -1;
+    first = next > LINENOISE_TRACE_SIZE ? next-LINENOISE_TRACE_SIZE : 0;
+    fprintf(fp,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (j = first; j < next; j++) {
+        linenoiseTraceRecord *rec = &trace_ring[j & (LINENOISE_TRACE_SIZE-1)];
+
+        fprintf(fp,"%s\n{\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"cat\":\"linenoise\",",
+            sep,(int)getpid(),rec->tid,rec->ts/1000.0);
+        if (rec->event == LINENOISE_TRACE_SPAN && rec->arg[0] < SPAN_KINDS) {
+            fprintf(fp,"\"ph\":\"X\",\"name\":\"%s\",\"dur\":%u,"
+                "\"args\":{\"cols\":%u,\"len\":%u,\"pos\":%u}}",
+                trace_span_names[rec->arg[0]],rec->arg[1],
+                rec->arg[2],rec->arg[3],rec->arg[4]);
+        } else {
+            fprintf(fp,"\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\","
+                "\"args\":{\"arg\":[%u,%u,%u,%u,%u]}}",
+                linenoiseTraceEventName(rec->event),rec->arg[0],rec->arg[1],
+                rec->arg[2],rec->arg[3],rec->arg[4]);
+        }
+        sep = ",";
     }
-    lc->cvec = cvec;
-    lc->cvec[lc->len++] = copy;
+    fprintf(fp,"\n]}\n");
+    if (fclose(fp) == EOF) return -1;
+    return 0;
 }
 
-/* Adds matching history entries as tab completions */
-void linenoiseAddHistoryCompletions(const char* buf, linenoiseCompletions *lc) {
-    int i;
-    size_t n;
-    if (history == NULL)
-        return;
-    n = strlen(buf);
-    for (i = 0; i < history_len; ++i)
-        if (strncasecmp(history[i], buf, n) == 0)
-            linenoiseAddCompletion(lc, history[i]);
-}
+/* ========================= Timers and idle callbacks ======================= */
+
+/* While linenoiseEdit() waits for the next key the application can have
+ * work done on the same thread: timers fire after a given number of
+ * milliseconds and may reschedule themselves by returning the next period,
+ * idle callbacks fire once every time the user stops typing for at least
+ * the given amount of milliseconds. Events are only run while linenoise
+ * is waiting for input. */
+struct linenoiseEvent {
+    long long id;                   /* Event id, -1 if deleted. */
+    int idle;                       /* Idle callback or timer? */
+    long long ms;                   /* Idle delay, unused by timers. */
+    long long when;                 /* Timers: when to fire, in ms. */
+    int fired;                      /* Idle: already run in this pause. */
+    linenoiseTimerCallback *timerfn;
+    linenoiseIdleCallback *idlefn;
+    void *privdata;
+    struct linenoiseEvent *next;
+};
 
+static struct linenoiseEvent *events = NULL;
+static long long events_next_id = 0;
 
-/* =========================== Line editing ================================= */
+/* Return the monotonic time in milliseconds. */
+static long long mstime(void) {
+    struct timespec ts;
 
-/* We define a very simple "append buffer" structure, that is an heap
- * allocated string where we can append to. This is useful in order to
- * write all the escape sequences in a buffer and flush them to the standard
- * output in a single call, to avoid flickering effects. */
-struct abuf {
-    char *b;
-    unsigned int len;
-};
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
 
-static void abInit(struct abuf *ab) {
-    ab->b = NULL;
-    ab->len = 0;
+static long long addEvent(int idle, long long ms, linenoiseTimerCallback *timerfn,
+                          linenoiseIdleCallback *idlefn, void *privdata)
+{
+    struct linenoiseEvent *ev = lnMalloc(LN_POOL_MISC,sizeof(*ev));
+
+    if (ev == NULL || ms < 0) {
+        lnFree(ev);
+        return -1;
+    }
+    ev->id = events_next_id++;
+    ev->idle = idle;
+    ev->ms = ms;
+    ev->when = mstime()+ms;
+    ev->fired = 0;
+    ev->timerfn = timerfn;
+    ev->idlefn = idlefn;
+    ev->privdata = privdata;
+    ev->next = events;
+    events = ev;
+    return ev->id;
 }
 
-static void abAppend(struct abuf *ab, const char *s, unsigned int len) {
-    char *new = realloc(ab->b,ab->len+len);
+/* Register a timer calling 'fn' in 'ms' milliseconds. The callback returns
+ * the number of milliseconds after which it should be called again, or
+ * LINENOISE_NOMORE to be deleted. Returns the timer id, or -1 on error. */
+long long linenoiseAddTimer(long long ms, linenoiseTimerCallback *fn, void *privdata) {
+    return addEvent(0,ms,fn,NULL,privdata);
+}
 
-    if (new == NULL) return;
-    memcpy(new+ab->len,s,len);
-    ab->b = new;
-    ab->len += len;
+/* Register a callback called once every time the user does not type
+ * anything for 'ms' milliseconds. Returns its id, or -1 on error. */
+long long linenoiseAddIdleCallback(long long ms, linenoiseIdleCallback *fn, void *privdata) {
+    return addEvent(1,ms,NULL,fn,privdata);
 }
 
-static void abFree(struct abuf *ab) {
-    free(ab->b);
+/* Delete the timer or idle callback with the specified id. Returns 0 on
+ * success, -1 if there is no such event. It is safe to call it from the
+ * callbacks themselves. */
+int linenoiseRemoveEvent(long long id) {
+    struct linenoiseEvent *ev;
+
+    for (ev = events; ev; ev = ev->next) {
+        if (ev->id == id) {
+            ev->id = -1;
+            return 0;
+        }
+    }
+    return -1;
 }
 
-/* Helper of refreshSingleLine() and refreshMultiLine() to show hints
- * to the right of the prompt. */
-void refreshShowHints(struct abuf *ab, struct linenoiseState *l, int pcollen) {
-    char seq[64];
-    size_t collen = pcollen+columnPos(l->buf,l->len,l->len);
-    if (hintsCallback && collen < l->cols) {
-        int color = -1, bold = 0;
-        char *hint = hintsCallback(l->buf,&color,&bold);
-        if (hint) {
-            int hintlen = strlen(hint);
-            int hintmaxlen = l->cols-collen;
-            if (hintlen > hintmaxlen) hintlen = hintmaxlen;
-            if (bold == 1 && color == -1) color = 37;
-            if (color != -1 || bold != 0)
-                snprintf(seq,64,"\033[%d;%d;49m",bold,color);
-            else
-                seq[0] = '\0';
-            abAppend(ab,seq,strlen(seq));
-            abAppend(ab,hint,hintlen);
-            if (color != -1 || bold != 0)
-                abAppend(ab,"\033[0m",4);
-            /* Call the function to free the hint returned. */
-            if (freeHintsCallback) freeHintsCallback(hint);
+/* Run the events that are due. 'idle_start' is when we started to wait
+ * for the current key. */
+static void processEvents(long long idle_start) {
+    struct linenoiseEvent *ev, **prev;
+    long long now = mstime();
+
+    for (ev = events; ev; ev = ev->next) {
+        if (ev->id == -1) continue;
+        if (ev->idle) {
+            if (!ev->fired && now-idle_start >= ev->ms) {
+                ev->fired = 1;
+                ev->idlefn(ev->privdata);
+            }
+        } else if (now >= ev->when) {
+            int ms = ev->timerfn(ev->id,ev->privdata);
+            if (ms == LINENOISE_NOMORE) ev->id = -1;
+            else ev->when = mstime()+ms;
+        }
+        now = mstime();
+    }
+
+    /* Free the events deleted meanwhile. */
+    prev = &events;
+    while ((ev = *prev) != NULL) {
+        if (ev->id == -1) {
+            *prev = ev->next;
+            lnFree(ev);
+        } else {
+            prev = &ev->next;
         }
     }
 }
 
-/* Check if text is an ANSI escape sequence
- */
-static int isAnsiEscape(const char *buf, size_t buf_len, size_t* len) {
-    if (buf_len > 2 && !memcmp("\033[", buf, 2)) {
-        size_t off = 2;
-        while (off < buf_len) {
-            switch (buf[off++]) {
-            case 'A': case 'B': case 'C': case 'D': case 'E':
-            case 'F': case 'G': case 'H': case 'J': case 'K':
-            case 'S': case 'T': case 'f': case 'm':
-                *len = off;
-                return 1;
+/* Wait for the input of 'l' to become readable, running timers and idle
+ * callbacks, and writing the output of other threads while waiting.
+ * Returns -1 on poll() errors. */
+static int waitForInput(struct linenoiseState *l) {
+    long long idle_start = mstime();
+    struct linenoiseEvent *ev;
+
+    for (ev = events; ev; ev = ev->next) ev->fired = 0;
+    while (1) {
+        struct pollfd pfd[2];
+        long long now = mstime(), timeout = -1;
+        int n, nfds = 1, wakefd = atomic_load(&output_wakefd);
+
+        for (ev = events; ev; ev = ev->next) {
+            long long wait;
+
+            if (ev->id == -1 || (ev->idle && ev->fired)) continue;
+            wait = (ev->idle ? idle_start+ev->ms : ev->when) - now;
+            if (wait < 0) wait = 0;
+            if (timeout == -1 || wait < timeout) timeout = wait;
+        }
+        /* Show the asynchronous prompt segments computed meanwhile, and
+         * the right prompt or status line set by the callbacks. */
+        if (atomic_exchange(&prompt_changed,0) && promptCompose(l))
+            layout_changed = 1;
+        if (layout_changed) {
+            layout_changed = 0;
+            refreshLine(l);
+        }
+
+        /* Write the queued output, unless the last batch is too recent. */
+        if (atomic_load(&output_queued)) {
+            long long wait = output_last+LINENOISE_OUTPUT_INTERVAL-now;
+
+            if (wait <= 0) {
+                outputFlush(l);
+                continue;
             }
+            if (timeout == -1 || wait < timeout) timeout = wait;
+        }
+
+        /* Nothing to run: let readCode() block, unless we are tracing,
+         * where waiting in poll() separates the read and decode spans, or
+         * other threads may wake us up, that is unless the wake up pipe
+         * could not be created. */
+        if (timeout == -1 && wakefd == -1 &&
+            !atomic_load_explicit(&trace_enabled,memory_order_relaxed)) break;
+
+        pfd[0].fd = l->ifd;
+        pfd[0].events = POLLIN;
+        if (wakefd != -1) {
+            pfd[1].fd = wakefd;
+            pfd[1].events = POLLIN;
+            nfds++;
+        }
+        n = poll(pfd,nfds,(int)timeout);
+        if (n > 0 && pfd[0].revents) break;
+        if (n == -1 && errno != EINTR) return -1;
+        if (n > 0 && pfd[1].revents) {
+            char buf[64];
+            while (read(wakefd,buf,sizeof(buf)) > 0);
         }
+        processEvents(idle_start);
     }
     return 0;
 }
 
-/* Get column length of prompt text
- */
-static size_t promptTextColumnLen(const char *prompt, size_t plen) {
-    char buf[LINENOISE_MAX_LINE];
-    size_t buf_len = 0;
-    size_t off = 0;
-    while (off < plen) {
-        size_t len;
-        if (isAnsiEscape(prompt + off, plen - off, &len)) {
-            off += len;
+/* Read the next character like readCode(), serving timers and idle
+ * callbacks until some input is available. */
+static int readCodeWithEvents(struct linenoiseState *l, char *buf, size_t buf_len, int *c) {
+    uint64_t span = traceStart();
+    int nread;
+
+    if (waitForInput(l) == -1) return -1;
+    lnspan(SPAN_READ,span,l->cols,l->len,l->pos);
+    span = traceStart();
+    nread = readCode(l->ifd,buf,buf_len,c);
+    lnspan(SPAN_DECODE,span,l->cols,l->len,l->pos);
+    return nread;
+}
+
+/* ============================== Buffer index ============================== */
+
+/* The edited buffer may contain several lines separated by newlines, and
+ * brackets. The offsets of these characters are kept sorted and updated on
+ * every change of the buffer, so that finding the line of a position, or
+ * the bracket under the cursor, is a binary search instead of a scan from
+ * the start of the buffer. */
+
+static const char *brackets = "()[]{}";
+
+/* Return the number of offsets of the index lower than 'pos'. */
+static size_t offsetRank(struct offsetIndex *idx, size_t pos) {
+    size_t lo = 0, hi = idx->len;
+
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if (idx->off[mid] < pos) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Update the index after 'dellen' bytes at 'pos' of 'buf' were replaced by
+ * 'inslen' bytes, indexing the inserted bytes found in 'chars'. Returns non
+ * zero if offsets were added or removed, not just moved. */
+static int offsetsEdit(struct offsetIndex *idx, const char *buf, size_t pos, size_t dellen, size_t inslen, const char *chars) {
+    size_t j, k, first = offsetRank(idx,pos), n = idx->len;
+    int changed = 0;
+
+    /* Drop the offsets that were deleted, shift the next ones. */
+    for (j = k = first; j < n; j++) {
+        size_t off = idx->off[j];
+
+        if (off < pos+dellen) {
+            changed = 1;
             continue;
         }
-        buf[buf_len++] = prompt[off++];
+        idx->off[k++] = off-dellen+inslen;
     }
-    return columnPos(buf,buf_len,buf_len);
+    n = k;
+
+    /* Index the characters that were inserted. */
+    for (j = pos; j < pos+inslen; j++) {
+        if (buf[j] == '\0' || strchr(chars,buf[j]) == NULL) continue;
+        if (n == idx->cap) {
+            size_t cap = idx->cap ? idx->cap*2 : 8;
+            size_t *off = lnRealloc(LN_POOL_EDIT,idx->off,sizeof(size_t)*cap);
+
+            if (off == NULL) break;
+            idx->off = off;
+            idx->cap = cap;
+        }
+        memmove(idx->off+first+1,idx->off+first,sizeof(size_t)*(n-first));
+        idx->off[first++] = j;
+        n++;
+        changed = 1;
+    }
+    idx->len = n;
+    return changed;
 }
 
-/* Single line low level line refresh.
- *
- * Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-static void refreshSingleLine(struct linenoiseState *l) {
-    char seq[64];
-    size_t pcollen = promptTextColumnLen(l->prompt,strlen(l->prompt));
-    int fd = l->ofd;
-    char *buf = l->buf;
-    size_t len = l->len;
-    size_t pos = l->pos;
-    struct abuf ab;
+/* Return the offset of the first byte of line 'k'. */
+static size_t lineStart(struct linenoiseState *l, size_t k) {
+    return k ? l->newlines.off[k-1]+1 : 0;
+}
 
-    while((pcollen+columnPos(buf,len,pos)) >= l->cols) {
-        int chlen = nextCharLen(buf,len,0,NULL);
-        buf += chlen;
-        len -= chlen;
-        pos -= chlen;
-    }
-    while (pcollen+columnPos(buf,len,len) > l->cols) {
-        len -= prevCharLen(buf,len,len,NULL);
-    }
+/* Return the offset of the newline ending line 'k', or the buffer length
+ * for the last line. */
+static size_t lineEnd(struct linenoiseState *l, size_t k) {
+    return k < l->newlines.len ? l->newlines.off[k] : l->len;
+}
 
-    abInit(&ab);
-    /* Cursor to left edge */
-    snprintf(seq,64,"\r");
-    abAppend(&ab,seq,strlen(seq));
-    /* Write the prompt and the current buffer content */
-    abAppend(&ab,l->prompt,strlen(l->prompt));
-    abAppend(&ab,buf,len);
-    /* Show hits if any. */
-    refreshShowHints(&ab,l,pcollen);
-    /* Erase to right */
-    snprintf(seq,64,"\x1b[0K");
-    abAppend(&ab,seq,strlen(seq));
-    /* Move cursor to original position. */
-//    snprintf(seq,64,"\r\x1b[%dC", (int)(pos+strlenPerceived(l->prompt)));
-    snprintf(seq,64,"\r\x1b[%dC", (int)(columnPos(buf,len,pos)+pcollen));
-    abAppend(&ab,seq,strlen(seq));
-    if (write(fd,ab.b,ab.len) == -1) {} /* Can't recover from write error. */
-    abFree(&ab);
+/* Return the index of the line containing the byte offset 'pos'. */
+static size_t lineOf(struct linenoiseState *l, size_t pos) {
+    return offsetRank(&l->newlines,pos);
 }
 
-/* Multi line low level line refresh.
- *
- * Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-static void refreshMultiLine(struct linenoiseState *l) {
-    char seq[64];
-    size_t pcollen = promptTextColumnLen(l->prompt,strlen(l->prompt));
-    int colpos = columnPosForMultiLine(l->buf, l->len, l->len, l->cols, pcollen);
-    int colpos2; /* cursor column position. */
-    int rows = (pcollen+colpos+l->cols-1)/l->cols; /* rows used by current buf. */
-    int rpos = (pcollen+l->oldcolpos+l->cols)/l->cols; /* cursor relative row. */
-    int rpos2; /* rpos after refresh. */
-    int col; /* column position, zero-based. */
-    int old_rows = l->maxrows;
-    int fd = l->ofd, j;
-    struct abuf ab;
+/* Update the indexes after 'dellen' bytes at 'pos' were replaced by
+ * 'inslen' bytes, that are already in the buffer. Replacing the whole
+ * buffer is just the special case of pos 0. */
+static void indexEdit(struct linenoiseState *l, size_t pos, size_t dellen, size_t inslen) {
+    size_t k;
+
+    l->gen++;
+    /* The lexer states after the edited line are stale. */
+    k = lineOf(l,pos)+1;
+    if (l->lexvalid > k) l->lexvalid = k;
+
+    offsetsEdit(&l->newlines,l->buf,pos,dellen,inslen,"\n");
+    l->nlines = l->newlines.len+1;
+    if (offsetsEdit(&l->brackets,l->buf,pos,dellen,inslen,brackets))
+        l->pairsvalid = 0;
+}
 
-    /* Update maxrows if needed. */
-    if (rows > (int)l->maxrows) l->maxrows = rows;
+/* Pair the indexed brackets, storing in l->pairs the index of the matching
+ * bracket of each one, or LINENOISE_NOMATCH. While scanning, the pairs
+ * entry of an open bracket links to the enclosing one, so no other stack
+ * is needed. Returns -1 if out of memory. */
+static int bracketsPair(struct linenoiseState *l) {
+    struct offsetIndex *b = &l->brackets;
+    size_t k, top = LINENOISE_NOMATCH;
 
-    /* First step: clear all the lines used before. To do so start by
-     * going to the last row. */
-    abInit(&ab);
-    if (old_rows-rpos > 0) {
-        lndebug("go down %d", old_rows-rpos);
-        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
-        abAppend(&ab,seq,strlen(seq));
+    if (l->pairscap < b->len) {
+        size_t *pairs = lnRealloc(LN_POOL_EDIT,l->pairs,sizeof(size_t)*b->cap);
+
+        if (pairs == NULL) return -1;
+        l->pairs = pairs;
+        l->pairscap = b->cap;
+    }
+    for (k = 0; k < b->len; k++) {
+        int type = strchr(brackets,l->buf[b->off[k]])-brackets;
+
+        if (type % 2 == 0) {
+            l->pairs[k] = top;
+            top = k;
+        } else if (top != LINENOISE_NOMATCH &&
+                   l->buf[b->off[top]] == brackets[type-1])
+        {
+            size_t enclosing = l->pairs[top];
+
+            l->pairs[top] = k;
+            l->pairs[k] = top;
+            top = enclosing;
+        } else {
+            l->pairs[k] = LINENOISE_NOMATCH;
+        }
+    }
+    /* Brackets still open are unmatched. */
+    while (top != LINENOISE_NOMATCH) {
+        k = l->pairs[top];
+        l->pairs[top] = LINENOISE_NOMATCH;
+        top = k;
     }
+    l->pairsvalid = 1;
+    return 0;
+}
 
-    /* Now for every row clear it, go up. */
-    for (j = 0; j < old_rows-1; j++) {
-        lndebug("clear+up", NULL);
-        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
-        abAppend(&ab,seq,strlen(seq));
+/* Return the offset of the bracket matching the one under the cursor, or
+ * just before it, or LINENOISE_NOMATCH. Pairs are computed again only after
+ * brackets were added or removed, so on cursor moves this is a binary
+ * search. */
+static size_t bracketMatch(struct linenoiseState *l) {
+    struct offsetIndex *b = &l->brackets;
+    size_t k;
+
+    if (!bracketmatching || b->len == 0) return LINENOISE_NOMATCH;
+    k = offsetRank(b,l->pos);
+    if (k == b->len || b->off[k] != l->pos) {
+        if (k == 0 || b->off[k-1]+1 != l->pos) return LINENOISE_NOMATCH;
+        k--;
     }
+    if (!l->pairsvalid && bracketsPair(l) == -1) return LINENOISE_NOMATCH;
+    k = l->pairs[k];
+    return k == LINENOISE_NOMATCH ? k : b->off[k];
+}
 
-    /* Clean the top line. */
-    lndebug("clear", NULL);
-    snprintf(seq,64,"\r\x1b[0K");
-    abAppend(&ab,seq,strlen(seq));
+/* Run the continuation lexer over the lines changed since the last call,
+ * starting from the state cached before the first of them, so that the
+ * cost depends on the edit and not on the size of the buffer. Returns the
+ * lexer result for the last line, non zero if the input is incomplete. */
+static int lexContinuation(struct linenoiseState *l) {
+    size_t size = lexerStateSize, k;
+
+    if (l->lexvalid > l->nlines) return l->lexresult;
+    if (l->lexcap < l->nlines+1) {
+        size_t cap = l->lexcap*2 > l->nlines+1 ? l->lexcap*2 : l->nlines+1;
+        char *states = lnRealloc(LN_POOL_EDIT,l->lexstates,size*cap);
+
+        if (states == NULL) return 0;
+        l->lexstates = states;
+        l->lexcap = cap;
+    }
+    if (l->lexvalid == 0) {
+        if (lexerInit) memcpy(l->lexstates,lexerInit,size);
+        else memset(l->lexstates,0,size);
+        l->lexvalid = 1;
+    }
+    for (k = l->lexvalid-1; k < l->nlines; k++) {
+        size_t start = lineStart(l,k), end = lineEnd(l,k);
+        char *state = l->lexstates+size*(k+1);
+
+        /* Every line but the last is passed with its newline. */
+        memcpy(state,state-size,size);
+        l->lexresult = continuationLexer(state,l->buf+start,
+                                         end-start+(k+1 < l->nlines));
+    }
+    l->lexvalid = l->nlines+1;
+    return l->lexresult;
+}
 
-    /* Write the prompt and the current buffer content */
-    abAppend(&ab,l->prompt,strlen(l->prompt));
-    abAppend(&ab,l->buf,l->len);
+/* Return non zero if on enter the input should go on in a new line. */
+static int inputIncomplete(struct linenoiseState *l) {
+    if (continuationLexer) return lexContinuation(l);
+    return continuationCallback && continuationCallback(l->buf);
+}
 
-    /* Show hits if any. */
-    refreshShowHints(&ab,l,pcollen);
+/* ============================= Word boundaries ============================ */
 
-    /* Get column length to cursor position */
-    colpos2 = columnPosForMultiLine(l->buf,l->len,l->pos,l->cols,pcollen);
+/* Word motion and deletion stop at word boundaries, found with the default
+ * rules of Unicode UAX #29 on a reduced set of classes. Scripts written
+ * with letters form words with the letters, numbers and connectors next to
+ * them, ideographs and kana are a word each, punctuation does not belong to
+ * any word. The start and end offsets of the words are computed on demand
+ * and kept until the buffer changes, so moving word by word on a long line
+ * is a binary search per key. */
 
-    /* If we are at the very end of the screen with our prompt, we need to
-     * emit a newline and move the prompt to the first column. */
-    if (l->pos &&
-        l->pos == l->len &&
-        (colpos2+pcollen) % l->cols == 0)
-    {
-        lndebug("<newline>", NULL);
-        abAppend(&ab,"\n",1);
-        snprintf(seq,64,"\r");
-        abAppend(&ab,seq,strlen(seq));
-        rows++;
-        if (rows > (int)l->maxrows) l->maxrows = rows;
+enum {
+    WB_OTHER, WB_NEWLINE, WB_SPACE, WB_EXTEND, WB_ALETTER, WB_NUMERIC,
+    WB_KATAKANA, WB_IDEO, WB_EXTENDNUMLET, WB_MIDLETTER, WB_MIDNUM,
+    WB_MIDNUMLET
+};
+
+/* Word break classes of the code points outside ASCII, generated from the
+ * WordBreakProperty.txt of Unicode 14.0 with the classes reduced as above:
+ * Format and ZWJ are WB_EXTEND, Hebrew_Letter is WB_ALETTER, and the
+ * ideographs, hiragana and Yi, that are Other there, are WB_IDEO. Ranges
+ * not listed are WB_OTHER. Unassigned code points between two ranges of
+ * the same class are part of them. The ranges are sorted and disjoint, as
+ * the binary search of wordBreakClass() requires. */
+static const struct wbRange {
+    unsigned int first, last;
+    unsigned char cls;
+} wbRanges[] = {
+    {0x0085,0x0085,WB_NEWLINE},     {0x00AA,0x00AA,WB_ALETTER},
+    {0x00AD,0x00AD,WB_EXTEND},      {0x00B5,0x00B5,WB_ALETTER},
+    {0x00B7,0x00B7,WB_MIDLETTER},   {0x00BA,0x00BA,WB_ALETTER},
+    {0x00C0,0x00D6,WB_ALETTER},     {0x00D8,0x00F6,WB_ALETTER},
+    {0x00F8,0x02D7,WB_ALETTER},     {0x02DE,0x02FF,WB_ALETTER},
+    {0x0300,0x036F,WB_EXTEND},      {0x0370,0x0374,WB_ALETTER},
+    {0x0376,0x037D,WB_ALETTER},     {0x037E,0x037E,WB_MIDNUM},
+    {0x037F,0x037F,WB_ALETTER},     {0x0386,0x0386,WB_ALETTER},
+    {0x0387,0x0387,WB_MIDLETTER},   {0x0388,0x03F5,WB_ALETTER},
+    {0x03F7,0x0481,WB_ALETTER},     {0x0483,0x0489,WB_EXTEND},
+    {0x048A,0x055C,WB_ALETTER},     {0x055E,0x055E,WB_ALETTER},
+    {0x055F,0x055F,WB_MIDLETTER},   {0x0560,0x0588,WB_ALETTER},
+    {0x0589,0x0589,WB_MIDNUM},      {0x058A,0x058A,WB_ALETTER},
+    {0x0591,0x05BD,WB_EXTEND},      {0x05BF,0x05BF,WB_EXTEND},
+    {0x05C1,0x05C2,WB_EXTEND},      {0x05C4,0x05C5,WB_EXTEND},
+    {0x05C7,0x05C7,WB_EXTEND},      {0x05D0,0x05F3,WB_ALETTER},
+    {0x05F4,0x05F4,WB_MIDLETTER},   {0x0600,0x0605,WB_EXTEND},
+    {0x060C,0x060D,WB_MIDNUM},      {0x0610,0x061A,WB_EXTEND},
+    {0x061C,0x061C,WB_EXTEND},      {0x0620,0x064A,WB_ALETTER},
+    {0x064B,0x065F,WB_EXTEND},      {0x0660,0x0669,WB_NUMERIC},
+    {0x066B,0x066B,WB_NUMERIC},     {0x066C,0x066C,WB_MIDNUM},
+    {0x066E,0x066F,WB_ALETTER},     {0x0670,0x0670,WB_EXTEND},
+    {0x0671,0x06D3,WB_ALETTER},     {0x06D5,0x06D5,WB_ALETTER},
+    {0x06D6,0x06DD,WB_EXTEND},      {0x06DF,0x06E4,WB_EXTEND},
+    {0x06E5,0x06E6,WB_ALETTER},     {0x06E7,0x06E8,WB_EXTEND},
+    {0x06EA,0x06ED,WB_EXTEND},      {0x06EE,0x06EF,WB_ALETTER},
+    {0x06F0,0x06F9,WB_NUMERIC},     {0x06FA,0x06FC,WB_ALETTER},
+    {0x06FF,0x06FF,WB_ALETTER},     {0x070F,0x070F,WB_EXTEND},
+    {0x0710,0x0710,WB_ALETTER},     {0x0711,0x0711,WB_EXTEND},
+    {0x0712,0x072F,WB_ALETTER},     {0x0730,0x074A,WB_EXTEND},
+    {0x074D,0x07A5,WB_ALETTER},     {0x07A6,0x07B0,WB_EXTEND},
+    {0x07B1,0x07B1,WB_ALETTER},     {0x07C0,0x07C9,WB_NUMERIC},
+    {0x07CA,0x07EA,WB_ALETTER},     {0x07EB,0x07F3,WB_EXTEND},
+    {0x07F4,0x07F5,WB_ALETTER},     {0x07F8,0x07F8,WB_MIDNUM},
+    {0x07FA,0x07FA,WB_ALETTER},     {0x07FD,0x07FD,WB_EXTEND},
+    {0x0800,0x0815,WB_ALETTER},     {0x0816,0x0819,WB_EXTEND},
+    {0x081A,0x081A,WB_ALETTER},     {0x081B,0x0823,WB_EXTEND},
+    {0x0824,0x0824,WB_ALETTER},     {0x0825,0x0827,WB_EXTEND},
+    {0x0828,0x0828,WB_ALETTER},     {0x0829,0x082D,WB_EXTEND},
+    {0x0840,0x0858,WB_ALETTER},     {0x0859,0x085B,WB_EXTEND},
+    {0x0860,0x0887,WB_ALETTER},     {0x0889,0x088E,WB_ALETTER},
+    {0x0890,0x089F,WB_EXTEND},      {0x08A0,0x08C9,WB_ALETTER},
+    {0x08CA,0x0903,WB_EXTEND},      {0x0904,0x0939,WB_ALETTER},
+    {0x093A,0x093C,WB_EXTEND},      {0x093D,0x093D,WB_ALETTER},
+    {0x093E,0x094F,WB_EXTEND},      {0x0950,0x0950,WB_ALETTER},
+    {0x0951,0x0957,WB_EXTEND},      {0x0958,0x0961,WB_ALETTER},
+    {0x0962,0x0963,WB_EXTEND},      {0x0966,0x096F,WB_NUMERIC},
+    {0x0971,0x0980,WB_ALETTER},     {0x0981,0x0983,WB_EXTEND},
+    {0x0985,0x09B9,WB_ALETTER},     {0x09BC,0x09BC,WB_EXTEND},
+    {0x09BD,0x09BD,WB_ALETTER},     {0x09BE,0x09CD,WB_EXTEND},
+    {0x09CE,0x09CE,WB_ALETTER},     {0x09D7,0x09D7,WB_EXTEND},
+    {0x09DC,0x09E1,WB_ALETTER},     {0x09E2,0x09E3,WB_EXTEND},
+    {0x09E6,0x09EF,WB_NUMERIC},     {0x09F0,0x09F1,WB_ALETTER},
+    {0x09FC,0x09FC,WB_ALETTER},     {0x09FE,0x0A03,WB_EXTEND},
+    {0x0A05,0x0A39,WB_ALETTER},     {0x0A3C,0x0A51,WB_EXTEND},
+    {0x0A59,0x0A5E,WB_ALETTER},     {0x0A66,0x0A6F,WB_NUMERIC},
+    {0x0A70,0x0A71,WB_EXTEND},      {0x0A72,0x0A74,WB_ALETTER},
+    {0x0A75,0x0A75,WB_EXTEND},      {0x0A81,0x0A83,WB_EXTEND},
+    {0x0A85,0x0AB9,WB_ALETTER},     {0x0ABC,0x0ABC,WB_EXTEND},
+    {0x0ABD,0x0ABD,WB_ALETTER},     {0x0ABE,0x0ACD,WB_EXTEND},
+    {0x0AD0,0x0AE1,WB_ALETTER},     {0x0AE2,0x0AE3,WB_EXTEND},
+    {0x0AE6,0x0AEF,WB_NUMERIC},     {0x0AF9,0x0AF9,WB_ALETTER},
+    {0x0AFA,0x0B03,WB_EXTEND},      {0x0B05,0x0B39,WB_ALETTER},
+    {0x0B3C,0x0B3C,WB_EXTEND},      {0x0B3D,0x0B3D,WB_ALETTER},
+    {0x0B3E,0x0B57,WB_EXTEND},      {0x0B5C,0x0B61,WB_ALETTER},
+    {0x0B62,0x0B63,WB_EXTEND},      {0x0B66,0x0B6F,WB_NUMERIC},
+    {0x0B71,0x0B71,WB_ALETTER},     {0x0B82,0x0B82,WB_EXTEND},
+    {0x0B83,0x0BB9,WB_ALETTER},     {0x0BBE,0x0BCD,WB_EXTEND},
+    {0x0BD0,0x0BD0,WB_ALETTER},     {0x0BD7,0x0BD7,WB_EXTEND},
+    {0x0BE6,0x0BEF,WB_NUMERIC},     {0x0C00,0x0C04,WB_EXTEND},
+    {0x0C05,0x0C39,WB_ALETTER},     {0x0C3C,0x0C3C,WB_EXTEND},
+    {0x0C3D,0x0C3D,WB_ALETTER},     {0x0C3E,0x0C56,WB_EXTEND},
+    {0x0C58,0x0C61,WB_ALETTER},     {0x0C62,0x0C63,WB_EXTEND},
+    {0x0C66,0x0C6F,WB_NUMERIC},     {0x0C80,0x0C80,WB_ALETTER},
+    {0x0C81,0x0C83,WB_EXTEND},      {0x0C85,0x0CB9,WB_ALETTER},
+    {0x0CBC,0x0CBC,WB_EXTEND},      {0x0CBD,0x0CBD,WB_ALETTER},
+    {0x0CBE,0x0CD6,WB_EXTEND},      {0x0CDD,0x0CE1,WB_ALETTER},
+    {0x0CE2,0x0CE3,WB_EXTEND},      {0x0CE6,0x0CEF,WB_NUMERIC},
+    {0x0CF1,0x0CF2,WB_ALETTER},     {0x0D00,0x0D03,WB_EXTEND},
+    {0x0D04,0x0D3A,WB_ALETTER},     {0x0D3B,0x0D3C,WB_EXTEND},
+    {0x0D3D,0x0D3D,WB_ALETTER},     {0x0D3E,0x0D4D,WB_EXTEND},
+    {0x0D4E,0x0D4E,WB_ALETTER},     {0x0D54,0x0D56,WB_ALETTER},
+    {0x0D57,0x0D57,WB_EXTEND},      {0x0D5F,0x0D61,WB_ALETTER},
+    {0x0D62,0x0D63,WB_EXTEND},      {0x0D66,0x0D6F,WB_NUMERIC},
+    {0x0D7A,0x0D7F,WB_ALETTER},     {0x0D81,0x0D83,WB_EXTEND},
+    {0x0D85,0x0DC6,WB_ALETTER},     {0x0DCA,0x0DDF,WB_EXTEND},
+    {0x0DE6,0x0DEF,WB_NUMERIC},     {0x0DF2,0x0DF3,WB_EXTEND},
+    {0x0E31,0x0E31,WB_EXTEND},      {0x0E34,0x0E3A,WB_EXTEND},
+    {0x0E47,0x0E4E,WB_EXTEND},      {0x0E50,0x0E59,WB_NUMERIC},
+    {0x0EB1,0x0EB1,WB_EXTEND},      {0x0EB4,0x0EBC,WB_EXTEND},
+    {0x0EC8,0x0ECD,WB_EXTEND},      {0x0ED0,0x0ED9,WB_NUMERIC},
+    {0x0F00,0x0F00,WB_ALETTER},     {0x0F18,0x0F19,WB_EXTEND},
+    {0x0F20,0x0F29,WB_NUMERIC},     {0x0F35,0x0F35,WB_EXTEND},
+    {0x0F37,0x0F37,WB_EXTEND},      {0x0F39,0x0F39,WB_EXTEND},
+    {0x0F3E,0x0F3F,WB_EXTEND},      {0x0F40,0x0F6C,WB_ALETTER},
+    {0x0F71,0x0F84,WB_EXTEND},      {0x0F86,0x0F87,WB_EXTEND},
+    {0x0F88,0x0F8C,WB_ALETTER},     {0x0F8D,0x0FBC,WB_EXTEND},
+    {0x0FC6,0x0FC6,WB_EXTEND},      {0x102B,0x103E,WB_EXTEND},
+    {0x1040,0x1049,WB_NUMERIC},     {0x1056,0x1059,WB_EXTEND},
+    {0x105E,0x1060,WB_EXTEND},      {0x1062,0x1064,WB_EXTEND},
+    {0x1067,0x106D,WB_EXTEND},      {0x1071,0x1074,WB_EXTEND},
+    {0x1082,0x108D,WB_EXTEND},      {0x108F,0x108F,WB_EXTEND},
+    {0x1090,0x1099,WB_NUMERIC},     {0x109A,0x109D,WB_EXTEND},
+    {0x10A0,0x10FA,WB_ALETTER},     {0x10FC,0x135A,WB_ALETTER},
+    {0x135D,0x135F,WB_EXTEND},      {0x1380,0x138F,WB_ALETTER},
+    {0x13A0,0x13FD,WB_ALETTER},     {0x1401,0x166C,WB_ALETTER},
+    {0x166F,0x167F,WB_ALETTER},     {0x1680,0x1680,WB_SPACE},
+    {0x1681,0x169A,WB_ALETTER},     {0x16A0,0x16EA,WB_ALETTER},
+    {0x16EE,0x1711,WB_ALETTER},     {0x1712,0x1715,WB_EXTEND},
+    {0x171F,0x1731,WB_ALETTER},     {0x1732,0x1734,WB_EXTEND},
+    {0x1740,0x1751,WB_ALETTER},     {0x1752,0x1753,WB_EXTEND},
+    {0x1760,0x1770,WB_ALETTER},     {0x1772,0x1773,WB_EXTEND},
+    {0x17B4,0x17D3,WB_EXTEND},      {0x17DD,0x17DD,WB_EXTEND},
+    {0x17E0,0x17E9,WB_NUMERIC},     {0x180B,0x180F,WB_EXTEND},
+    {0x1810,0x1819,WB_NUMERIC},     {0x1820,0x1884,WB_ALETTER},
+    {0x1885,0x1886,WB_EXTEND},      {0x1887,0x18A8,WB_ALETTER},
+    {0x18A9,0x18A9,WB_EXTEND},      {0x18AA,0x191E,WB_ALETTER},
+    {0x1920,0x193B,WB_EXTEND},      {0x1946,0x194F,WB_NUMERIC},
+    {0x19D0,0x19D9,WB_NUMERIC},     {0x1A00,0x1A16,WB_ALETTER},
+    {0x1A17,0x1A1B,WB_EXTEND},      {0x1A55,0x1A7F,WB_EXTEND},
+    {0x1A80,0x1A99,WB_NUMERIC},     {0x1AB0,0x1B04,WB_EXTEND},
+    {0x1B05,0x1B33,WB_ALETTER},     {0x1B34,0x1B44,WB_EXTEND},
+    {0x1B45,0x1B4C,WB_ALETTER},     {0x1B50,0x1B59,WB_NUMERIC},
+    {0x1B6B,0x1B73,WB_EXTEND},      {0x1B80,0x1B82,WB_EXTEND},
+    {0x1B83,0x1BA0,WB_ALETTER},     {0x1BA1,0x1BAD,WB_EXTEND},
+    {0x1BAE,0x1BAF,WB_ALETTER},     {0x1BB0,0x1BB9,WB_NUMERIC},
+    {0x1BBA,0x1BE5,WB_ALETTER},     {0x1BE6,0x1BF3,WB_EXTEND},
+    {0x1C00,0x1C23,WB_ALETTER},     {0x1C24,0x1C37,WB_EXTEND},
+    {0x1C40,0x1C49,WB_NUMERIC},     {0x1C4D,0x1C4F,WB_ALETTER},
+    {0x1C50,0x1C59,WB_NUMERIC},     {0x1C5A,0x1C7D,WB_ALETTER},
+    {0x1C80,0x1CBF,WB_ALETTER},     {0x1CD0,0x1CD2,WB_EXTEND},
+    {0x1CD4,0x1CE8,WB_EXTEND},      {0x1CE9,0x1CEC,WB_ALETTER},
+    {0x1CED,0x1CED,WB_EXTEND},      {0x1CEE,0x1CF3,WB_ALETTER},
+    {0x1CF4,0x1CF4,WB_EXTEND},      {0x1CF5,0x1CF6,WB_ALETTER},
+    {0x1CF7,0x1CF9,WB_EXTEND},      {0x1CFA,0x1DBF,WB_ALETTER},
+    {0x1DC0,0x1DFF,WB_EXTEND},      {0x1E00,0x1FBC,WB_ALETTER},
+    {0x1FBE,0x1FBE,WB_ALETTER},     {0x1FC2,0x1FCC,WB_ALETTER},
+    {0x1FD0,0x1FDB,WB_ALETTER},     {0x1FE0,0x1FEC,WB_ALETTER},
+    {0x1FF2,0x1FFC,WB_ALETTER},     {0x2000,0x2006,WB_SPACE},
+    {0x2008,0x200A,WB_SPACE},       {0x200C,0x200F,WB_EXTEND},
+    {0x2018,0x2019,WB_MIDNUMLET},   {0x2024,0x2024,WB_MIDNUMLET},
+    {0x2027,0x2027,WB_MIDLETTER},   {0x2028,0x2029,WB_NEWLINE},
+    {0x202A,0x202E,WB_EXTEND},      {0x202F,0x202F,WB_EXTENDNUMLET},
+    {0x203F,0x2040,WB_EXTENDNUMLET},{0x2044,0x2044,WB_MIDNUM},
+    {0x2054,0x2054,WB_EXTENDNUMLET},{0x205F,0x205F,WB_SPACE},
+    {0x2060,0x206F,WB_EXTEND},      {0x2071,0x2071,WB_ALETTER},
+    {0x207F,0x207F,WB_ALETTER},     {0x2090,0x209C,WB_ALETTER},
+    {0x20D0,0x20F0,WB_EXTEND},      {0x2102,0x2102,WB_ALETTER},
+    {0x2107,0x2107,WB_ALETTER},     {0x210A,0x2113,WB_ALETTER},
+    {0x2115,0x2115,WB_ALETTER},     {0x2119,0x211D,WB_ALETTER},
+    {0x2124,0x2124,WB_ALETTER},     {0x2126,0x2126,WB_ALETTER},
+    {0x2128,0x2128,WB_ALETTER},     {0x212A,0x212D,WB_ALETTER},
+    {0x212F,0x2139,WB_ALETTER},     {0x213C,0x213F,WB_ALETTER},
+    {0x2145,0x2149,WB_ALETTER},     {0x214E,0x214E,WB_ALETTER},
+    {0x2160,0x2188,WB_ALETTER},     {0x24B6,0x24E9,WB_ALETTER},
+    {0x2C00,0x2CE4,WB_ALETTER},     {0x2CEB,0x2CEE,WB_ALETTER},
+    {0x2CEF,0x2CF1,WB_EXTEND},      {0x2CF2,0x2CF3,WB_ALETTER},
+    {0x2D00,0x2D6F,WB_ALETTER},     {0x2D7F,0x2D7F,WB_EXTEND},
+    {0x2D80,0x2DDE,WB_ALETTER},     {0x2DE0,0x2DFF,WB_EXTEND},
+    {0x2E2F,0x2E2F,WB_ALETTER},     {0x3000,0x3000,WB_SPACE},
+    {0x3005,0x3005,WB_ALETTER},     {0x3006,0x3007,WB_IDEO},
+    {0x3021,0x3029,WB_IDEO},        {0x302A,0x302F,WB_EXTEND},
+    {0x3031,0x3035,WB_KATAKANA},    {0x3038,0x303A,WB_IDEO},
+    {0x303B,0x303C,WB_ALETTER},     {0x3041,0x3096,WB_IDEO},
+    {0x3099,0x309A,WB_EXTEND},      {0x309B,0x309C,WB_KATAKANA},
+    {0x309D,0x309F,WB_IDEO},        {0x30A0,0x30FA,WB_KATAKANA},
+    {0x30FC,0x30FF,WB_KATAKANA},    {0x3105,0x318E,WB_ALETTER},
+    {0x31A0,0x31BF,WB_ALETTER},     {0x31F0,0x31FF,WB_KATAKANA},
+    {0x32D0,0x32FE,WB_KATAKANA},    {0x3300,0x3357,WB_KATAKANA},
+    {0x3400,0x4DBF,WB_IDEO},        {0x4E00,0x9FFF,WB_IDEO},
+    {0xA000,0xA48C,WB_ALETTER},     {0xA490,0xA4C6,WB_IDEO},
+    {0xA4D0,0xA4FD,WB_ALETTER},     {0xA500,0xA60C,WB_ALETTER},
+    {0xA610,0xA61F,WB_ALETTER},     {0xA620,0xA629,WB_NUMERIC},
+    {0xA62A,0xA66E,WB_ALETTER},     {0xA66F,0xA672,WB_EXTEND},
+    {0xA674,0xA67D,WB_EXTEND},      {0xA67F,0xA69D,WB_ALETTER},
+    {0xA69E,0xA69F,WB_EXTEND},      {0xA6A0,0xA6EF,WB_ALETTER},
+    {0xA6F0,0xA6F1,WB_EXTEND},      {0xA708,0xA801,WB_ALETTER},
+    {0xA802,0xA802,WB_EXTEND},      {0xA803,0xA805,WB_ALETTER},
+    {0xA806,0xA806,WB_EXTEND},      {0xA807,0xA80A,WB_ALETTER},
+    {0xA80B,0xA80B,WB_EXTEND},      {0xA80C,0xA822,WB_ALETTER},
+    {0xA823,0xA827,WB_EXTEND},      {0xA82C,0xA82C,WB_EXTEND},
+    {0xA840,0xA873,WB_ALETTER},     {0xA880,0xA881,WB_EXTEND},
+    {0xA882,0xA8B3,WB_ALETTER},     {0xA8B4,0xA8C5,WB_EXTEND},
+    {0xA8D0,0xA8D9,WB_NUMERIC},     {0xA8E0,0xA8F1,WB_EXTEND},
+    {0xA8F2,0xA8F7,WB_ALETTER},     {0xA8FB,0xA8FB,WB_ALETTER},
+    {0xA8FD,0xA8FE,WB_ALETTER},     {0xA8FF,0xA8FF,WB_EXTEND},
+    {0xA900,0xA909,WB_NUMERIC},     {0xA90A,0xA925,WB_ALETTER},
+    {0xA926,0xA92D,WB_EXTEND},      {0xA930,0xA946,WB_ALETTER},
+    {0xA947,0xA953,WB_EXTEND},      {0xA960,0xA97C,WB_ALETTER},
+    {0xA980,0xA983,WB_EXTEND},      {0xA984,0xA9B2,WB_ALETTER},
+    {0xA9B3,0xA9C0,WB_EXTEND},      {0xA9CF,0xA9CF,WB_ALETTER},
+    {0xA9D0,0xA9D9,WB_NUMERIC},     {0xA9E5,0xA9E5,WB_EXTEND},
+    {0xA9F0,0xA9F9,WB_NUMERIC},     {0xAA00,0xAA28,WB_ALETTER},
+    {0xAA29,0xAA36,WB_EXTEND},      {0xAA40,0xAA42,WB_ALETTER},
+    {0xAA43,0xAA43,WB_EXTEND},      {0xAA44,0xAA4B,WB_ALETTER},
+    {0xAA4C,0xAA4D,WB_EXTEND},      {0xAA50,0xAA59,WB_NUMERIC},
+    {0xAA7B,0xAA7D,WB_EXTEND},      {0xAAB0,0xAAB0,WB_EXTEND},
+    {0xAAB2,0xAAB4,WB_EXTEND},      {0xAAB7,0xAAB8,WB_EXTEND},
+    {0xAABE,0xAABF,WB_EXTEND},      {0xAAC1,0xAAC1,WB_EXTEND},
+    {0xAAE0,0xAAEA,WB_ALETTER},     {0xAAEB,0xAAEF,WB_EXTEND},
+    {0xAAF2,0xAAF4,WB_ALETTER},     {0xAAF5,0xAAF6,WB_EXTEND},
+    {0xAB01,0xAB69,WB_ALETTER},     {0xAB70,0xABE2,WB_ALETTER},
+    {0xABE3,0xABEA,WB_EXTEND},      {0xABEC,0xABED,WB_EXTEND},
+    {0xABF0,0xABF9,WB_NUMERIC},     {0xAC00,0xD7FB,WB_ALETTER},
+    {0xF900,0xFAD9,WB_IDEO},        {0xFB00,0xFB1D,WB_ALETTER},
+    {0xFB1E,0xFB1E,WB_EXTEND},      {0xFB1F,0xFB28,WB_ALETTER},
+    {0xFB2A,0xFBB1,WB_ALETTER},     {0xFBD3,0xFD3D,WB_ALETTER},
+    {0xFD50,0xFDC7,WB_ALETTER},     {0xFDF0,0xFDFB,WB_ALETTER},
+    {0xFE00,0xFE0F,WB_EXTEND},      {0xFE10,0xFE10,WB_MIDNUM},
+    {0xFE13,0xFE13,WB_MIDLETTER},   {0xFE14,0xFE14,WB_MIDNUM},
+    {0xFE20,0xFE2F,WB_EXTEND},      {0xFE33,0xFE34,WB_EXTENDNUMLET},
+    {0xFE4D,0xFE4F,WB_EXTENDNUMLET},{0xFE50,0xFE50,WB_MIDNUM},
+    {0xFE52,0xFE52,WB_MIDNUMLET},   {0xFE54,0xFE54,WB_MIDNUM},
+    {0xFE55,0xFE55,WB_MIDLETTER},   {0xFE70,0xFEFC,WB_ALETTER},
+    {0xFEFF,0xFEFF,WB_EXTEND},      {0xFF07,0xFF07,WB_MIDNUMLET},
+    {0xFF0C,0xFF0C,WB_MIDNUM},      {0xFF0E,0xFF0E,WB_MIDNUMLET},
+    {0xFF10,0xFF19,WB_NUMERIC},     {0xFF1A,0xFF1A,WB_MIDLETTER},
+    {0xFF1B,0xFF1B,WB_MIDNUM},      {0xFF21,0xFF3A,WB_ALETTER},
+    {0xFF3F,0xFF3F,WB_EXTENDNUMLET},{0xFF41,0xFF5A,WB_ALETTER},
+    {0xFF66,0xFF9D,WB_KATAKANA},    {0xFF9E,0xFF9F,WB_EXTEND},
+    {0xFFA0,0xFFDC,WB_ALETTER},     {0xFFF9,0xFFFB,WB_EXTEND},
+    {0x10000,0x100FA,WB_ALETTER},   {0x10140,0x10174,WB_ALETTER},
+    {0x101FD,0x101FD,WB_EXTEND},    {0x10280,0x102D0,WB_ALETTER},
+    {0x102E0,0x102E0,WB_EXTEND},    {0x10300,0x1031F,WB_ALETTER},
+    {0x1032D,0x10375,WB_ALETTER},   {0x10376,0x1037A,WB_EXTEND},
+    {0x10380,0x1039D,WB_ALETTER},   {0x103A0,0x103CF,WB_ALETTER},
+    {0x103D1,0x1049D,WB_ALETTER},   {0x104A0,0x104A9,WB_NUMERIC},
+    {0x104B0,0x10563,WB_ALETTER},   {0x10570,0x10855,WB_ALETTER},
+    {0x10860,0x10876,WB_ALETTER},   {0x10880,0x1089E,WB_ALETTER},
+    {0x108E0,0x108F5,WB_ALETTER},   {0x10900,0x10915,WB_ALETTER},
+    {0x10920,0x10939,WB_ALETTER},   {0x10980,0x109B7,WB_ALETTER},
+    {0x109BE,0x109BF,WB_ALETTER},   {0x10A00,0x10A00,WB_ALETTER},
+    {0x10A01,0x10A0F,WB_EXTEND},    {0x10A10,0x10A35,WB_ALETTER},
+    {0x10A38,0x10A3F,WB_EXTEND},    {0x10A60,0x10A7C,WB_ALETTER},
+    {0x10A80,0x10A9C,WB_ALETTER},   {0x10AC0,0x10AC7,WB_ALETTER},
+    {0x10AC9,0x10AE4,WB_ALETTER},   {0x10AE5,0x10AE6,WB_EXTEND},
+    {0x10B00,0x10B35,WB_ALETTER},   {0x10B40,0x10B55,WB_ALETTER},
+    {0x10B60,0x10B72,WB_ALETTER},   {0x10B80,0x10B91,WB_ALETTER},
+    {0x10C00,0x10CF2,WB_ALETTER},   {0x10D00,0x10D23,WB_ALETTER},
+    {0x10D24,0x10D27,WB_EXTEND},    {0x10D30,0x10D39,WB_NUMERIC},
+    {0x10E80,0x10EA9,WB_ALETTER},   {0x10EAB,0x10EAC,WB_EXTEND},
+    {0x10EB0,0x10F1C,WB_ALETTER},   {0x10F27,0x10F45,WB_ALETTER},
+    {0x10F46,0x10F50,WB_EXTEND},    {0x10F70,0x10F81,WB_ALETTER},
+    {0x10F82,0x10F85,WB_EXTEND},    {0x10FB0,0x10FC4,WB_ALETTER},
+    {0x10FE0,0x10FF6,WB_ALETTER},   {0x11000,0x11002,WB_EXTEND},
+    {0x11003,0x11037,WB_ALETTER},   {0x11038,0x11046,WB_EXTEND},
+    {0x11066,0x1106F,WB_NUMERIC},   {0x11070,0x11070,WB_EXTEND},
+    {0x11071,0x11072,WB_ALETTER},   {0x11073,0x11074,WB_EXTEND},
+    {0x11075,0x11075,WB_ALETTER},   {0x1107F,0x11082,WB_EXTEND},
+    {0x11083,0x110AF,WB_ALETTER},   {0x110B0,0x110BA,WB_EXTEND},
+    {0x110BD,0x110BD,WB_EXTEND},    {0x110C2,0x110CD,WB_EXTEND},
+    {0x110D0,0x110E8,WB_ALETTER},   {0x110F0,0x110F9,WB_NUMERIC},
+    {0x11100,0x11102,WB_EXTEND},    {0x11103,0x11126,WB_ALETTER},
+    {0x11127,0x11134,WB_EXTEND},    {0x11136,0x1113F,WB_NUMERIC},
+    {0x11144,0x11144,WB_ALETTER},   {0x11145,0x11146,WB_EXTEND},
+    {0x11147,0x11172,WB_ALETTER},   {0x11173,0x11173,WB_EXTEND},
+    {0x11176,0x11176,WB_ALETTER},   {0x11180,0x11182,WB_EXTEND},
+    {0x11183,0x111B2,WB_ALETTER},   {0x111B3,0x111C0,WB_EXTEND},
+    {0x111C1,0x111C4,WB_ALETTER},   {0x111C9,0x111CC,WB_EXTEND},
+    {0x111CE,0x111CF,WB_EXTEND},    {0x111D0,0x111D9,WB_NUMERIC},
+    {0x111DA,0x111DA,WB_ALETTER},   {0x111DC,0x111DC,WB_ALETTER},
+    {0x11200,0x1122B,WB_ALETTER},   {0x1122C,0x11237,WB_EXTEND},
+    {0x1123E,0x1123E,WB_EXTEND},    {0x11280,0x112A8,WB_ALETTER},
+    {0x112B0,0x112DE,WB_ALETTER},   {0x112DF,0x112EA,WB_EXTEND},
+    {0x112F0,0x112F9,WB_NUMERIC},   {0x11300,0x11303,WB_EXTEND},
+    {0x11305,0x11339,WB_ALETTER},   {0x1133B,0x1133C,WB_EXTEND},
+    {0x1133D,0x1133D,WB_ALETTER},   {0x1133E,0x1134D,WB_EXTEND},
+    {0x11350,0x11350,WB_ALETTER},   {0x11357,0x11357,WB_EXTEND},
+    {0x1135D,0x11361,WB_ALETTER},   {0x11362,0x11374,WB_EXTEND},
+    {0x11400,0x11434,WB_ALETTER},   {0x11435,0x11446,WB_EXTEND},
+    {0x11447,0x1144A,WB_ALETTER},   {0x11450,0x11459,WB_NUMERIC},
+    {0x1145E,0x1145E,WB_EXTEND},    {0x1145F,0x114AF,WB_ALETTER},
+    {0x114B0,0x114C3,WB_EXTEND},    {0x114C4,0x114C5,WB_ALETTER},
+    {0x114C7,0x114C7,WB_ALETTER},   {0x114D0,0x114D9,WB_NUMERIC},
+    {0x11580,0x115AE,WB_ALETTER},   {0x115AF,0x115C0,WB_EXTEND},
+    {0x115D8,0x115DB,WB_ALETTER},   {0x115DC,0x115DD,WB_EXTEND},
+    {0x11600,0x1162F,WB_ALETTER},   {0x11630,0x11640,WB_EXTEND},
+    {0x11644,0x11644,WB_ALETTER},   {0x11650,0x11659,WB_NUMERIC},
+    {0x11680,0x116AA,WB_ALETTER},   {0x116AB,0x116B7,WB_EXTEND},
+    {0x116B8,0x116B8,WB_ALETTER},   {0x116C0,0x116C9,WB_NUMERIC},
+    {0x1171D,0x1172B,WB_EXTEND},    {0x11730,0x11739,WB_NUMERIC},
+    {0x11800,0x1182B,WB_ALETTER},   {0x1182C,0x1183A,WB_EXTEND},
+    {0x118A0,0x118DF,WB_ALETTER},   {0x118E0,0x118E9,WB_NUMERIC},
+    {0x118FF,0x1192F,WB_ALETTER},   {0x11930,0x1193E,WB_EXTEND},
+    {0x1193F,0x1193F,WB_ALETTER},   {0x11940,0x11940,WB_EXTEND},
+    {0x11941,0x11941,WB_ALETTER},   {0x11942,0x11943,WB_EXTEND},
+    {0x11950,0x11959,WB_NUMERIC},   {0x119A0,0x119D0,WB_ALETTER},
+    {0x119D1,0x119E0,WB_EXTEND},    {0x119E1,0x119E1,WB_ALETTER},
+    {0x119E3,0x119E3,WB_ALETTER},   {0x119E4,0x119E4,WB_EXTEND},
+    {0x11A00,0x11A00,WB_ALETTER},   {0x11A01,0x11A0A,WB_EXTEND},
+    {0x11A0B,0x11A32,WB_ALETTER},   {0x11A33,0x11A39,WB_EXTEND},
+    {0x11A3A,0x11A3A,WB_ALETTER},   {0x11A3B,0x11A3E,WB_EXTEND},
+    {0x11A47,0x11A47,WB_EXTEND},    {0x11A50,0x11A50,WB_ALETTER},
+    {0x11A51,0x11A5B,WB_EXTEND},    {0x11A5C,0x11A89,WB_ALETTER},
+    {0x11A8A,0x11A99,WB_EXTEND},    {0x11A9D,0x11A9D,WB_ALETTER},
+    {0x11AB0,0x11C2E,WB_ALETTER},   {0x11C2F,0x11C3F,WB_EXTEND},
+    {0x11C40,0x11C40,WB_ALETTER},   {0x11C50,0x11C59,WB_NUMERIC},
+    {0x11C72,0x11C8F,WB_ALETTER},   {0x11C92,0x11CB6,WB_EXTEND},
+    {0x11D00,0x11D30,WB_ALETTER},   {0x11D31,0x11D45,WB_EXTEND},
+    {0x11D46,0x11D46,WB_ALETTER},   {0x11D47,0x11D47,WB_EXTEND},
+    {0x11D50,0x11D59,WB_NUMERIC},   {0x11D60,0x11D89,WB_ALETTER},
+    {0x11D8A,0x11D97,WB_EXTEND},    {0x11D98,0x11D98,WB_ALETTER},
+    {0x11DA0,0x11DA9,WB_NUMERIC},   {0x11EE0,0x11EF2,WB_ALETTER},
+    {0x11EF3,0x11EF6,WB_EXTEND},    {0x11FB0,0x11FB0,WB_ALETTER},
+    {0x12000,0x1246E,WB_ALETTER},   {0x12480,0x12FF0,WB_ALETTER},
+    {0x13000,0x1342E,WB_ALETTER},   {0x13430,0x13438,WB_EXTEND},
+    {0x14400,0x16A5E,WB_ALETTER},   {0x16A60,0x16A69,WB_NUMERIC},
+    {0x16A70,0x16ABE,WB_ALETTER},   {0x16AC0,0x16AC9,WB_NUMERIC},
+    {0x16AD0,0x16AED,WB_ALETTER},   {0x16AF0,0x16AF4,WB_EXTEND},
+    {0x16B00,0x16B2F,WB_ALETTER},   {0x16B30,0x16B36,WB_EXTEND},
+    {0x16B40,0x16B43,WB_ALETTER},   {0x16B50,0x16B59,WB_NUMERIC},
+    {0x16B63,0x16E7F,WB_ALETTER},   {0x16F00,0x16F4A,WB_ALETTER},
+    {0x16F4F,0x16F4F,WB_EXTEND},    {0x16F50,0x16F50,WB_ALETTER},
+    {0x16F51,0x16F92,WB_EXTEND},    {0x16F93,0x16FE1,WB_ALETTER},
+    {0x16FE3,0x16FE3,WB_ALETTER},   {0x16FE4,0x16FF1,WB_EXTEND},
+    {0x17000,0x18D08,WB_IDEO},      {0x1AFF0,0x1B000,WB_KATAKANA},
+    {0x1B001,0x1B11F,WB_IDEO},      {0x1B120,0x1B122,WB_KATAKANA},
+    {0x1B150,0x1B152,WB_IDEO},      {0x1B164,0x1B167,WB_KATAKANA},
+    {0x1B170,0x1B2FB,WB_IDEO},      {0x1BC00,0x1BC99,WB_ALETTER},
+    {0x1BC9D,0x1BC9E,WB_EXTEND},    {0x1BCA0,0x1CF46,WB_EXTEND},
+    {0x1D165,0x1D169,WB_EXTEND},    {0x1D16D,0x1D182,WB_EXTEND},
+    {0x1D185,0x1D18B,WB_EXTEND},    {0x1D1AA,0x1D1AD,WB_EXTEND},
+    {0x1D242,0x1D244,WB_EXTEND},    {0x1D400,0x1D6C0,WB_ALETTER},
+    {0x1D6C2,0x1D6DA,WB_ALETTER},   {0x1D6DC,0x1D6FA,WB_ALETTER},
+    {0x1D6FC,0x1D714,WB_ALETTER},   {0x1D716,0x1D734,WB_ALETTER},
+    {0x1D736,0x1D74E,WB_ALETTER},   {0x1D750,0x1D76E,WB_ALETTER},
+    {0x1D770,0x1D788,WB_ALETTER},   {0x1D78A,0x1D7A8,WB_ALETTER},
+    {0x1D7AA,0x1D7C2,WB_ALETTER},   {0x1D7C4,0x1D7CB,WB_ALETTER},
+    {0x1D7CE,0x1D7FF,WB_NUMERIC},   {0x1DA00,0x1DA36,WB_EXTEND},
+    {0x1DA3B,0x1DA6C,WB_EXTEND},    {0x1DA75,0x1DA75,WB_EXTEND},
+    {0x1DA84,0x1DA84,WB_EXTEND},    {0x1DA9B,0x1DAAF,WB_EXTEND},
+    {0x1DF00,0x1DF1E,WB_ALETTER},   {0x1E000,0x1E02A,WB_EXTEND},
+    {0x1E100,0x1E12C,WB_ALETTER},   {0x1E130,0x1E136,WB_EXTEND},
+    {0x1E137,0x1E13D,WB_ALETTER},   {0x1E140,0x1E149,WB_NUMERIC},
+    {0x1E14E,0x1E14E,WB_ALETTER},   {0x1E290,0x1E2AD,WB_ALETTER},
+    {0x1E2AE,0x1E2AE,WB_EXTEND},    {0x1E2C0,0x1E2EB,WB_ALETTER},
+    {0x1E2EC,0x1E2EF,WB_EXTEND},    {0x1E2F0,0x1E2F9,WB_NUMERIC},
+    {0x1E7E0,0x1E8C4,WB_ALETTER},   {0x1E8D0,0x1E8D6,WB_EXTEND},
+    {0x1E900,0x1E943,WB_ALETTER},   {0x1E944,0x1E94A,WB_EXTEND},
+    {0x1E94B,0x1E94B,WB_ALETTER},   {0x1E950,0x1E959,WB_NUMERIC},
+    {0x1EE00,0x1EEBB,WB_ALETTER},   {0x1F130,0x1F149,WB_ALETTER},
+    {0x1F150,0x1F169,WB_ALETTER},   {0x1F170,0x1F189,WB_ALETTER},
+    {0x1F200,0x1F200,WB_IDEO},      {0x1F3FB,0x1F3FF,WB_EXTEND},
+    {0x1FBF0,0x1FBF9,WB_NUMERIC},   {0x20000,0x3134A,WB_IDEO},
+    {0xE0001,0xE01EF,WB_EXTEND}
+};
+
+/* Return the word break class of the character of 'len' bytes at 's'.
+ * Multi byte characters are decoded as UTF-8, and classified by their
+ * first code point, since the encoding may return a grapheme cluster. A
+ * single byte above ASCII belongs to some 8 bit encoding, and is taken as
+ * a letter. */
+static int wordBreakClass(const unsigned char *s, size_t len) {
+    unsigned int c = s[0], j, n;
+    size_t lo = 0, hi = sizeof(wbRanges)/sizeof(wbRanges[0]);
+
+    if (c < 0x80 || len == 1) {
+        if (c >= 0x80 || isalpha(c)) return WB_ALETTER;
+        if (isdigit(c)) return WB_NUMERIC;
+        switch(c) {
+        case '\n': case '\r': case '\v': case '\f': return WB_NEWLINE;
+        case ' ': case '\t': return WB_SPACE;
+        case '_': return WB_EXTENDNUMLET;
+        case ':': return WB_MIDLETTER;
+        case ',': case ';': return WB_MIDNUM;
+        case '.': case '\'': return WB_MIDNUMLET;
+        default: return WB_OTHER;
+        }
     }
+    n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+    if (n == 0 || n > len) return WB_OTHER;
+    c &= 0x7F >> n;
+    for (j = 1; j < n; j++) c = (c << 6) | (s[j] & 0x3F);
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if (wbRanges[mid].last < c) lo = mid+1;
+        else if (wbRanges[mid].first > c) hi = mid;
+        else return wbRanges[mid].cls;
+    }
+    return WB_OTHER;
+}
 
-    /* Move cursor to right position. */
-    rpos2 = (pcollen+colpos2+l->cols)/l->cols; /* current cursor relative row. */
-    lndebug("rpos2 %d", rpos2);
+#define WB_AHLETTER(c) ((c) == WB_ALETTER)
+#define WB_MIDLETTERQ(c) ((c) == WB_MIDLETTER || (c) == WB_MIDNUMLET)
+#define WB_MIDNUMQ(c) ((c) == WB_MIDNUM || (c) == WB_MIDNUMLET)
+#define WB_WORDLIKE(c) ((c) >= WB_ALETTER && (c) <= WB_EXTENDNUMLET)
+
+/* Return non zero if there is no word boundary between the characters of
+ * class 'b' and 'c'. 'a' is the class before 'b' and 'd' the class after
+ * 'c', both -1 if missing, for the rules that look at four characters.
+ * Extend characters are already skipped by the caller (rule WB4). */
+static int wordJoins(int a, int b, int c, int d) {
+    if (WB_AHLETTER(b) && WB_AHLETTER(c)) return 1;                /* WB5 */
+    if (WB_AHLETTER(b) && WB_MIDLETTERQ(c) && WB_AHLETTER(d)) return 1;
+    if (WB_AHLETTER(a) && WB_MIDLETTERQ(b) && WB_AHLETTER(c)) return 1;
+    if ((b == WB_NUMERIC || WB_AHLETTER(b)) &&
+        (c == WB_NUMERIC || WB_AHLETTER(c))) return 1;          /* WB8-10 */
+    if (a == WB_NUMERIC && WB_MIDNUMQ(b) && c == WB_NUMERIC) return 1;
+    if (b == WB_NUMERIC && WB_MIDNUMQ(c) && d == WB_NUMERIC) return 1;
+    if (b == WB_KATAKANA && c == WB_KATAKANA) return 1;             /* WB13 */
+    if (c == WB_EXTENDNUMLET && (WB_AHLETTER(b) || b == WB_NUMERIC ||
+        b == WB_KATAKANA || b == WB_EXTENDNUMLET)) return 1;       /* WB13a */
+    if (b == WB_EXTENDNUMLET && (WB_AHLETTER(c) || c == WB_NUMERIC ||
+        c == WB_KATAKANA)) return 1;                               /* WB13b */
+    return 0;
+}
 
-    /* Go up till we reach the expected positon. */
-    if (rows-rpos2 > 0) {
-        lndebug("go-up %d", rows-rpos2);
-        snprintf(seq,64,"\x1b[%dA", rows-rpos2);
-        abAppend(&ab,seq,strlen(seq));
+/* Append the word from 'start' to 'end' to the index. */
+static int wordsAppend(struct offsetIndex *w, size_t start, size_t end) {
+    if (w->len+2 > w->cap) {
+        size_t cap = w->cap ? w->cap*2 : 16;
+        size_t *off = lnRealloc(LN_POOL_EDIT,w->off,sizeof(size_t)*cap);
+
+        if (off == NULL) return -1;
+        w->off = off;
+        w->cap = cap;
     }
+    w->off[w->len++] = start;
+    w->off[w->len++] = end;
+    return 0;
+}
 
-    /* Set column. */
-    col = (pcollen + colpos2) % l->cols;
-    lndebug("set col %d", 1+col);
-    if (col)
-        snprintf(seq,64,"\r\x1b[%dC", col);
-    else
-        snprintf(seq,64,"\r");
-    abAppend(&ab,seq,strlen(seq));
+/* Compute the start and end offsets of the words of the buffer, unless
+ * they are already known for this generation of the buffer. The classes of
+ * the last two characters and of the next two are kept as the scan goes,
+ * with the extend characters attached to the character before them. */
+static void wordsUpdate(struct linenoiseState *l) {
+    const unsigned char *buf = (const unsigned char *)l->buf;
+    size_t pos = 0, next, start = 0, clen, nlen = 0;
+    int a = -1, b = -1, c = -1, d = -1, first = -1;
+
+    if (l->wordsgen == l->gen) return;
+    l->words.len = 0;
+    l->wordsgen = l->gen;
+    if (l->len == 0) return;
 
-    lndebug("\n", NULL);
-    l->oldcolpos = colpos2;
+    /* Class of the character at 'pos', then the one after it. */
+    clen = nextCharLen(l->buf,l->len,0,NULL);
+    c = wordBreakClass(buf,clen);
+    next = clen;
+    while (1) {
+        int join;
+
+        /* Attach the extend characters to 'c', and find 'd'. */
+        while (next < l->len) {
+            nlen = nextCharLen(l->buf,l->len,next,NULL);
+            d = wordBreakClass(buf+next,nlen);
+            if (d != WB_EXTEND || c == WB_NEWLINE) break;
+            next += nlen;
+            d = -1;
+        }
+        if (next >= l->len) d = -1;
+
+        /* Boundary before 'c' at 'pos'? */
+        if (b == -1) join = 0;
+        else if (b == WB_NEWLINE || c == WB_NEWLINE) join = 0;      /* WB3a */
+        else if (b == WB_SPACE && c == WB_SPACE) join = 1;          /* WB3d */
+        else join = wordJoins(a,b,c,d);
+        if (!join) {
+            if (first != -1 && WB_WORDLIKE(first) &&
+                wordsAppend(&l->words,start,pos) == -1) goto error;
+            start = pos;
+            first = c;
+        }
+        if (d == -1) break;
+        a = b;
+        b = c;
+        c = d;
+        pos = next;
+        next += nlen;
+    }
+    if (WB_WORDLIKE(first) && wordsAppend(&l->words,start,l->len) == -1)
+        goto error;
+    return;
 
-    if (write(fd,ab.b,ab.len) == -1) {} /* Can't recover from write error. */
-    abFree(&ab);
+error:
+    l->words.len = 0;
+    l->wordsgen = l->gen-1;
 }
 
-/* Calls the two low level functions refreshSingleLine() or
- * refreshMultiLine() according to the selected mode. */
-static void refreshLine(struct linenoiseState *l) {
-    if (mlmode)
-        refreshMultiLine(l);
-    else
-        refreshSingleLine(l);
+/* Return the end of the word under the cursor, or of the next word if the
+ * cursor is not on a word, or the buffer length if there is none. */
+static size_t wordEnd(struct linenoiseState *l) {
+    struct offsetIndex *w = &l->words;
+    size_t k;
+
+    wordsUpdate(l);
+    k = offsetRank(w,l->pos+1);
+    if (k % 2) return w->off[k];
+    return k < w->len ? w->off[k+1] : l->len;
 }
 
-/* Insert the character 'c' at cursor current position.
- *
- * On error writing to the terminal -1 is returned, otherwise 0. */
-int linenoiseEditInsert(struct linenoiseState *l, const char *cbuf, int clen) {
-    if (l->len+clen <= l->buflen) {
-        if (l->len == l->pos) {
-            memcpy(&l->buf[l->pos],cbuf,clen);
-            l->pos+=clen;
-            l->len+=clen;;
-            l->buf[l->len] = '\0';
-            if ((!mlmode && promptTextColumnLen(l->prompt,l->plen)+columnPos(l->buf,l->len,l->len) < l->cols && !hintsCallback)) {
-                /* Avoid a full update of the line in the
-                 * trivial case. */
-                if (write(l->ofd,cbuf,clen) == -1) return -1;
-            } else {
-                refreshLine(l);
+/* Return the start of the word before the cursor, or 0 if there is none. */
+static size_t wordStart(struct linenoiseState *l) {
+    struct offsetIndex *w = &l->words;
+    size_t k;
+
+    wordsUpdate(l);
+    k = offsetRank(w,l->pos);
+    if (k % 2) return w->off[k-1];
+    return k ? w->off[k-2] : 0;
+}
+
+/* ============================== Case folding ============================== */
+
+/* Case insensitive matching of the history compares strings after Unicode
+ * simple case folding, so that it works for every script and does not
+ * depend on the locale. The mapping is stored as runs of code points
+ * folded by the same delta, every 'stride' code points, which is how the
+ * Unicode data is laid out: most scripts alternate upper and lower case
+ * letters, or have them in two blocks. Generated from CaseFolding.txt of
+ * Unicode 14.0, status C and S. */
+static const struct foldRun {
+    unsigned int first;     /* First code point of the run. */
+    unsigned short count;   /* Code points folded. */
+    unsigned char stride;   /* Distance between them. */
+    int delta;              /* What to add to fold them. */
+} foldRuns[] = {
+    {0x00B5,1,1,775},    {0x00C0,23,1,32},    {0x00D8,7,1,32},
+    {0x0100,24,2,1},    {0x0132,3,2,1},    {0x0139,8,2,1},
+    {0x014A,23,2,1},    {0x0178,1,1,-121},    {0x0179,3,2,1},
+    {0x017F,1,1,-268},    {0x0181,1,1,210},    {0x0182,2,2,1},
+    {0x0186,1,1,206},    {0x0187,1,1,1},    {0x0189,2,1,205},
+    {0x018B,1,1,1},    {0x018E,1,1,79},    {0x018F,1,1,202},
+    {0x0190,1,1,203},    {0x0191,1,1,1},    {0x0193,1,1,205},
+    {0x0194,1,1,207},    {0x0196,1,1,211},    {0x0197,1,1,209},
+    {0x0198,1,1,1},    {0x019C,1,1,211},    {0x019D,1,1,213},
+    {0x019F,1,1,214},    {0x01A0,3,2,1},    {0x01A6,1,1,218},
+    {0x01A7,1,1,1},    {0x01A9,1,1,218},    {0x01AC,1,1,1},
+    {0x01AE,1,1,218},    {0x01AF,1,1,1},    {0x01B1,2,1,217},
+    {0x01B3,2,2,1},    {0x01B7,1,1,219},    {0x01B8,1,1,1},
+    {0x01BC,1,1,1},    {0x01C4,1,1,2},    {0x01C5,1,1,1},
+    {0x01C7,1,1,2},    {0x01C8,1,1,1},    {0x01CA,1,1,2},
+    {0x01CB,9,2,1},    {0x01DE,9,2,1},    {0x01F1,1,1,2},
+    {0x01F2,2,2,1},    {0x01F6,1,1,-97},    {0x01F7,1,1,-56},
+    {0x01F8,20,2,1},    {0x0220,1,1,-130},    {0x0222,9,2,1},
+    {0x023A,1,1,10795},    {0x023B,1,1,1},    {0x023D,1,1,-163},
+    {0x023E,1,1,10792},    {0x0241,1,1,1},    {0x0243,1,1,-195},
+    {0x0244,1,1,69},    {0x0245,1,1,71},    {0x0246,5,2,1},
+    {0x0345,1,1,116},    {0x0370,2,2,1},    {0x0376,1,1,1},
+    {0x037F,1,1,116},    {0x0386,1,1,38},    {0x0388,3,1,37},
+    {0x038C,1,1,64},    {0x038E,2,1,63},    {0x0391,17,1,32},
+    {0x03A3,9,1,32},    {0x03C2,1,1,1},    {0x03CF,1,1,8},
+    {0x03D0,1,1,-30},    {0x03D1,1,1,-25},    {0x03D5,1,1,-15},
+    {0x03D6,1,1,-22},    {0x03D8,12,2,1},    {0x03F0,1,1,-54},
+    {0x03F1,1,1,-48},    {0x03F4,1,1,-60},    {0x03F5,1,1,-64},
+    {0x03F7,1,1,1},    {0x03F9,1,1,-7},    {0x03FA,1,1,1},
+    {0x03FD,3,1,-130},    {0x0400,16,1,80},    {0x0410,32,1,32},
+    {0x0460,17,2,1},    {0x048A,27,2,1},    {0x04C0,1,1,15},
+    {0x04C1,7,2,1},    {0x04D0,48,2,1},    {0x0531,38,1,48},
+    {0x10A0,38,1,7264},    {0x10C7,1,1,7264},    {0x10CD,1,1,7264},
+    {0x13F8,6,1,-8},    {0x1C80,1,1,-6222},    {0x1C81,1,1,-6221},
+    {0x1C82,1,1,-6212},    {0x1C83,2,1,-6210},    {0x1C85,1,1,-6211},
+    {0x1C86,1,1,-6204},    {0x1C87,1,1,-6180},    {0x1C88,1,1,35267},
+    {0x1C90,43,1,-3008},    {0x1CBD,3,1,-3008},    {0x1E00,75,2,1},
+    {0x1E9B,1,1,-58},    {0x1E9E,1,1,-7615},    {0x1EA0,48,2,1},
+    {0x1F08,8,1,-8},    {0x1F18,6,1,-8},    {0x1F28,8,1,-8},
+    {0x1F38,8,1,-8},    {0x1F48,6,1,-8},    {0x1F59,4,2,-8},
+    {0x1F68,8,1,-8},    {0x1F88,8,1,-8},    {0x1F98,8,1,-8},
+    {0x1FA8,8,1,-8},    {0x1FB8,2,1,-8},    {0x1FBA,2,1,-74},
+    {0x1FBC,1,1,-9},    {0x1FBE,1,1,-7173},    {0x1FC8,4,1,-86},
+    {0x1FCC,1,1,-9},    {0x1FD8,2,1,-8},    {0x1FDA,2,1,-100},
+    {0x1FE8,2,1,-8},    {0x1FEA,2,1,-112},    {0x1FEC,1,1,-7},
+    {0x1FF8,2,1,-128},    {0x1FFA,2,1,-126},    {0x1FFC,1,1,-9},
+    {0x2126,1,1,-7517},    {0x212A,1,1,-8383},    {0x212B,1,1,-8262},
+    {0x2132,1,1,28},    {0x2160,16,1,16},    {0x2183,1,1,1},
+    {0x24B6,26,1,26},    {0x2C00,48,1,48},    {0x2C60,1,1,1},
+    {0x2C62,1,1,-10743},    {0x2C63,1,1,-3814},    {0x2C64,1,1,-10727},
+    {0x2C67,3,2,1},    {0x2C6D,1,1,-10780},    {0x2C6E,1,1,-10749},
+    {0x2C6F,1,1,-10783},    {0x2C70,1,1,-10782},    {0x2C72,1,1,1},
+    {0x2C75,1,1,1},    {0x2C7E,2,1,-10815},    {0x2C80,50,2,1},
+    {0x2CEB,2,2,1},    {0x2CF2,1,1,1},    {0xA640,23,2,1},
+    {0xA680,14,2,1},    {0xA722,7,2,1},    {0xA732,31,2,1},
+    {0xA779,2,2,1},    {0xA77D,1,1,-35332},    {0xA77E,5,2,1},
+    {0xA78B,1,1,1},    {0xA78D,1,1,-42280},    {0xA790,2,2,1},
+    {0xA796,10,2,1},    {0xA7AA,1,1,-42308},    {0xA7AB,1,1,-42319},
+    {0xA7AC,1,1,-42315},    {0xA7AD,1,1,-42305},    {0xA7AE,1,1,-42308},
+    {0xA7B0,1,1,-42258},    {0xA7B1,1,1,-42282},    {0xA7B2,1,1,-42261},
+    {0xA7B3,1,1,928},    {0xA7B4,8,2,1},    {0xA7C4,1,1,-48},
+    {0xA7C5,1,1,-42307},    {0xA7C6,1,1,-35384},    {0xA7C7,2,2,1},
+    {0xA7D0,1,1,1},    {0xA7D6,2,2,1},    {0xA7F5,1,1,1},
+    {0xAB70,80,1,-38864},    {0xFF21,26,1,32},    {0x10400,40,1,40},
+    {0x104B0,36,1,40},    {0x10570,11,1,39},    {0x1057C,15,1,39},
+    {0x1058C,7,1,39},    {0x10594,2,1,39},    {0x10C80,51,1,64},
+    {0x118A0,32,1,32},    {0x16E40,32,1,32},    {0x1E900,34,1,34},
+
+};
+
+/* Return the simple case folding of the code point 'c'. */
+static unsigned int foldCodePoint(unsigned int c) {
+    size_t lo = 0, hi = sizeof(foldRuns)/sizeof(foldRuns[0]);
+
+    if (c < 0x80) return c >= 'A' && c <= 'Z' ? c+32 : c;
+    /* Find the last run starting at or before 'c'. */
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if (foldRuns[mid].first <= c) lo = mid+1;
+        else hi = mid;
+    }
+    if (lo == 0) return c;
+    lo--;
+    if (c < foldRuns[lo].first+foldRuns[lo].count*foldRuns[lo].stride &&
+        (c-foldRuns[lo].first) % foldRuns[lo].stride == 0)
+        return c+foldRuns[lo].delta;
+    return c;
+}
+
+/* Lower case the ASCII letters of the eight bytes in 'w', that must all be
+ * ASCII. Adding 0x3F to a byte sets its high bit if it is 'A' or above,
+ * adding 0x25 if it is above 'Z', and no sum carries into the next byte. */
+static uint64_t foldAscii8(uint64_t w) {
+    const uint64_t highs = 0x8080808080808080ULL, ones = 0x0101010101010101ULL;
+    uint64_t upper = (w + ones*0x3F) & ~(w + ones*0x25) & highs;
+
+    return w | (upper >> 2);
+}
+
+/* Non zero if the eight bytes in the word 'w' are all ASCII. */
+#define ASCII8(w) (((w) & 0x8080808080808080ULL) == 0)
+
+/* Fold the 'len' bytes at 's' into 'out', that must have room for 2*len
+ * bytes: a folded character may take a byte more than the original, as in
+ * U+023A, that folds to U+2C65. Invalid UTF-8 is copied as it is. Returns
+ * the length of the folded string. */
+static size_t caseFold(const char *s, size_t len, char *out) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        unsigned int c = p[i], n, j;
+        uint64_t w;
+
+        /* Eight ASCII bytes at a time while possible. */
+        if (i+8 <= len) {
+            memcpy(&w,p+i,8);
+            if (ASCII8(w)) {
+                w = foldAscii8(w);
+                memcpy(out+o,&w,8);
+                i += 8;
+                o += 8;
+                continue;
             }
+        }
+        n = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+        for (j = 1; j < n && i+j < len && (p[i+j] & 0xC0) == 0x80; j++);
+        if (n == 0 || j != n || c >= 0xF8) {
+            out[o++] = p[i++];
+            continue;
+        }
+        c &= n == 1 ? 0x7F : 0x7F >> n;
+        for (j = 1; j < n; j++) c = (c << 6) | (p[i+j] & 0x3F);
+        i += n;
+        c = foldCodePoint(c);
+        if (c < 0x80) {
+            out[o++] = c;
+        } else if (c < 0x800) {
+            out[o++] = 0xC0 | (c >> 6);
+            out[o++] = 0x80 | (c & 0x3F);
+        } else if (c < 0x10000) {
+            out[o++] = 0xE0 | (c >> 12);
+            out[o++] = 0x80 | ((c >> 6) & 0x3F);
+            out[o++] = 0x80 | (c & 0x3F);
         } else {
-            memmove(l->buf+l->pos+clen,l->buf+l->pos,l->len-l->pos);
-            memcpy(&l->buf[l->pos],cbuf,clen);
-            l->pos+=clen;
-            l->len+=clen;
-            l->buf[l->len] = '\0';
-            refreshLine(l);
+            out[o++] = 0xF0 | (c >> 18);
+            out[o++] = 0x80 | ((c >> 12) & 0x3F);
+            out[o++] = 0x80 | ((c >> 6) & 0x3F);
+            out[o++] = 0x80 | (c & 0x3F);
         }
     }
-    return 0;
+    return o;
 }
 
-/* Move cursor on the left. */
-void linenoiseEditMoveLeft(struct linenoiseState *l) {
-    if (l->pos > 0) {
-        l->pos -= prevCharLen(l->buf,l->len,l->pos,NULL);
-        refreshLine(l);
+/* Return non zero if the folding of the 'len' bytes at 's' starts with
+ * 'folded', of 'flen' bytes, already folded. The string is folded a piece
+ * at a time and only as far as needed, without allocations. */
+static int caseFoldPrefix(const char *s, size_t len, const char *folded, size_t flen) {
+    char buf[64];
+    size_t i = 0, o = 0;
+
+    while (o < flen) {
+        size_t n = len-i, chunk, k;
+
+        if (n == 0) return 0;
+        if (n > sizeof(buf)/2) {
+            /* Don't split a character between chunks. */
+            n = sizeof(buf)/2;
+            while (n > 1 && ((unsigned char)s[i+n] & 0xC0) == 0x80) n--;
+        }
+        chunk = caseFold(s+i,n,buf);
+        k = chunk < flen-o ? chunk : flen-o;
+        if (memcmp(buf,folded+o,k)) return 0;
+        i += n;
+        o += k;
     }
+    return 1;
 }
 
-/* Move cursor on the right. */
-void linenoiseEditMoveRight(struct linenoiseState *l) {
-    if (l->pos != l->len) {
-        l->pos += nextCharLen(l->buf,l->len,l->pos,NULL);
-        refreshLine(l);
+/* Fold 'len' bytes at 's' into a new allocated string, returning it and
+ * its length in '*flen', or NULL on out of memory. */
+static char *caseFoldDup(const char *s, size_t len, size_t *flen) {
+    char *out = lnMalloc(LN_POOL_MISC,len*2+1);
+
+    if (out == NULL) return NULL;
+    *flen = caseFold(s,len,out);
+    out[*flen] = '\0';
+    return out;
+}
+
+/* Return non zero if 'a' and 'b', of 'alen' and 'blen' bytes, are the same
+ * string ignoring the case. */
+static int caseFoldEqual(const char *a, size_t alen, const char *b, size_t blen) {
+    char *fa = caseFoldDup(a,alen,&alen);
+    char *fb = caseFoldDup(b,blen,&blen);
+    int equal;
+
+    if (fa && fb) equal = alen == blen && !memcmp(fa,fb,alen);
+    else equal = alen == blen && !memcmp(a,b,alen);
+    lnFree(fa);
+    lnFree(fb);
+    return equal;
+}
+
+/* ============================= Normalization ============================== */
+
+/* The same text can be encoded with precomposed characters or with base
+ * characters followed by combining marks, depending on the keyboard or the
+ * source it was pasted from. When enabled, entries are converted to the
+ * Normalization Form C before to be added, so that duplicates are found and
+ * searches match however they were typed. The tables are generated from
+ * UnicodeData.txt and CompositionExclusions.txt of Unicode 14.0. */
+
+/* Canonical combining classes, as runs of code points of the same class.
+ * Code points not listed have class zero. */
+static const struct nfcClassRun {
+    unsigned int first;
+    unsigned char count;
+    unsigned char ccc;
+} nfcClasses[] = {
+    {0x0300,21,230}, {0x0315,1,232}, {0x0316,4,220}, {0x031A,1,232},
+    {0x031B,1,216}, {0x031C,5,220}, {0x0321,2,202}, {0x0323,4,220},
+    {0x0327,2,202}, {0x0329,11,220}, {0x0334,5,1}, {0x0339,4,220},
+    {0x033D,8,230}, {0x0345,1,240}, {0x0346,1,230}, {0x0347,3,220},
+    {0x034A,3,230}, {0x034D,2,220}, {0x0350,3,230}, {0x0353,4,220},
+    {0x0357,1,230}, {0x0358,1,232}, {0x0359,2,220}, {0x035B,1,230},
+    {0x035C,1,233}, {0x035D,2,234}, {0x035F,1,233}, {0x0360,2,234},
+    {0x0362,1,233}, {0x0363,13,230}, {0x0483,5,230}, {0x0591,1,220},
+    {0x0592,4,230}, {0x0596,1,220}, {0x0597,3,230}, {0x059A,1,222},
+    {0x059B,1,220}, {0x059C,6,230}, {0x05A2,6,220}, {0x05A8,2,230},
+    {0x05AA,1,220}, {0x05AB,2,230}, {0x05AD,1,222}, {0x05AE,1,228},
+    {0x05AF,1,230}, {0x05B0,1,10}, {0x05B1,1,11}, {0x05B2,1,12},
+    {0x05B3,1,13}, {0x05B4,1,14}, {0x05B5,1,15}, {0x05B6,1,16}, {0x05B7,1,17},
+    {0x05B8,1,18}, {0x05B9,2,19}, {0x05BB,1,20}, {0x05BC,1,21}, {0x05BD,1,22},
+    {0x05BF,1,23}, {0x05C1,1,24}, {0x05C2,1,25}, {0x05C4,1,230},
+    {0x05C5,1,220}, {0x05C7,1,18}, {0x0610,8,230}, {0x0618,1,30},
+    {0x0619,1,31}, {0x061A,1,32}, {0x064B,1,27}, {0x064C,1,28}, {0x064D,1,29},
+    {0x064E,1,30}, {0x064F,1,31}, {0x0650,1,32}, {0x0651,1,33}, {0x0652,1,34},
+    {0x0653,2,230}, {0x0655,2,220}, {0x0657,5,230}, {0x065C,1,220},
+    {0x065D,2,230}, {0x065F,1,220}, {0x0670,1,35}, {0x06D6,7,230},
+    {0x06DF,4,230}, {0x06E3,1,220}, {0x06E4,1,230}, {0x06E7,2,230},
+    {0x06EA,1,220}, {0x06EB,2,230}, {0x06ED,1,220}, {0x0711,1,36},
+    {0x0730,1,230}, {0x0731,1,220}, {0x0732,2,230}, {0x0734,1,220},
+    {0x0735,2,230}, {0x0737,3,220}, {0x073A,1,230}, {0x073B,2,220},
+    {0x073D,1,230}, {0x073E,1,220}, {0x073F,3,230}, {0x0742,1,220},
+    {0x0743,1,230}, {0x0744,1,220}, {0x0745,1,230}, {0x0746,1,220},
+    {0x0747,1,230}, {0x0748,1,220}, {0x0749,2,230}, {0x07EB,7,230},
+    {0x07F2,1,220}, {0x07F3,1,230}, {0x07FD,1,220}, {0x0816,4,230},
+    {0x081B,9,230}, {0x0825,3,230}, {0x0829,5,230}, {0x0859,3,220},
+    {0x0898,1,230}, {0x0899,3,220}, {0x089C,4,230}, {0x08CA,5,230},
+    {0x08CF,5,220}, {0x08D4,14,230}, {0x08E3,1,220}, {0x08E4,2,230},
+    {0x08E6,1,220}, {0x08E7,2,230}, {0x08E9,1,220}, {0x08EA,3,230},
+    {0x08ED,3,220}, {0x08F0,1,27}, {0x08F1,1,28}, {0x08F2,1,29},
+    {0x08F3,3,230}, {0x08F6,1,220}, {0x08F7,2,230}, {0x08F9,2,220},
+    {0x08FB,5,230}, {0x093C,1,7}, {0x094D,1,9}, {0x0951,1,230},
+    {0x0952,1,220}, {0x0953,2,230}, {0x09BC,1,7}, {0x09CD,1,9},
+    {0x09FE,1,230}, {0x0A3C,1,7}, {0x0A4D,1,9}, {0x0ABC,1,7}, {0x0ACD,1,9},
+    {0x0B3C,1,7}, {0x0B4D,1,9}, {0x0BCD,1,9}, {0x0C3C,1,7}, {0x0C4D,1,9},
+    {0x0C55,1,84}, {0x0C56,1,91}, {0x0CBC,1,7}, {0x0CCD,1,9}, {0x0D3B,2,9},
+    {0x0D4D,1,9}, {0x0DCA,1,9}, {0x0E38,2,103}, {0x0E3A,1,9}, {0x0E48,4,107},
+    {0x0EB8,2,118}, {0x0EBA,1,9}, {0x0EC8,4,122}, {0x0F18,2,220},
+    {0x0F35,1,220}, {0x0F37,1,220}, {0x0F39,1,216}, {0x0F71,1,129},
+    {0x0F72,1,130}, {0x0F74,1,132}, {0x0F7A,4,130}, {0x0F80,1,130},
+    {0x0F82,2,230}, {0x0F84,1,9}, {0x0F86,2,230}, {0x0FC6,1,220},
+    {0x1037,1,7}, {0x1039,2,9}, {0x108D,1,220}, {0x135D,3,230}, {0x1714,2,9},
+    {0x1734,1,9}, {0x17D2,1,9}, {0x17DD,1,230}, {0x18A9,1,228},
+    {0x1939,1,222}, {0x193A,1,230}, {0x193B,1,220}, {0x1A17,1,230},
+    {0x1A18,1,220}, {0x1A60,1,9}, {0x1A75,8,230}, {0x1A7F,1,220},
+    {0x1AB0,5,230}, {0x1AB5,6,220}, {0x1ABB,2,230}, {0x1ABD,1,220},
+    {0x1ABF,2,220}, {0x1AC1,2,230}, {0x1AC3,2,220}, {0x1AC5,5,230},
+    {0x1ACA,1,220}, {0x1ACB,4,230}, {0x1B34,1,7}, {0x1B44,1,9},
+    {0x1B6B,1,230}, {0x1B6C,1,220}, {0x1B6D,7,230}, {0x1BAA,2,9},
+    {0x1BE6,1,7}, {0x1BF2,2,9}, {0x1C37,1,7}, {0x1CD0,3,230}, {0x1CD4,1,1},
+    {0x1CD5,5,220}, {0x1CDA,2,230}, {0x1CDC,4,220}, {0x1CE0,1,230},
+    {0x1CE2,7,1}, {0x1CED,1,220}, {0x1CF4,1,230}, {0x1CF8,2,230},
+    {0x1DC0,2,230}, {0x1DC2,1,220}, {0x1DC3,7,230}, {0x1DCA,1,220},
+    {0x1DCB,2,230}, {0x1DCD,1,234}, {0x1DCE,1,214}, {0x1DCF,1,220},
+    {0x1DD0,1,202}, {0x1DD1,37,230}, {0x1DF6,1,232}, {0x1DF7,2,228},
+    {0x1DF9,1,220}, {0x1DFA,1,218}, {0x1DFB,1,230}, {0x1DFC,1,233},
+    {0x1DFD,1,220}, {0x1DFE,1,230}, {0x1DFF,1,220}, {0x20D0,2,230},
+    {0x20D2,2,1}, {0x20D4,4,230}, {0x20D8,3,1}, {0x20DB,2,230},
+    {0x20E1,1,230}, {0x20E5,2,1}, {0x20E7,1,230}, {0x20E8,1,220},
+    {0x20E9,1,230}, {0x20EA,2,1}, {0x20EC,4,220}, {0x20F0,1,230},
+    {0x2CEF,3,230}, {0x2D7F,1,9}, {0x2DE0,32,230}, {0x302A,1,218},
+    {0x302B,1,228}, {0x302C,1,232}, {0x302D,1,222}, {0x302E,2,224},
+    {0x3099,2,8}, {0xA66F,1,230}, {0xA674,10,230}, {0xA69E,2,230},
+    {0xA6F0,2,230}, {0xA806,1,9}, {0xA82C,1,9}, {0xA8C4,1,9}, {0xA8E0,18,230},
+    {0xA92B,3,220}, {0xA953,1,9}, {0xA9B3,1,7}, {0xA9C0,1,9}, {0xAAB0,1,230},
+    {0xAAB2,2,230}, {0xAAB4,1,220}, {0xAAB7,2,230}, {0xAABE,2,230},
+    {0xAAC1,1,230}, {0xAAF6,1,9}, {0xABED,1,9}, {0xFB1E,1,26}, {0xFE20,7,230},
+    {0xFE27,7,220}, {0xFE2E,2,230}, {0x101FD,1,220}, {0x102E0,1,220},
+    {0x10376,5,230}, {0x10A0D,1,220}, {0x10A0F,1,230}, {0x10A38,1,230},
+    {0x10A39,1,1}, {0x10A3A,1,220}, {0x10A3F,1,9}, {0x10AE5,1,230},
+    {0x10AE6,1,220}, {0x10D24,4,230}, {0x10EAB,2,230}, {0x10F46,2,220},
+    {0x10F48,3,230}, {0x10F4B,1,220}, {0x10F4C,1,230}, {0x10F4D,4,220},
+    {0x10F82,1,230}, {0x10F83,1,220}, {0x10F84,1,230}, {0x10F85,1,220},
+    {0x11046,1,9}, {0x11070,1,9}, {0x1107F,1,9}, {0x110B9,1,9}, {0x110BA,1,7},
+    {0x11100,3,230}, {0x11133,2,9}, {0x11173,1,7}, {0x111C0,1,9},
+    {0x111CA,1,7}, {0x11235,1,9}, {0x11236,1,7}, {0x112E9,1,7}, {0x112EA,1,9},
+    {0x1133B,2,7}, {0x1134D,1,9}, {0x11366,7,230}, {0x11370,5,230},
+    {0x11442,1,9}, {0x11446,1,7}, {0x1145E,1,230}, {0x114C2,1,9},
+    {0x114C3,1,7}, {0x115BF,1,9}, {0x115C0,1,7}, {0x1163F,1,9}, {0x116B6,1,9},
+    {0x116B7,1,7}, {0x1172B,1,9}, {0x11839,1,9}, {0x1183A,1,7}, {0x1193D,2,9},
+    {0x11943,1,7}, {0x119E0,1,9}, {0x11A34,1,9}, {0x11A47,1,9}, {0x11A99,1,9},
+    {0x11C3F,1,9}, {0x11D42,1,7}, {0x11D44,2,9}, {0x11D97,1,9}, {0x16AF0,5,1},
+    {0x16B30,7,230}, {0x16FF0,2,6}, {0x1BC9E,1,1}, {0x1D165,2,216},
+    {0x1D167,3,1}, {0x1D16D,1,226}, {0x1D16E,5,216}, {0x1D17B,8,220},
+    {0x1D185,5,230}, {0x1D18A,2,220}, {0x1D1AA,4,230}, {0x1D242,3,230},
+    {0x1E000,7,230}, {0x1E008,17,230}, {0x1E01B,7,230}, {0x1E023,2,230},
+    {0x1E026,5,230}, {0x1E130,7,230}, {0x1E2AE,1,230}, {0x1E2EC,4,230},
+    {0x1E8D0,7,220}, {0x1E944,6,230}, {0x1E94A,1,7}
+};
+
+/* Canonical decompositions to two code points, sorted by code point. */
+static const struct nfcPair {
+    unsigned int cp, first, second;
+} nfcPairs[] = {
+    {0x00C0,0x0041,0x0300}, {0x00C1,0x0041,0x0301}, {0x00C2,0x0041,0x0302},
+    {0x00C3,0x0041,0x0303}, {0x00C4,0x0041,0x0308}, {0x00C5,0x0041,0x030A},
+    {0x00C7,0x0043,0x0327}, {0x00C8,0x0045,0x0300}, {0x00C9,0x0045,0x0301},
+    {0x00CA,0x0045,0x0302}, {0x00CB,0x0045,0x0308}, {0x00CC,0x0049,0x0300},
+    {0x00CD,0x0049,0x0301}, {0x00CE,0x0049,0x0302}, {0x00CF,0x0049,0x0308},
+    {0x00D1,0x004E,0x0303}, {0x00D2,0x004F,0x0300}, {0x00D3,0x004F,0x0301},
+    {0x00D4,0x004F,0x0302}, {0x00D5,0x004F,0x0303}, {0x00D6,0x004F,0x0308},
+    {0x00D9,0x0055,0x0300}, {0x00DA,0x0055,0x0301}, {0x00DB,0x0055,0x0302},
+    {0x00DC,0x0055,0x0308}, {0x00DD,0x0059,0x0301}, {0x00E0,0x0061,0x0300},
+    {0x00E1,0x0061,0x0301}, {0x00E2,0x0061,0x0302}, {0x00E3,0x0061,0x0303},
+    {0x00E4,0x0061,0x0308}, {0x00E5,0x0061,0x030A}, {0x00E7,0x0063,0x0327},
+    {0x00E8,0x0065,0x0300}, {0x00E9,0x0065,0x0301}, {0x00EA,0x0065,0x0302},
+    {0x00EB,0x0065,0x0308}, {0x00EC,0x0069,0x0300}, {0x00ED,0x0069,0x0301},
+    {0x00EE,0x0069,0x0302}, {0x00EF,0x0069,0x0308}, {0x00F1,0x006E,0x0303},
+    {0x00F2,0x006F,0x0300}, {0x00F3,0x006F,0x0301}, {0x00F4,0x006F,0x0302},
+    {0x00F5,0x006F,0x0303}, {0x00F6,0x006F,0x0308}, {0x00F9,0x0075,0x0300},
+    {0x00FA,0x0075,0x0301}, {0x00FB,0x0075,0x0302}, {0x00FC,0x0075,0x0308},
+    {0x00FD,0x0079,0x0301}, {0x00FF,0x0079,0x0308}, {0x0100,0x0041,0x0304},
+    {0x0101,0x0061,0x0304}, {0x0102,0x0041,0x0306}, {0x0103,0x0061,0x0306},
+    {0x0104,0x0041,0x0328}, {0x0105,0x0061,0x0328}, {0x0106,0x0043,0x0301},
+    {0x0107,0x0063,0x0301}, {0x0108,0x0043,0x0302}, {0x0109,0x0063,0x0302},
+    {0x010A,0x0043,0x0307}, {0x010B,0x0063,0x0307}, {0x010C,0x0043,0x030C},
+    {0x010D,0x0063,0x030C}, {0x010E,0x0044,0x030C}, {0x010F,0x0064,0x030C},
+    {0x0112,0x0045,0x0304}, {0x0113,0x0065,0x0304}, {0x0114,0x0045,0x0306},
+    {0x0115,0x0065,0x0306}, {0x0116,0x0045,0x0307}, {0x0117,0x0065,0x0307},
+    {0x0118,0x0045,0x0328}, {0x0119,0x0065,0x0328}, {0x011A,0x0045,0x030C},
+    {0x011B,0x0065,0x030C}, {0x011C,0x0047,0x0302}, {0x011D,0x0067,0x0302},
+    {0x011E,0x0047,0x0306}, {0x011F,0x0067,0x0306}, {0x0120,0x0047,0x0307},
+    {0x0121,0x0067,0x0307}, {0x0122,0x0047,0x0327}, {0x0123,0x0067,0x0327},
+    {0x0124,0x0048,0x0302}, {0x0125,0x0068,0x0302}, {0x0128,0x0049,0x0303},
+    {0x0129,0x0069,0x0303}, {0x012A,0x0049,0x0304}, {0x012B,0x0069,0x0304},
+    {0x012C,0x0049,0x0306}, {0x012D,0x0069,0x0306}, {0x012E,0x0049,0x0328},
+    {0x012F,0x0069,0x0328}, {0x0130,0x0049,0x0307}, {0x0134,0x004A,0x0302},
+    {0x0135,0x006A,0x0302}, {0x0136,0x004B,0x0327}, {0x0137,0x006B,0x0327},
+    {0x0139,0x004C,0x0301}, {0x013A,0x006C,0x0301}, {0x013B,0x004C,0x0327},
+    {0x013C,0x006C,0x0327}, {0x013D,0x004C,0x030C}, {0x013E,0x006C,0x030C},
+    {0x0143,0x004E,0x0301}, {0x0144,0x006E,0x0301}, {0x0145,0x004E,0x0327},
+    {0x0146,0x006E,0x0327}, {0x0147,0x004E,0x030C}, {0x0148,0x006E,0x030C},
+    {0x014C,0x004F,0x0304}, {0x014D,0x006F,0x0304}, {0x014E,0x004F,0x0306},
+    {0x014F,0x006F,0x0306}, {0x0150,0x004F,0x030B}, {0x0151,0x006F,0x030B},
+    {0x0154,0x0052,0x0301}, {0x0155,0x0072,0x0301}, {0x0156,0x0052,0x0327},
+    {0x0157,0x0072,0x0327}, {0x0158,0x0052,0x030C}, {0x0159,0x0072,0x030C},
+    {0x015A,0x0053,0x0301}, {0x015B,0x0073,0x0301}, {0x015C,0x0053,0x0302},
+    {0x015D,0x0073,0x0302}, {0x015E,0x0053,0x0327}, {0x015F,0x0073,0x0327},
+    {0x0160,0x0053,0x030C}, {0x0161,0x0073,0x030C}, {0x0162,0x0054,0x0327},
+    {0x0163,0x0074,0x0327}, {0x0164,0x0054,0x030C}, {0x0165,0x0074,0x030C},
+    {0x0168,0x0055,0x0303}, {0x0169,0x0075,0x0303}, {0x016A,0x0055,0x0304},
+    {0x016B,0x0075,0x0304}, {0x016C,0x0055,0x0306}, {0x016D,0x0075,0x0306},
+    {0x016E,0x0055,0x030A}, {0x016F,0x0075,0x030A}, {0x0170,0x0055,0x030B},
+    {0x0171,0x0075,0x030B}, {0x0172,0x0055,0x0328}, {0x0173,0x0075,0x0328},
+    {0x0174,0x0057,0x0302}, {0x0175,0x0077,0x0302}, {0x0176,0x0059,0x0302},
+    {0x0177,0x0079,0x0302}, {0x0178,0x0059,0x0308}, {0x0179,0x005A,0x0301},
+    {0x017A,0x007A,0x0301}, {0x017B,0x005A,0x0307}, {0x017C,0x007A,0x0307},
+    {0x017D,0x005A,0x030C}, {0x017E,0x007A,0x030C}, {0x01A0,0x004F,0x031B},
+    {0x01A1,0x006F,0x031B}, {0x01AF,0x0055,0x031B}, {0x01B0,0x0075,0x031B},
+    {0x01CD,0x0041,0x030C}, {0x01CE,0x0061,0x030C}, {0x01CF,0x0049,0x030C},
+    {0x01D0,0x0069,0x030C}, {0x01D1,0x004F,0x030C}, {0x01D2,0x006F,0x030C},
+    {0x01D3,0x0055,0x030C}, {0x01D4,0x0075,0x030C}, {0x01D5,0x00DC,0x0304},
+    {0x01D6,0x00FC,0x0304}, {0x01D7,0x00DC,0x0301}, {0x01D8,0x00FC,0x0301},
+    {0x01D9,0x00DC,0x030C}, {0x01DA,0x00FC,0x030C}, {0x01DB,0x00DC,0x0300},
+    {0x01DC,0x00FC,0x0300}, {0x01DE,0x00C4,0x0304}, {0x01DF,0x00E4,0x0304},
+    {0x01E0,0x0226,0x0304}, {0x01E1,0x0227,0x0304}, {0x01E2,0x00C6,0x0304},
+    {0x01E3,0x00E6,0x0304}, {0x01E6,0x0047,0x030C}, {0x01E7,0x0067,0x030C},
+    {0x01E8,0x004B,0x030C}, {0x01E9,0x006B,0x030C}, {0x01EA,0x004F,0x0328},
+    {0x01EB,0x006F,0x0328}, {0x01EC,0x01EA,0x0304}, {0x01ED,0x01EB,0x0304},
+    {0x01EE,0x01B7,0x030C}, {0x01EF,0x0292,0x030C}, {0x01F0,0x006A,0x030C},
+    {0x01F4,0x0047,0x0301}, {0x01F5,0x0067,0x0301}, {0x01F8,0x004E,0x0300},
+    {0x01F9,0x006E,0x0300}, {0x01FA,0x00C5,0x0301}, {0x01FB,0x00E5,0x0301},
+    {0x01FC,0x00C6,0x0301}, {0x01FD,0x00E6,0x0301}, {0x01FE,0x00D8,0x0301},
+    {0x01FF,0x00F8,0x0301}, {0x0200,0x0041,0x030F}, {0x0201,0x0061,0x030F},
+    {0x0202,0x0041,0x0311}, {0x0203,0x0061,0x0311}, {0x0204,0x0045,0x030F},
+    {0x0205,0x0065,0x030F}, {0x0206,0x0045,0x0311}, {0x0207,0x0065,0x0311},
+    {0x0208,0x0049,0x030F}, {0x0209,0x0069,0x030F}, {0x020A,0x0049,0x0311},
+    {0x020B,0x0069,0x0311}, {0x020C,0x004F,0x030F}, {0x020D,0x006F,0x030F},
+    {0x020E,0x004F,0x0311}, {0x020F,0x006F,0x0311}, {0x0210,0x0052,0x030F},
+    {0x0211,0x0072,0x030F}, {0x0212,0x0052,0x0311}, {0x0213,0x0072,0x0311},
+    {0x0214,0x0055,0x030F}, {0x0215,0x0075,0x030F}, {0x0216,0x0055,0x0311},
+    {0x0217,0x0075,0x0311}, {0x0218,0x0053,0x0326}, {0x0219,0x0073,0x0326},
+    {0x021A,0x0054,0x0326}, {0x021B,0x0074,0x0326}, {0x021E,0x0048,0x030C},
+    {0x021F,0x0068,0x030C}, {0x0226,0x0041,0x0307}, {0x0227,0x0061,0x0307},
+    {0x0228,0x0045,0x0327}, {0x0229,0x0065,0x0327}, {0x022A,0x00D6,0x0304},
+    {0x022B,0x00F6,0x0304}, {0x022C,0x00D5,0x0304}, {0x022D,0x00F5,0x0304},
+    {0x022E,0x004F,0x0307}, {0x022F,0x006F,0x0307}, {0x0230,0x022E,0x0304},
+    {0x0231,0x022F,0x0304}, {0x0232,0x0059,0x0304}, {0x0233,0x0079,0x0304},
+    {0x0344,0x0308,0x0301}, {0x0385,0x00A8,0x0301}, {0x0386,0x0391,0x0301},
+    {0x0388,0x0395,0x0301}, {0x0389,0x0397,0x0301}, {0x038A,0x0399,0x0301},
+    {0x038C,0x039F,0x0301}, {0x038E,0x03A5,0x0301}, {0x038F,0x03A9,0x0301},
+    {0x0390,0x03CA,0x0301}, {0x03AA,0x0399,0x0308}, {0x03AB,0x03A5,0x0308},
+    {0x03AC,0x03B1,0x0301}, {0x03AD,0x03B5,0x0301}, {0x03AE,0x03B7,0x0301},
+    {0x03AF,0x03B9,0x0301}, {0x03B0,0x03CB,0x0301}, {0x03CA,0x03B9,0x0308},
+    {0x03CB,0x03C5,0x0308}, {0x03CC,0x03BF,0x0301}, {0x03CD,0x03C5,0x0301},
+    {0x03CE,0x03C9,0x0301}, {0x03D3,0x03D2,0x0301}, {0x03D4,0x03D2,0x0308},
+    {0x0400,0x0415,0x0300}, {0x0401,0x0415,0x0308}, {0x0403,0x0413,0x0301},
+    {0x0407,0x0406,0x0308}, {0x040C,0x041A,0x0301}, {0x040D,0x0418,0x0300},
+    {0x040E,0x0423,0x0306}, {0x0419,0x0418,0x0306}, {0x0439,0x0438,0x0306},
+    {0x0450,0x0435,0x0300}, {0x0451,0x0435,0x0308}, {0x0453,0x0433,0x0301},
+    {0x0457,0x0456,0x0308}, {0x045C,0x043A,0x0301}, {0x045D,0x0438,0x0300},
+    {0x045E,0x0443,0x0306}, {0x0476,0x0474,0x030F}, {0x0477,0x0475,0x030F},
+    {0x04C1,0x0416,0x0306}, {0x04C2,0x0436,0x0306}, {0x04D0,0x0410,0x0306},
+    {0x04D1,0x0430,0x0306}, {0x04D2,0x0410,0x0308}, {0x04D3,0x0430,0x0308},
+    {0x04D6,0x0415,0x0306}, {0x04D7,0x0435,0x0306}, {0x04DA,0x04D8,0x0308},
+    {0x04DB,0x04D9,0x0308}, {0x04DC,0x0416,0x0308}, {0x04DD,0x0436,0x0308},
+    {0x04DE,0x0417,0x0308}, {0x04DF,0x0437,0x0308}, {0x04E2,0x0418,0x0304},
+    {0x04E3,0x0438,0x0304}, {0x04E4,0x0418,0x0308}, {0x04E5,0x0438,0x0308},
+    {0x04E6,0x041E,0x0308}, {0x04E7,0x043E,0x0308}, {0x04EA,0x04E8,0x0308},
+    {0x04EB,0x04E9,0x0308}, {0x04EC,0x042D,0x0308}, {0x04ED,0x044D,0x0308},
+    {0x04EE,0x0423,0x0304}, {0x04EF,0x0443,0x0304}, {0x04F0,0x0423,0x0308},
+    {0x04F1,0x0443,0x0308}, {0x04F2,0x0423,0x030B}, {0x04F3,0x0443,0x030B},
+    {0x04F4,0x0427,0x0308}, {0x04F5,0x0447,0x0308}, {0x04F8,0x042B,0x0308},
+    {0x04F9,0x044B,0x0308}, {0x0622,0x0627,0x0653}, {0x0623,0x0627,0x0654},
+    {0x0624,0x0648,0x0654}, {0x0625,0x0627,0x0655}, {0x0626,0x064A,0x0654},
+    {0x06C0,0x06D5,0x0654}, {0x06C2,0x06C1,0x0654}, {0x06D3,0x06D2,0x0654},
+    {0x0929,0x0928,0x093C}, {0x0931,0x0930,0x093C}, {0x0934,0x0933,0x093C},
+    {0x0958,0x0915,0x093C}, {0x0959,0x0916,0x093C}, {0x095A,0x0917,0x093C},
+    {0x095B,0x091C,0x093C}, {0x095C,0x0921,0x093C}, {0x095D,0x0922,0x093C},
+    {0x095E,0x092B,0x093C}, {0x095F,0x092F,0x093C}, {0x09CB,0x09C7,0x09BE},
+    {0x09CC,0x09C7,0x09D7}, {0x09DC,0x09A1,0x09BC}, {0x09DD,0x09A2,0x09BC},
+    {0x09DF,0x09AF,0x09BC}, {0x0A33,0x0A32,0x0A3C}, {0x0A36,0x0A38,0x0A3C},
+    {0x0A59,0x0A16,0x0A3C}, {0x0A5A,0x0A17,0x0A3C}, {0x0A5B,0x0A1C,0x0A3C},
+    {0x0A5E,0x0A2B,0x0A3C}, {0x0B48,0x0B47,0x0B56}, {0x0B4B,0x0B47,0x0B3E},
+    {0x0B4C,0x0B47,0x0B57}, {0x0B5C,0x0B21,0x0B3C}, {0x0B5D,0x0B22,0x0B3C},
+    {0x0B94,0x0B92,0x0BD7}, {0x0BCA,0x0BC6,0x0BBE}, {0x0BCB,0x0BC7,0x0BBE},
+    {0x0BCC,0x0BC6,0x0BD7}, {0x0C48,0x0C46,0x0C56}, {0x0CC0,0x0CBF,0x0CD5},
+    {0x0CC7,0x0CC6,0x0CD5}, {0x0CC8,0x0CC6,0x0CD6}, {0x0CCA,0x0CC6,0x0CC2},
+    {0x0CCB,0x0CCA,0x0CD5}, {0x0D4A,0x0D46,0x0D3E}, {0x0D4B,0x0D47,0x0D3E},
+    {0x0D4C,0x0D46,0x0D57}, {0x0DDA,0x0DD9,0x0DCA}, {0x0DDC,0x0DD9,0x0DCF},
+    {0x0DDD,0x0DDC,0x0DCA}, {0x0DDE,0x0DD9,0x0DDF}, {0x0F43,0x0F42,0x0FB7},
+    {0x0F4D,0x0F4C,0x0FB7}, {0x0F52,0x0F51,0x0FB7}, {0x0F57,0x0F56,0x0FB7},
+    {0x0F5C,0x0F5B,0x0FB7}, {0x0F69,0x0F40,0x0FB5}, {0x0F73,0x0F71,0x0F72},
+    {0x0F75,0x0F71,0x0F74}, {0x0F76,0x0FB2,0x0F80}, {0x0F78,0x0FB3,0x0F80},
+    {0x0F81,0x0F71,0x0F80}, {0x0F93,0x0F92,0x0FB7}, {0x0F9D,0x0F9C,0x0FB7},
+    {0x0FA2,0x0FA1,0x0FB7}, {0x0FA7,0x0FA6,0x0FB7}, {0x0FAC,0x0FAB,0x0FB7},
+    {0x0FB9,0x0F90,0x0FB5}, {0x1026,0x1025,0x102E}, {0x1B06,0x1B05,0x1B35},
+    {0x1B08,0x1B07,0x1B35}, {0x1B0A,0x1B09,0x1B35}, {0x1B0C,0x1B0B,0x1B35},
+    {0x1B0E,0x1B0D,0x1B35}, {0x1B12,0x1B11,0x1B35}, {0x1B3B,0x1B3A,0x1B35},
+    {0x1B3D,0x1B3C,0x1B35}, {0x1B40,0x1B3E,0x1B35}, {0x1B41,0x1B3F,0x1B35},
+    {0x1B43,0x1B42,0x1B35}, {0x1E00,0x0041,0x0325}, {0x1E01,0x0061,0x0325},
+    {0x1E02,0x0042,0x0307}, {0x1E03,0x0062,0x0307}, {0x1E04,0x0042,0x0323},
+    {0x1E05,0x0062,0x0323}, {0x1E06,0x0042,0x0331}, {0x1E07,0x0062,0x0331},
+    {0x1E08,0x00C7,0x0301}, {0x1E09,0x00E7,0x0301}, {0x1E0A,0x0044,0x0307},
+    {0x1E0B,0x0064,0x0307}, {0x1E0C,0x0044,0x0323}, {0x1E0D,0x0064,0x0323},
+    {0x1E0E,0x0044,0x0331}, {0x1E0F,0x0064,0x0331}, {0x1E10,0x0044,0x0327},
+    {0x1E11,0x0064,0x0327}, {0x1E12,0x0044,0x032D}, {0x1E13,0x0064,0x032D},
+    {0x1E14,0x0112,0x0300}, {0x1E15,0x0113,0x0300}, {0x1E16,0x0112,0x0301},
+    {0x1E17,0x0113,0x0301}, {0x1E18,0x0045,0x032D}, {0x1E19,0x0065,0x032D},
+    {0x1E1A,0x0045,0x0330}, {0x1E1B,0x0065,0x0330}, {0x1E1C,0x0228,0x0306},
+    {0x1E1D,0x0229,0x0306}, {0x1E1E,0x0046,0x0307}, {0x1E1F,0x0066,0x0307},
+    {0x1E20,0x0047,0x0304}, {0x1E21,0x0067,0x0304}, {0x1E22,0x0048,0x0307},
+    {0x1E23,0x0068,0x0307}, {0x1E24,0x0048,0x0323}, {0x1E25,0x0068,0x0323},
+    {0x1E26,0x0048,0x0308}, {0x1E27,0x0068,0x0308}, {0x1E28,0x0048,0x0327},
+    {0x1E29,0x0068,0x0327}, {0x1E2A,0x0048,0x032E}, {0x1E2B,0x0068,0x032E},
+    {0x1E2C,0x0049,0x0330}, {0x1E2D,0x0069,0x0330}, {0x1E2E,0x00CF,0x0301},
+    {0x1E2F,0x00EF,0x0301}, {0x1E30,0x004B,0x0301}, {0x1E31,0x006B,0x0301},
+    {0x1E32,0x004B,0x0323}, {0x1E33,0x006B,0x0323}, {0x1E34,0x004B,0x0331},
+    {0x1E35,0x006B,0x0331}, {0x1E36,0x004C,0x0323}, {0x1E37,0x006C,0x0323},
+    {0x1E38,0x1E36,0x0304}, {0x1E39,0x1E37,0x0304}, {0x1E3A,0x004C,0x0331},
+    {0x1E3B,0x006C,0x0331}, {0x1E3C,0x004C,0x032D}, {0x1E3D,0x006C,0x032D},
+    {0x1E3E,0x004D,0x0301}, {0x1E3F,0x006D,0x0301}, {0x1E40,0x004D,0x0307},
+    {0x1E41,0x006D,0x0307}, {0x1E42,0x004D,0x0323}, {0x1E43,0x006D,0x0323},
+    {0x1E44,0x004E,0x0307}, {0x1E45,0x006E,0x0307}, {0x1E46,0x004E,0x0323},
+    {0x1E47,0x006E,0x0323}, {0x1E48,0x004E,0x0331}, {0x1E49,0x006E,0x0331},
+    {0x1E4A,0x004E,0x032D}, {0x1E4B,0x006E,0x032D}, {0x1E4C,0x00D5,0x0301},
+    {0x1E4D,0x00F5,0x0301}, {0x1E4E,0x00D5,0x0308}, {0x1E4F,0x00F5,0x0308},
+    {0x1E50,0x014C,0x0300}, {0x1E51,0x014D,0x0300}, {0x1E52,0x014C,0x0301},
+    {0x1E53,0x014D,0x0301}, {0x1E54,0x0050,0x0301}, {0x1E55,0x0070,0x0301},
+    {0x1E56,0x0050,0x0307}, {0x1E57,0x0070,0x0307}, {0x1E58,0x0052,0x0307},
+    {0x1E59,0x0072,0x0307}, {0x1E5A,0x0052,0x0323}, {0x1E5B,0x0072,0x0323},
+    {0x1E5C,0x1E5A,0x0304}, {0x1E5D,0x1E5B,0x0304}, {0x1E5E,0x0052,0x0331},
+    {0x1E5F,0x0072,0x0331}, {0x1E60,0x0053,0x0307}, {0x1E61,0x0073,0x0307},
+    {0x1E62,0x0053,0x0323}, {0x1E63,0x0073,0x0323}, {0x1E64,0x015A,0x0307},
+    {0x1E65,0x015B,0x0307}, {0x1E66,0x0160,0x0307}, {0x1E67,0x0161,0x0307},
+    {0x1E68,0x1E62,0x0307}, {0x1E69,0x1E63,0x0307}, {0x1E6A,0x0054,0x0307},
+    {0x1E6B,0x0074,0x0307}, {0x1E6C,0x0054,0x0323}, {0x1E6D,0x0074,0x0323},
+    {0x1E6E,0x0054,0x0331}, {0x1E6F,0x0074,0x0331}, {0x1E70,0x0054,0x032D},
+    {0x1E71,0x0074,0x032D}, {0x1E72,0x0055,0x0324}, {0x1E73,0x0075,0x0324},
+    {0x1E74,0x0055,0x0330}, {0x1E75,0x0075,0x0330}, {0x1E76,0x0055,0x032D},
+    {0x1E77,0x0075,0x032D}, {0x1E78,0x0168,0x0301}, {0x1E79,0x0169,0x0301},
+    {0x1E7A,0x016A,0x0308}, {0x1E7B,0x016B,0x0308}, {0x1E7C,0x0056,0x0303},
+    {0x1E7D,0x0076,0x0303}, {0x1E7E,0x0056,0x0323}, {0x1E7F,0x0076,0x0323},
+    {0x1E80,0x0057,0x0300}, {0x1E81,0x0077,0x0300}, {0x1E82,0x0057,0x0301},
+    {0x1E83,0x0077,0x0301}, {0x1E84,0x0057,0x0308}, {0x1E85,0x0077,0x0308},
+    {0x1E86,0x0057,0x0307}, {0x1E87,0x0077,0x0307}, {0x1E88,0x0057,0x0323},
+    {0x1E89,0x0077,0x0323}, {0x1E8A,0x0058,0x0307}, {0x1E8B,0x0078,0x0307},
+    {0x1E8C,0x0058,0x0308}, {0x1E8D,0x0078,0x0308}, {0x1E8E,0x0059,0x0307},
+    {0x1E8F,0x0079,0x0307}, {0x1E90,0x005A,0x0302}, {0x1E91,0x007A,0x0302},
+    {0x1E92,0x005A,0x0323}, {0x1E93,0x007A,0x0323}, {0x1E94,0x005A,0x0331},
+    {0x1E95,0x007A,0x0331}, {0x1E96,0x0068,0x0331}, {0x1E97,0x0074,0x0308},
+    {0x1E98,0x0077,0x030A}, {0x1E99,0x0079,0x030A}, {0x1E9B,0x017F,0x0307},
+    {0x1EA0,0x0041,0x0323}, {0x1EA1,0x0061,0x0323}, {0x1EA2,0x0041,0x0309},
+    {0x1EA3,0x0061,0x0309}, {0x1EA4,0x00C2,0x0301}, {0x1EA5,0x00E2,0x0301},
+    {0x1EA6,0x00C2,0x0300}, {0x1EA7,0x00E2,0x0300}, {0x1EA8,0x00C2,0x0309},
+    {0x1EA9,0x00E2,0x0309}, {0x1EAA,0x00C2,0x0303}, {0x1EAB,0x00E2,0x0303},
+    {0x1EAC,0x1EA0,0x0302}, {0x1EAD,0x1EA1,0x0302}, {0x1EAE,0x0102,0x0301},
+    {0x1EAF,0x0103,0x0301}, {0x1EB0,0x0102,0x0300}, {0x1EB1,0x0103,0x0300},
+    {0x1EB2,0x0102,0x0309}, {0x1EB3,0x0103,0x0309}, {0x1EB4,0x0102,0x0303},
+    {0x1EB5,0x0103,0x0303}, {0x1EB6,0x1EA0,0x0306}, {0x1EB7,0x1EA1,0x0306},
+    {0x1EB8,0x0045,0x0323}, {0x1EB9,0x0065,0x0323}, {0x1EBA,0x0045,0x0309},
+    {0x1EBB,0x0065,0x0309}, {0x1EBC,0x0045,0x0303}, {0x1EBD,0x0065,0x0303},
+    {0x1EBE,0x00CA,0x0301}, {0x1EBF,0x00EA,0x0301}, {0x1EC0,0x00CA,0x0300},
+    {0x1EC1,0x00EA,0x0300}, {0x1EC2,0x00CA,0x0309}, {0x1EC3,0x00EA,0x0309},
+    {0x1EC4,0x00CA,0x0303}, {0x1EC5,0x00EA,0x0303}, {0x1EC6,0x1EB8,0x0302},
+    {0x1EC7,0x1EB9,0x0302}, {0x1EC8,0x0049,0x0309}, {0x1EC9,0x0069,0x0309},
+    {0x1ECA,0x0049,0x0323}, {0x1ECB,0x0069,0x0323}, {0x1ECC,0x004F,0x0323},
+    {0x1ECD,0x006F,0x0323}, {0x1ECE,0x004F,0x0309}, {0x1ECF,0x006F,0x0309},
+    {0x1ED0,0x00D4,0x0301}, {0x1ED1,0x00F4,0x0301}, {0x1ED2,0x00D4,0x0300},
+    {0x1ED3,0x00F4,0x0300}, {0x1ED4,0x00D4,0x0309}, {0x1ED5,0x00F4,0x0309},
+    {0x1ED6,0x00D4,0x0303}, {0x1ED7,0x00F4,0x0303}, {0x1ED8,0x1ECC,0x0302},
+    {0x1ED9,0x1ECD,0x0302}, {0x1EDA,0x01A0,0x0301}, {0x1EDB,0x01A1,0x0301},
+    {0x1EDC,0x01A0,0x0300}, {0x1EDD,0x01A1,0x0300}, {0x1EDE,0x01A0,0x0309},
+    {0x1EDF,0x01A1,0x0309}, {0x1EE0,0x01A0,0x0303}, {0x1EE1,0x01A1,0x0303},
+    {0x1EE2,0x01A0,0x0323}, {0x1EE3,0x01A1,0x0323}, {0x1EE4,0x0055,0x0323},
+    {0x1EE5,0x0075,0x0323}, {0x1EE6,0x0055,0x0309}, {0x1EE7,0x0075,0x0309},
+    {0x1EE8,0x01AF,0x0301}, {0x1EE9,0x01B0,0x0301}, {0x1EEA,0x01AF,0x0300},
+    {0x1EEB,0x01B0,0x0300}, {0x1EEC,0x01AF,0x0309}, {0x1EED,0x01B0,0x0309},
+    {0x1EEE,0x01AF,0x0303}, {0x1EEF,0x01B0,0x0303}, {0x1EF0,0x01AF,0x0323},
+    {0x1EF1,0x01B0,0x0323}, {0x1EF2,0x0059,0x0300}, {0x1EF3,0x0079,0x0300},
+    {0x1EF4,0x0059,0x0323}, {0x1EF5,0x0079,0x0323}, {0x1EF6,0x0059,0x0309},
+    {0x1EF7,0x0079,0x0309}, {0x1EF8,0x0059,0x0303}, {0x1EF9,0x0079,0x0303},
+    {0x1F00,0x03B1,0x0313}, {0x1F01,0x03B1,0x0314}, {0x1F02,0x1F00,0x0300},
+    {0x1F03,0x1F01,0x0300}, {0x1F04,0x1F00,0x0301}, {0x1F05,0x1F01,0x0301},
+    {0x1F06,0x1F00,0x0342}, {0x1F07,0x1F01,0x0342}, {0x1F08,0x0391,0x0313},
+    {0x1F09,0x0391,0x0314}, {0x1F0A,0x1F08,0x0300}, {0x1F0B,0x1F09,0x0300},
+    {0x1F0C,0x1F08,0x0301}, {0x1F0D,0x1F09,0x0301}, {0x1F0E,0x1F08,0x0342},
+    {0x1F0F,0x1F09,0x0342}, {0x1F10,0x03B5,0x0313}, {0x1F11,0x03B5,0x0314},
+    {0x1F12,0x1F10,0x0300}, {0x1F13,0x1F11,0x0300}, {0x1F14,0x1F10,0x0301},
+    {0x1F15,0x1F11,0x0301}, {0x1F18,0x0395,0x0313}, {0x1F19,0x0395,0x0314},
+    {0x1F1A,0x1F18,0x0300}, {0x1F1B,0x1F19,0x0300}, {0x1F1C,0x1F18,0x0301},
+    {0x1F1D,0x1F19,0x0301}, {0x1F20,0x03B7,0x0313}, {0x1F21,0x03B7,0x0314},
+    {0x1F22,0x1F20,0x0300}, {0x1F23,0x1F21,0x0300}, {0x1F24,0x1F20,0x0301},
+    {0x1F25,0x1F21,0x0301}, {0x1F26,0x1F20,0x0342}, {0x1F27,0x1F21,0x0342},
+    {0x1F28,0x0397,0x0313}, {0x1F29,0x0397,0x0314}, {0x1F2A,0x1F28,0x0300},
+    {0x1F2B,0x1F29,0x0300}, {0x1F2C,0x1F28,0x0301}, {0x1F2D,0x1F29,0x0301},
+    {0x1F2E,0x1F28,0x0342}, {0x1F2F,0x1F29,0x0342}, {0x1F30,0x03B9,0x0313},
+    {0x1F31,0x03B9,0x0314}, {0x1F32,0x1F30,0x0300}, {0x1F33,0x1F31,0x0300},
+    {0x1F34,0x1F30,0x0301}, {0x1F35,0x1F31,0x0301}, {0x1F36,0x1F30,0x0342},
+    {0x1F37,0x1F31,0x0342}, {0x1F38,0x0399,0x0313}, {0x1F39,0x0399,0x0314},
+    {0x1F3A,0x1F38,0x0300}, {0x1F3B,0x1F39,0x0300}, {0x1F3C,0x1F38,0x0301},
+    {0x1F3D,0x1F39,0x0301}, {0x1F3E,0x1F38,0x0342}, {0x1F3F,0x1F39,0x0342},
+    {0x1F40,0x03BF,0x0313}, {0x1F41,0x03BF,0x0314}, {0x1F42,0x1F40,0x0300},
+    {0x1F43,0x1F41,0x0300}, {0x1F44,0x1F40,0x0301}, {0x1F45,0x1F41,0x0301},
+    {0x1F48,0x039F,0x0313}, {0x1F49,0x039F,0x0314}, {0x1F4A,0x1F48,0x0300},
+    {0x1F4B,0x1F49,0x0300}, {0x1F4C,0x1F48,0x0301}, {0x1F4D,0x1F49,0x0301},
+    {0x1F50,0x03C5,0x0313}, {0x1F51,0x03C5,0x0314}, {0x1F52,0x1F50,0x0300},
+    {0x1F53,0x1F51,0x0300}, {0x1F54,0x1F50,0x0301}, {0x1F55,0x1F51,0x0301},
+    {0x1F56,0x1F50,0x0342}, {0x1F57,0x1F51,0x0342}, {0x1F59,0x03A5,0x0314},
+    {0x1F5B,0x1F59,0x0300}, {0x1F5D,0x1F59,0x0301}, {0x1F5F,0x1F59,0x0342},
+    {0x1F60,0x03C9,0x0313}, {0x1F61,0x03C9,0x0314}, {0x1F62,0x1F60,0x0300},
+    {0x1F63,0x1F61,0x0300}, {0x1F64,0x1F60,0x0301}, {0x1F65,0x1F61,0x0301},
+    {0x1F66,0x1F60,0x0342}, {0x1F67,0x1F61,0x0342}, {0x1F68,0x03A9,0x0313},
+    {0x1F69,0x03A9,0x0314}, {0x1F6A,0x1F68,0x0300}, {0x1F6B,0x1F69,0x0300},
+    {0x1F6C,0x1F68,0x0301}, {0x1F6D,0x1F69,0x0301}, {0x1F6E,0x1F68,0x0342},
+    {0x1F6F,0x1F69,0x0342}, {0x1F70,0x03B1,0x0300}, {0x1F72,0x03B5,0x0300},
+    {0x1F74,0x03B7,0x0300}, {0x1F76,0x03B9,0x0300}, {0x1F78,0x03BF,0x0300},
+    {0x1F7A,0x03C5,0x0300}, {0x1F7C,0x03C9,0x0300}, {0x1F80,0x1F00,0x0345},
+    {0x1F81,0x1F01,0x0345}, {0x1F82,0x1F02,0x0345}, {0x1F83,0x1F03,0x0345},
+    {0x1F84,0x1F04,0x0345}, {0x1F85,0x1F05,0x0345}, {0x1F86,0x1F06,0x0345},
+    {0x1F87,0x1F07,0x0345}, {0x1F88,0x1F08,0x0345}, {0x1F89,0x1F09,0x0345},
+    {0x1F8A,0x1F0A,0x0345}, {0x1F8B,0x1F0B,0x0345}, {0x1F8C,0x1F0C,0x0345},
+    {0x1F8D,0x1F0D,0x0345}, {0x1F8E,0x1F0E,0x0345}, {0x1F8F,0x1F0F,0x0345},
+    {0x1F90,0x1F20,0x0345}, {0x1F91,0x1F21,0x0345}, {0x1F92,0x1F22,0x0345},
+    {0x1F93,0x1F23,0x0345}, {0x1F94,0x1F24,0x0345}, {0x1F95,0x1F25,0x0345},
+    {0x1F96,0x1F26,0x0345}, {0x1F97,0x1F27,0x0345}, {0x1F98,0x1F28,0x0345},
+    {0x1F99,0x1F29,0x0345}, {0x1F9A,0x1F2A,0x0345}, {0x1F9B,0x1F2B,0x0345},
+    {0x1F9C,0x1F2C,0x0345}, {0x1F9D,0x1F2D,0x0345}, {0x1F9E,0x1F2E,0x0345},
+    {0x1F9F,0x1F2F,0x0345}, {0x1FA0,0x1F60,0x0345}, {0x1FA1,0x1F61,0x0345},
+    {0x1FA2,0x1F62,0x0345}, {0x1FA3,0x1F63,0x0345}, {0x1FA4,0x1F64,0x0345},
+    {0x1FA5,0x1F65,0x0345}, {0x1FA6,0x1F66,0x0345}, {0x1FA7,0x1F67,0x0345},
+    {0x1FA8,0x1F68,0x0345}, {0x1FA9,0x1F69,0x0345}, {0x1FAA,0x1F6A,0x0345},
+    {0x1FAB,0x1F6B,0x0345}, {0x1FAC,0x1F6C,0x0345}, {0x1FAD,0x1F6D,0x0345},
+    {0x1FAE,0x1F6E,0x0345}, {0x1FAF,0x1F6F,0x0345}, {0x1FB0,0x03B1,0x0306},
+    {0x1FB1,0x03B1,0x0304}, {0x1FB2,0x1F70,0x0345}, {0x1FB3,0x03B1,0x0345},
+    {0x1FB4,0x03AC,0x0345}, {0x1FB6,0x03B1,0x0342}, {0x1FB7,0x1FB6,0x0345},
+    {0x1FB8,0x0391,0x0306}, {0x1FB9,0x0391,0x0304}, {0x1FBA,0x0391,0x0300},
+    {0x1FBC,0x0391,0x0345}, {0x1FC1,0x00A8,0x0342}, {0x1FC2,0x1F74,0x0345},
+    {0x1FC3,0x03B7,0x0345}, {0x1FC4,0x03AE,0x0345}, {0x1FC6,0x03B7,0x0342},
+    {0x1FC7,0x1FC6,0x0345}, {0x1FC8,0x0395,0x0300}, {0x1FCA,0x0397,0x0300},
+    {0x1FCC,0x0397,0x0345}, {0x1FCD,0x1FBF,0x0300}, {0x1FCE,0x1FBF,0x0301},
+    {0x1FCF,0x1FBF,0x0342}, {0x1FD0,0x03B9,0x0306}, {0x1FD1,0x03B9,0x0304},
+    {0x1FD2,0x03CA,0x0300}, {0x1FD6,0x03B9,0x0342}, {0x1FD7,0x03CA,0x0342},
+    {0x1FD8,0x0399,0x0306}, {0x1FD9,0x0399,0x0304}, {0x1FDA,0x0399,0x0300},
+    {0x1FDD,0x1FFE,0x0300}, {0x1FDE,0x1FFE,0x0301}, {0x1FDF,0x1FFE,0x0342},
+    {0x1FE0,0x03C5,0x0306}, {0x1FE1,0x03C5,0x0304}, {0x1FE2,0x03CB,0x0300},
+    {0x1FE4,0x03C1,0x0313}, {0x1FE5,0x03C1,0x0314}, {0x1FE6,0x03C5,0x0342},
+    {0x1FE7,0x03CB,0x0342}, {0x1FE8,0x03A5,0x0306}, {0x1FE9,0x03A5,0x0304},
+    {0x1FEA,0x03A5,0x0300}, {0x1FEC,0x03A1,0x0314}, {0x1FED,0x00A8,0x0300},
+    {0x1FF2,0x1F7C,0x0345}, {0x1FF3,0x03C9,0x0345}, {0x1FF4,0x03CE,0x0345},
+    {0x1FF6,0x03C9,0x0342}, {0x1FF7,0x1FF6,0x0345}, {0x1FF8,0x039F,0x0300},
+    {0x1FFA,0x03A9,0x0300}, {0x1FFC,0x03A9,0x0345}, {0x219A,0x2190,0x0338},
+    {0x219B,0x2192,0x0338}, {0x21AE,0x2194,0x0338}, {0x21CD,0x21D0,0x0338},
+    {0x21CE,0x21D4,0x0338}, {0x21CF,0x21D2,0x0338}, {0x2204,0x2203,0x0338},
+    {0x2209,0x2208,0x0338}, {0x220C,0x220B,0x0338}, {0x2224,0x2223,0x0338},
+    {0x2226,0x2225,0x0338}, {0x2241,0x223C,0x0338}, {0x2244,0x2243,0x0338},
+    {0x2247,0x2245,0x0338}, {0x2249,0x2248,0x0338}, {0x2260,0x003D,0x0338},
+    {0x2262,0x2261,0x0338}, {0x226D,0x224D,0x0338}, {0x226E,0x003C,0x0338},
+    {0x226F,0x003E,0x0338}, {0x2270,0x2264,0x0338}, {0x2271,0x2265,0x0338},
+    {0x2274,0x2272,0x0338}, {0x2275,0x2273,0x0338}, {0x2278,0x2276,0x0338},
+    {0x2279,0x2277,0x0338}, {0x2280,0x227A,0x0338}, {0x2281,0x227B,0x0338},
+    {0x2284,0x2282,0x0338}, {0x2285,0x2283,0x0338}, {0x2288,0x2286,0x0338},
+    {0x2289,0x2287,0x0338}, {0x22AC,0x22A2,0x0338}, {0x22AD,0x22A8,0x0338},
+    {0x22AE,0x22A9,0x0338}, {0x22AF,0x22AB,0x0338}, {0x22E0,0x227C,0x0338},
+    {0x22E1,0x227D,0x0338}, {0x22E2,0x2291,0x0338}, {0x22E3,0x2292,0x0338},
+    {0x22EA,0x22B2,0x0338}, {0x22EB,0x22B3,0x0338}, {0x22EC,0x22B4,0x0338},
+    {0x22ED,0x22B5,0x0338}, {0x2ADC,0x2ADD,0x0338}, {0x304C,0x304B,0x3099},
+    {0x304E,0x304D,0x3099}, {0x3050,0x304F,0x3099}, {0x3052,0x3051,0x3099},
+    {0x3054,0x3053,0x3099}, {0x3056,0x3055,0x3099}, {0x3058,0x3057,0x3099},
+    {0x305A,0x3059,0x3099}, {0x305C,0x305B,0x3099}, {0x305E,0x305D,0x3099},
+    {0x3060,0x305F,0x3099}, {0x3062,0x3061,0x3099}, {0x3065,0x3064,0x3099},
+    {0x3067,0x3066,0x3099}, {0x3069,0x3068,0x3099}, {0x3070,0x306F,0x3099},
+    {0x3071,0x306F,0x309A}, {0x3073,0x3072,0x3099}, {0x3074,0x3072,0x309A},
+    {0x3076,0x3075,0x3099}, {0x3077,0x3075,0x309A}, {0x3079,0x3078,0x3099},
+    {0x307A,0x3078,0x309A}, {0x307C,0x307B,0x3099}, {0x307D,0x307B,0x309A},
+    {0x3094,0x3046,0x3099}, {0x309E,0x309D,0x3099}, {0x30AC,0x30AB,0x3099},
+    {0x30AE,0x30AD,0x3099}, {0x30B0,0x30AF,0x3099}, {0x30B2,0x30B1,0x3099},
+    {0x30B4,0x30B3,0x3099}, {0x30B6,0x30B5,0x3099}, {0x30B8,0x30B7,0x3099},
+    {0x30BA,0x30B9,0x3099}, {0x30BC,0x30BB,0x3099}, {0x30BE,0x30BD,0x3099},
+    {0x30C0,0x30BF,0x3099}, {0x30C2,0x30C1,0x3099}, {0x30C5,0x30C4,0x3099},
+    {0x30C7,0x30C6,0x3099}, {0x30C9,0x30C8,0x3099}, {0x30D0,0x30CF,0x3099},
+    {0x30D1,0x30CF,0x309A}, {0x30D3,0x30D2,0x3099}, {0x30D4,0x30D2,0x309A},
+    {0x30D6,0x30D5,0x3099}, {0x30D7,0x30D5,0x309A}, {0x30D9,0x30D8,0x3099},
+    {0x30DA,0x30D8,0x309A}, {0x30DC,0x30DB,0x3099}, {0x30DD,0x30DB,0x309A},
+    {0x30F4,0x30A6,0x3099}, {0x30F7,0x30EF,0x3099}, {0x30F8,0x30F0,0x3099},
+    {0x30F9,0x30F1,0x3099}, {0x30FA,0x30F2,0x3099}, {0x30FE,0x30FD,0x3099},
+    {0xFB1D,0x05D9,0x05B4}, {0xFB1F,0x05F2,0x05B7}, {0xFB2A,0x05E9,0x05C1},
+    {0xFB2B,0x05E9,0x05C2}, {0xFB2C,0xFB49,0x05C1}, {0xFB2D,0xFB49,0x05C2},
+    {0xFB2E,0x05D0,0x05B7}, {0xFB2F,0x05D0,0x05B8}, {0xFB30,0x05D0,0x05BC},
+    {0xFB31,0x05D1,0x05BC}, {0xFB32,0x05D2,0x05BC}, {0xFB33,0x05D3,0x05BC},
+    {0xFB34,0x05D4,0x05BC}, {0xFB35,0x05D5,0x05BC}, {0xFB36,0x05D6,0x05BC},
+    {0xFB38,0x05D8,0x05BC}, {0xFB39,0x05D9,0x05BC}, {0xFB3A,0x05DA,0x05BC},
+    {0xFB3B,0x05DB,0x05BC}, {0xFB3C,0x05DC,0x05BC}, {0xFB3E,0x05DE,0x05BC},
+    {0xFB40,0x05E0,0x05BC}, {0xFB41,0x05E1,0x05BC}, {0xFB43,0x05E3,0x05BC},
+    {0xFB44,0x05E4,0x05BC}, {0xFB46,0x05E6,0x05BC}, {0xFB47,0x05E7,0x05BC},
+    {0xFB48,0x05E8,0x05BC}, {0xFB49,0x05E9,0x05BC}, {0xFB4A,0x05EA,0x05BC},
+    {0xFB4B,0x05D5,0x05B9}, {0xFB4C,0x05D1,0x05BF}, {0xFB4D,0x05DB,0x05BF},
+    {0xFB4E,0x05E4,0x05BF}, {0x1109A,0x11099,0x110BA},
+    {0x1109C,0x1109B,0x110BA}, {0x110AB,0x110A5,0x110BA},
+    {0x1112E,0x11131,0x11127}, {0x1112F,0x11132,0x11127},
+    {0x1134B,0x11347,0x1133E}, {0x1134C,0x11347,0x11357},
+    {0x114BB,0x114B9,0x114BA}, {0x114BC,0x114B9,0x114B0},
+    {0x114BE,0x114B9,0x114BD}, {0x115BA,0x115B8,0x115AF},
+    {0x115BB,0x115B9,0x115AF}, {0x11938,0x11935,0x11930},
+    {0x1D15E,0x1D157,0x1D165}, {0x1D15F,0x1D158,0x1D165},
+    {0x1D160,0x1D15F,0x1D16E}, {0x1D161,0x1D15F,0x1D16F},
+    {0x1D162,0x1D15F,0x1D170}, {0x1D163,0x1D15F,0x1D171},
+    {0x1D164,0x1D15F,0x1D172}, {0x1D1BB,0x1D1B9,0x1D165},
+    {0x1D1BC,0x1D1BA,0x1D165}, {0x1D1BD,0x1D1BB,0x1D16E},
+    {0x1D1BE,0x1D1BC,0x1D16E}, {0x1D1BF,0x1D1BB,0x1D16F},
+    {0x1D1C0,0x1D1BC,0x1D16F}
+};
+
+/* Pairs not composed back: composition exclusions and decompositions
+ * starting with a combining mark. */
+static const unsigned int nfcExcluded[] = {
+    0x0344, 0x0958, 0x0959, 0x095A, 0x095B, 0x095C, 0x095D, 0x095E, 0x095F,
+    0x09DC, 0x09DD, 0x09DF, 0x0A33, 0x0A36, 0x0A59, 0x0A5A, 0x0A5B, 0x0A5E,
+    0x0B5C, 0x0B5D, 0x0F43, 0x0F4D, 0x0F52, 0x0F57, 0x0F5C, 0x0F69, 0x0F73,
+    0x0F75, 0x0F76, 0x0F78, 0x0F81, 0x0F93, 0x0F9D, 0x0FA2, 0x0FA7, 0x0FAC,
+    0x0FB9, 0x2ADC, 0xFB1D, 0xFB1F, 0xFB2A, 0xFB2B, 0xFB2C, 0xFB2D, 0xFB2E,
+    0xFB2F, 0xFB30, 0xFB31, 0xFB32, 0xFB33, 0xFB34, 0xFB35, 0xFB36, 0xFB38,
+    0xFB39, 0xFB3A, 0xFB3B, 0xFB3C, 0xFB3E, 0xFB40, 0xFB41, 0xFB43, 0xFB44,
+    0xFB46, 0xFB47, 0xFB48, 0xFB49, 0xFB4A, 0xFB4B, 0xFB4C, 0xFB4D, 0xFB4E,
+    0x1D15E, 0x1D15F, 0x1D160, 0x1D161, 0x1D162, 0x1D163, 0x1D164, 0x1D1BB,
+    0x1D1BC, 0x1D1BD, 0x1D1BE, 0x1D1BF, 0x1D1C0
+};
+
+/* Canonical decompositions to a single code point, never composed back. */
+static const struct nfcSingleton {
+    unsigned int cp, to;
+} nfcSingletons[] = {
+    {0x0340,0x0300}, {0x0341,0x0301}, {0x0343,0x0313}, {0x0374,0x02B9},
+    {0x037E,0x003B}, {0x0387,0x00B7}, {0x1F71,0x03AC}, {0x1F73,0x03AD},
+    {0x1F75,0x03AE}, {0x1F77,0x03AF}, {0x1F79,0x03CC}, {0x1F7B,0x03CD},
+    {0x1F7D,0x03CE}, {0x1FBB,0x0386}, {0x1FBE,0x03B9}, {0x1FC9,0x0388},
+    {0x1FCB,0x0389}, {0x1FD3,0x0390}, {0x1FDB,0x038A}, {0x1FE3,0x03B0},
+    {0x1FEB,0x038E}, {0x1FEE,0x0385}, {0x1FEF,0x0060}, {0x1FF9,0x038C},
+    {0x1FFB,0x038F}, {0x1FFD,0x00B4}, {0x2000,0x2002}, {0x2001,0x2003},
+    {0x2126,0x03A9}, {0x212A,0x004B}, {0x212B,0x00C5}, {0x2329,0x3008},
+    {0x232A,0x3009}, {0xF900,0x8C48}, {0xF901,0x66F4}, {0xF902,0x8ECA},
+    {0xF903,0x8CC8}, {0xF904,0x6ED1}, {0xF905,0x4E32}, {0xF906,0x53E5},
+    {0xF907,0x9F9C}, {0xF908,0x9F9C}, {0xF909,0x5951}, {0xF90A,0x91D1},
+    {0xF90B,0x5587}, {0xF90C,0x5948}, {0xF90D,0x61F6}, {0xF90E,0x7669},
+    {0xF90F,0x7F85}, {0xF910,0x863F}, {0xF911,0x87BA}, {0xF912,0x88F8},
+    {0xF913,0x908F}, {0xF914,0x6A02}, {0xF915,0x6D1B}, {0xF916,0x70D9},
+    {0xF917,0x73DE}, {0xF918,0x843D}, {0xF919,0x916A}, {0xF91A,0x99F1},
+    {0xF91B,0x4E82}, {0xF91C,0x5375}, {0xF91D,0x6B04}, {0xF91E,0x721B},
+    {0xF91F,0x862D}, {0xF920,0x9E1E}, {0xF921,0x5D50}, {0xF922,0x6FEB},
+    {0xF923,0x85CD}, {0xF924,0x8964}, {0xF925,0x62C9}, {0xF926,0x81D8},
+    {0xF927,0x881F}, {0xF928,0x5ECA}, {0xF929,0x6717}, {0xF92A,0x6D6A},
+    {0xF92B,0x72FC}, {0xF92C,0x90CE}, {0xF92D,0x4F86}, {0xF92E,0x51B7},
+    {0xF92F,0x52DE}, {0xF930,0x64C4}, {0xF931,0x6AD3}, {0xF932,0x7210},
+    {0xF933,0x76E7}, {0xF934,0x8001}, {0xF935,0x8606}, {0xF936,0x865C},
+    {0xF937,0x8DEF}, {0xF938,0x9732}, {0xF939,0x9B6F}, {0xF93A,0x9DFA},
+    {0xF93B,0x788C}, {0xF93C,0x797F}, {0xF93D,0x7DA0}, {0xF93E,0x83C9},
+    {0xF93F,0x9304}, {0xF940,0x9E7F}, {0xF941,0x8AD6}, {0xF942,0x58DF},
+    {0xF943,0x5F04}, {0xF944,0x7C60}, {0xF945,0x807E}, {0xF946,0x7262},
+    {0xF947,0x78CA}, {0xF948,0x8CC2}, {0xF949,0x96F7}, {0xF94A,0x58D8},
+    {0xF94B,0x5C62}, {0xF94C,0x6A13}, {0xF94D,0x6DDA}, {0xF94E,0x6F0F},
+    {0xF94F,0x7D2F}, {0xF950,0x7E37}, {0xF951,0x964B}, {0xF952,0x52D2},
+    {0xF953,0x808B}, {0xF954,0x51DC}, {0xF955,0x51CC}, {0xF956,0x7A1C},
+    {0xF957,0x7DBE}, {0xF958,0x83F1}, {0xF959,0x9675}, {0xF95A,0x8B80},
+    {0xF95B,0x62CF}, {0xF95C,0x6A02}, {0xF95D,0x8AFE}, {0xF95E,0x4E39},
+    {0xF95F,0x5BE7}, {0xF960,0x6012}, {0xF961,0x7387}, {0xF962,0x7570},
+    {0xF963,0x5317}, {0xF964,0x78FB}, {0xF965,0x4FBF}, {0xF966,0x5FA9},
+    {0xF967,0x4E0D}, {0xF968,0x6CCC}, {0xF969,0x6578}, {0xF96A,0x7D22},
+    {0xF96B,0x53C3}, {0xF96C,0x585E}, {0xF96D,0x7701}, {0xF96E,0x8449},
+    {0xF96F,0x8AAA}, {0xF970,0x6BBA}, {0xF971,0x8FB0}, {0xF972,0x6C88},
+    {0xF973,0x62FE}, {0xF974,0x82E5}, {0xF975,0x63A0}, {0xF976,0x7565},
+    {0xF977,0x4EAE}, {0xF978,0x5169}, {0xF979,0x51C9}, {0xF97A,0x6881},
+    {0xF97B,0x7CE7}, {0xF97C,0x826F}, {0xF97D,0x8AD2}, {0xF97E,0x91CF},
+    {0xF97F,0x52F5}, {0xF980,0x5442}, {0xF981,0x5973}, {0xF982,0x5EEC},
+    {0xF983,0x65C5}, {0xF984,0x6FFE}, {0xF985,0x792A}, {0xF986,0x95AD},
+    {0xF987,0x9A6A}, {0xF988,0x9E97}, {0xF989,0x9ECE}, {0xF98A,0x529B},
+    {0xF98B,0x66C6}, {0xF98C,0x6B77}, {0xF98D,0x8F62}, {0xF98E,0x5E74},
+    {0xF98F,0x6190}, {0xF990,0x6200}, {0xF991,0x649A}, {0xF992,0x6F23},
+    {0xF993,0x7149}, {0xF994,0x7489}, {0xF995,0x79CA}, {0xF996,0x7DF4},
+    {0xF997,0x806F}, {0xF998,0x8F26}, {0xF999,0x84EE}, {0xF99A,0x9023},
+    {0xF99B,0x934A}, {0xF99C,0x5217}, {0xF99D,0x52A3}, {0xF99E,0x54BD},
+    {0xF99F,0x70C8}, {0xF9A0,0x88C2}, {0xF9A1,0x8AAA}, {0xF9A2,0x5EC9},
+    {0xF9A3,0x5FF5}, {0xF9A4,0x637B}, {0xF9A5,0x6BAE}, {0xF9A6,0x7C3E},
+    {0xF9A7,0x7375}, {0xF9A8,0x4EE4}, {0xF9A9,0x56F9}, {0xF9AA,0x5BE7},
+    {0xF9AB,0x5DBA}, {0xF9AC,0x601C}, {0xF9AD,0x73B2}, {0xF9AE,0x7469},
+    {0xF9AF,0x7F9A}, {0xF9B0,0x8046}, {0xF9B1,0x9234}, {0xF9B2,0x96F6},
+    {0xF9B3,0x9748}, {0xF9B4,0x9818}, {0xF9B5,0x4F8B}, {0xF9B6,0x79AE},
+    {0xF9B7,0x91B4}, {0xF9B8,0x96B8}, {0xF9B9,0x60E1}, {0xF9BA,0x4E86},
+    {0xF9BB,0x50DA}, {0xF9BC,0x5BEE}, {0xF9BD,0x5C3F}, {0xF9BE,0x6599},
+    {0xF9BF,0x6A02}, {0xF9C0,0x71CE}, {0xF9C1,0x7642}, {0xF9C2,0x84FC},
+    {0xF9C3,0x907C}, {0xF9C4,0x9F8D}, {0xF9C5,0x6688}, {0xF9C6,0x962E},
+    {0xF9C7,0x5289}, {0xF9C8,0x677B}, {0xF9C9,0x67F3}, {0xF9CA,0x6D41},
+    {0xF9CB,0x6E9C}, {0xF9CC,0x7409}, {0xF9CD,0x7559}, {0xF9CE,0x786B},
+    {0xF9CF,0x7D10}, {0xF9D0,0x985E}, {0xF9D1,0x516D}, {0xF9D2,0x622E},
+    {0xF9D3,0x9678}, {0xF9D4,0x502B}, {0xF9D5,0x5D19}, {0xF9D6,0x6DEA},
+    {0xF9D7,0x8F2A}, {0xF9D8,0x5F8B}, {0xF9D9,0x6144}, {0xF9DA,0x6817},
+    {0xF9DB,0x7387}, {0xF9DC,0x9686}, {0xF9DD,0x5229}, {0xF9DE,0x540F},
+    {0xF9DF,0x5C65}, {0xF9E0,0x6613}, {0xF9E1,0x674E}, {0xF9E2,0x68A8},
+    {0xF9E3,0x6CE5}, {0xF9E4,0x7406}, {0xF9E5,0x75E2}, {0xF9E6,0x7F79},
+    {0xF9E7,0x88CF}, {0xF9E8,0x88E1}, {0xF9E9,0x91CC}, {0xF9EA,0x96E2},
+    {0xF9EB,0x533F}, {0xF9EC,0x6EBA}, {0xF9ED,0x541D}, {0xF9EE,0x71D0},
+    {0xF9EF,0x7498}, {0xF9F0,0x85FA}, {0xF9F1,0x96A3}, {0xF9F2,0x9C57},
+    {0xF9F3,0x9E9F}, {0xF9F4,0x6797}, {0xF9F5,0x6DCB}, {0xF9F6,0x81E8},
+    {0xF9F7,0x7ACB}, {0xF9F8,0x7B20}, {0xF9F9,0x7C92}, {0xF9FA,0x72C0},
+    {0xF9FB,0x7099}, {0xF9FC,0x8B58}, {0xF9FD,0x4EC0}, {0xF9FE,0x8336},
+    {0xF9FF,0x523A}, {0xFA00,0x5207}, {0xFA01,0x5EA6}, {0xFA02,0x62D3},
+    {0xFA03,0x7CD6}, {0xFA04,0x5B85}, {0xFA05,0x6D1E}, {0xFA06,0x66B4},
+    {0xFA07,0x8F3B}, {0xFA08,0x884C}, {0xFA09,0x964D}, {0xFA0A,0x898B},
+    {0xFA0B,0x5ED3}, {0xFA0C,0x5140}, {0xFA0D,0x55C0}, {0xFA10,0x585A},
+    {0xFA12,0x6674}, {0xFA15,0x51DE}, {0xFA16,0x732A}, {0xFA17,0x76CA},
+    {0xFA18,0x793C}, {0xFA19,0x795E}, {0xFA1A,0x7965}, {0xFA1B,0x798F},
+    {0xFA1C,0x9756}, {0xFA1D,0x7CBE}, {0xFA1E,0x7FBD}, {0xFA20,0x8612},
+    {0xFA22,0x8AF8}, {0xFA25,0x9038}, {0xFA26,0x90FD}, {0xFA2A,0x98EF},
+    {0xFA2B,0x98FC}, {0xFA2C,0x9928}, {0xFA2D,0x9DB4}, {0xFA2E,0x90DE},
+    {0xFA2F,0x96B7}, {0xFA30,0x4FAE}, {0xFA31,0x50E7}, {0xFA32,0x514D},
+    {0xFA33,0x52C9}, {0xFA34,0x52E4}, {0xFA35,0x5351}, {0xFA36,0x559D},
+    {0xFA37,0x5606}, {0xFA38,0x5668}, {0xFA39,0x5840}, {0xFA3A,0x58A8},
+    {0xFA3B,0x5C64}, {0xFA3C,0x5C6E}, {0xFA3D,0x6094}, {0xFA3E,0x6168},
+    {0xFA3F,0x618E}, {0xFA40,0x61F2}, {0xFA41,0x654F}, {0xFA42,0x65E2},
+    {0xFA43,0x6691}, {0xFA44,0x6885}, {0xFA45,0x6D77}, {0xFA46,0x6E1A},
+    {0xFA47,0x6F22}, {0xFA48,0x716E}, {0xFA49,0x722B}, {0xFA4A,0x7422},
+    {0xFA4B,0x7891}, {0xFA4C,0x793E}, {0xFA4D,0x7949}, {0xFA4E,0x7948},
+    {0xFA4F,0x7950}, {0xFA50,0x7956}, {0xFA51,0x795D}, {0xFA52,0x798D},
+    {0xFA53,0x798E}, {0xFA54,0x7A40}, {0xFA55,0x7A81}, {0xFA56,0x7BC0},
+    {0xFA57,0x7DF4}, {0xFA58,0x7E09}, {0xFA59,0x7E41}, {0xFA5A,0x7F72},
+    {0xFA5B,0x8005}, {0xFA5C,0x81ED}, {0xFA5D,0x8279}, {0xFA5E,0x8279},
+    {0xFA5F,0x8457}, {0xFA60,0x8910}, {0xFA61,0x8996}, {0xFA62,0x8B01},
+    {0xFA63,0x8B39}, {0xFA64,0x8CD3}, {0xFA65,0x8D08}, {0xFA66,0x8FB6},
+    {0xFA67,0x9038}, {0xFA68,0x96E3}, {0xFA69,0x97FF}, {0xFA6A,0x983B},
+    {0xFA6B,0x6075}, {0xFA6C,0x242EE}, {0xFA6D,0x8218}, {0xFA70,0x4E26},
+    {0xFA71,0x51B5}, {0xFA72,0x5168}, {0xFA73,0x4F80}, {0xFA74,0x5145},
+    {0xFA75,0x5180}, {0xFA76,0x52C7}, {0xFA77,0x52FA}, {0xFA78,0x559D},
+    {0xFA79,0x5555}, {0xFA7A,0x5599}, {0xFA7B,0x55E2}, {0xFA7C,0x585A},
+    {0xFA7D,0x58B3}, {0xFA7E,0x5944}, {0xFA7F,0x5954}, {0xFA80,0x5A62},
+    {0xFA81,0x5B28}, {0xFA82,0x5ED2}, {0xFA83,0x5ED9}, {0xFA84,0x5F69},
+    {0xFA85,0x5FAD}, {0xFA86,0x60D8}, {0xFA87,0x614E}, {0xFA88,0x6108},
+    {0xFA89,0x618E}, {0xFA8A,0x6160}, {0xFA8B,0x61F2}, {0xFA8C,0x6234},
+    {0xFA8D,0x63C4}, {0xFA8E,0x641C}, {0xFA8F,0x6452}, {0xFA90,0x6556},
+    {0xFA91,0x6674}, {0xFA92,0x6717}, {0xFA93,0x671B}, {0xFA94,0x6756},
+    {0xFA95,0x6B79}, {0xFA96,0x6BBA}, {0xFA97,0x6D41}, {0xFA98,0x6EDB},
+    {0xFA99,0x6ECB}, {0xFA9A,0x6F22}, {0xFA9B,0x701E}, {0xFA9C,0x716E},
+    {0xFA9D,0x77A7}, {0xFA9E,0x7235}, {0xFA9F,0x72AF}, {0xFAA0,0x732A},
+    {0xFAA1,0x7471}, {0xFAA2,0x7506}, {0xFAA3,0x753B}, {0xFAA4,0x761D},
+    {0xFAA5,0x761F}, {0xFAA6,0x76CA}, {0xFAA7,0x76DB}, {0xFAA8,0x76F4},
+    {0xFAA9,0x774A}, {0xFAAA,0x7740}, {0xFAAB,0x78CC}, {0xFAAC,0x7AB1},
+    {0xFAAD,0x7BC0}, {0xFAAE,0x7C7B}, {0xFAAF,0x7D5B}, {0xFAB0,0x7DF4},
+    {0xFAB1,0x7F3E}, {0xFAB2,0x8005}, {0xFAB3,0x8352}, {0xFAB4,0x83EF},
+    {0xFAB5,0x8779}, {0xFAB6,0x8941}, {0xFAB7,0x8986}, {0xFAB8,0x8996},
+    {0xFAB9,0x8ABF}, {0xFABA,0x8AF8}, {0xFABB,0x8ACB}, {0xFABC,0x8B01},
+    {0xFABD,0x8AFE}, {0xFABE,0x8AED}, {0xFABF,0x8B39}, {0xFAC0,0x8B8A},
+    {0xFAC1,0x8D08}, {0xFAC2,0x8F38}, {0xFAC3,0x9072}, {0xFAC4,0x9199},
+    {0xFAC5,0x9276}, {0xFAC6,0x967C}, {0xFAC7,0x96E3}, {0xFAC8,0x9756},
+    {0xFAC9,0x97DB}, {0xFACA,0x97FF}, {0xFACB,0x980B}, {0xFACC,0x983B},
+    {0xFACD,0x9B12}, {0xFACE,0x9F9C}, {0xFACF,0x2284A}, {0xFAD0,0x22844},
+    {0xFAD1,0x233D5}, {0xFAD2,0x3B9D}, {0xFAD3,0x4018}, {0xFAD4,0x4039},
+    {0xFAD5,0x25249}, {0xFAD6,0x25CD0}, {0xFAD7,0x27ED3}, {0xFAD8,0x9F43},
+    {0xFAD9,0x9F8E}, {0x2F800,0x4E3D}, {0x2F801,0x4E38}, {0x2F802,0x4E41},
+    {0x2F803,0x20122}, {0x2F804,0x4F60}, {0x2F805,0x4FAE}, {0x2F806,0x4FBB},
+    {0x2F807,0x5002}, {0x2F808,0x507A}, {0x2F809,0x5099}, {0x2F80A,0x50E7},
+    {0x2F80B,0x50CF}, {0x2F80C,0x349E}, {0x2F80D,0x2063A}, {0x2F80E,0x514D},
+    {0x2F80F,0x5154}, {0x2F810,0x5164}, {0x2F811,0x5177}, {0x2F812,0x2051C},
+    {0x2F813,0x34B9}, {0x2F814,0x5167}, {0x2F815,0x518D}, {0x2F816,0x2054B},
+    {0x2F817,0x5197}, {0x2F818,0x51A4}, {0x2F819,0x4ECC}, {0x2F81A,0x51AC},
+    {0x2F81B,0x51B5}, {0x2F81C,0x291DF}, {0x2F81D,0x51F5}, {0x2F81E,0x5203},
+    {0x2F81F,0x34DF}, {0x2F820,0x523B}, {0x2F821,0x5246}, {0x2F822,0x5272},
+    {0x2F823,0x5277}, {0x2F824,0x3515}, {0x2F825,0x52C7}, {0x2F826,0x52C9},
+    {0x2F827,0x52E4}, {0x2F828,0x52FA}, {0x2F829,0x5305}, {0x2F82A,0x5306},
+    {0x2F82B,0x5317}, {0x2F82C,0x5349}, {0x2F82D,0x5351}, {0x2F82E,0x535A},
+    {0x2F82F,0x5373}, {0x2F830,0x537D}, {0x2F831,0x537F}, {0x2F832,0x537F},
+    {0x2F833,0x537F}, {0x2F834,0x20A2C}, {0x2F835,0x7070}, {0x2F836,0x53CA},
+    {0x2F837,0x53DF}, {0x2F838,0x20B63}, {0x2F839,0x53EB}, {0x2F83A,0x53F1},
+    {0x2F83B,0x5406}, {0x2F83C,0x549E}, {0x2F83D,0x5438}, {0x2F83E,0x5448},
+    {0x2F83F,0x5468}, {0x2F840,0x54A2}, {0x2F841,0x54F6}, {0x2F842,0x5510},
+    {0x2F843,0x5553}, {0x2F844,0x5563}, {0x2F845,0x5584}, {0x2F846,0x5584},
+    {0x2F847,0x5599}, {0x2F848,0x55AB}, {0x2F849,0x55B3}, {0x2F84A,0x55C2},
+    {0x2F84B,0x5716}, {0x2F84C,0x5606}, {0x2F84D,0x5717}, {0x2F84E,0x5651},
+    {0x2F84F,0x5674}, {0x2F850,0x5207}, {0x2F851,0x58EE}, {0x2F852,0x57CE},
+    {0x2F853,0x57F4}, {0x2F854,0x580D}, {0x2F855,0x578B}, {0x2F856,0x5832},
+    {0x2F857,0x5831}, {0x2F858,0x58AC}, {0x2F859,0x214E4}, {0x2F85A,0x58F2},
+    {0x2F85B,0x58F7}, {0x2F85C,0x5906}, {0x2F85D,0x591A}, {0x2F85E,0x5922},
+    {0x2F85F,0x5962}, {0x2F860,0x216A8}, {0x2F861,0x216EA}, {0x2F862,0x59EC},
+    {0x2F863,0x5A1B}, {0x2F864,0x5A27}, {0x2F865,0x59D8}, {0x2F866,0x5A66},
+    {0x2F867,0x36EE}, {0x2F868,0x36FC}, {0x2F869,0x5B08}, {0x2F86A,0x5B3E},
+    {0x2F86B,0x5B3E}, {0x2F86C,0x219C8}, {0x2F86D,0x5BC3}, {0x2F86E,0x5BD8},
+    {0x2F86F,0x5BE7}, {0x2F870,0x5BF3}, {0x2F871,0x21B18}, {0x2F872,0x5BFF},
+    {0x2F873,0x5C06}, {0x2F874,0x5F53}, {0x2F875,0x5C22}, {0x2F876,0x3781},
+    {0x2F877,0x5C60}, {0x2F878,0x5C6E}, {0x2F879,0x5CC0}, {0x2F87A,0x5C8D},
+    {0x2F87B,0x21DE4}, {0x2F87C,0x5D43}, {0x2F87D,0x21DE6}, {0x2F87E,0x5D6E},
+    {0x2F87F,0x5D6B}, {0x2F880,0x5D7C}, {0x2F881,0x5DE1}, {0x2F882,0x5DE2},
+    {0x2F883,0x382F}, {0x2F884,0x5DFD}, {0x2F885,0x5E28}, {0x2F886,0x5E3D},
+    {0x2F887,0x5E69}, {0x2F888,0x3862}, {0x2F889,0x22183}, {0x2F88A,0x387C},
+    {0x2F88B,0x5EB0}, {0x2F88C,0x5EB3}, {0x2F88D,0x5EB6}, {0x2F88E,0x5ECA},
+    {0x2F88F,0x2A392}, {0x2F890,0x5EFE}, {0x2F891,0x22331}, {0x2F892,0x22331},
+    {0x2F893,0x8201}, {0x2F894,0x5F22}, {0x2F895,0x5F22}, {0x2F896,0x38C7},
+    {0x2F897,0x232B8}, {0x2F898,0x261DA}, {0x2F899,0x5F62}, {0x2F89A,0x5F6B},
+    {0x2F89B,0x38E3}, {0x2F89C,0x5F9A}, {0x2F89D,0x5FCD}, {0x2F89E,0x5FD7},
+    {0x2F89F,0x5FF9}, {0x2F8A0,0x6081}, {0x2F8A1,0x393A}, {0x2F8A2,0x391C},
+    {0x2F8A3,0x6094}, {0x2F8A4,0x226D4}, {0x2F8A5,0x60C7}, {0x2F8A6,0x6148},
+    {0x2F8A7,0x614C}, {0x2F8A8,0x614E}, {0x2F8A9,0x614C}, {0x2F8AA,0x617A},
+    {0x2F8AB,0x618E}, {0x2F8AC,0x61B2}, {0x2F8AD,0x61A4}, {0x2F8AE,0x61AF},
+    {0x2F8AF,0x61DE}, {0x2F8B0,0x61F2}, {0x2F8B1,0x61F6}, {0x2F8B2,0x6210},
+    {0x2F8B3,0x621B}, {0x2F8B4,0x625D}, {0x2F8B5,0x62B1}, {0x2F8B6,0x62D4},
+    {0x2F8B7,0x6350}, {0x2F8B8,0x22B0C}, {0x2F8B9,0x633D}, {0x2F8BA,0x62FC},
+    {0x2F8BB,0x6368}, {0x2F8BC,0x6383}, {0x2F8BD,0x63E4}, {0x2F8BE,0x22BF1},
+    {0x2F8BF,0x6422}, {0x2F8C0,0x63C5}, {0x2F8C1,0x63A9}, {0x2F8C2,0x3A2E},
+    {0x2F8C3,0x6469}, {0x2F8C4,0x647E}, {0x2F8C5,0x649D}, {0x2F8C6,0x6477},
+    {0x2F8C7,0x3A6C}, {0x2F8C8,0x654F}, {0x2F8C9,0x656C}, {0x2F8CA,0x2300A},
+    {0x2F8CB,0x65E3}, {0x2F8CC,0x66F8}, {0x2F8CD,0x6649}, {0x2F8CE,0x3B19},
+    {0x2F8CF,0x6691}, {0x2F8D0,0x3B08}, {0x2F8D1,0x3AE4}, {0x2F8D2,0x5192},
+    {0x2F8D3,0x5195}, {0x2F8D4,0x6700}, {0x2F8D5,0x669C}, {0x2F8D6,0x80AD},
+    {0x2F8D7,0x43D9}, {0x2F8D8,0x6717}, {0x2F8D9,0x671B}, {0x2F8DA,0x6721},
+    {0x2F8DB,0x675E}, {0x2F8DC,0x6753}, {0x2F8DD,0x233C3}, {0x2F8DE,0x3B49},
+    {0x2F8DF,0x67FA}, {0x2F8E0,0x6785}, {0x2F8E1,0x6852}, {0x2F8E2,0x6885},
+    {0x2F8E3,0x2346D}, {0x2F8E4,0x688E}, {0x2F8E5,0x681F}, {0x2F8E6,0x6914},
+    {0x2F8E7,0x3B9D}, {0x2F8E8,0x6942}, {0x2F8E9,0x69A3}, {0x2F8EA,0x69EA},
+    {0x2F8EB,0x6AA8}, {0x2F8EC,0x236A3}, {0x2F8ED,0x6ADB}, {0x2F8EE,0x3C18},
+    {0x2F8EF,0x6B21}, {0x2F8F0,0x238A7}, {0x2F8F1,0x6B54}, {0x2F8F2,0x3C4E},
+    {0x2F8F3,0x6B72}, {0x2F8F4,0x6B9F}, {0x2F8F5,0x6BBA}, {0x2F8F6,0x6BBB},
+    {0x2F8F7,0x23A8D}, {0x2F8F8,0x21D0B}, {0x2F8F9,0x23AFA}, {0x2F8FA,0x6C4E},
+    {0x2F8FB,0x23CBC}, {0x2F8FC,0x6CBF}, {0x2F8FD,0x6CCD}, {0x2F8FE,0x6C67},
+    {0x2F8FF,0x6D16}, {0x2F900,0x6D3E}, {0x2F901,0x6D77}, {0x2F902,0x6D41},
+    {0x2F903,0x6D69}, {0x2F904,0x6D78}, {0x2F905,0x6D85}, {0x2F906,0x23D1E},
+    {0x2F907,0x6D34}, {0x2F908,0x6E2F}, {0x2F909,0x6E6E}, {0x2F90A,0x3D33},
+    {0x2F90B,0x6ECB}, {0x2F90C,0x6EC7}, {0x2F90D,0x23ED1}, {0x2F90E,0x6DF9},
+    {0x2F90F,0x6F6E}, {0x2F910,0x23F5E}, {0x2F911,0x23F8E}, {0x2F912,0x6FC6},
+    {0x2F913,0x7039}, {0x2F914,0x701E}, {0x2F915,0x701B}, {0x2F916,0x3D96},
+    {0x2F917,0x704A}, {0x2F918,0x707D}, {0x2F919,0x7077}, {0x2F91A,0x70AD},
+    {0x2F91B,0x20525}, {0x2F91C,0x7145}, {0x2F91D,0x24263}, {0x2F91E,0x719C},
+    {0x2F91F,0x243AB}, {0x2F920,0x7228}, {0x2F921,0x7235}, {0x2F922,0x7250},
+    {0x2F923,0x24608}, {0x2F924,0x7280}, {0x2F925,0x7295}, {0x2F926,0x24735},
+    {0x2F927,0x24814}, {0x2F928,0x737A}, {0x2F929,0x738B}, {0x2F92A,0x3EAC},
+    {0x2F92B,0x73A5}, {0x2F92C,0x3EB8}, {0x2F92D,0x3EB8}, {0x2F92E,0x7447},
+    {0x2F92F,0x745C}, {0x2F930,0x7471}, {0x2F931,0x7485}, {0x2F932,0x74CA},
+    {0x2F933,0x3F1B}, {0x2F934,0x7524}, {0x2F935,0x24C36}, {0x2F936,0x753E},
+    {0x2F937,0x24C92}, {0x2F938,0x7570}, {0x2F939,0x2219F}, {0x2F93A,0x7610},
+    {0x2F93B,0x24FA1}, {0x2F93C,0x24FB8}, {0x2F93D,0x25044}, {0x2F93E,0x3FFC},
+    {0x2F93F,0x4008}, {0x2F940,0x76F4}, {0x2F941,0x250F3}, {0x2F942,0x250F2},
+    {0x2F943,0x25119}, {0x2F944,0x25133}, {0x2F945,0x771E}, {0x2F946,0x771F},
+    {0x2F947,0x771F}, {0x2F948,0x774A}, {0x2F949,0x4039}, {0x2F94A,0x778B},
+    {0x2F94B,0x4046}, {0x2F94C,0x4096}, {0x2F94D,0x2541D}, {0x2F94E,0x784E},
+    {0x2F94F,0x788C}, {0x2F950,0x78CC}, {0x2F951,0x40E3}, {0x2F952,0x25626},
+    {0x2F953,0x7956}, {0x2F954,0x2569A}, {0x2F955,0x256C5}, {0x2F956,0x798F},
+    {0x2F957,0x79EB}, {0x2F958,0x412F}, {0x2F959,0x7A40}, {0x2F95A,0x7A4A},
+    {0x2F95B,0x7A4F}, {0x2F95C,0x2597C}, {0x2F95D,0x25AA7}, {0x2F95E,0x25AA7},
+    {0x2F95F,0x7AEE}, {0x2F960,0x4202}, {0x2F961,0x25BAB}, {0x2F962,0x7BC6},
+    {0x2F963,0x7BC9}, {0x2F964,0x4227}, {0x2F965,0x25C80}, {0x2F966,0x7CD2},
+    {0x2F967,0x42A0}, {0x2F968,0x7CE8}, {0x2F969,0x7CE3}, {0x2F96A,0x7D00},
+    {0x2F96B,0x25F86}, {0x2F96C,0x7D63}, {0x2F96D,0x4301}, {0x2F96E,0x7DC7},
+    {0x2F96F,0x7E02}, {0x2F970,0x7E45}, {0x2F971,0x4334}, {0x2F972,0x26228},
+    {0x2F973,0x26247}, {0x2F974,0x4359}, {0x2F975,0x262D9}, {0x2F976,0x7F7A},
+    {0x2F977,0x2633E}, {0x2F978,0x7F95}, {0x2F979,0x7FFA}, {0x2F97A,0x8005},
+    {0x2F97B,0x264DA}, {0x2F97C,0x26523}, {0x2F97D,0x8060}, {0x2F97E,0x265A8},
+    {0x2F97F,0x8070}, {0x2F980,0x2335F}, {0x2F981,0x43D5}, {0x2F982,0x80B2},
+    {0x2F983,0x8103}, {0x2F984,0x440B}, {0x2F985,0x813E}, {0x2F986,0x5AB5},
+    {0x2F987,0x267A7}, {0x2F988,0x267B5}, {0x2F989,0x23393},
+    {0x2F98A,0x2339C}, {0x2F98B,0x8201}, {0x2F98C,0x8204}, {0x2F98D,0x8F9E},
+    {0x2F98E,0x446B}, {0x2F98F,0x8291}, {0x2F990,0x828B}, {0x2F991,0x829D},
+    {0x2F992,0x52B3}, {0x2F993,0x82B1}, {0x2F994,0x82B3}, {0x2F995,0x82BD},
+    {0x2F996,0x82E6}, {0x2F997,0x26B3C}, {0x2F998,0x82E5}, {0x2F999,0x831D},
+    {0x2F99A,0x8363}, {0x2F99B,0x83AD}, {0x2F99C,0x8323}, {0x2F99D,0x83BD},
+    {0x2F99E,0x83E7}, {0x2F99F,0x8457}, {0x2F9A0,0x8353}, {0x2F9A1,0x83CA},
+    {0x2F9A2,0x83CC}, {0x2F9A3,0x83DC}, {0x2F9A4,0x26C36}, {0x2F9A5,0x26D6B},
+    {0x2F9A6,0x26CD5}, {0x2F9A7,0x452B}, {0x2F9A8,0x84F1}, {0x2F9A9,0x84F3},
+    {0x2F9AA,0x8516}, {0x2F9AB,0x273CA}, {0x2F9AC,0x8564}, {0x2F9AD,0x26F2C},
+    {0x2F9AE,0x455D}, {0x2F9AF,0x4561}, {0x2F9B0,0x26FB1}, {0x2F9B1,0x270D2},
+    {0x2F9B2,0x456B}, {0x2F9B3,0x8650}, {0x2F9B4,0x865C}, {0x2F9B5,0x8667},
+    {0x2F9B6,0x8669}, {0x2F9B7,0x86A9}, {0x2F9B8,0x8688}, {0x2F9B9,0x870E},
+    {0x2F9BA,0x86E2}, {0x2F9BB,0x8779}, {0x2F9BC,0x8728}, {0x2F9BD,0x876B},
+    {0x2F9BE,0x8786}, {0x2F9BF,0x45D7}, {0x2F9C0,0x87E1}, {0x2F9C1,0x8801},
+    {0x2F9C2,0x45F9}, {0x2F9C3,0x8860}, {0x2F9C4,0x8863}, {0x2F9C5,0x27667},
+    {0x2F9C6,0x88D7}, {0x2F9C7,0x88DE}, {0x2F9C8,0x4635}, {0x2F9C9,0x88FA},
+    {0x2F9CA,0x34BB}, {0x2F9CB,0x278AE}, {0x2F9CC,0x27966}, {0x2F9CD,0x46BE},
+    {0x2F9CE,0x46C7}, {0x2F9CF,0x8AA0}, {0x2F9D0,0x8AED}, {0x2F9D1,0x8B8A},
+    {0x2F9D2,0x8C55}, {0x2F9D3,0x27CA8}, {0x2F9D4,0x8CAB}, {0x2F9D5,0x8CC1},
+    {0x2F9D6,0x8D1B}, {0x2F9D7,0x8D77}, {0x2F9D8,0x27F2F}, {0x2F9D9,0x20804},
+    {0x2F9DA,0x8DCB}, {0x2F9DB,0x8DBC}, {0x2F9DC,0x8DF0}, {0x2F9DD,0x208DE},
+    {0x2F9DE,0x8ED4}, {0x2F9DF,0x8F38}, {0x2F9E0,0x285D2}, {0x2F9E1,0x285ED},
+    {0x2F9E2,0x9094}, {0x2F9E3,0x90F1}, {0x2F9E4,0x9111}, {0x2F9E5,0x2872E},
+    {0x2F9E6,0x911B}, {0x2F9E7,0x9238}, {0x2F9E8,0x92D7}, {0x2F9E9,0x92D8},
+    {0x2F9EA,0x927C}, {0x2F9EB,0x93F9}, {0x2F9EC,0x9415}, {0x2F9ED,0x28BFA},
+    {0x2F9EE,0x958B}, {0x2F9EF,0x4995}, {0x2F9F0,0x95B7}, {0x2F9F1,0x28D77},
+    {0x2F9F2,0x49E6}, {0x2F9F3,0x96C3}, {0x2F9F4,0x5DB2}, {0x2F9F5,0x9723},
+    {0x2F9F6,0x29145}, {0x2F9F7,0x2921A}, {0x2F9F8,0x4A6E}, {0x2F9F9,0x4A76},
+    {0x2F9FA,0x97E0}, {0x2F9FB,0x2940A}, {0x2F9FC,0x4AB2}, {0x2F9FD,0x29496},
+    {0x2F9FE,0x980B}, {0x2F9FF,0x980B}, {0x2FA00,0x9829}, {0x2FA01,0x295B6},
+    {0x2FA02,0x98E2}, {0x2FA03,0x4B33}, {0x2FA04,0x9929}, {0x2FA05,0x99A7},
+    {0x2FA06,0x99C2}, {0x2FA07,0x99FE}, {0x2FA08,0x4BCE}, {0x2FA09,0x29B30},
+    {0x2FA0A,0x9B12}, {0x2FA0B,0x9C40}, {0x2FA0C,0x9CFD}, {0x2FA0D,0x4CCE},
+    {0x2FA0E,0x4CED}, {0x2FA0F,0x9D67}, {0x2FA10,0x2A0CE}, {0x2FA11,0x4CF8},
+    {0x2FA12,0x2A105}, {0x2FA13,0x2A20E}, {0x2FA14,0x2A291}, {0x2FA15,0x9EBB},
+    {0x2FA16,0x4D56}, {0x2FA17,0x9EF9}, {0x2FA18,0x9EFE}, {0x2FA19,0x9F05},
+    {0x2FA1A,0x9F0F}, {0x2FA1B,0x9F16}, {0x2FA1C,0x9F3B}, {0x2FA1D,0x2A600}
+};
+
+#define NFC_TABLE_LEN(t) (sizeof(t)/sizeof((t)[0]))
+
+/* Hangul syllables are composed and decomposed algorithmically. */
+#define HANGUL_S 0xAC00
+#define HANGUL_L 0x1100
+#define HANGUL_V 0x1161
+#define HANGUL_T 0x11A7
+#define HANGUL_LCOUNT 19
+#define HANGUL_VCOUNT 21
+#define HANGUL_TCOUNT 28
+#define HANGUL_SCOUNT (HANGUL_LCOUNT*HANGUL_VCOUNT*HANGUL_TCOUNT)
+
+/* Bytes that are not valid UTF-8 are kept as code points above the
+ * Unicode range, so they never combine and are written back as they were. */
+#define NFC_RAW 0x110000
+
+/* The composable pairs, sorted by their two code points, and the code
+ * points that can compose with a preceding one, sorted. Built once from
+ * nfcPairs[]. */
+static unsigned short nfc_compose[NFC_TABLE_LEN(nfcPairs)];
+static unsigned int nfc_ncompose;
+static unsigned int nfc_seconds[NFC_TABLE_LEN(nfcPairs)];
+static unsigned int nfc_nseconds;
+static pthread_once_t nfc_once = PTHREAD_ONCE_INIT;
+
+/* Return the index of 'c' in the sorted array 'a' of 'n' elements of
+ * 'size' bytes starting with an unsigned int, or -1. */
+static long nfcFind(const void *a, size_t n, size_t size, unsigned int c) {
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        unsigned int v = *(const unsigned int *)((const char *)a+mid*size);
+        if (v == c) return mid;
+        if (v < c) lo = mid+1;
+        else hi = mid;
     }
+    return -1;
 }
 
-/* Move cursor to the end of the current word. */
-void linenoiseEditMoveWordEnd(struct linenoiseState *l) {
-    if (l->len == 0 || l->pos >= l->len) return;
-    if (l->buf[l->pos] == ' ')
-        while (l->pos < l->len && l->buf[l->pos] == ' ') ++l->pos;
-    while (l->pos < l->len && l->buf[l->pos] != ' ') ++l->pos;
-    refreshLine(l);
+static int nfcComposeCompare(const void *a, const void *b) {
+    const struct nfcPair *pa = &nfcPairs[*(const unsigned short *)a];
+    const struct nfcPair *pb = &nfcPairs[*(const unsigned short *)b];
+
+    if (pa->first != pb->first) return pa->first < pb->first ? -1 : 1;
+    if (pa->second != pb->second) return pa->second < pb->second ? -1 : 1;
+    return 0;
 }
 
-/* Move cursor to the start of the current word. */
-void linenoiseEditMoveWordStart(struct linenoiseState *l) {
-    if (l->len == 0) return;
-    if (l->buf[l->pos-1] == ' ') --l->pos;
-    if (l->buf[l->pos] == ' ')
-        while (l->pos > 0 && l->buf[l->pos] == ' ') --l->pos;
-    while (l->pos > 0 && l->buf[l->pos-1] != ' ') --l->pos;
-    refreshLine(l);
+static int nfcUintCompare(const void *a, const void *b) {
+    unsigned int ua = *(const unsigned int *)a, ub = *(const unsigned int *)b;
+
+    return ua < ub ? -1 : ua > ub;
 }
 
-/* Move cursor to the start of the line. */
-void linenoiseEditMoveHome(struct linenoiseState *l) {
-    if (l->pos != 0) {
-        l->pos = 0;
-        refreshLine(l);
+static void nfcInit(void) {
+    unsigned int j, k;
+
+    for (j = 0; j < NFC_TABLE_LEN(nfcPairs); j++) {
+        if (nfcFind(nfcExcluded,NFC_TABLE_LEN(nfcExcluded),
+                    sizeof(nfcExcluded[0]),nfcPairs[j].cp) != -1) continue;
+        nfc_compose[nfc_ncompose++] = j;
+        nfc_seconds[nfc_nseconds++] = nfcPairs[j].second;
     }
+    qsort(nfc_compose,nfc_ncompose,sizeof(nfc_compose[0]),nfcComposeCompare);
+    qsort(nfc_seconds,nfc_nseconds,sizeof(nfc_seconds[0]),nfcUintCompare);
+    for (j = 0, k = 0; j < nfc_nseconds; j++)
+        if (k == 0 || nfc_seconds[j] != nfc_seconds[k-1])
+            nfc_seconds[k++] = nfc_seconds[j];
+    nfc_nseconds = k;
 }
 
-/* Move cursor to the end of the line. */
-void linenoiseEditMoveEnd(struct linenoiseState *l) {
-    if (l->pos != l->len) {
-        l->pos = l->len;
-        refreshLine(l);
+/* Return the canonical combining class of 'c'. */
+static int nfcClass(unsigned int c) {
+    size_t lo = 0, hi = NFC_TABLE_LEN(nfcClasses);
+
+    if (c < 0x300) return 0;
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if (nfcClasses[mid].first <= c) lo = mid+1;
+        else hi = mid;
     }
+    if (lo == 0 || c >= nfcClasses[lo-1].first+nfcClasses[lo-1].count)
+        return 0;
+    return nfcClasses[lo-1].ccc;
 }
 
-/* Substitute the currently edited line with the next or previous history
- * entry as specified by 'dir'. */
-#define LINENOISE_HISTORY_NEXT 0
-#define LINENOISE_HISTORY_PREV 1
-void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
-    if (history_len > 1) {
-        /* Update the current history entry before to
-         * overwrite it with the next one. */
-        free(history[history_len - 1 - l->history_index]);
-        history[history_len - 1 - l->history_index] = strdup(l->buf);
-        /* Show the new entry */
-        l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
-        if (l->history_index < 0) {
-            l->history_index = 0;
-            return;
-        } else if (l->history_index >= history_len) {
-            l->history_index = history_len-1;
-            return;
-        }
-        strncpy(l->buf,history[history_len - 1 - l->history_index],l->buflen);
-        l->buf[l->buflen-1] = '\0';
-        l->len = l->pos = strlen(l->buf);
-        refreshLine(l);
+/* Return the code point composing 'a' and 'b', or zero. */
+static unsigned int nfcCompose(unsigned int a, unsigned int b) {
+    size_t lo = 0, hi = nfc_ncompose;
+
+    if (a >= HANGUL_L && a < HANGUL_L+HANGUL_LCOUNT &&
+        b >= HANGUL_V && b < HANGUL_V+HANGUL_VCOUNT)
+        return HANGUL_S+((a-HANGUL_L)*HANGUL_VCOUNT+b-HANGUL_V)*HANGUL_TCOUNT;
+    if (a >= HANGUL_S && a < HANGUL_S+HANGUL_SCOUNT &&
+        (a-HANGUL_S) % HANGUL_TCOUNT == 0 &&
+        b > HANGUL_T && b < HANGUL_T+HANGUL_TCOUNT)
+        return a+b-HANGUL_T;
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        const struct nfcPair *p = &nfcPairs[nfc_compose[mid]];
+        if (p->first == a && p->second == b) return p->cp;
+        if (p->first < a || (p->first == a && p->second < b)) lo = mid+1;
+        else hi = mid;
     }
+    return 0;
 }
 
-/* Delete the character at the right of the cursor without altering the cursor
- * position. Basically this is what happens with the "Delete" keyboard key. */
-void linenoiseEditDelete(struct linenoiseState *l) {
-    if (l->len > 0 && l->pos < l->len) {
-        int chlen = nextCharLen(l->buf,l->len,l->pos,NULL);
-        memmove(l->buf+l->pos,l->buf+l->pos+chlen,l->len-l->pos-chlen);
-        l->len-=chlen;
-        l->buf[l->len] = '\0';
-        refreshLine(l);
+/* Append to 'out' the full canonical decomposition of 'c', returning the
+ * number of code points, at most four. */
+static int nfcDecompose(unsigned int c, unsigned int *out) {
+    long i;
+    int n;
+
+    if (c >= HANGUL_S && c < HANGUL_S+HANGUL_SCOUNT) {
+        unsigned int s = c-HANGUL_S;
+        out[0] = HANGUL_L+s/(HANGUL_VCOUNT*HANGUL_TCOUNT);
+        out[1] = HANGUL_V+(s%(HANGUL_VCOUNT*HANGUL_TCOUNT))/HANGUL_TCOUNT;
+        if (s % HANGUL_TCOUNT == 0) return 2;
+        out[2] = HANGUL_T+s%HANGUL_TCOUNT;
+        return 3;
     }
+    if (c < 0xC0) goto nodecomp;
+    i = nfcFind(nfcPairs,NFC_TABLE_LEN(nfcPairs),sizeof(nfcPairs[0]),c);
+    if (i != -1) {
+        n = nfcDecompose(nfcPairs[i].first,out);
+        out[n++] = nfcPairs[i].second;
+        return n;
+    }
+    i = nfcFind(nfcSingletons,NFC_TABLE_LEN(nfcSingletons),
+                sizeof(nfcSingletons[0]),c);
+    if (i != -1) return nfcDecompose(nfcSingletons[i].to,out);
+
+nodecomp:
+    out[0] = c;
+    return 1;
 }
 
-/* Backspace implementation. */
-void linenoiseEditBackspace(struct linenoiseState *l) {
-    if (l->pos > 0 && l->len > 0) {
-        int chlen = prevCharLen(l->buf,l->len,l->pos,NULL);
-        memmove(l->buf+l->pos-chlen,l->buf+l->pos,l->len-l->pos);
-        l->pos-=chlen;
-        l->len-=chlen;
-        l->buf[l->len] = '\0';
-        refreshLine(l);
+/* Decode the UTF-8 character at 'p', of at most 'len' bytes, into 'c',
+ * returning its length. Invalid bytes decode as NFC_RAW plus the byte. */
+static size_t nfcDecode(const unsigned char *p, size_t len, unsigned int *c) {
+    size_t n = p[0] < 0x80 ? 1 : p[0] >= 0xF8 ? 0 : p[0] >= 0xF0 ? 4 :
+               p[0] >= 0xE0 ? 3 : p[0] >= 0xC0 ? 2 : 0, j;
+
+    for (j = 1; j < n && j < len && (p[j] & 0xC0) == 0x80; j++);
+    if (n == 0 || j != n) {
+        *c = NFC_RAW+p[0];
+        return 1;
     }
+    *c = p[0] & (n == 1 ? 0x7F : 0x7F >> n);
+    for (j = 1; j < n; j++) *c = (*c << 6) | (p[j] & 0x3F);
+    return n;
 }
 
-/* Delete the previous word, maintaining the cursor at the start of the
- * current word. */
-void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
-    size_t old_pos = l->pos;
-    size_t diff;
+/* Return non zero if the 'len' bytes at 's' are surely in NFC already,
+ * which is the case for ASCII, for the characters before the combining
+ * diacritical marks, and for most text: only characters that may compose
+ * with the one before, that are never in NFC, or combining marks out of
+ * order need the full normalization. */
+static int nfcQuickCheck(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t i = 0;
+    int last = 0;
+
+    pthread_once(&nfc_once,nfcInit);
+    while (i < len) {
+        unsigned int c;
+        uint64_t w;
+        int ccc;
+
+        if (i+8 <= len) {
+            memcpy(&w,p+i,8);
+            if (ASCII8(w)) {
+                i += 8;
+                last = 0;
+                continue;
+            }
+        }
+        i += nfcDecode(p+i,len-i,&c);
+        if (c < 0x300) {
+            last = 0;
+            continue;
+        }
+        ccc = nfcClass(c);
+        if (ccc && last > ccc) return 0;
+        last = ccc;
+        if (c >= NFC_RAW) continue;
+        if (c >= HANGUL_V && c < HANGUL_T+HANGUL_TCOUNT) return 0;
+        if (nfcFind(nfc_seconds,nfc_nseconds,sizeof(nfc_seconds[0]),c) != -1 ||
+            nfcFind(nfcExcluded,NFC_TABLE_LEN(nfcExcluded),
+                    sizeof(nfcExcluded[0]),c) != -1 ||
+            nfcFind(nfcSingletons,NFC_TABLE_LEN(nfcSingletons),
+                    sizeof(nfcSingletons[0]),c) != -1) return 0;
+    }
+    return 1;
+}
 
-    while (l->pos > 0 && l->buf[l->pos-1] == ' ')
-        l->pos--;
-    while (l->pos > 0 && l->buf[l->pos-1] != ' ')
-        l->pos--;
-    diff = old_pos - l->pos;
-    memmove(l->buf+l->pos,l->buf+old_pos,l->len-old_pos+1);
-    l->len -= diff;
-    refreshLine(l);
+/* Return a new allocated copy of the 'len' bytes at 's' converted to NFC,
+ * or NULL on out of memory, storing its length in '*nlen'. Call it only if
+ * nfcQuickCheck() fails. */
+static char *nfcNormalize(const char *s, size_t len, size_t *nlen) {
+    const unsigned char *p = (const unsigned char *)s;
+    unsigned int *cp, starter;
+    size_t i, n = 0, o, spos;
+    int last;
+    char *out;
+
+    /* Decompose. A character of k bytes decomposes in at most k+1 code
+     * points. */
+    if ((cp = lnMalloc(LN_POOL_MISC,sizeof(*cp)*(len*2+1))) == NULL) return NULL;
+    for (i = 0; i < len; ) {
+        unsigned int c;
+        i += nfcDecode(p+i,len-i,&c);
+        n += c < NFC_RAW ? nfcDecompose(c,cp+n) : (cp[n] = c, 1);
+    }
+
+    /* Put every run of combining marks in the canonical order, with a
+     * stable insertion sort: runs are short. */
+    for (i = 1; i < n; i++) {
+        unsigned int c = cp[i];
+        int ccc = nfcClass(c);
+        size_t j = i;
+
+        if (ccc == 0) continue;
+        while (j > 0 && nfcClass(cp[j-1]) > ccc) {
+            cp[j] = cp[j-1];
+            j--;
+        }
+        cp[j] = c;
+    }
+
+    /* Compose every character with the last starter if nothing with the
+     * same or a higher class is between them. */
+    o = n ? 1 : 0;
+    spos = 0;
+    starter = n ? cp[0] : 0;
+    last = n && nfcClass(starter) ? 256 : 0;
+    for (i = 1; i < n; i++) {
+        unsigned int c = cp[i], comp;
+        int ccc = nfcClass(c);
+
+        comp = last < 256 && (last == 0 || last < ccc) ?
+               nfcCompose(starter,c) : 0;
+        if (comp) {
+            cp[spos] = starter = comp;
+            continue;
+        }
+        if (ccc == 0) {
+            spos = o;
+            starter = c;
+        }
+        last = ccc;
+        cp[o++] = c;
+    }
+    n = o;
+
+    /* Encode back. */
+    if ((out = lnMalloc(LN_POOL_MISC,n*4+1)) == NULL) {
+        lnFree(cp);
+        return NULL;
+    }
+    for (i = 0, o = 0; i < n; i++) {
+        unsigned int c = cp[i];
+        if (c >= NFC_RAW) {
+            out[o++] = c-NFC_RAW;
+        } else if (c < 0x80) {
+            out[o++] = c;
+        } else if (c < 0x800) {
+            out[o++] = 0xC0 | (c >> 6);
+            out[o++] = 0x80 | (c & 0x3F);
+        } else if (c < 0x10000) {
+            out[o++] = 0xE0 | (c >> 12);
+            out[o++] = 0x80 | ((c >> 6) & 0x3F);
+            out[o++] = 0x80 | (c & 0x3F);
+        } else {
+            out[o++] = 0xF0 | (c >> 18);
+            out[o++] = 0x80 | ((c >> 12) & 0x3F);
+            out[o++] = 0x80 | ((c >> 6) & 0x3F);
+            out[o++] = 0x80 | (c & 0x3F);
+        }
+    }
+    out[o] = '\0';
+    *nlen = o;
+    lnFree(cp);
+    return out;
 }
 
-/* Delete the next word, maintaining the cursor at the same position */
-void linenoiseEditDeleteNextWord(struct linenoiseState *l) {
-    size_t next_word_end = l->pos;
-    while (next_word_end < l->len && l->buf[next_word_end] == ' ') ++next_word_end;
-    while (next_word_end < l->len && l->buf[next_word_end] != ' ') ++next_word_end;
-    memmove(l->buf+l->pos, l->buf+next_word_end, l->len-next_word_end);
-    l->len -= next_word_end - l->pos;
-    refreshLine(l);
+/* Return 's' converted to NFC if the normalization of the history is
+ * enabled and it is not in NFC already, otherwise 's' itself. A converted
+ * string is also stored in '*alloc', to be freed, that is set to NULL
+ * otherwise. Returns NULL on out of memory. */
+static const char *historyNormalize(const char *s, char **alloc) {
+    size_t len = strlen(s), nlen;
+
+    *alloc = NULL;
+    if (!history_normalize || nfcQuickCheck(s,len)) return s;
+    return *alloc = nfcNormalize(s,len,&nlen);
 }
 
-/* This function is the core of the line editing capability of linenoise.
- * It expects 'fd' to be already in "raw mode" so that every key pressed
- * will be returned ASAP to read().
- *
- * The resulting string is put into 'buf' when the user type enter, or
- * when ctrl+d is typed.
+/* ============================== Completion ================================ */
+
+/* Free a list of completion option populated by linenoiseAddCompletion(). */
+static void freeCompletions(linenoiseCompletions *lc) {
+    size_t i;
+    for (i = 0; i < lc->len; i++) {
+        lnFree(lc->cvec[i]);
+        lnFree(lc->descvec[i]);
+    }
+    lnFree(lc->cvec);
+    lnFree(lc->descvec);
+    lnFree(lc->scorevec);
+    lnFree(lc->kindvec);
+    lnFree(lc->widthvec);
+    lnFree(lc->descwidthvec);
+}
+
+/* Order of the candidates: highest score first, then as they were added. */
+struct completionRank {
+    int score;
+    size_t index;
+};
+
+static int completionRankCompare(const void *a, const void *b) {
+    const struct completionRank *ra = a, *rb = b;
+
+    if (ra->score != rb->score) return ra->score > rb->score ? -1 : 1;
+    return ra->index < rb->index ? -1 : ra->index > rb->index;
+}
+
+/* Return the candidates indexes in the order they should be shown, or
+ * NULL on out of memory. */
+static size_t *completionsOrder(linenoiseCompletions *lc) {
+    size_t *order = lnMalloc(LN_POOL_COMPLETIONS,sizeof(size_t)*lc->len), i;
+    struct completionRank *rank;
+    int scored = 0;
+
+    if (order == NULL) return NULL;
+    for (i = 0; i < lc->len; i++) {
+        order[i] = i;
+        if (lc->scorevec[i] != lc->scorevec[0]) scored = 1;
+    }
+    if (!scored) return order;
+    if ((rank = lnMalloc(LN_POOL_COMPLETIONS,sizeof(*rank)*lc->len)) == NULL) return order;
+    for (i = 0; i < lc->len; i++) {
+        rank[i].score = lc->scorevec[i];
+        rank[i].index = i;
+    }
+    qsort(rank,lc->len,sizeof(*rank),completionRankCompare);
+    for (i = 0; i < lc->len; i++) order[i] = rank[i].index;
+    lnFree(rank);
+    return order;
+}
+
+/* Refresh the line showing the candidate 'text', with the description
+ * 'desc' of 'descwidth' columns, in place of the edited buffer. The
+ * candidate gets its own line and bracket indexes, then the buffer and its
+ * indexes are restored, keeping only what the refresh changed on screen. */
+static void completionShow(struct linenoiseState *ls, char *text, const char *desc, size_t descwidth) {
+    struct linenoiseState saved = *ls;
+
+    ls->buf = text;
+    ls->len = ls->pos = strlen(text);
+    memset(&ls->newlines,0,sizeof(ls->newlines));
+    memset(&ls->brackets,0,sizeof(ls->brackets));
+    ls->nlines = 1;
+    ls->pairs = NULL;
+    ls->pairscap = 0;
+    ls->lexstates = NULL;
+    ls->lexvalid = ls->lexcap = 0;
+    indexEdit(ls,0,0,ls->len);
+    ls->compdesc = desc;
+    ls->compdescwidth = descwidth;
+    refreshLine(ls);
+    lnFree(ls->newlines.off);
+    lnFree(ls->brackets.off);
+    lnFree(ls->pairs);
+    saved.oldrpos = ls->oldrpos;
+    saved.maxrows = ls->maxrows;
+    saved.hlpos = ls->hlpos;
+    saved.statusshown = ls->statusshown;
+    *ls = saved;
+}
+
+/* This is an helper function for linenoiseEdit() and is called when the
+ * user types the <tab> key in order to complete the string currently in the
+ * input.
  *
- * The function returns the length of the current buffer. */
-static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen, const char *prompt)
-{
-    struct linenoiseState l;
+ * The state of the editing is encapsulated into the pointed linenoiseState
+ * structure as described in the structure definition. */
+static int completeLine(struct linenoiseState *ls, char *cbuf, size_t cbuf_len, int *c) {
+    linenoiseCompletions lc = { 0, NULL, NULL, NULL, NULL, NULL, NULL, 0 };
+    size_t *order = NULL;
+    int nread = 0, nwritten;
+    uint64_t start = traceStart(), span;
+    *c = 0;
 
-    /* Populate the linenoise state that we pass to functions implementing
-     * specific editing functionalities. */
-    l.ifd = stdin_fd;
-    l.ofd = stdout_fd;
-    l.buf = buf;
-    l.buflen = buflen;
-    l.prompt = prompt;
-    l.plen = strlen(prompt);
-    l.oldcolpos = l.pos = 0;
-    l.len = 0;
-    l.cols = getColumns(stdin_fd, stdout_fd);
-    l.maxrows = 0;
-    l.history_index = 0;
+    span = traceStart();
+    completionCallback(ls->buf,&lc);
+    lnspan(SPAN_COMPLETION_CALLBACK,span,ls->cols,ls->len,ls->pos);
+    if (lc.len && (order = completionsOrder(&lc)) == NULL) {
+        freeCompletions(&lc);
+        memset(&lc,0,sizeof(lc));
+    }
+    if (lc.len == 0) {
+        linenoiseBeep();
+    } else {
+        size_t stop = 0, i = 0;
 
-    /* Buffer starts empty. */
-    l.buf[0] = '\0';
-    l.buflen--; /* Make sure there is always space for the nulterm */
+        while(!stop) {
+            /* Show completion or original buffer */
+            if (i < lc.len) {
+                size_t k = order[i];
 
-    /* The latest history entry is always our current buffer, that
-     * initially is just an empty string. */
-    linenoiseHistoryAdd("");
+                completionShow(ls,lc.cvec[k],lc.descvec[k],lc.descwidthvec[k]);
+            } else {
+                refreshLine(ls);
+            }
+            /* Only measure up to the first candidate shown, not the time
+             * spent by the user choosing. */
+            lnspan(SPAN_COMPLETE_LINE,start,ls->cols,ls->len,ls->pos);
+            start = 0;
 
-    if (write(l.ofd,prompt,l.plen) == -1) return -1;
-    while(1) {
-        signed int c;
-        char cbuf[32]; // large enough for any encoding?
-        int nread;
-        char seq[3];
+            nread = readCodeWithEvents(ls,cbuf,cbuf_len,c);
+            if (nread <= 0) {
+                freeCompletions(&lc);
+                lnFree(order);
+                *c = -1;
+                return nread;
+            }
 
-	/* Continue reading if interrupted by a signal */
-// TODO
-//	do {
-//          nread = read(l.ifd,&c,1);
-//        } while((nread == -1) && (errno == EINTR));
-        nread = readCode(l.ifd,cbuf,sizeof(cbuf),&c);
-        if (nread <= 0) return l.len;
-        
+            lntrace(LINENOISE_TRACE_COMPLETE,lc.len,i,*c,0,0);
+            switch(*c) {
+                case TAB: /* tab */
+                    i = (i+1) % (lc.len+1);
+                    if (i == lc.len) linenoiseBeep();
+                    break;
+                case ESC: /* escape */
+                    /* Re-show original buffer */
+                    if (i < lc.len) refreshLine(ls);
+                    stop = 1;
+                    break;
+                default:
+                    /* Update buffer and return */
+                    if (i < lc.len) {
+                        nwritten = snprintf(ls->buf,ls->buflen,"%s",lc.cvec[order[i]]);
+                        if (nwritten >= (int)ls->buflen) nwritten = strlen(ls->buf);
+                        indexEdit(ls,0,ls->len,nwritten);
+                        ls->len = ls->pos = nwritten;
+                    }
+                    stop = 1;
+                    break;
+            }
+        }
+    }
 
-        /* Only autocomplete when the callback is set. It returns < 0 when
-         * there was an error reading from fd. Otherwise it will return the
-         * character that should be handled next. */
-        if (c == TAB && completionCallback != NULL) {
-            nread = completeLine(&l,cbuf,sizeof(cbuf),&c);
-            /* Return on errors */
-            if (c < 0) return l.len;
-            /* Read next character when 0 */
-            if (c == 0) continue;
+    freeCompletions(&lc);
+    lnFree(order);
+    return nread;
+}
+
+/* Register a callback function to be called for tab-completion. */
+void linenoiseSetCompletionCallback(linenoiseCompletionCallback *fn) {
+    completionCallback = fn;
+}
+
+/* Register a hits function to be called to show hits to the user at the
+ * right of the prompt. */
+void linenoiseSetHintsCallback(linenoiseHintsCallback *fn) {
+    hintsCallback = fn;
+}
+
+/* Register a function to free the hints returned by the hints callback
+ * registered with linenoiseSetHintsCallback(). */
+void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
+    freeHintsCallback = fn;
+}
+
+/* Register a function called on enter, that returns non zero when the
+ * input is incomplete and should go on in a new line of the buffer. */
+void linenoiseSetContinuationCallback(linenoiseContinuationCallback *fn) {
+    continuationCallback = fn;
+}
+
+/* Register an incremental lexer used instead of the continuation callback.
+ * Its state of 'size' bytes starts as a copy of 'init', or zeroed if 'init'
+ * is NULL, and is cached at the start of every line of the buffer, so that
+ * only the lines changed since the last enter are lexed again. The 'init'
+ * memory must stay valid while the lexer is set. */
+void linenoiseSetContinuationLexer(linenoiseContinuationLexer *fn, const void *init, size_t size) {
+    continuationLexer = size ? fn : NULL;
+    lexerInit = init;
+    lexerStateSize = size;
+}
+
+/* Make room for one more candidate in all the arrays. */
+static int completionsGrow(linenoiseCompletions *lc) {
+    size_t cap = lc->cap ? lc->cap*2 : 16;
+    void *p;
+
+    if (lc->len < lc->cap) return 0;
+#define COMPLETIONS_GROW(field) do { \
+        if ((p = lnRealloc(LN_POOL_COMPLETIONS,lc->field,sizeof(*lc->field)*cap)) == NULL) \
+            return -1; \
+        lc->field = p; \
+    } while (0)
+    COMPLETIONS_GROW(cvec);
+    COMPLETIONS_GROW(descvec);
+    COMPLETIONS_GROW(scorevec);
+    COMPLETIONS_GROW(kindvec);
+    COMPLETIONS_GROW(widthvec);
+    COMPLETIONS_GROW(descwidthvec);
+#undef COMPLETIONS_GROW
+    lc->cap = cap;
+    return 0;
+}
+
+/* This function is used by the callback function registered by the user
+ * in order to add completion options given the input string when the
+ * user typed <tab>. See the example.c source code for a very easy to
+ * understand example. */
+void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
+    linenoiseAddCompletionFull(lc,str,NULL,0,0);
+}
+
+/* Like linenoiseAddCompletion(), with a description shown after the
+ * candidate when it is selected, or NULL, a score, candidates with higher
+ * scores being shown first, and a kind left to the application. The
+ * display widths are measured here, once. */
+void linenoiseAddCompletionFull(linenoiseCompletions *lc, const char *str, const char *desc, int score, int kind) {
+    size_t len = strlen(str), desclen = desc ? strlen(desc) : 0;
+    char *copy, *desccopy = NULL;
+
+    if (completionsGrow(lc) == -1) return;
+    copy = lnMalloc(LN_POOL_COMPLETIONS,len+1);
+    if (copy == NULL) return;
+    memcpy(copy,str,len+1);
+    if (desc && (desccopy = lnMalloc(LN_POOL_COMPLETIONS,desclen+1)) == NULL) {
+        lnFree(copy);
+        return;
+    }
+    if (desc) memcpy(desccopy,desc,desclen+1);
+    lc->cvec[lc->len] = copy;
+    lc->descvec[lc->len] = desccopy;
+    lc->scorevec[lc->len] = score;
+    lc->kindvec[lc->len] = kind;
+    lc->widthvec[lc->len] = columnPos(str,len,len);
+    lc->descwidthvec[lc->len] = desc ? columnPos(desc,desclen,desclen) : 0;
+    lc->len++;
+}
+
+/* Adds matching history entries as tab completions. The match ignores the
+ * case, in every script. */
+void linenoiseAddHistoryCompletions(const char* buf, linenoiseCompletions *lc) {
+    struct historyReader *rd = historyPin();
+    struct historyRing *r = atomic_load_explicit(&history,memory_order_acquire);
+    unsigned long seq, head;
+    char *folded = NULL, *normalized = NULL;
+    size_t n;
+
+    if (r != NULL) {
+        if ((buf = historyNormalize(buf,&normalized)) == NULL) goto done;
+        folded = caseFoldDup(buf,strlen(buf),&n);
+        if (folded == NULL) goto done;
+        head = atomic_load_explicit(&r->head,memory_order_acquire);
+        for (seq = atomic_load(&r->tail); seq < head; seq++) {
+            char *entry = historyRingGet(r,seq);
+            if (entry && caseFoldPrefix(entry,strlen(entry),folded,n))
+                linenoiseAddCompletion(lc, entry);
         }
+    }
 
-        switch(c) {
-        case LINE_FEED:/* line feed */
-        case ENTER:    /* enter */
-            history_len--;
-            free(history[history_len]);
-            if (mlmode) linenoiseEditMoveEnd(&l);
-            if (hintsCallback) {
-                /* Force a refresh without hints to leave the previous
-                 * line as the user typed it after a newline. */
-                linenoiseHintsCallback *hc = hintsCallback;
-                hintsCallback = NULL;
-                refreshLine(&l);
-                hintsCallback = hc;
-            }
-            return (int)l.len;
-        case CTRL_C:     /* ctrl-c */
-            errno = EAGAIN;
+done:
+    lnFree(folded);
+    lnFree(normalized);
+    historyUnpin(rd);
+}
+
+
+/* ========================== Regular expressions =========================== */
+
+/* Patterns are a subset of POSIX extended regular expressions: literals,
+ * '.', bracket expressions with ranges, negation and the [:class:] names,
+ * '*', '+', '?', '|', groups, the '^' and '$' anchors, and '\' to escape.
+ * They are parsed into a Thompson NFA, that is compiled once into a DFA by
+ * subset construction, so that matching is a single pass over the line
+ * with a table lookup per byte and never backtracks. The DFA works on
+ * bytes: '.' matches a whole UTF-8 character, but bracket expressions
+ * match single bytes.
+ *
+ * Bytes are mapped to classes that no part of the pattern tells apart, so
+ * that the transition table has a column per class and not per byte. A
+ * literal string that every match must contain is extracted while parsing,
+ * and looked for with substrFind() before to run the DFA. */
+#ifndef LINENOISE_REGEX_MAX_STATES
+#define LINENOISE_REGEX_MAX_STATES 1024 /* DFA states before to give up. */
+#endif
+#define LINENOISE_REGEX_LITERAL 64      /* Max length of the literal. */
+
+enum { NFA_SET, NFA_SPLIT, NFA_JMP, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+struct nfaState {
+    int op;
+    int out, out1;      /* Next states, -1 or a hole while parsing. */
+    int set;            /* Byte set of NFA_SET states. */
+};
+
+/* A fragment of NFA being built: its start and the list of its dangling
+ * exits. The list is threaded through the exits themselves: hole h is the
+ * 'out' field (h even) or the 'out1' field (h odd) of state h/2, and holds
+ * the next hole, or -1. */
+struct nfaFrag {
+    int start;
+    int holes;
+};
+
+struct regexParser {
+    const char *p;
+    struct nfaState *states;
+    int len, cap;
+    unsigned char (*sets)[32];
+    int nsets, setscap;
+    int depth;
+    int err;
+    char lit[LINENOISE_REGEX_LITERAL];  /* Literal of the last atom. */
+    size_t litlen;
+    char run[LINENOISE_REGEX_LITERAL];  /* Current run of literals. */
+    size_t runlen;
+    char best[LINENOISE_REGEX_LITERAL]; /* Longest run so far. */
+    size_t bestlen;
+    int alternation;    /* Top level '|' seen: no literal is required. */
+};
+
+#define REGEX_ACCEPT 1      /* A match ends here. */
+#define REGEX_ACCEPT_EOL 2  /* A match ends here if the input ends. */
+#define REGEX_DEAD 4        /* No match can be found anymore. */
+
+struct linenoiseRegex {
+    int ncls;                   /* Byte classes. */
+    unsigned char cls[256];     /* Class of every byte. */
+    int nstates;
+    int *trans;                 /* Next state, by state and class. */
+    unsigned char *flags;       /* REGEX_* flags of every state. */
+    char lit[LINENOISE_REGEX_LITERAL];
+    size_t litlen;
+};
+
+static int nfaNew(struct regexParser *rp, int op, int out, int out1) {
+    if (rp->len == rp->cap) {
+        int cap = rp->cap ? rp->cap*2 : 32;
+        struct nfaState *states = lnRealloc(LN_POOL_MISC,rp->states,sizeof(*states)*cap);
+
+        if (states == NULL) {
+            rp->err = ENOMEM;
             return -1;
-        case BACKSPACE:   /* backspace */
-        case 8:     /* ctrl-h */
-            linenoiseEditBackspace(&l);
-            break;
-        case CTRL_D:     /* ctrl-d, remove char at right of cursor, or if the
-                            line is empty, act as end-of-file. */
-            if (l.len > 0) {
-                linenoiseEditDelete(&l);
-            } else {
-                history_len--;
-                free(history[history_len]);
-                return -1;
+        }
+        rp->states = states;
+        rp->cap = cap;
+    }
+    rp->states[rp->len].op = op;
+    rp->states[rp->len].out = out;
+    rp->states[rp->len].out1 = out1;
+    rp->states[rp->len].set = -1;
+    return rp->len++;
+}
+
+static int *nfaHole(struct regexParser *rp, int h) {
+    return h % 2 ? &rp->states[h/2].out1 : &rp->states[h/2].out;
+}
+
+/* Point all the holes of the list to 'target'. */
+static void nfaPatch(struct regexParser *rp, int h, int target) {
+    while (h != -1) {
+        int *slot = nfaHole(rp,h);
+
+        h = *slot;
+        *slot = target;
+    }
+}
+
+/* Join two lists of holes. */
+static int nfaAppend(struct regexParser *rp, int h1, int h2) {
+    int h = h1;
+
+    if (h1 == -1) return h2;
+    while (*nfaHole(rp,h) != -1) h = *nfaHole(rp,h);
+    *nfaHole(rp,h) = h2;
+    return h1;
+}
+
+/* Fragment of a single state with its 'out' dangling. */
+static struct nfaFrag nfaFrag1(struct regexParser *rp, int op) {
+    struct nfaFrag f;
+
+    f.start = nfaNew(rp,op,-1,-1);
+    f.holes = f.start == -1 ? -1 : f.start*2;
+    return f;
+}
+
+/* Fragment matching one byte of the set 'set'. */
+static struct nfaFrag nfaSet(struct regexParser *rp, int set) {
+    struct nfaFrag f = nfaFrag1(rp,NFA_SET);
+
+    if (f.start != -1) rp->states[f.start].set = set;
+    return f;
+}
+
+static struct nfaFrag nfaConcat(struct regexParser *rp, struct nfaFrag a, struct nfaFrag b) {
+    nfaPatch(rp,a.holes,b.start);
+    a.holes = b.holes;
+    return a;
+}
+
+/* Return a new byte set, zeroed, or -1. */
+static int regexNewSet(struct regexParser *rp) {
+    if (rp->nsets == rp->setscap) {
+        int cap = rp->setscap ? rp->setscap*2 : 16;
+        unsigned char (*sets)[32] = lnRealloc(LN_POOL_MISC,rp->sets,sizeof(*sets)*cap);
+
+        if (sets == NULL) {
+            rp->err = ENOMEM;
+            return -1;
+        }
+        rp->sets = sets;
+        rp->setscap = cap;
+    }
+    memset(rp->sets[rp->nsets],0,32);
+    return rp->nsets++;
+}
+
+static void setAdd(unsigned char *set, int lo, int hi) {
+    for (; lo <= hi; lo++) set[lo/8] |= 1 << (lo%8);
+}
+
+static int setHas(const unsigned char *set, int c) {
+    return set[c/8] & (1 << (c%8));
+}
+
+/* Fragment matching one byte from 'lo' to 'hi'. */
+static struct nfaFrag nfaRange(struct regexParser *rp, int lo, int hi) {
+    int set = regexNewSet(rp);
+
+    if (set != -1) setAdd(rp->sets[set],lo,hi);
+    return nfaSet(rp,set);
+}
+
+/* Fragment matching either 'a' or 'b'. */
+static struct nfaFrag nfaAlt(struct regexParser *rp, struct nfaFrag a, struct nfaFrag b) {
+    struct nfaFrag f;
+
+    f.start = nfaNew(rp,NFA_SPLIT,a.start,b.start);
+    f.holes = nfaAppend(rp,a.holes,b.holes);
+    return f;
+}
+
+/* Fragment matching any UTF-8 character, or any single byte that is not
+ * part of a valid sequence. */
+static struct nfaFrag nfaAnyChar(struct regexParser *rp) {
+    static const int lead[5][2] = {{0,0},{0,0},{0xC0,0xDF},{0xE0,0xEF},{0xF0,0xF7}};
+    struct nfaFrag f = nfaRange(rp,0,0xBF), seq;
+    int len, j;
+
+    if (rp->err) return f;
+    setAdd(rp->sets[rp->nsets-1],0xF8,0xFF);
+    for (len = 2; len <= 4 && !rp->err; len++) {
+        seq = nfaRange(rp,lead[len][0],lead[len][1]);
+        for (j = 1; j < len && !rp->err; j++)
+            seq = nfaConcat(rp,seq,nfaRange(rp,0x80,0xBF));
+        if (!rp->err) f = nfaAlt(rp,f,seq);
+    }
+    return f;
+}
+
+/* Add the bytes of the [:name:] class at 'p' to 'set'. Returns the length
+ * of the name with the brackets, or 0 if it is not a class name. */
+static size_t regexNamedClass(const char *p, unsigned char *set) {
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        {"alpha",isalpha}, {"digit",isdigit}, {"alnum",isalnum},
+        {"space",isspace}, {"upper",isupper}, {"lower",islower},
+        {"punct",ispunct}, {"xdigit",isxdigit}, {"blank",isblank},
+        {"cntrl",iscntrl}, {"print",isprint}, {"graph",isgraph}
+    };
+    size_t j, len;
+    int c;
+
+    for (j = 0; j < sizeof(classes)/sizeof(classes[0]); j++) {
+        len = strlen(classes[j].name);
+        if (strncmp(p+2,classes[j].name,len) || strncmp(p+2+len,":]",2))
+            continue;
+        for (c = 0; c < 128; c++)
+            if (classes[j].fn(c)) setAdd(set,c,c);
+        return len+4;
+    }
+    return 0;
+}
+
+/* Parse the bracket expression after '['. */
+static struct nfaFrag regexBracket(struct regexParser *rp) {
+    struct nfaFrag none = { -1, -1 };
+    int set = regexNewSet(rp), negate = 0, first = 1, j;
+    unsigned char *s;
+
+    if (set == -1) return none;
+    s = rp->sets[set];
+    if (*rp->p == '^') {
+        negate = 1;
+        rp->p++;
+    }
+    while (*rp->p && (*rp->p != ']' || first)) {
+        int lo = (unsigned char)*rp->p, hi;
+        size_t n;
+
+        first = 0;
+        if (lo == '[' && rp->p[1] == ':' && (n = regexNamedClass(rp->p,s))) {
+            rp->p += n;
+            continue;
+        }
+        if (lo == '\\' && rp->p[1]) lo = (unsigned char)*++rp->p;
+        rp->p++;
+        hi = lo;
+        if (rp->p[0] == '-' && rp->p[1] && rp->p[1] != ']') {
+            rp->p++;
+            if (*rp->p == '\\' && rp->p[1]) rp->p++;
+            hi = (unsigned char)*rp->p++;
+            if (hi < lo) {
+                rp->err = EINVAL;
+                return none;
             }
+        }
+        setAdd(s,lo,hi);
+    }
+    if (*rp->p != ']') {
+        rp->err = EINVAL;
+        return none;
+    }
+    rp->p++;
+    if (negate) for (j = 0; j < 32; j++) s[j] = ~s[j];
+    return nfaSet(rp,set);
+}
+
+static struct nfaFrag regexAlternation(struct regexParser *rp);
+
+/* Parse a single atom. Literal atoms are also stored in rp->lit, for the
+ * literal prefilter. */
+static struct nfaFrag regexAtom(struct regexParser *rp) {
+    struct nfaFrag f = { -1, -1 };
+    int c = (unsigned char)*rp->p, len, j;
+
+    rp->litlen = 0;
+    switch(c) {
+    case '(':
+        rp->p++;
+        rp->depth++;
+        f = regexAlternation(rp);
+        rp->depth--;
+        rp->litlen = 0;
+        if (*rp->p != ')') {
+            rp->err = EINVAL;
+            return f;
+        }
+        rp->p++;
+        return f;
+    case '.':
+        rp->p++;
+        return nfaAnyChar(rp);
+    case '[':
+        rp->p++;
+        return regexBracket(rp);
+    case '^':
+        rp->p++;
+        return nfaFrag1(rp,NFA_BOL);
+    case '$':
+        rp->p++;
+        return nfaFrag1(rp,NFA_EOL);
+    case '*': case '+': case '?': case ')': case '\0':
+        rp->err = EINVAL;
+        return f;
+    case '\\':
+        if (rp->p[1] == '\0') {
+            rp->err = EINVAL;
+            return f;
+        }
+        c = (unsigned char)*++rp->p;
+        /* fall through */
+    default:
+        /* A multi byte character is a single atom for the operators. */
+        len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        for (j = 0; j < len; j++) {
+            int b = (unsigned char)rp->p[j];
+
+            if (j && (b & 0xC0) != 0x80) break;
+            rp->lit[j] = b;
+            f = j ? nfaConcat(rp,f,nfaRange(rp,b,b)) : nfaRange(rp,b,b);
+            if (rp->err) return f;
+        }
+        rp->litlen = j;
+        rp->p += j;
+        return f;
+    }
+}
+
+/* End the current run of literals, keeping it if it is the longest. */
+static void regexEndRun(struct regexParser *rp) {
+    if (rp->runlen > rp->bestlen) {
+        memcpy(rp->best,rp->run,rp->runlen);
+        rp->bestlen = rp->runlen;
+    }
+    rp->runlen = 0;
+}
+
+/* Parse an atom followed by any number of '*', '+' and '?'. */
+static struct nfaFrag regexRepeat(struct regexParser *rp) {
+    struct nfaFrag f = regexAtom(rp);
+    int op = 0;
+
+    while (!rp->err && (*rp->p == '*' || *rp->p == '+' || *rp->p == '?')) {
+        int s = nfaNew(rp,NFA_SPLIT,f.start,-1);
+
+        if (s == -1) break;
+        op = op ? '*' : *rp->p;
+        switch(*rp->p++) {
+        case '*':
+            nfaPatch(rp,f.holes,s);
+            f.start = s;
+            f.holes = s*2+1;
             break;
-        case CTRL_T:    /* ctrl-t, swaps current character with previous. */
-            {
-              int pcl, ncl;
-              char auxb[5];
-              
- 	      pcl = prevCharLen(l.buf,l.len,l.pos,NULL);
-	      ncl = nextCharLen(l.buf,l.len,l.pos,NULL);
-//            printf("[%d %d %d]\n", pcl, l.pos, ncl);
-	      // to perform a swap we need
-              // * nonzero char length to the left
-              // * not at the end of the line
-              if(pcl != 0 && l.pos != l.len && pcl < 5 && ncl < 5) {
-		// the actual transpose works like this
-		//
-		//           ,--- l.pos
-		//          v
-		// xxx [AAA] [BB] xxx
-		// xxx [BB] [AAA] xxx
-		memcpy(auxb, l.buf+l.pos-pcl, pcl);
-		memcpy(l.buf+l.pos-pcl, l.buf+l.pos, ncl);
-		memcpy(l.buf+l.pos-pcl+ncl, auxb, pcl);
-		l.pos += -pcl+ncl;
-		refreshLine(&l);
-              }
-            }
+        case '+':
+            nfaPatch(rp,f.holes,s);
+            f.holes = s*2+1;
             break;
-        case CTRL_B:     /* ctrl-b */
-            linenoiseEditMoveLeft(&l);
+        case '?':
+            f.start = s;
+            f.holes = nfaAppend(rp,f.holes,s*2+1);
             break;
-        case CTRL_F:     /* ctrl-f */
-            linenoiseEditMoveRight(&l);
+        }
+    }
+
+    /* Only literals outside of groups that must appear once are part of
+     * the runs. */
+    if (rp->depth == 0 && !rp->err) {
+        if (rp->litlen && (op == 0 || op == '+')) {
+            if (rp->runlen+rp->litlen > sizeof(rp->run)) regexEndRun(rp);
+            memcpy(rp->run+rp->runlen,rp->lit,rp->litlen);
+            rp->runlen += rp->litlen;
+            if (op == '+') regexEndRun(rp);
+        } else if (rp->litlen || op) {
+            regexEndRun(rp);
+        } else if (rp->states[f.start].op != NFA_BOL &&
+                   rp->states[f.start].op != NFA_EOL) {
+            regexEndRun(rp);
+        }
+    }
+    return f;
+}
+
+/* Parse a sequence of atoms, possibly empty. */
+static struct nfaFrag regexSequence(struct regexParser *rp) {
+    struct nfaFrag f = nfaFrag1(rp,NFA_JMP);
+
+    while (!rp->err && *rp->p && *rp->p != '|' && *rp->p != ')')
+        f = nfaConcat(rp,f,regexRepeat(rp));
+    if (rp->depth == 0) regexEndRun(rp);
+    return f;
+}
+
+static struct nfaFrag regexAlternation(struct regexParser *rp) {
+    struct nfaFrag f = regexSequence(rp);
+
+    while (!rp->err && *rp->p == '|') {
+        rp->p++;
+        if (rp->depth == 0) rp->alternation = 1;
+        f = nfaAlt(rp,f,regexSequence(rp));
+    }
+    return f;
+}
+
+/* The DFA states being built: the sorted NFA states of every DFA state,
+ * kept only for SET, EOL and MATCH states, with a hash table to find them
+ * again. */
+struct dfaBuilder {
+    struct regexParser *rp;
+    int start;                  /* NFA start state. */
+    int *stack, *mark, markgen; /* For the closures. */
+    int *list, listlen;         /* Set being computed. */
+    int **sets;                 /* NFA states of every DFA state. */
+    int *setlen;
+    int *hash, *chain;          /* Hash table of the sets. */
+    int hashsize;
+};
+
+/* Add to b->list the closure of NFA state 's', following '^' only at the
+ * start of the input. */
+static void dfaClosure(struct dfaBuilder *b, int s, int atstart) {
+    int sp = 0;
+
+    if (s == -1) return;
+    b->stack[sp++] = s;
+    while (sp) {
+        struct nfaState *st;
+
+        s = b->stack[--sp];
+        if (b->mark[s] == b->markgen) continue;
+        b->mark[s] = b->markgen;
+        st = &b->rp->states[s];
+        switch(st->op) {
+        case NFA_SPLIT:
+            if (st->out1 != -1) b->stack[sp++] = st->out1;
+            /* fall through */
+        case NFA_JMP:
+            if (st->out != -1) b->stack[sp++] = st->out;
             break;
-        case CTRL_P:    /* ctrl-p */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
+        case NFA_BOL:
+            if (atstart && st->out != -1) b->stack[sp++] = st->out;
             break;
-        case CTRL_N:    /* ctrl-n */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
+        default:
+            b->list[b->listlen++] = s;
             break;
-        case ESC:    /* escape sequence */
-            if (read(l.ifd,seq,1) == -1) break;
-            /* ESC ? sequences */
-            if (seq[0] != '[' && seq[0] != 'O') {
-                switch (seq[0]) {
-                case 'f':
-                    linenoiseEditMoveWordEnd(&l);
-                    break;
-                case 'b':
-                    linenoiseEditMoveWordStart(&l);
-                    break;
-                case 'd':
-                    linenoiseEditDeleteNextWord(&l);
-                    break;
-                }
-            } else {
-                if (read(l.ifd,seq+1,1) == -1) break;
-                /* ESC [ sequences. */
-                if (seq[0] == '[') {
-                    if (seq[1] >= '0' && seq[1] <= '9') {
-                        /* Extended escape, read additional byte. */
-                        if (read(l.ifd,seq+2,1) == -1) break;
-                        if (seq[2] == '~') {
-                            switch(seq[1]) {
-                            case '3': /* Delete key. */
-                                linenoiseEditDelete(&l);
-                                break;
-                            }
-                        }
-			else if(seq[2] == ';') {
-				if (read(l.ifd,seq,2) == -1) break;
-				if (seq[0] == '5' && seq[1] == 'C') linenoiseEditMoveWordEnd(&l);
-				if (seq[0] == '5' && seq[1] == 'D') linenoiseEditMoveWordStart(&l);
-			}
-                    } else {
-                        switch(seq[1]) {
-                        case 'A': /* Up */
-                            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
-                            break;
-                        case 'B': /* Down */
-                            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
-                            break;
-                        case 'C': /* Right */
-                            linenoiseEditMoveRight(&l);
-                            break;
-                        case 'D': /* Left */
-                            linenoiseEditMoveLeft(&l);
-                            break;
-                        case 'H': /* Home */
-                            linenoiseEditMoveHome(&l);
-                            break;
-                        case 'F': /* End*/
-                            linenoiseEditMoveEnd(&l);
-                            break;
-                        case 'd': /* End*/
-                            linenoiseEditDeleteNextWord(&l);
-                            break;
-                        case '1': /* Home */
-                            linenoiseEditMoveHome(&l);
-                            break;
-                        case '4': /* End */
-                            linenoiseEditMoveEnd(&l);
-                            break;
-                        }
-                    }
-                }
-                /* ESC O sequences. */
-                else if (seq[0] == 'O') {
-                    switch(seq[1]) {
-                    case 'A': /* Up */
-                        linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
-                        break;
-                    case 'B': /* Down */
-                        linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
-                        break;
-                    case 'C': /* Right */
-                        linenoiseEditMoveRight(&l);
-                        break;
-                    case 'D': /* Left */
-                        linenoiseEditMoveLeft(&l);
-                        break;
-                    case 'H': /* Home */
-                        linenoiseEditMoveHome(&l);
-                        break;
-                    case 'F': /* End*/
-                        linenoiseEditMoveEnd(&l);
-                        break;
-                    }
+        }
+    }
+}
+
+/* Return non zero if a match ends at the end of the input from NFA state
+ * 's'. The closure computed by the caller is complete, so the marks can be
+ * used again. */
+static int dfaAcceptsAtEnd(struct dfaBuilder *b, int s) {
+    int sp = 0;
+
+    b->markgen++;
+    b->stack[sp++] = s;
+    while (sp) {
+        struct nfaState *st;
+
+        s = b->stack[--sp];
+        if (s == -1 || b->mark[s] == b->markgen) continue;
+        b->mark[s] = b->markgen;
+        st = &b->rp->states[s];
+        switch(st->op) {
+        case NFA_MATCH:
+            return 1;
+        case NFA_SPLIT:
+            b->stack[sp++] = st->out1;
+            /* fall through */
+        case NFA_JMP:
+        case NFA_EOL:
+            b->stack[sp++] = st->out;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int intCompare(const void *a, const void *b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+static unsigned int dfaHash(const int *list, int len) {
+    unsigned int h = 2166136261u;
+    int j;
+
+    for (j = 0; j < len; j++) h = (h ^ (unsigned int)list[j]) * 16777619u;
+    return h;
+}
+
+/* Return the DFA state for the set in b->list, adding it if new, or -1. */
+static int dfaState(struct dfaBuilder *b, linenoiseRegex *re) {
+    unsigned int h;
+    int d, j, flags = 0;
+
+    qsort(b->list,b->listlen,sizeof(int),intCompare);
+    h = dfaHash(b->list,b->listlen) & (b->hashsize-1);
+    for (d = b->hash[h]; d != -1; d = b->chain[d]) {
+        if (b->setlen[d] == b->listlen &&
+            !memcmp(b->sets[d],b->list,sizeof(int)*b->listlen)) return d;
+    }
+    if (re->nstates == LINENOISE_REGEX_MAX_STATES) {
+        b->rp->err = E2BIG;
+        return -1;
+    }
+    d = re->nstates;
+    b->sets[d] = lnMalloc(LN_POOL_MISC,sizeof(int)*(b->listlen ? b->listlen : 1));
+    if (b->sets[d] == NULL) {
+        b->rp->err = ENOMEM;
+        return -1;
+    }
+    memcpy(b->sets[d],b->list,sizeof(int)*b->listlen);
+    b->setlen[d] = b->listlen;
+    b->chain[d] = b->hash[h];
+    b->hash[h] = d;
+
+    /* Flags: a MATCH state accepts, an EOL state accepts if its closure
+     * at the end of the input does. */
+    if (b->listlen == 0) flags |= REGEX_DEAD;
+    for (j = 0; j < b->listlen; j++) {
+        struct nfaState *st = &b->rp->states[b->list[j]];
+
+        if (st->op == NFA_MATCH) flags |= REGEX_ACCEPT;
+        if (st->op == NFA_EOL && dfaAcceptsAtEnd(b,st->out))
+            flags |= REGEX_ACCEPT_EOL;
+    }
+    re->flags[d] = flags;
+    re->nstates++;
+    return d;
+}
+
+/* Compute the byte classes: consecutive bytes that belong to the same
+ * sets are in the same class. */
+static void regexClasses(struct regexParser *rp, linenoiseRegex *re) {
+    int c, j;
+
+    re->ncls = 1;
+    re->cls[0] = 0;
+    for (c = 1; c < 256; c++) {
+        for (j = 0; j < rp->nsets; j++)
+            if (!setHas(rp->sets[j],c) != !setHas(rp->sets[j],c-1)) break;
+        if (j < rp->nsets) re->ncls++;
+        re->cls[c] = re->ncls-1;
+    }
+}
+
+/* Build the DFA of the NFA starting at 'start', by subset construction.
+ * A search matches anywhere, so every step also restarts the NFA. */
+static int regexBuild(struct regexParser *rp, linenoiseRegex *re, int start) {
+    struct dfaBuilder b;
+    int d, c, j, ret = -1, transcap = 0;
+    unsigned char rep[256];
+
+    memset(&b,0,sizeof(b));
+    b.rp = rp;
+    b.start = start;
+    b.hashsize = 1;
+    while (b.hashsize < LINENOISE_REGEX_MAX_STATES*2) b.hashsize *= 2;
+    b.stack = lnMalloc(LN_POOL_MISC,sizeof(int)*(rp->len*2+1));
+    b.mark = lnCalloc(LN_POOL_MISC,rp->len,sizeof(int));
+    b.list = lnMalloc(LN_POOL_MISC,sizeof(int)*rp->len);
+    b.sets = lnCalloc(LN_POOL_MISC,LINENOISE_REGEX_MAX_STATES,sizeof(int*));
+    b.setlen = lnMalloc(LN_POOL_MISC,sizeof(int)*LINENOISE_REGEX_MAX_STATES);
+    b.chain = lnMalloc(LN_POOL_MISC,sizeof(int)*LINENOISE_REGEX_MAX_STATES);
+    b.hash = lnMalloc(LN_POOL_MISC,sizeof(int)*b.hashsize);
+    re->flags = lnMalloc(LN_POOL_MISC,LINENOISE_REGEX_MAX_STATES);
+    if (!b.stack || !b.mark || !b.list || !b.sets || !b.setlen ||
+        !b.chain || !b.hash || !re->flags)
+    {
+        rp->err = ENOMEM;
+        goto done;
+    }
+    for (j = 0; j < b.hashsize; j++) b.hash[j] = -1;
+
+    regexClasses(rp,re);
+    for (c = 255; c >= 0; c--) rep[re->cls[c]] = c;
+
+    b.markgen++;
+    b.listlen = 0;
+    dfaClosure(&b,start,1);
+    if (dfaState(&b,re) == -1) goto done;
+
+    for (d = 0; d < re->nstates; d++) {
+        if (d == transcap) {
+            int *trans;
+
+            transcap = transcap ? transcap*2 : 16;
+            trans = lnRealloc(LN_POOL_MISC,re->trans,sizeof(int)*re->ncls*transcap);
+            if (trans == NULL) {
+                rp->err = ENOMEM;
+                goto done;
+            }
+            re->trans = trans;
+        }
+        for (c = 0; c < re->ncls; c++) {
+            int next = d;
+
+            /* A search stops at the first accepting state. */
+            if (!(re->flags[d] & REGEX_ACCEPT)) {
+                b.markgen++;
+                b.listlen = 0;
+                for (j = 0; j < b.setlen[d]; j++) {
+                    struct nfaState *st = &rp->states[b.sets[d][j]];
+
+                    if (st->op == NFA_SET && setHas(rp->sets[st->set],rep[c]))
+                        dfaClosure(&b,st->out,0);
                 }
+                dfaClosure(&b,start,0);
+                if ((next = dfaState(&b,re)) == -1) goto done;
             }
-            break;
-        default:
-            if (linenoiseEditInsert(&l,cbuf,nread)) return -1;
-            break;
-        case CTRL_U: /* Ctrl+u, delete the whole line. */
-            buf[0] = '\0';
-            l.pos = l.len = 0;
-            refreshLine(&l);
-            break;
-        case CTRL_K: /* Ctrl+k, delete from current to end of line. */
-            buf[l.pos] = '\0';
-            l.len = l.pos;
-            refreshLine(&l);
-            break;
-        case CTRL_A: /* Ctrl+a, go to the start of the line */
-            linenoiseEditMoveHome(&l);
-            break;
-        case CTRL_E: /* ctrl+e, go to the end of the line */
-            linenoiseEditMoveEnd(&l);
-            break;
-        case CTRL_L: /* ctrl+l, clear screen */
-            linenoiseClearScreen();
-            refreshLine(&l);
-            break;
-        case CTRL_W: /* ctrl+w, delete previous word */
-            linenoiseEditDeletePrevWord(&l);
-            break;
+            re->trans[d*re->ncls+c] = next;
+        }
+    }
+    ret = 0;
+
+done:
+    for (d = 0; b.sets && d < re->nstates; d++) lnFree(b.sets[d]);
+    lnFree(b.stack);
+    lnFree(b.mark);
+    lnFree(b.list);
+    lnFree(b.sets);
+    lnFree(b.setlen);
+    lnFree(b.chain);
+    lnFree(b.hash);
+    return ret;
+}
+
+/* Free a regular expression compiled by linenoiseRegexCompile(). */
+void linenoiseRegexFree(linenoiseRegex *re) {
+    if (re == NULL) return;
+    lnFree(re->trans);
+    lnFree(re->flags);
+    lnFree(re);
+}
+
+/* Compile 'pattern' into a DFA. Returns NULL with errno set to EINVAL on
+ * syntax errors, to E2BIG if the DFA would have more than
+ * LINENOISE_REGEX_MAX_STATES states, or to ENOMEM. */
+linenoiseRegex *linenoiseRegexCompile(const char *pattern) {
+    struct regexParser rp;
+    linenoiseRegex *re;
+    struct nfaFrag f;
+    int match;
+
+    memset(&rp,0,sizeof(rp));
+    rp.p = pattern;
+    if ((re = lnCalloc(LN_POOL_MISC,1,sizeof(*re))) == NULL) return NULL;
+    f = regexAlternation(&rp);
+    if (!rp.err && *rp.p != '\0') rp.err = EINVAL;
+    if (!rp.err && (match = nfaNew(&rp,NFA_MATCH,-1,-1)) != -1)
+        nfaPatch(&rp,f.holes,match);
+    if (!rp.err) regexBuild(&rp,re,f.start);
+    if (!rp.alternation) {
+        memcpy(re->lit,rp.best,rp.bestlen);
+        re->litlen = rp.bestlen;
+    }
+    lnFree(rp.states);
+    lnFree(rp.sets);
+    if (rp.err) {
+        linenoiseRegexFree(re);
+        errno = rp.err;
+        return NULL;
+    }
+    return re;
+}
+
+/* Run the DFA over 'len' bytes of 's'. Returns non zero on match, setting
+ * '*end' to the offset where the first match to complete ends. */
+static int regexExec(const linenoiseRegex *re, const char *s, size_t len, size_t *end) {
+    const unsigned char *p = (const unsigned char *)s;
+    int d = 0;
+    size_t j;
+
+    if (re->litlen && !substrFind(s,len,re->lit,re->litlen)) return 0;
+    for (j = 0; j < len; j++) {
+        if (re->flags[d] & (REGEX_ACCEPT|REGEX_DEAD)) break;
+        d = re->trans[d*re->ncls+re->cls[p[j]]];
+    }
+    if (re->flags[d] & REGEX_ACCEPT) {
+        *end = j;
+        return 1;
+    }
+    if (j == len && (re->flags[d] & REGEX_ACCEPT_EOL)) {
+        *end = len;
+        return 1;
+    }
+    return 0;
+}
+
+/* Return non zero if the regular expression matches a part of 'str'. */
+int linenoiseRegexMatch(const linenoiseRegex *re, const char *str) {
+    size_t end;
+
+    return regexExec(re,str,strlen(str),&end);
+}
+
+/* =========================== Line editing ================================= */
+
+/* We define a very simple "append buffer" structure, that collects all the
+ * escape sequences and text of a refresh so that they are flushed to the
+ * standard output in a single call, to avoid flickering effects.
+ *
+ * Only the escape sequences we generate are copied, into a small heap
+ * allocated area. The prompt, the edited buffer and the hint are just
+ * referenced by the iovec array and handed directly to writev(), so that
+ * refreshing a long line does not copy it. Since 'seqs' may be moved by
+ * realloc(), copied chunks are stored as offsets and only resolved to
+ * pointers by abWrite(). A refresh with more chunks than LINENOISE_MAX_IOV,
+ * which must not exceed IOV_MAX, is flushed with one writev() every time
+ * the array fills. */
+#ifndef LINENOISE_MAX_IOV
+#define LINENOISE_MAX_IOV 64
+#endif
+#define ABUF_REF ((size_t)-1)
+
+struct abuf {
+    int fd;                         /* Where the buffer is written. */
+    struct iovec iov[LINENOISE_MAX_IOV];
+    size_t off[LINENOISE_MAX_IOV];  /* Offset in 'seqs' or ABUF_REF. */
+    int iovcnt;
+    char *seqs;                     /* Copied escape sequences. */
+    unsigned int len;               /* Bytes used in 'seqs'. */
+    unsigned int cap;               /* Bytes allocated in 'seqs'. */
+    char *hint;                     /* Hint to free after the write. */
+};
+
+static void abInit(struct abuf *ab, int fd) {
+    ab->fd = fd;
+    ab->iovcnt = 0;
+    ab->seqs = NULL;
+    ab->len = ab->cap = 0;
+    ab->hint = NULL;
+}
+
+/* Flush the buffer to its file descriptor with a single writev(), and
+ * empty it. */
+static ssize_t abWrite(struct abuf *ab) {
+    ssize_t nwritten;
+    int j;
+
+    for (j = 0; j < ab->iovcnt; j++)
+        if (ab->off[j] != ABUF_REF) ab->iov[j].iov_base = ab->seqs+ab->off[j];
+    nwritten = writev(ab->fd,ab->iov,ab->iovcnt);
+    ab->iovcnt = 0;
+    ab->len = 0;
+    return nwritten;
+}
+
+/* Append a copy of 's' to the buffer. */
+static void abAppend(struct abuf *ab, const char *s, unsigned int len) {
+    struct iovec *last = ab->iovcnt ? &ab->iov[ab->iovcnt-1] : NULL;
+
+    if (len == 0) return;
+    /* Grow the last chunk if it ends where this one starts, otherwise a
+     * new one is needed. */
+    if (last && (ab->off[ab->iovcnt-1] == ABUF_REF ||
+                 ab->off[ab->iovcnt-1]+last->iov_len != ab->len))
+    {
+        last = NULL;
+        if (ab->iovcnt == LINENOISE_MAX_IOV &&
+            abWrite(ab) == -1) {} /* Can't recover from write error. */
+    }
+    if (ab->len+len > ab->cap) {
+        unsigned int cap = ab->cap ? ab->cap*2 : 64;
+        char *new;
+
+        while (cap < ab->len+len) cap *= 2;
+        new = lnRealloc(LN_POOL_OUTPUT,ab->seqs,cap);
+        if (new == NULL) return;
+        ab->seqs = new;
+        ab->cap = cap;
+    }
+    memcpy(ab->seqs+ab->len,s,len);
+    if (last) {
+        last->iov_len += len;
+    } else {
+        ab->off[ab->iovcnt] = ab->len;
+        ab->iov[ab->iovcnt].iov_len = len;
+        ab->iovcnt++;
+    }
+    ab->len += len;
+}
+
+/* Append 's' without copying it: it must stay valid until abFree(). */
+static void abAppendRef(struct abuf *ab, const char *s, unsigned int len) {
+    struct iovec *last = ab->iovcnt ? &ab->iov[ab->iovcnt-1] : NULL;
+
+    if (len == 0) return;
+    /* Grow the last reference if it ends where this one starts. */
+    if (last && ab->off[ab->iovcnt-1] == ABUF_REF &&
+        (const char *)last->iov_base+last->iov_len == s)
+    {
+        last->iov_len += len;
+        return;
+    }
+    if (ab->iovcnt == LINENOISE_MAX_IOV &&
+        abWrite(ab) == -1) {} /* Can't recover from write error. */
+    ab->off[ab->iovcnt] = ABUF_REF;
+    ab->iov[ab->iovcnt].iov_base = (void*)s;
+    ab->iov[ab->iovcnt].iov_len = len;
+    ab->iovcnt++;
+}
+
+static void abFree(struct abuf *ab) {
+    lnFree(ab->seqs);
+    /* Call the function to free the hint returned. */
+    if (ab->hint && freeHintsCallback) freeHintsCallback(ab->hint);
+}
+
+/* Append 'len' bytes of the edited buffer from offset 'start', with the
+ * matching bracket highlighted if it is in that range. Only its cell gets
+ * escape sequences, the rest of the text is still referenced. */
+static void abAppendText(struct abuf *ab, struct linenoiseState *l, size_t start, size_t len) {
+    size_t hl = l->hlpos;
+
+    if (hl == LINENOISE_NOMATCH || hl < start || hl >= start+len) {
+        abAppendRef(ab,l->buf+start,len);
+        return;
+    }
+    abAppendRef(ab,l->buf+start,hl-start);
+    abAppend(ab,"\x1b[7m",4);
+    abAppendRef(ab,l->buf+hl,1);
+    abAppend(ab,"\x1b[0m",4);
+    abAppendRef(ab,l->buf+hl+1,start+len-hl-1);
+}
+
+/* Helper of refreshSingleLine() and refreshMultiLine() to show hints
+ * to the right of the prompt, where 'collen' is the column after the
+ * text. Returns the number of columns used by the hint. */
+static size_t refreshShowHints(struct abuf *ab, struct linenoiseState *l, size_t collen) {
+    char seq[64];
+    /* The description of the completion shown replaces the hint, if it
+     * fits in the line. */
+    if (l->compdesc) {
+        if (collen+1+l->compdescwidth > l->cols) return 0;
+        abAppend(ab," \033[2m",5);
+        abAppendRef(ab,l->compdesc,strlen(l->compdesc));
+        abAppend(ab,"\033[0m",4);
+        return 1+l->compdescwidth;
+    }
+    if (hintsCallback && collen < l->cols) {
+        int color = -1, bold = 0;
+        uint64_t span = traceStart();
+        char *hint = hintsCallback(l->buf,&color,&bold);
+        lnspan(SPAN_HINTS_CALLBACK,span,l->cols,l->len,l->pos);
+        if (hint) {
+            int hintlen = strlen(hint);
+            int hintmaxlen = l->cols-collen;
+            if (hintlen > hintmaxlen) hintlen = hintmaxlen;
+            if (bold == 1 && color == -1) color = 37;
+            if (color != -1 || bold != 0)
+                snprintf(seq,64,"\033[%d;%d;49m",bold,color);
+            else
+                seq[0] = '\0';
+            abAppend(ab,seq,strlen(seq));
+            abAppendRef(ab,hint,hintlen);
+            if (color != -1 || bold != 0)
+                abAppend(ab,"\033[0m",4);
+            /* The hint is referenced until the buffer is written. */
+            ab->hint = hint;
+            return hintlen;
+        }
+    }
+    return 0;
+}
+
+/* Check if text is an ANSI escape sequence
+ */
+static int isAnsiEscape(const char *buf, size_t buf_len, size_t* len) {
+    if (buf_len > 2 && !memcmp("\033[", buf, 2)) {
+        size_t off = 2;
+        while (off < buf_len) {
+            switch (buf[off++]) {
+            case 'A': case 'B': case 'C': case 'D': case 'E':
+            case 'F': case 'G': case 'H': case 'J': case 'K':
+            case 'S': case 'T': case 'f': case 'm':
+                *len = off;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Get column length of prompt text
+ */
+static size_t promptTextColumnLen(const char *prompt, size_t plen) {
+    char buf[LINENOISE_MAX_LINE];
+    size_t buf_len = 0;
+    size_t off = 0;
+    while (off < plen) {
+        size_t len;
+        if (isAnsiEscape(prompt + off, plen - off, &len)) {
+            off += len;
+            continue;
+        }
+        buf[buf_len++] = prompt[off++];
+    }
+    return columnPos(buf,buf_len,buf_len);
+}
+
+/* Single line low level line refresh.
+ *
+ * Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. */
+static void refreshSingleLine(struct linenoiseState *l) {
+    char seq[64];
+    uint64_t span = traceStart();
+    size_t pcollen = l->pcollen;
+    int fd = l->ofd;
+    char *buf = l->buf;
+    size_t len = l->len;
+    size_t pos = l->pos;
+    size_t poscol, lencol, col_len, used;
+    struct abuf ab;
+
+    /* Columns are computed once, then adjusted while scrolling the text
+     * left until the cursor fits, and cutting what does not fit on the
+     * right. */
+    poscol = columnPos(buf,len,pos);
+    lencol = poscol+columnPos(buf+pos,len-pos,len-pos);
+    while (pcollen+poscol >= l->cols && pos > 0) {
+        int chlen = nextCharLen(buf,len,0,&col_len);
+        buf += chlen;
+        len -= chlen;
+        pos -= chlen;
+        poscol -= col_len;
+        lencol -= col_len;
+    }
+    while (pcollen+lencol > l->cols && len > pos) {
+        len -= prevCharLen(buf,len,len,&col_len);
+        lencol -= col_len;
+    }
+
+    abInit(&ab,fd);
+    /* Cursor to left edge */
+    snprintf(seq,64,"\r");
+    abAppend(&ab,seq,strlen(seq));
+    /* Write the prompt and the current buffer content */
+    abAppendRef(&ab,l->prompt,strlen(l->prompt));
+    abAppendText(&ab,l,buf-l->buf,len);
+    /* Show hits if any. */
+    used = pcollen+lencol;
+    used += refreshShowHints(&ab,l,used);
+    /* Erase to right */
+    snprintf(seq,64,"\x1b[0K");
+    abAppend(&ab,seq,strlen(seq));
+    /* Show the right prompt if it fits, leaving the last column free. */
+    if (rprompt && used+rpromptcols+1 < l->cols) {
+        snprintf(seq,64,"\r\x1b[%dC", (int)(l->cols-rpromptcols-1));
+        abAppend(&ab,seq,strlen(seq));
+        abAppendRef(&ab,rprompt,strlen(rprompt));
+    }
+    /* Show the status line in the row below, or clear it. */
+    if (statusline && statuscols < l->cols) {
+        abAppend(&ab,"\n\r",2);
+        abAppendRef(&ab,statusline,strlen(statusline));
+        abAppend(&ab,"\x1b[0K\x1b[1A",8);
+        l->statusshown = 1;
+    } else if (l->statusshown) {
+        abAppend(&ab,"\n\r\x1b[0K\x1b[1A",10);
+        l->statusshown = 0;
+    }
+    /* Move cursor to original position. */
+    if (poscol+pcollen)
+        snprintf(seq,64,"\r\x1b[%dC", (int)(poscol+pcollen));
+    else
+        snprintf(seq,64,"\r");
+    abAppend(&ab,seq,strlen(seq));
+    lntrace(LINENOISE_TRACE_REFRESH_SINGLE,l->len,l->pos,l->cols,pcollen,
+            buf-l->buf);
+    if (abWrite(&ab) == -1) {} /* Can't recover from write error. */
+    abFree(&ab);
+    lnspan(SPAN_REFRESH_SINGLE,span,l->cols,l->len,l->pos);
+}
+
+/* Multi line low level line refresh.
+ *
+ * Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. */
+static void refreshMultiLine(struct linenoiseState *l) {
+    char seq[64];
+    uint64_t span = traceStart();
+    size_t pcollen = l->pcollen;
+    int colpos = columnPosForMultiLine(l->buf, l->len, l->len, l->cols, pcollen);
+    int colpos2; /* cursor column position. */
+    int rows = (pcollen+colpos+l->cols-1)/l->cols; /* rows used by current buf. */
+    int rpos = l->oldrpos; /* cursor relative row. */
+    int rpos2; /* rpos after refresh. */
+    int col; /* column position, zero-based. */
+    int old_rows = l->maxrows;
+    int fd = l->ofd, j;
+    struct abuf ab;
+
+    /* Update maxrows if needed. */
+    if (rows > (int)l->maxrows) l->maxrows = rows;
+
+    /* First step: clear all the lines used before. To do so start by
+     * going to the last row. */
+    abInit(&ab,fd);
+    if (old_rows-rpos > 0) {
+        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
+        abAppend(&ab,seq,strlen(seq));
+    }
+
+    /* Now for every row clear it, go up. */
+    for (j = 0; j < old_rows-1; j++) {
+        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
+        abAppend(&ab,seq,strlen(seq));
+    }
+
+    /* Clean the top line. */
+    snprintf(seq,64,"\r\x1b[0K");
+    abAppend(&ab,seq,strlen(seq));
+
+    /* Write the prompt and the current buffer content */
+    abAppendRef(&ab,l->prompt,strlen(l->prompt));
+    abAppendText(&ab,l,0,l->len);
+
+    /* Show hits if any. */
+    refreshShowHints(&ab,l,pcollen+columnPos(l->buf,l->len,l->len));
+
+    /* Get column length to cursor position */
+    colpos2 = columnPosForMultiLine(l->buf,l->len,l->pos,l->cols,pcollen);
+
+    /* If we are at the very end of the screen with our prompt, we need to
+     * emit a newline and move the prompt to the first column. */
+    if (l->pos &&
+        l->pos == l->len &&
+        (colpos2+pcollen) % l->cols == 0)
+    {
+        abAppend(&ab,"\n",1);
+        snprintf(seq,64,"\r");
+        abAppend(&ab,seq,strlen(seq));
+        rows++;
+        if (rows > (int)l->maxrows) l->maxrows = rows;
+    }
+
+    /* Show the status line in the row below the last one. */
+    l->statusshown = 0;
+    if (statusline && statuscols < l->cols) {
+        abAppend(&ab,"\n\r",2);
+        abAppendRef(&ab,statusline,strlen(statusline));
+        abAppend(&ab,"\x1b[0K",4);
+        rows++;
+        if (rows > (int)l->maxrows) l->maxrows = rows;
+        l->statusshown = 1;
+    }
+
+    /* Move cursor to right position. */
+    rpos2 = (pcollen+colpos2+l->cols)/l->cols; /* current cursor relative row. */
+
+    /* Go up till we reach the expected positon. */
+    if (rows-rpos2 > 0) {
+        snprintf(seq,64,"\x1b[%dA", rows-rpos2);
+        abAppend(&ab,seq,strlen(seq));
+    }
+
+    /* Set column. */
+    col = (pcollen + colpos2) % l->cols;
+    if (col)
+        snprintf(seq,64,"\r\x1b[%dC", col);
+    else
+        snprintf(seq,64,"\r");
+    abAppend(&ab,seq,strlen(seq));
+
+    l->oldrpos = rpos2;
+
+    lntrace(LINENOISE_TRACE_REFRESH_MULTI,rows,old_rows,rpos,rpos2,col);
+    if (abWrite(&ab) == -1) {} /* Can't recover from write error. */
+    abFree(&ab);
+    lnspan(SPAN_REFRESH_MULTI,span,l->cols,l->len,l->pos);
+}
+
+/* Refresh of a buffer holding several lines separated by newlines.
+ *
+ * Every line starts on a new row, and wraps like in multi line mode. The
+ * line of the cursor is found with the line index, so that its row and
+ * column are computed from the start of its line, not of the buffer. */
+static void refreshLines(struct linenoiseState *l) {
+    char seq[64];
+    uint64_t span = traceStart();
+    size_t pcollen = l->pcollen;
+    size_t k, cline = lineOf(l,l->pos);
+    int rows = 0; /* rows used by current buf. */
+    int crow = 0, col = 0; /* cursor row and column, zero-based. */
+    int rpos = l->oldrpos; /* cursor relative row. */
+    int old_rows = l->maxrows;
+    int fd = l->ofd, j;
+    struct abuf ab;
+
+    /* First step: clear all the lines used before, like in
+     * refreshMultiLine(). */
+    abInit(&ab,fd);
+    if (old_rows-rpos > 0) {
+        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
+        abAppend(&ab,seq,strlen(seq));
+    }
+    for (j = 0; j < old_rows-1; j++) {
+        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
+        abAppend(&ab,seq,strlen(seq));
+    }
+    snprintf(seq,64,"\r\x1b[0K");
+    abAppend(&ab,seq,strlen(seq));
+
+    /* Write the prompt and every line, computing the rows they take. */
+    abAppendRef(&ab,l->prompt,strlen(l->prompt));
+    for (k = 0; k < l->nlines; k++) {
+        size_t start = lineStart(l,k), end = lineEnd(l,k);
+        size_t ini = k ? 0 : pcollen;
+        int colpos = columnPosForMultiLine(l->buf+start,end-start,end-start,l->cols,ini);
+        int lrows = (ini+colpos+l->cols-1)/l->cols;
+
+        if (k == cline) {
+            int colpos2 = columnPosForMultiLine(l->buf+start,end-start,
+                                                l->pos-start,l->cols,ini);
+            crow = rows + (ini+colpos2)/l->cols;
+            col = (ini+colpos2) % l->cols;
+        }
+        if (k) abAppend(&ab,"\r\n",2);
+        abAppendText(&ab,l,start,end-start);
+        rows += lrows ? lrows : 1;
+    }
+
+    /* If the cursor is past the end of the last row, we need to emit a
+     * newline and move to the first column. */
+    if (crow >= rows) {
+        abAppend(&ab,"\n\r",2);
+        rows = crow+1;
+    }
+
+    /* Show the status line in the row below the last one. */
+    l->statusshown = 0;
+    if (statusline && statuscols < l->cols) {
+        abAppend(&ab,"\n\r",2);
+        abAppendRef(&ab,statusline,strlen(statusline));
+        abAppend(&ab,"\x1b[0K",4);
+        rows++;
+        l->statusshown = 1;
+    }
+    if (rows > (int)l->maxrows) l->maxrows = rows;
+
+    /* Go up till we reach the cursor row, and set the column. */
+    if (rows-1-crow > 0) {
+        snprintf(seq,64,"\x1b[%dA", rows-1-crow);
+        abAppend(&ab,seq,strlen(seq));
+    }
+    if (col)
+        snprintf(seq,64,"\r\x1b[%dC", col);
+    else
+        snprintf(seq,64,"\r");
+    abAppend(&ab,seq,strlen(seq));
+    l->oldrpos = crow+1;
+
+    lntrace(LINENOISE_TRACE_REFRESH_MULTI,rows,old_rows,rpos,crow+1,col);
+    if (abWrite(&ab) == -1) {} /* Can't recover from write error. */
+    abFree(&ab);
+    lnspan(SPAN_REFRESH_MULTI,span,l->cols,l->len,l->pos);
+}
+
+/* Calls the low level functions refreshSingleLine() or refreshMultiLine()
+ * according to the selected mode, or refreshLines() when the buffer holds
+ * several lines. Once more rows were used, we keep refreshing them all. */
+static void refreshLine(struct linenoiseState *l) {
+    if (l->batch) return;
+    l->hlpos = bracketMatch(l);
+    if (l->nlines > 1)
+        refreshLines(l);
+    else if (mlmode || l->maxrows > 1)
+        refreshMultiLine(l);
+    else
+        refreshSingleLine(l);
+}
+
+/* Force a refresh without hints and status line to leave the previous
+ * line as the user typed it after a newline. */
+static void refreshFinal(struct linenoiseState *l) {
+    linenoiseHintsCallback *hc = hintsCallback;
+    char *status = statusline;
+
+    if (hc == NULL && !l->statusshown) return;
+    hintsCallback = NULL;
+    statusline = NULL;
+    refreshLine(l);
+    hintsCallback = hc;
+    statusline = status;
+}
+
+/* Insert the character 'c' at cursor current position.
+ *
+ * On error writing to the terminal -1 is returned, otherwise 0. */
+static int linenoiseEditInsert(struct linenoiseState *l, const char *cbuf, int clen) {
+    if (l->len+clen <= l->buflen) {
+        if (l->len == l->pos) {
+            memcpy(&l->buf[l->pos],cbuf,clen);
+            indexEdit(l,l->pos,0,clen);
+            l->pos+=clen;
+            l->len+=clen;;
+            l->buf[l->len] = '\0';
+            if ((!mlmode && l->nlines == 1 && l->pcollen+columnPos(l->buf,l->len,l->len)+(rprompt ? rpromptcols+1 : 0) < l->cols && !hintsCallback) &&
+                l->hlpos == LINENOISE_NOMATCH && bracketMatch(l) == LINENOISE_NOMATCH && !l->batch) {
+                /* Avoid a full update of the line in the
+                 * trivial case. */
+                if (write(l->ofd,cbuf,clen) == -1) return -1;
+            } else {
+                refreshLine(l);
+            }
+        } else {
+            memmove(l->buf+l->pos+clen,l->buf+l->pos,l->len-l->pos);
+            memcpy(&l->buf[l->pos],cbuf,clen);
+            indexEdit(l,l->pos,0,clen);
+            l->pos+=clen;
+            l->len+=clen;
+            l->buf[l->len] = '\0';
+            refreshLine(l);
+        }
+    }
+    return 0;
+}
+
+/* Move cursor on the left. */
+static void linenoiseEditMoveLeft(struct linenoiseState *l) {
+    if (l->pos > 0) {
+        l->pos -= prevCharLen(l->buf,l->len,l->pos,NULL);
+        refreshLine(l);
+    }
+}
+
+/* Move cursor on the right. */
+static void linenoiseEditMoveRight(struct linenoiseState *l) {
+    if (l->pos != l->len) {
+        l->pos += nextCharLen(l->buf,l->len,l->pos,NULL);
+        refreshLine(l);
+    }
+}
+
+/* Move cursor to the end of the current word, or of the next one. */
+static void linenoiseEditMoveWordEnd(struct linenoiseState *l) {
+    if (l->pos >= l->len) return;
+    l->pos = wordEnd(l);
+    refreshLine(l);
+}
+
+/* Move cursor to the start of the current word, or of the previous one. */
+static void linenoiseEditMoveWordStart(struct linenoiseState *l) {
+    if (l->pos == 0) return;
+    l->pos = wordStart(l);
+    refreshLine(l);
+}
+
+#define LINENOISE_HISTORY_NEXT 0
+#define LINENOISE_HISTORY_PREV 1
+
+/* Move cursor to the start of the line. */
+static void linenoiseEditMoveHome(struct linenoiseState *l) {
+    size_t start = lineStart(l,lineOf(l,l->pos));
+
+    if (l->pos != start) {
+        l->pos = start;
+        refreshLine(l);
+    }
+}
+
+/* Move cursor to the end of the line. */
+static void linenoiseEditMoveEnd(struct linenoiseState *l) {
+    size_t end = lineEnd(l,lineOf(l,l->pos));
+
+    if (l->pos != end) {
+        l->pos = end;
+        refreshLine(l);
+    }
+}
+
+/* Move cursor to the previous or next line of the buffer as specified by
+ * 'dir', at the same column if possible. Returns 0 if there is no such
+ * line, so that the caller can browse the history instead. */
+static int linenoiseEditMoveLine(struct linenoiseState *l, int dir) {
+    size_t k = lineOf(l,l->pos), start, end, col, pos, c = 0;
+
+    if (dir == LINENOISE_HISTORY_PREV ? k == 0 : k+1 == l->nlines) return 0;
+    start = lineStart(l,k);
+    col = columnPos(l->buf+start,l->pos-start,l->pos-start);
+    k += (dir == LINENOISE_HISTORY_PREV) ? -1 : 1;
+    start = lineStart(l,k);
+    end = lineEnd(l,k);
+    for (pos = start; pos < end; ) {
+        size_t col_len, len = nextCharLen(l->buf,end,pos,&col_len);
+
+        if (c+col_len > col) break;
+        c += col_len;
+        pos += len;
+    }
+    l->pos = pos;
+    refreshLine(l);
+    return 1;
+}
+
+/* Return the edited copy of the history entry at 'index', or NULL if the
+ * entry was not modified during this edit. */
+static struct historyEdit *historyEditFind(struct linenoiseState *l, int index) {
+    size_t j;
+
+    for (j = 0; j < l->nedits; j++)
+        if (l->edits[j].index == index) return l->edits+j;
+    return NULL;
+}
+
+/* Remember the buffer as the edited copy of the history entry 'entry' we
+ * are leaving, if the user modified it. On out of memory the changes are
+ * lost, like the entry was never edited. */
+static void historyEditKeep(struct linenoiseState *l, const char *entry) {
+    struct historyEdit *e = historyEditFind(l,l->history_index);
+    char *line;
+
+    if (e == NULL && !strcmp(l->buf,entry)) return;
+    if ((line = lnStrdup(LN_POOL_EDIT,l->buf)) == NULL) return;
+    if (e == NULL) {
+        e = lnRealloc(LN_POOL_EDIT,l->edits,sizeof(*e)*(l->nedits+1));
+        if (e == NULL) {
+            lnFree(line);
+            return;
+        }
+        l->edits = e;
+        e += l->nedits++;
+        e->index = l->history_index;
+    } else {
+        lnFree(e->line);
+    }
+    e->line = line;
+}
+
+/* Return the history entry at 'index', relatively to the head we saw when
+ * the edit started, so lines added meanwhile by other threads don't shift
+ * what the user is browsing. Must be called with the reader pinned. */
+static const char *historyEditEntry(struct linenoiseState *l, int index) {
+    struct historyRing *r = atomic_load_explicit(&history,memory_order_acquire);
+
+    if (r == NULL || (unsigned long)index > l->history_head) return NULL;
+    return historyRingGet(r,l->history_head-index);
+}
+
+/* Substitute the currently edited line with the next or previous history
+ * entry as specified by 'dir'. Changes made to the entries are kept until
+ * the end of the edit, without altering the history. */
+static void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
+    int index = l->history_index + ((dir == LINENOISE_HISTORY_PREV) ? 1 : -1);
+    struct historyReader *rd;
+    struct historyEdit *e;
+    const char *entry, *cur;
+
+    if (index < 0) return;
+    rd = historyPin();
+    if (index == 0) {
+        entry = l->saved;
+    } else if ((e = historyEditFind(l,index)) != NULL) {
+        entry = e->line;
+    } else if ((entry = historyEditEntry(l,index)) == NULL) {
+        historyUnpin(rd);
+        return;
+    }
+    /* Remember what the user typed before to overwrite it. */
+    if (l->history_index == 0) {
+        strncpy(l->saved,l->buf,l->buflen);
+        l->saved[l->buflen] = '\0';
+    } else if ((cur = historyEditEntry(l,l->history_index)) != NULL) {
+        historyEditKeep(l,cur);
+    }
+    l->history_index = index;
+    lntrace(LINENOISE_TRACE_HISTORY_BROWSE,index,l->history_head,0,0,0);
+    strncpy(l->buf,entry,l->buflen);
+    l->buf[l->buflen] = '\0';
+    historyUnpin(rd);
+    indexEdit(l,0,l->len,strlen(l->buf));
+    l->len = l->pos = strlen(l->buf);
+    refreshLine(l);
+}
+
+/* Delete the character at the right of the cursor without altering the cursor
+ * position. Basically this is what happens with the "Delete" keyboard key. */
+static void linenoiseEditDelete(struct linenoiseState *l) {
+    if (l->len > 0 && l->pos < l->len) {
+        int chlen = nextCharLen(l->buf,l->len,l->pos,NULL);
+        memmove(l->buf+l->pos,l->buf+l->pos+chlen,l->len-l->pos-chlen);
+        indexEdit(l,l->pos,chlen,0);
+        l->len-=chlen;
+        l->buf[l->len] = '\0';
+        refreshLine(l);
+    }
+}
+
+/* Backspace implementation. */
+static void linenoiseEditBackspace(struct linenoiseState *l) {
+    if (l->pos > 0 && l->len > 0) {
+        int chlen = prevCharLen(l->buf,l->len,l->pos,NULL);
+        memmove(l->buf+l->pos-chlen,l->buf+l->pos,l->len-l->pos);
+        l->pos-=chlen;
+        indexEdit(l,l->pos,chlen,0);
+        l->len-=chlen;
+        l->buf[l->len] = '\0';
+        refreshLine(l);
+    }
+}
+
+/* Delete the previous word, maintaining the cursor at the start of the
+ * current word. */
+static void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
+    size_t old_pos = l->pos;
+    size_t diff;
+
+    l->pos = wordStart(l);
+    diff = old_pos - l->pos;
+    memmove(l->buf+l->pos,l->buf+old_pos,l->len-old_pos+1);
+    indexEdit(l,l->pos,diff,0);
+    l->len -= diff;
+    refreshLine(l);
+}
+
+/* Delete the next word, maintaining the cursor at the same position */
+static void linenoiseEditDeleteNextWord(struct linenoiseState *l) {
+    size_t next_word_end = wordEnd(l);
+
+    memmove(l->buf+l->pos, l->buf+next_word_end, l->len-next_word_end);
+    indexEdit(l,l->pos,next_word_end-l->pos,0);
+    l->len -= next_word_end - l->pos;
+    l->buf[l->len] = '\0';
+    refreshLine(l);
+}
+
+/* Read the bytes of the escape sequence following ESC, if the key is ESC,
+ * as far as needed to know which key was pressed. */
+static void readEscapeSeq(struct linenoiseState *l, struct linenoiseKey *k) {
+    k->seqlen = 0;
+    if (k->c != ESC) return;
+    if (read(l->ifd,k->seq,1) != 1) return;
+    k->seqlen = 1;
+    if (k->seq[0] != '[' && k->seq[0] != 'O') return;
+    if (read(l->ifd,k->seq+1,1) != 1) return;
+    k->seqlen = 2;
+    if (k->seq[0] != '[' || k->seq[1] < '0' || k->seq[1] > '9') return;
+    if (read(l->ifd,k->seq+2,1) != 1) return;
+    k->seqlen = 3;
+    if (k->seq[2] != ';') return;
+    if (read(l->ifd,k->seq+3,2) != 2) return;
+    k->seqlen = 5;
+}
+
+/* Read the next key. Returns the number of bytes of its character, zero
+ * or less on end of file or errors. */
+static int readKey(struct linenoiseState *l, struct linenoiseKey *k) {
+    k->nread = readCodeWithEvents(l,k->cbuf,sizeof(k->cbuf),&k->c);
+    k->seqlen = 0;
+    if (k->nread > 0) readEscapeSeq(l,k);
+    return k->nread;
+}
+
+/* Execute the action of the key 'k'. Returns LINENOISE_EDIT_MORE if the
+ * editing goes on, otherwise the value linenoiseEdit() should return. */
+static int linenoiseEditKey(struct linenoiseState *l, struct linenoiseKey *k) {
+    char *seq = k->seq;
+
+    switch(k->c) {
+    case LINE_FEED:/* line feed */
+    case ENTER:    /* enter */
+        /* Incomplete input goes on in a new line of the buffer. */
+        if (inputIncomplete(l)) {
+            if (linenoiseEditInsert(l,"\n",1)) return -1;
+            break;
+        }
+        if ((mlmode || l->nlines > 1) && l->pos != l->len) {
+            l->pos = l->len;
+            refreshLine(l);
+        }
+        refreshFinal(l);
+        return l->len;
+    case CTRL_C:     /* ctrl-c */
+        errno = EAGAIN;
+        return -1;
+    case BACKSPACE:   /* backspace */
+    case 8:     /* ctrl-h */
+        linenoiseEditBackspace(l);
+        break;
+    case CTRL_D:     /* ctrl-d, remove char at right of cursor, or if the
+                        line is empty, act as end-of-file. */
+        if (l->len > 0) {
+            linenoiseEditDelete(l);
+        } else {
+            return -1;
+        }
+        break;
+    case CTRL_T:    /* ctrl-t, swaps current character with previous. */
+        {
+          int pcl, ncl;
+          char auxb[5];
+          
+ 	      pcl = prevCharLen(l->buf,l->len,l->pos,NULL);
+	      ncl = nextCharLen(l->buf,l->len,l->pos,NULL);
+//            printf("[%d %d %d]\n", pcl, l->pos, ncl);
+	      // to perform a swap we need
+          // * nonzero char length to the left
+          // * not at the end of the line
+          if(pcl != 0 && l->pos != l->len && pcl < 5 && ncl < 5) {
+		// the actual transpose works like this
+		//
+		//           ,--- l->pos
+		//          v
+		// xxx [AAA] [BB] xxx
+		// xxx [BB] [AAA] xxx
+		memcpy(auxb, l->buf+l->pos-pcl, pcl);
+		memcpy(l->buf+l->pos-pcl, l->buf+l->pos, ncl);
+		memcpy(l->buf+l->pos-pcl+ncl, auxb, pcl);
+		indexEdit(l,l->pos-pcl,pcl+ncl,pcl+ncl);
+		l->pos += -pcl+ncl;
+		refreshLine(l);
+          }
+        }
+        break;
+    case CTRL_B:     /* ctrl-b */
+        linenoiseEditMoveLeft(l);
+        break;
+    case CTRL_F:     /* ctrl-f */
+        linenoiseEditMoveRight(l);
+        break;
+    case CTRL_P:    /* ctrl-p */
+        if (!linenoiseEditMoveLine(l, LINENOISE_HISTORY_PREV))
+            linenoiseEditHistoryNext(l, LINENOISE_HISTORY_PREV);
+        break;
+    case CTRL_N:    /* ctrl-n */
+        if (!linenoiseEditMoveLine(l, LINENOISE_HISTORY_NEXT))
+            linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
+        break;
+    case ESC:    /* escape sequence */
+        if (k->seqlen < 1) break;
+        /* ESC ? sequences */
+        if (seq[0] != '[' && seq[0] != 'O') {
+            switch (seq[0]) {
+            case 'f':
+                linenoiseEditMoveWordEnd(l);
+                break;
+            case 'b':
+                linenoiseEditMoveWordStart(l);
+                break;
+            case 'd':
+                linenoiseEditDeleteNextWord(l);
+                break;
+            }
+        } else {
+            if (k->seqlen < 2) break;
+            /* ESC [ sequences. */
+            if (seq[0] == '[') {
+                if (seq[1] >= '0' && seq[1] <= '9') {
+                    /* Extended escape, with an additional byte. */
+                    if (k->seqlen < 3) break;
+                    if (seq[2] == '~') {
+                        switch(seq[1]) {
+                        case '3': /* Delete key. */
+                            linenoiseEditDelete(l);
+                            break;
+                        }
+                    }
+			else if(seq[2] == ';') {
+				if (k->seqlen < 5) break;
+				if (seq[3] == '5' && seq[4] == 'C') linenoiseEditMoveWordEnd(l);
+				if (seq[3] == '5' && seq[4] == 'D') linenoiseEditMoveWordStart(l);
+			}
+                } else {
+                    switch(seq[1]) {
+                    case 'A': /* Up */
+                        if (!linenoiseEditMoveLine(l, LINENOISE_HISTORY_PREV))
+                            linenoiseEditHistoryNext(l, LINENOISE_HISTORY_PREV);
+                        break;
+                    case 'B': /* Down */
+                        if (!linenoiseEditMoveLine(l, LINENOISE_HISTORY_NEXT))
+                            linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
+                        break;
+                    case 'C': /* Right */
+                        linenoiseEditMoveRight(l);
+                        break;
+                    case 'D': /* Left */
+                        linenoiseEditMoveLeft(l);
+                        break;
+                    case 'H': /* Home */
+                        linenoiseEditMoveHome(l);
+                        break;
+                    case 'F': /* End*/
+                        linenoiseEditMoveEnd(l);
+                        break;
+                    case 'd': /* End*/
+                        linenoiseEditDeleteNextWord(l);
+                        break;
+                    case '1': /* Home */
+                        linenoiseEditMoveHome(l);
+                        break;
+                    case '4': /* End */
+                        linenoiseEditMoveEnd(l);
+                        break;
+                    }
+                }
+            }
+            /* ESC O sequences. */
+            else if (seq[0] == 'O') {
+                switch(seq[1]) {
+                case 'A': /* Up */
+                    if (!linenoiseEditMoveLine(l, LINENOISE_HISTORY_PREV))
+                        linenoiseEditHistoryNext(l, LINENOISE_HISTORY_PREV);
+                    break;
+                case 'B': /* Down */
+                    if (!linenoiseEditMoveLine(l, LINENOISE_HISTORY_NEXT))
+                        linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
+                    break;
+                case 'C': /* Right */
+                    linenoiseEditMoveRight(l);
+                    break;
+                case 'D': /* Left */
+                    linenoiseEditMoveLeft(l);
+                    break;
+                case 'H': /* Home */
+                    linenoiseEditMoveHome(l);
+                    break;
+                case 'F': /* End*/
+                    linenoiseEditMoveEnd(l);
+                    break;
+                }
+            }
+        }
+        break;
+    default:
+        if (linenoiseEditInsert(l,k->cbuf,k->nread)) return -1;
+        break;
+    case CTRL_U: /* Ctrl+u, delete the whole line. */
+        l->buf[0] = '\0';
+        indexEdit(l,0,l->len,0);
+        l->pos = l->len = 0;
+        refreshLine(l);
+        break;
+    case CTRL_K: /* Ctrl+k, delete from current to end of line. */
+        l->buf[l->pos] = '\0';
+        indexEdit(l,l->pos,l->len-l->pos,0);
+        l->len = l->pos;
+        refreshLine(l);
+        break;
+    case CTRL_A: /* Ctrl+a, go to the start of the line */
+        linenoiseEditMoveHome(l);
+        break;
+    case CTRL_E: /* ctrl+e, go to the end of the line */
+        linenoiseEditMoveEnd(l);
+        break;
+    case CTRL_L: /* ctrl+l, clear screen */
+        linenoiseClearScreen();
+        refreshLine(l);
+        break;
+    case CTRL_W: /* ctrl+w, delete previous word */
+        linenoiseEditDeletePrevWord(l);
+        break;
+    }
+    return LINENOISE_EDIT_MORE;
+}
+
+/* Keyboard macros. After ctrl-x ( the keys are recorded as read, until
+ * ctrl-x ). Then ctrl-x e replays them directly against the edit state,
+ * with refreshes skipped until the end, so that a macro costs a single
+ * refresh however many keys it has. The macro is kept across lines. */
+static struct linenoiseKey *macro = NULL;
+static size_t macro_len = 0;
+static size_t macro_cap = 0;
+static int macro_recording = 0;
+
+/* Append a key to the macro being recorded. */
+static void macroRecord(struct linenoiseKey *k) {
+    if (macro_len == macro_cap) {
+        size_t cap = macro_cap ? macro_cap*2 : 64;
+        struct linenoiseKey *keys = lnRealloc(LN_POOL_EDIT,macro,sizeof(*keys)*cap);
+
+        if (keys == NULL) {
+            macro_recording = 0;
+            return;
+        }
+        macro = keys;
+        macro_cap = cap;
+    }
+    macro[macro_len++] = *k;
+}
+
+/* Replay the macro, stopping early if a key ends the editing. Returns like
+ * linenoiseEditKey(). */
+static int macroReplay(struct linenoiseState *l) {
+    int ret = LINENOISE_EDIT_MORE;
+    size_t j;
+
+    l->batch = 1;
+    for (j = 0; j < macro_len && ret == LINENOISE_EDIT_MORE; j++)
+        ret = linenoiseEditKey(l,&macro[j]);
+    l->batch = 0;
+    refreshLine(l);
+    if (ret != LINENOISE_EDIT_MORE) refreshFinal(l);
+    return ret;
+}
+
+/* Handle the key following ctrl-x. Returns like linenoiseEditKey(). */
+static int macroCommand(struct linenoiseState *l) {
+    struct linenoiseKey k;
+
+    if (readKey(l,&k) <= 0) return LINENOISE_EDIT_MORE;
+    switch(k.c) {
+    case '(':
+        macro_recording = 1;
+        macro_len = 0;
+        break;
+    case ')':
+        macro_recording = 0;
+        break;
+    case 'e':
+        if (!macro_recording) return macroReplay(l);
+        /* fall through */
+    default:
+        linenoiseBeep();
+        break;
+    }
+    return LINENOISE_EDIT_MORE;
+}
+
+/* Incremental regex search of the history, started with ctrl-r. The prompt
+ * shows the pattern and the buffer the newest entry matching it, with the
+ * cursor where the match ends. Ctrl-r goes on with older entries, enter
+ * accepts the entry, ctrl-g and escape restore the buffer, and any other
+ * key accepts the entry and is then handled as usual. An escape alone is
+ * told from the start of a sequence by waiting a little for the next byte. */
+#define LINENOISE_SEARCH_PATTERN 256
+#ifndef LINENOISE_ESC_TIMEOUT
+#define LINENOISE_ESC_TIMEOUT 50    /* Milliseconds to wait after escape. */
+#endif
+
+/* Show the newest entry older than the sequence number 'top' matching
+ * 're'. Returns the sequence number of the entry plus one, or 0 if there
+ * is none. */
+static unsigned long searchFind(struct linenoiseState *l, linenoiseRegex *re, unsigned long top) {
+    struct historyReader *rd = historyPin();
+    struct historyRing *r = atomic_load_explicit(&history,memory_order_acquire);
+    unsigned long seq, found = 0;
+
+    if (r == NULL) goto done;
+    if (top > l->history_head) top = l->history_head;
+    for (seq = top; seq-- > atomic_load(&r->tail); ) {
+        char *entry = historyRingGet(r,seq);
+        size_t len, end;
+
+        if (entry == NULL) break;
+        len = strlen(entry);
+        if (!regexExec(re,entry,len,&end)) continue;
+        if (len > l->buflen) len = l->buflen;
+        memcpy(l->buf,entry,len);
+        l->buf[len] = '\0';
+        indexEdit(l,0,l->len,len);
+        l->len = len;
+        l->pos = end < len ? end : len;
+        found = seq+1;
+        break;
+    }
+
+done:
+    historyUnpin(rd);
+    return found;
+}
+
+/* Read the next key like readKey(), but read the sequence after ESC only
+ * if it follows soon enough, leaving 'seqlen' zero for an escape alone. */
+static int searchReadKey(struct linenoiseState *l, struct linenoiseKey *k) {
+    struct pollfd pfd;
+
+    k->nread = readCodeWithEvents(l,k->cbuf,sizeof(k->cbuf),&k->c);
+    k->seqlen = 0;
+    if (k->nread <= 0 || k->c != ESC) return k->nread;
+    pfd.fd = l->ifd;
+    pfd.events = POLLIN;
+    if (poll(&pfd,1,LINENOISE_ESC_TIMEOUT) == 1) readEscapeSeq(l,k);
+    return k->nread;
+}
+
+/* Put back the prompt that was replaced by the search one. */
+static void searchPromptRestore(struct linenoiseState *l) {
+    l->prompt = l->segprompt ? l->segprompt : l->uprompt;
+    l->plen = strlen(l->prompt);
+    l->pcollen = promptTextColumnLen(l->prompt,l->plen);
+}
+
+static int searchCommand(struct linenoiseState *l) {
+    char pattern[LINENOISE_SEARCH_PATTERN], prompt[LINENOISE_SEARCH_PATTERN+32];
+    size_t patlen = 0, origpos = l->pos;
+    unsigned long cur = 0, top;
+    char *orig = lnStrdup(LN_POOL_EDIT,l->buf);
+    linenoiseRegex *re = NULL;
+    int failed = 0, ret = LINENOISE_EDIT_MORE;
+
+    if (orig == NULL) return ret;
+    pattern[0] = '\0';
+    while (1) {
+        struct linenoiseKey k;
+        int search = 0;
+
+        snprintf(prompt,sizeof(prompt),"(%sregex-search)`%s': ",
+                 failed ? "failed " : "",pattern);
+        l->prompt = prompt;
+        l->plen = strlen(prompt);
+        l->pcollen = promptTextColumnLen(prompt,l->plen);
+        refreshLine(l);
+
+        if (searchReadKey(l,&k) <= 0) {
+            ret = l->len;
+            break;
+        }
+        if (k.c == CTRL_R) {
+            top = cur ? cur-1 : l->history_head;
+            search = 1;
+        } else if (k.c == BACKSPACE || k.c == CTRL_H) {
+            if (patlen) patlen -= prevCharLen(pattern,patlen,patlen,NULL);
+            pattern[patlen] = '\0';
+            top = l->history_head;
+            search = 2;
+        } else if (k.c == CTRL_G || (k.c == ESC && k.seqlen == 0)) {
+            size_t oldlen = l->len;
+
+            l->len = strlen(orig);
+            memcpy(l->buf,orig,l->len+1);
+            indexEdit(l,0,oldlen,l->len);
+            l->pos = origpos;
+            break;
+        } else if (k.c >= ' ' && k.c != ESC) {
+            if (patlen+k.nread < sizeof(pattern)) {
+                memcpy(pattern+patlen,k.cbuf,k.nread);
+                patlen += k.nread;
+                pattern[patlen] = '\0';
+            }
+            top = cur ? cur : l->history_head;
+            search = 2;
+        } else {
+            searchPromptRestore(l);
+            ret = linenoiseEditKey(l,&k);
+            break;
+        }
+
+        /* Compile again when the pattern changed. While it is typed it
+         * may be invalid for a while, like after an open bracket. */
+        if (search == 2) {
+            linenoiseRegexFree(re);
+            re = patlen ? linenoiseRegexCompile(pattern) : NULL;
+        }
+        if (re) {
+            unsigned long found = searchFind(l,re,top);
+
+            failed = found == 0;
+            if (found) cur = found;
+        } else {
+            failed = patlen != 0;
+            cur = 0;
+        }
+    }
+    searchPromptRestore(l);
+    if (ret == LINENOISE_EDIT_MORE) refreshLine(l);
+    linenoiseRegexFree(re);
+    lnFree(orig);
+    return ret;
+}
+
+/* This function is the core of the line editing capability of linenoise.
+ * It expects 'fd' to be already in "raw mode" so that every key pressed
+ * will be returned ASAP to read().
+ *
+ * The resulting string is put into 'buf' when the user type enter, or
+ * when ctrl+d is typed.
+ *
+ * The function returns the length of the current buffer. */
+static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen, const char *prompt)
+{
+    struct linenoiseState l;
+    char saved[LINENOISE_MAX_LINE];
+    int ret;
+
+    /* Populate the linenoise state that we pass to functions implementing
+     * specific editing functionalities. */
+    l.ifd = stdin_fd;
+    l.ofd = stdout_fd;
+    l.buf = buf;
+    l.buflen = buflen;
+    l.uprompt = prompt;
+    l.segprompt = NULL;
+    promptCompose(&l);
+    l.pos = 0;
+    l.oldrpos = 1;
+    l.len = 0;
+    memset(&l.newlines,0,sizeof(l.newlines));
+    l.nlines = 1;
+    memset(&l.brackets,0,sizeof(l.brackets));
+    l.pairs = NULL;
+    l.pairscap = 0;
+    l.pairsvalid = 1;
+    l.hlpos = LINENOISE_NOMATCH;
+    memset(&l.words,0,sizeof(l.words));
+    l.gen = 1;
+    l.wordsgen = 0;
+    l.statusshown = 0;
+    l.batch = 0;
+    l.compdesc = NULL;
+    l.lexstates = NULL;
+    l.lexvalid = l.lexcap = 0;
+    l.cols = getColumns(stdin_fd, stdout_fd);
+    l.maxrows = 0;
+    l.history_index = 0;
+    l.saved = saved;
+    l.edits = NULL;
+    l.nedits = 0;
+
+    /* Buffer starts empty. */
+    l.buf[0] = '\0';
+    l.buflen--; /* Make sure there is always space for the nulterm */
+    if (l.buflen >= sizeof(saved)) l.buflen = sizeof(saved)-1;
+
+    /* The line being edited is not part of the shared history: browsing
+     * starts from the newest entry at the time the edit started. */
+    l.history_head = linenoiseHistoryHead();
+
+    lntrace(LINENOISE_TRACE_EDIT_START,l.cols,l.plen,l.buflen,l.history_head,0);
+    layout_changed = 0;
+    if (rprompt || statusline) {
+        refreshLine(&l);
+    } else if (write(l.ofd,l.prompt,l.plen) == -1) {
+        ret = -1;
+        goto done;
+    }
+    while(1) {
+        struct linenoiseKey k;
+        uint64_t span;
+
+	/* Continue reading if interrupted by a signal */
+// TODO
+//	do {
+//          nread = read(l.ifd,&c,1);
+//        } while((nread == -1) && (errno == EINTR));
+        if (readKey(&l,&k) <= 0) {
+            ret = l.len;
+            goto done;
+        }
+        lntrace(LINENOISE_TRACE_KEY,k.c,k.nread,l.len,l.pos,l.history_index);
+        span = traceStart();
+
+        /* Only autocomplete when the callback is set. It returns < 0 when
+         * there was an error reading from fd. Otherwise it will return the
+         * character that should be handled next. */
+        if (k.c == TAB && completionCallback != NULL) {
+            k.nread = completeLine(&l,k.cbuf,sizeof(k.cbuf),&k.c);
+            /* Return on errors */
+            if (k.c < 0) {
+                ret = l.len;
+                goto done;
+            }
+            /* Read next character when 0 */
+            if (k.c == 0) continue;
+            readEscapeSeq(&l,&k);
+        }
+
+        /* Ctrl-x starts a keyboard macro command, ctrl-r a search. */
+        if (k.c == CTRL_X) {
+            ret = macroCommand(&l);
+        } else if (k.c == CTRL_R) {
+            ret = searchCommand(&l);
+        } else {
+            if (macro_recording) macroRecord(&k);
+            ret = linenoiseEditKey(&l,&k);
+        }
+        lnspan(SPAN_DISPATCH,span,l.cols,l.len,l.pos);
+        if (ret != LINENOISE_EDIT_MORE) goto done;
+    }
+
+done:
+    if (l.statusshown) refreshFinal(&l);
+    lnFree(l.newlines.off);
+    lnFree(l.brackets.off);
+    lnFree(l.pairs);
+    lnFree(l.words.off);
+    lnFree(l.lexstates);
+    lnFree(l.segprompt);
+    while (l.nedits) lnFree(l.edits[--l.nedits].line);
+    lnFree(l.edits);
+    return ret;
+}
+
+/* This special mode is used by linenoise in order to print scan codes
+ * on screen for debugging / development purposes. It is implemented
+ * by the linenoise_example program using the --keycodes option. */
+void linenoisePrintKeyCodes(void) {
+    char quit[4];
+
+    printf("Linenoise key codes debugging mode.\n"
+            "Press keys to see scan codes. Type 'quit' at any time to exit.\n");
+    if (enableRawMode(STDIN_FILENO) == -1) return;
+    memset(quit,' ',4);
+    while(1) {
+        char c;
+        int nread;
+
+        nread = read(STDIN_FILENO,&c,1);
+        if (nread <= 0) continue;
+        memmove(quit,quit+1,sizeof(quit)-1); /* shift string to left. */
+        quit[sizeof(quit)-1] = c; /* Insert current char on the right. */
+        if (memcmp(quit,"quit",sizeof(quit)) == 0) break;
+
+        printf("'%c' %02x (%d) (type quit to exit)\n",
+            isprint((int)c) ? c : '?', (int)c, (int)c);
+        printf("\r"); /* Go left edge manually, we are in raw mode. */
+        fflush(stdout);
+    }
+    disableRawMode(STDIN_FILENO);
+}
+
+/* This function calls the line editing function linenoiseEdit() using
+ * the STDIN file descriptor set in raw mode. */
+static int linenoiseRaw(char *buf, FILE *out, size_t buflen, const char *prompt) {
+    int outfd, count;
+
+    if (buflen == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((outfd = fileno(out)) == -1)
+        return -1;
+
+    if (enableRawMode(STDIN_FILENO) == -1) return -1;
+    outputBegin();
+    count = linenoiseEdit(STDIN_FILENO, outfd, buf, buflen, prompt);
+    lntrace(LINENOISE_TRACE_EDIT_END,count,errno,0,0,0);
+    disableRawMode(STDIN_FILENO);
+    fprintf(out, "\n");
+    fflush(out);
+    outputEnd(outfd);
+    return count;
+}
+
+/* This function is called when linenoise() is called with the standard
+ * input file descriptor not attached to a TTY. So for example when the
+ * program using linenoise is called in pipe or with a file redirected
+ * to its standard input. In this case, we want to be able to return the
+ * line regardless of its length (by default we are limited to 4k). */
+static char *linenoiseNoTTY(void) {
+    char *line = NULL;
+    size_t len = 0, maxlen = 0;
+
+    while(1) {
+    	int c;
+        if (len == maxlen) {
+            char *oldval = line;
+            if (maxlen == 0) maxlen = 16;
+            maxlen *= 2;
+            line = lnRealloc(LN_POOL_EDIT,line,maxlen);
+            if (line == NULL) {
+                if (oldval) lnFree(oldval);
+                return NULL;
+            }
+        }
+        c = fgetc(stdin);
+        if (c == EOF || c == '\n') {
+            if (c == EOF && len == 0) {
+                lnFree(line);
+                return NULL;
+            } else {
+                line[len] = '\0';
+                return line;
+            }
+        } else {
+            line[len] = c;
+            len++;
+        }
+    }
+}
+
+/* The high level function that is the main API of the linenoise library.
+ * This function checks if the terminal has basic capabilities, just checking
+ * for a blacklist of stupid terminals, and later either calls the line
+ * editing function or uses dummy fgets() so that you will be able to type
+ * something even in the most desperate of the conditions. */
+char *linenoise(const char *prompt) {
+    char buf[LINENOISE_MAX_LINE];
+    FILE *stream;
+    int count;
+
+    stream = isatty(STDOUT_FILENO) ? stdout : stderr;
+    if (!isatty(STDIN_FILENO)) {
+        /* Not a tty: read from file / pipe. In this mode we don't want any
+         * limit to the line size, so we call a function to handle that. */
+        return linenoiseNoTTY();
+    } else if (isUnsupportedTerm()) {
+        size_t len;
+
+        fprintf(stream, "%s",prompt);
+        fflush(stream);
+        if (fgets(buf,LINENOISE_MAX_LINE,stdin) == NULL) return NULL;
+        len = strlen(buf);
+        while(len && (buf[len-1] == '\n' || buf[len-1] == '\r')) {
+            len--;
+            buf[len] = '\0';
+        }
+        return lnStrdup(LN_POOL_EDIT,buf);
+    } else {
+        count = linenoiseRaw(buf,stream,LINENOISE_MAX_LINE,prompt);
+        if (count == -1) return NULL;
+        return lnStrdup(LN_POOL_EDIT,buf);
+    }
+}
+
+/* This is just a wrapper the user may want to call in order to make sure
+ * the linenoise returned buffer is freed with the same allocator it was
+ * created with. Useful when the main program is using an alternative
+ * allocator. */
+void linenoiseFree(void *ptr) {
+    lnFree(ptr);
+}
+
+/* ========================== Asynchronous output =========================== */
+
+/* Other threads can print lines while the user is editing. The lines are
+ * queued, and the editing thread, woken up by a pipe, hides the prompt
+ * once, writes the whole batch and shows the prompt again. A new batch is
+ * written at most every LINENOISE_OUTPUT_INTERVAL milliseconds, so that a
+ * flood of lines does not slow down the handling of the keys. When no
+ * prompt is shown the lines are written right away. */
+struct outputLine {
+    struct outputLine *next;
+    size_t len;
+    char buf[];
+};
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t output_once = PTHREAD_ONCE_INIT;
+static struct outputLine *output_head = NULL;
+static struct outputLine **output_tail = &output_head;
+static int output_active = 0;           /* Is a prompt shown? */
+static int output_pipe[2] = {-1,-1};
+
+static void outputInit(void) {
+    int j;
+
+    if (pipe(output_pipe) == -1) return;
+    for (j = 0; j < 2; j++) {
+        fcntl(output_pipe[j],F_SETFL,fcntl(output_pipe[j],F_GETFL)|O_NONBLOCK);
+        fcntl(output_pipe[j],F_SETFD,FD_CLOEXEC);
+    }
+    atomic_store(&output_wakefd,output_pipe[0]);
+}
+
+/* Wake up the editing thread if it is waiting for input. */
+static void wakeEditor(void) {
+    pthread_once(&output_once,outputInit);
+    if (output_pipe[1] != -1 && write(output_pipe[1],"",1) == -1) {}
+}
+
+/* Remove all the lines from the queue and return them. Called with the
+ * lock held. */
+static struct outputLine *outputTake(void) {
+    struct outputLine *list = output_head;
+
+    output_head = NULL;
+    output_tail = &output_head;
+    atomic_store(&output_queued,0);
+    return list;
+}
+
+/* Write the lines of 'list' to 'fd' with as few writev() as possible,
+ * then free them. */
+static void outputWrite(int fd, struct outputLine *list) {
+    struct iovec iov[LINENOISE_MAX_IOV];
+    struct outputLine *ol, *next;
+    int n = 0;
+
+    for (ol = list; ol; ol = ol->next) {
+        iov[n].iov_base = ol->buf;
+        iov[n].iov_len = ol->len;
+        if (++n == LINENOISE_MAX_IOV || ol->next == NULL) {
+            if (writev(fd,iov,n) == -1) {} /* Can't recover from write error. */
+            n = 0;
+        }
+    }
+    for (ol = list; ol; ol = next) {
+        next = ol->next;
+        lnFree(ol);
+    }
+}
+
+/* Print a line above the prompt being edited, if any. It can be called
+ * from any thread. A newline is added if 'fmt' does not end with one.
+ * Returns 0 on success, -1 if out of memory. */
+int linenoisePrintf(const char *fmt, ...) {
+    struct outputLine *ol;
+    va_list ap;
+    int len, wake = 0;
+
+    va_start(ap,fmt);
+    len = vsnprintf(NULL,0,fmt,ap);
+    va_end(ap);
+    if (len < 0 || (ol = lnMalloc(LN_POOL_OUTPUT,sizeof(*ol)+len+2)) == NULL) return -1;
+    va_start(ap,fmt);
+    vsnprintf(ol->buf,len+1,fmt,ap);
+    va_end(ap);
+    ol->len = len;
+    if (len == 0 || ol->buf[len-1] != '\n') ol->buf[ol->len++] = '\n';
+    ol->next = NULL;
+
+    pthread_mutex_lock(&output_lock);
+    if (output_active) {
+        *output_tail = ol;
+        output_tail = &ol->next;
+        wake = !atomic_exchange(&output_queued,1);
+    } else {
+        outputWrite(STDOUT_FILENO,ol);
+    }
+    pthread_mutex_unlock(&output_lock);
+    if (wake) wakeEditor();
+    return 0;
+}
+
+/* Called by the editing thread when the prompt is shown. The wake up pipe
+ * is created here, so that the editor waits on it from the first key. */
+static void outputBegin(void) {
+    pthread_once(&output_once,outputInit);
+    pthread_mutex_lock(&output_lock);
+    output_active = 1;
+    pthread_mutex_unlock(&output_lock);
+}
+
+/* Called by the editing thread when the prompt is gone, to write what was
+ * queued meanwhile to 'fd'. */
+static void outputEnd(int fd) {
+    pthread_mutex_lock(&output_lock);
+    output_active = 0;
+    outputWrite(fd,outputTake());
+    pthread_mutex_unlock(&output_lock);
+}
+
+/* Hide the prompt, write the queued lines, and show the prompt again. */
+static void outputFlush(struct linenoiseState *l) {
+    struct outputLine *list;
+    char seq[64];
+    struct abuf ab;
+    int j, old_rows = l->maxrows, rpos = l->oldrpos;
+
+    pthread_mutex_lock(&output_lock);
+    list = outputTake();
+    pthread_mutex_unlock(&output_lock);
+    output_last = mstime();
+    if (list == NULL) return;
+
+    /* Clear all the rows of the prompt, starting from the last one. */
+    abInit(&ab,l->ofd);
+    if (old_rows-rpos > 0) {
+        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
+        abAppend(&ab,seq,strlen(seq));
+    }
+    for (j = 0; j < old_rows-1; j++)
+        abAppend(&ab,"\r\x1b[0K\x1b[1A",10);
+    abAppend(&ab,"\r\x1b[0K",5);
+    /* The single line refresh does not count the status line in the rows,
+     * clear it too. */
+    if (l->statusshown && old_rows <= 1) {
+        abAppend(&ab,"\n\r\x1b[0K\x1b[1A",10);
+        l->statusshown = 0;
+    }
+    if (abWrite(&ab) == -1) {} /* Can't recover from write error. */
+    abFree(&ab);
+
+    /* The lines take the place of the prompt, that starts again below. */
+    outputWrite(l->ofd,list);
+    l->maxrows = 0;
+    l->oldrpos = 1;
+    refreshLine(l);
+}
+
+/* ============================= Prompt segments ============================ */
+
+/* The prompt can start with segments computed by callbacks, so that the
+ * application does not have to build it before every call. Values are
+ * cached until the segment is invalidated. Slow segments can be computed
+ * in a thread: the placeholder is shown until the value is ready, then the
+ * editing thread is woken up to show the prompt again. */
+struct promptSegment {
+    int id;
+    linenoisePromptCallback *fn;
+    void *privdata;
+    char *placeholder;      /* Shown while the value is not ready. */
+    int async;              /* Computed in a thread? */
+    int running;            /* Is a thread computing the value? */
+    char *value;            /* Cached value, or NULL. */
+    unsigned long gen;      /* Incremented when invalidated. */
+    unsigned long valuegen; /* 'gen' when the value was computed. */
+    struct promptSegment *next;
+};
+
+static pthread_mutex_t prompt_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct promptSegment *segments = NULL;
+static int segments_next_id = 0;
+
+/* Add a prompt segment after the ones added before. 'fn' returns its value
+ * allocated with malloc(), or NULL for an empty segment. When 'async' is
+ * true it is called in a new thread, and 'placeholder' is shown meanwhile.
+ * Returns the segment id, or -1 if out of memory. */
+int linenoiseAddPromptSegment(linenoisePromptCallback *fn, void *privdata, const char *placeholder, int async) {
+    struct promptSegment *seg = lnCalloc(LN_POOL_EDIT,1,sizeof(*seg)), **p;
+
+    if (seg == NULL) return -1;
+    if ((seg->placeholder = lnStrdup(LN_POOL_EDIT,placeholder ? placeholder : "")) == NULL) {
+        lnFree(seg);
+        return -1;
+    }
+    seg->fn = fn;
+    seg->privdata = privdata;
+    seg->async = async;
+    seg->gen = 1;
+    pthread_mutex_lock(&prompt_lock);
+    seg->id = segments_next_id++;
+    for (p = &segments; *p; p = &(*p)->next);
+    *p = seg;
+    pthread_mutex_unlock(&prompt_lock);
+    return seg->id;
+}
+
+/* Drop the cached value of a segment, so that it is computed again for the
+ * next prompt. It can be called from any thread. Returns 0 on success, -1
+ * if there is no such segment. */
+int linenoiseInvalidatePromptSegment(int id) {
+    struct promptSegment *seg;
+    int retval = -1;
+
+    pthread_mutex_lock(&prompt_lock);
+    for (seg = segments; seg; seg = seg->next) {
+        if (seg->id == id) {
+            seg->gen++;
+            retval = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prompt_lock);
+    return retval;
+}
+
+/* Store the value computed for the generation 'gen' of the segment. Called
+ * with the lock held. */
+static void promptSetValue(struct promptSegment *seg, char *value, unsigned long gen) {
+    lnFree(seg->value);
+    seg->value = value;
+    seg->valuegen = gen;
+}
+
+static void *promptThread(void *arg) {
+    struct promptSegment *seg = arg;
+    unsigned long gen;
+    char *value;
+
+    pthread_mutex_lock(&prompt_lock);
+    gen = seg->gen;
+    pthread_mutex_unlock(&prompt_lock);
+    value = seg->fn(seg->privdata);
+    pthread_mutex_lock(&prompt_lock);
+    promptSetValue(seg,value,gen);
+    seg->running = 0;
+    pthread_mutex_unlock(&prompt_lock);
+    /* If invalidated meanwhile, the next compose starts a new thread. */
+    atomic_store(&prompt_changed,1);
+    wakeEditor();
+    return NULL;
+}
+
+/* Set l->prompt to the value of every segment, or its placeholder, followed
+ * by the prompt given by the caller. Segments not cached are computed, or
+ * their thread is started, before the prompt is built. Returns non zero if
+ * the prompt changed. */
+static int promptCompose(struct linenoiseState *l) {
+    struct promptSegment *seg;
+    size_t len = strlen(l->uprompt), off = 0;
+    int changed = 0;
+    char *p;
+
+    l->prompt = l->uprompt;
+    l->plen = len;
+    l->pcollen = promptTextColumnLen(l->prompt,l->plen);
+
+    pthread_mutex_lock(&prompt_lock);
+    if (segments == NULL) {
+        pthread_mutex_unlock(&prompt_lock);
+        return 0;
+    }
+    for (seg = segments; seg; seg = seg->next) {
+        if (seg->valuegen != seg->gen && !seg->running) {
+            if (seg->async) {
+                pthread_t tid;
+
+                if (pthread_create(&tid,NULL,promptThread,seg) == 0) {
+                    pthread_detach(tid);
+                    seg->running = 1;
+                }
+            } else {
+                unsigned long gen = seg->gen;
+                char *value;
+
+                /* Don't hold the lock while running the callback. */
+                seg->running = 1;
+                pthread_mutex_unlock(&prompt_lock);
+                value = seg->fn(seg->privdata);
+                pthread_mutex_lock(&prompt_lock);
+                promptSetValue(seg,value,gen);
+                seg->running = 0;
+            }
+        }
+    }
+
+    /* Measure and copy without releasing the lock, so that the values
+     * can't change in between. */
+    for (seg = segments; seg; seg = seg->next) {
+        if (seg->valuegen == seg->gen) len += seg->value ? strlen(seg->value) : 0;
+        else len += strlen(seg->placeholder);
+    }
+    p = lnMalloc(LN_POOL_EDIT,len+1);
+    if (p) {
+        for (seg = segments; seg; seg = seg->next) {
+            const char *s = seg->valuegen == seg->gen ? seg->value : seg->placeholder;
+            size_t slen = s ? strlen(s) : 0;
+
+            if (slen) memcpy(p+off,s,slen);
+            off += slen;
+        }
+        memcpy(p+off,l->uprompt,strlen(l->uprompt)+1);
+        changed = l->segprompt == NULL || strcmp(l->segprompt,p) != 0;
+        lnFree(l->segprompt);
+        l->segprompt = p;
+        l->prompt = p;
+        l->plen = strlen(p);
+        l->pcollen = promptTextColumnLen(l->prompt,l->plen);
+    }
+    pthread_mutex_unlock(&prompt_lock);
+    return changed;
+}
+
+/* ============================== Thread pool =============================== */
+
+/* Searches and loads of large histories split their work in chunks, that
+ * the calling thread and a small pool of threads, started on first use,
+ * claim until there are no more. The pool works on one job at a time:
+ * concurrent jobs just run on their own thread. */
+#ifndef LINENOISE_SEARCH_THREADS
+#define LINENOISE_SEARCH_THREADS 8
+#endif
+
+struct poolJob {
+    void (*run)(struct poolJob *job);   /* Claim and process chunks. */
+    int active;                         /* Pool threads working on it. */
+};
+
+static pthread_mutex_t pool_busy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct poolJob *pool_job = NULL;
+static unsigned long pool_gen = 0;
+static int pool_threads = 0;
+
+/* Pool threads wait for a job, work on it, and wait for the next one. */
+static void *poolThread(void *arg) {
+    unsigned long gen = 0;
+
+    UNUSED(arg);
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        struct poolJob *job;
+
+        while (pool_gen == gen) pthread_cond_wait(&pool_cond,&pool_lock);
+        gen = pool_gen;
+        if ((job = pool_job) == NULL) continue;
+        job->active++;
+        pthread_mutex_unlock(&pool_lock);
+        job->run(job);
+        pthread_mutex_lock(&pool_lock);
+        if (--job->active == 0) pthread_cond_broadcast(&pool_done);
+    }
+    return NULL;
+}
+
+/* Start the pool threads, one less than the online CPUs since the calling
+ * thread works too. Must be called with pool_lock held. */
+static void poolStart(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpu > LINENOISE_SEARCH_THREADS) ncpu = LINENOISE_SEARCH_THREADS;
+    while (pool_threads < ncpu-1) {
+        pthread_t tid;
+
+        if (pthread_create(&tid,NULL,poolThread,NULL) != 0) break;
+        pthread_detach(tid);
+        pool_threads++;
+    }
+}
+
+/* Run 'job' on the calling thread, and on the pool unless it is busy with
+ * another job. Returns once no thread works on it anymore. */
+static void poolRun(struct poolJob *job) {
+    int parallel = pthread_mutex_trylock(&pool_busy) == 0;
+
+    if (parallel) {
+        pthread_mutex_lock(&pool_lock);
+        poolStart();
+        job->active = 0;
+        pool_job = job;
+        pool_gen++;
+        pthread_cond_broadcast(&pool_cond);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    job->run(job);
+    if (parallel) {
+        pthread_mutex_lock(&pool_lock);
+        pool_job = NULL;
+        while (job->active) pthread_cond_wait(&pool_done,&pool_lock);
+        pthread_mutex_unlock(&pool_lock);
+        pthread_mutex_unlock(&pool_busy);
+    }
+}
+
+/* ================================ History ================================= */
+
+/* History readers never take a lock: a thread that wants to look at the
+ * history first "pins" itself by announcing the global epoch it saw in its
+ * reader record, and clears it when done. Writers, serialized by
+ * history_lock, never free what they unlink: lines and rings go into the
+ * limbo bag of the current epoch instead. The epoch can only move forward
+ * when every pinned reader announced the current one, so when it goes from
+ * E to E+1 nobody can still reference what was retired in E-2, and that bag
+ * is freed. Three bags are enough since only three epochs can be alive. */
+struct historyReader {
+    _Atomic unsigned long epoch;    /* Announced epoch, 0 if not reading. */
+    _Atomic int used;               /* Owned by a live thread. */
+    int depth;                      /* Nesting level of historyPin(). */
+    struct historyReader *next;
+};
+
+struct historyLimbo {
+    void **vec;
+    size_t len;
+    size_t cap;
+};
+
+static _Atomic unsigned long history_epoch = 1;
+static _Atomic(struct historyReader *) history_readers = NULL;
+static struct historyLimbo history_limbo[3];
+static pthread_key_t history_reader_key;
+static pthread_once_t history_reader_once = PTHREAD_ONCE_INIT;
+
+/* Called when a thread exits: its reader record can be reused. */
+static void historyReaderRelease(void *ptr) {
+    struct historyReader *rd = ptr;
+
+    atomic_store(&rd->epoch,0);
+    rd->depth = 0;
+    atomic_store(&rd->used,0);
+}
+
+static void historyReaderKeyInit(void) {
+    pthread_key_create(&history_reader_key,historyReaderRelease);
+}
+
+/* Return the reader record of the calling thread, taking a free one or
+ * allocating it the first time. Records are never freed. */
+static struct historyReader *historyReaderGet(void) {
+    struct historyReader *rd;
+
+    pthread_once(&history_reader_once,historyReaderKeyInit);
+    rd = pthread_getspecific(history_reader_key);
+    if (rd) return rd;
+
+    for (rd = atomic_load(&history_readers); rd; rd = rd->next) {
+        int unused = 0;
+        if (atomic_compare_exchange_strong(&rd->used,&unused,1)) break;
+    }
+    if (rd == NULL) {
+        rd = lnCalloc(LN_POOL_HISTORY,1,sizeof(*rd));
+        if (rd == NULL) return NULL;
+        atomic_init(&rd->epoch,0);
+        atomic_init(&rd->used,1);
+        rd->next = atomic_load(&history_readers);
+        while (!atomic_compare_exchange_weak(&history_readers,&rd->next,rd));
+    }
+    if (pthread_setspecific(history_reader_key,rd) != 0) {
+        atomic_store(&rd->used,0);
+        return NULL;
+    }
+    return rd;
+}
+
+/* Enter a history read side section. Everything reachable from the
+ * 'history' ring stays valid until the matching historyUnpin(). If we are
+ * out of memory for the reader record we fall back to the writers lock,
+ * signaled by returning NULL. */
+static struct historyReader *historyPin(void) {
+    struct historyReader *rd = historyReaderGet();
+
+    if (rd == NULL) {
+        pthread_mutex_lock(&history_lock);
+        return NULL;
+    }
+    if (rd->depth++ == 0) {
+        atomic_store(&rd->epoch,atomic_load(&history_epoch));
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+    return rd;
+}
+
+static void historyUnpin(struct historyReader *rd) {
+    if (rd == NULL) {
+        pthread_mutex_unlock(&history_lock);
+        return;
+    }
+    if (--rd->depth == 0)
+        atomic_store_explicit(&rd->epoch,0,memory_order_release);
+}
+
+/* Try to move the global epoch forward, freeing what was retired two
+ * epochs ago. Fails if some reader is still pinned in an older epoch.
+ * Must be called with history_lock held. */
+static int historyAdvance(void) {
+    unsigned long epoch = atomic_load(&history_epoch);
+    struct historyLimbo *bag;
+    struct historyReader *rd;
+    size_t j;
+
+    for (rd = atomic_load(&history_readers); rd; rd = rd->next) {
+        unsigned long e = atomic_load(&rd->epoch);
+        if (e != 0 && e != epoch) return 0;
+    }
+    bag = &history_limbo[(epoch+1) % 3];
+    for (j = 0; j < bag->len; j++) lnFree(bag->vec[j]);
+    bag->len = 0;
+    atomic_store(&history_epoch,epoch+1);
+    return 1;
+}
+
+/* Wait until every reader pinned before this call is gone. Only used
+ * when we can't retire because we are out of memory, and at exit. */
+static void historySynchronize(void) {
+    int advanced = 0;
+
+    while (advanced < 2) {
+        if (historyAdvance()) advanced++;
+        else sched_yield();
+    }
+}
+
+/* Free 'ptr' as soon as no reader can reference it anymore.
+ * Must be called with history_lock held. */
+static void historyRetire(void *ptr) {
+    struct historyLimbo *bag;
+
+    if (ptr == NULL) return;
+    bag = &history_limbo[atomic_load(&history_epoch) % 3];
+    if (bag->len == bag->cap) {
+        size_t cap = bag->cap ? bag->cap*2 : 16;
+        void **vec = lnRealloc(LN_POOL_HISTORY,bag->vec,sizeof(void*)*cap);
+
+        if (vec == NULL) {
+            historySynchronize();
+            lnFree(ptr);
+            return;
+        }
+        bag->vec = vec;
+        bag->cap = cap;
+    }
+    bag->vec[bag->len++] = ptr;
+    historyAdvance();
+}
+
+/* Create an empty ring of 'max_len' slots whose first entry will get the
+ * sequence number 'seq'. */
+static struct historyRing *historyRingNew(int max_len, unsigned long seq) {
+    struct historyRing *r;
+    int j;
+
+    r = lnMalloc(LN_POOL_HISTORY,sizeof(*r)+(sizeof(r->vec[0])+sizeof(r->stamps[0]))*max_len);
+    if (r == NULL) return NULL;
+    r->max_len = max_len;
+    r->stamps = (_Atomic uint32_t *)(r->vec+max_len);
+    atomic_init(&r->head,seq);
+    atomic_init(&r->tail,seq);
+    for (j = 0; j < max_len; j++) {
+        atomic_init(&r->vec[j],NULL);
+        atomic_init(&r->stamps[j],0);
+    }
+    return r;
+}
+
+/* Return the entry with sequence number 'seq', or NULL if it was not added
+ * yet or was already evicted. Must be called by a pinned reader or with
+ * history_lock held. */
+static char *historyRingGet(struct historyRing *r, unsigned long seq) {
+    char *line;
+
+    if (seq >= atomic_load_explicit(&r->head,memory_order_acquire)) return NULL;
+    line = atomic_load_explicit(&r->vec[seq % r->max_len],memory_order_acquire);
+    /* The writer moves the tail before to reuse a slot, so if the slot was
+     * already recycled we are guaranteed to see it here. */
+    if (seq < atomic_load_explicit(&r->tail,memory_order_acquire)) return NULL;
+    return line;
+}
+
+/* Return the timestamp of the entry with sequence number 'seq', or 0 if it
+ * was already evicted. Same rules as historyRingGet(). */
+static uint32_t historyRingStamp(struct historyRing *r, unsigned long seq) {
+    uint32_t stamp;
+
+    if (seq >= atomic_load_explicit(&r->head,memory_order_acquire)) return 0;
+    stamp = atomic_load_explicit(&r->stamps[seq % r->max_len],memory_order_acquire);
+    if (seq < atomic_load_explicit(&r->tail,memory_order_acquire)) return 0;
+    return stamp;
+}
+
+/* Append 'line' added at time 'stamp' to the ring, evicting the oldest
+ * entry if it is full. Must be called with history_lock held. */
+static void historyRingPush(struct historyRing *r, char *line, uint32_t stamp) {
+    unsigned long head = atomic_load_explicit(&r->head,memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&r->tail,memory_order_relaxed);
+    _Atomic(char *) *slot = &r->vec[head % r->max_len];
+    char *old = NULL;
+
+    if (head-tail == (unsigned long)r->max_len) {
+        old = atomic_load_explicit(slot,memory_order_relaxed);
+        lntrace(LINENOISE_TRACE_HISTORY_EVICT,tail,strlen(old),0,0,0);
+        atomic_store_explicit(&r->tail,tail+1,memory_order_release);
+        statsUpdate(old,-1);
+    }
+    statsUpdate(line,1);
+    atomic_store_explicit(&r->stamps[head % r->max_len],stamp,memory_order_release);
+    atomic_store_explicit(slot,line,memory_order_release);
+    atomic_store_explicit(&r->head,head+1,memory_order_release);
+    historyRetire(old);
+}
+
+/* Sequence number the next history entry will get. */
+static unsigned long linenoiseHistoryHead(void) {
+    struct historyRing *r = atomic_load_explicit(&history,memory_order_acquire);
+
+    return r ? atomic_load_explicit(&r->head,memory_order_acquire) : 0;
+}
+
+#ifdef VALGRIND
+/* Free the history, but does not reset it. Only used when we have to
+ * exit() to avoid memory leaks are reported by valgrind & co. */
+static void freeHistory(void) {
+    struct historyRing *r;
+    unsigned long seq;
+    int j;
+
+    linenoiseHistoryStatsEnable(0);
+    pthread_mutex_lock(&history_lock);
+    r = atomic_exchange(&history,NULL);
+    if (r) {
+        for (seq = atomic_load(&r->tail); seq < atomic_load(&r->head); seq++)
+            historyRetire(historyRingGet(r,seq));
+        historyRetire(r);
+    }
+    for (j = 0; j < 3; j++) historySynchronize();
+    for (j = 0; j < 3; j++) lnFree(history_limbo[j].vec);
+    pthread_mutex_unlock(&history_lock);
+}
+#endif
+
+/* At exit we'll try to fix the terminal to the initial conditions. */
+static void linenoiseAtExit(void) {
+    disableRawMode(STDIN_FILENO);
+#ifdef VALGRIND
+    freeHistory();
+#endif
+}
+
+/* Return the history ring, created on first use, or NULL on out of memory.
+ * Must be called with history_lock held. */
+static struct historyRing *historyInit(void) {
+    struct historyRing *r = atomic_load(&history);
+
+    if (r == NULL) {
+        r = historyRingNew(history_max_len,0);
+        if (r) atomic_store_explicit(&history,r,memory_order_release);
+    }
+    return r;
+}
+
+/* Is the entry 'a' the same as 'b', for the purpose of dropping
+ * duplicates? */
+static int historySame(const char *a, const char *b) {
+    return history_ignorecase ? caseFoldEqual(a,strlen(a),b,strlen(b)) :
+                                !strcmp(a,b);
+}
+
+/* Add 'line' to the history as added at time 'stamp', in seconds, now if
+ * 'stamp' is zero, or at an unknown time if it is negative. Timestamps
+ * never go back, so that the history can be searched by time with a binary
+ * search: an entry older than the previous one gets the same timestamp. */
+static int historyAdd(const char *line, int64_t stamp) {
+    struct historyRing *r;
+    char *linecopy, *last, *normalized;
+    unsigned long head;
+    uint32_t prev;
+    int added = 0;
+
+    if (history_max_len == 0) return 0;
+    if ((line = historyNormalize(line,&normalized)) == NULL) return 0;
+    if (stamp == 0) stamp = time(NULL);
+    if (stamp < 0) stamp = 0;
+    if (stamp > UINT32_MAX) stamp = UINT32_MAX;
+
+    pthread_mutex_lock(&history_lock);
+    if ((r = historyInit()) == NULL) goto done;
+
+    /* Don't add duplicated lines. */
+    head = atomic_load(&r->head);
+    last = historyRingGet(r,head-1);
+    if (last && historySame(last,line)) goto done;
+    prev = historyRingStamp(r,head-1);
+    if (stamp < prev) stamp = prev;
+
+    /* Add an heap allocated copy of the line in the history. */
+    linecopy = lnStrdup(LN_POOL_HISTORY,line);
+    if (!linecopy) goto done;
+    historyRingPush(r,linecopy,stamp);
+    lntrace(LINENOISE_TRACE_HISTORY_ADD,atomic_load(&r->head)-1,strlen(line),0,0,0);
+    added = 1;
+
+done:
+    pthread_mutex_unlock(&history_lock);
+    lnFree(normalized);
+    return added;
+}
+
+/* This is the API call to add a new entry in the linenoise history.
+ * The history is a ring of at most history_max_len lines, when it is full
+ * the oldest line is evicted to make room for the new one. Adding only
+ * holds the writers lock for a few stores: threads concurrently reading
+ * the history are never blocked. */
+int linenoiseHistoryAdd(const char *line) {
+    return historyAdd(line,0);
+}
+
+/* Set the maximum length for the history. This function can be called even
+ * if there is already some history, the function will make sure to retain
+ * just the latest 'len' elements if the new history length value is smaller
+ * than the amount of items already inside the history. */
+int linenoiseHistorySetMaxLen(int len) {
+    struct historyRing *r, *new;
+    unsigned long seq, head, tail;
+
+    if (len < 1) return 0;
+    pthread_mutex_lock(&history_lock);
+    r = atomic_load(&history);
+    if (r) {
+        head = atomic_load(&r->head);
+        tail = atomic_load(&r->tail);
+
+        /* Sequence numbers are preserved, so readers browsing the old ring
+         * keep addressing the same lines in the new one. */
+        new = historyRingNew(len,head);
+        if (new == NULL) {
+            pthread_mutex_unlock(&history_lock);
+            return 0;
+        }
+        if (head-tail > (unsigned long)len) {
+            /* If we can't copy everything, retire the elements we'll not
+             * use. */
+            for (seq = tail; seq < head-len; seq++) {
+                statsUpdate(historyRingGet(r,seq),-1);
+                historyRetire(historyRingGet(r,seq));
+            }
+            tail = head-len;
+        }
+        for (seq = tail; seq < head; seq++) {
+            atomic_init(&new->vec[seq % len],historyRingGet(r,seq));
+            atomic_init(&new->stamps[seq % len],historyRingStamp(r,seq));
+        }
+        atomic_init(&new->tail,tail);
+        atomic_store_explicit(&history,new,memory_order_release);
+        historyRetire(r);
+    }
+    history_max_len = len;
+    pthread_mutex_unlock(&history_lock);
+    return 1;
+}
+
+int linenoiseHistoryGetMaxLen(void) {
+    return history_max_len;
+}
+
+/* History files are made of one entry per line. When some entry can't be
+ * saved as a plain line, or starts with '#' and could be taken for the
+ * header, or the timestamps are saved, the file starts with
+ * HISTORY_HEADER and all the entries are escaped: a backslash is written
+ * as \\, a new line as \n, a carriage return as \r, and a '#' starting
+ * an entry as \#, so that it is not taken for a timestamp line. Files
+ * without the header are read as plain lines, like the ones written by
+ * older versions. */
+#define HISTORY_HEADER "#linenoise-history"
+
+/* Write the entry 'line' in the history file 'fp', escaped if 'escape' is
+ * non zero. */
+static void historySaveLine(FILE *fp, const char *line, int escape) {
+    if (escape && *line == '#') fputc('\\',fp);
+    for (; *line; line++) {
+        if (escape && *line == '\\') fputs("\\\\",fp);
+        else if (escape && *line == '\n') fputs("\\n",fp);
+        else if (escape && *line == '\r') fputs("\\r",fp);
+        else fputc(*line,fp);
+    }
+    fputc('\n',fp);
+}
+
+/* Save the history in the specified file. On success 0 is returned
+ * otherwise -1 is returned. */
+int linenoiseHistorySave(const char *filename) {
+    mode_t old_umask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
+    struct historyReader *rd;
+    struct historyRing *r;
+    unsigned long seq, head, tail;
+    int escape = history_timestamps;
+    FILE *fp;
+
+    fp = fopen(filename,"w");
+    umask(old_umask);
+    if (fp == NULL) return -1;
+    (void)chmod(filename,S_IRUSR|S_IWUSR);
+    rd = historyPin();
+    r = atomic_load_explicit(&history,memory_order_acquire);
+    if (r) {
+        head = atomic_load_explicit(&r->head,memory_order_acquire);
+        tail = atomic_load(&r->tail);
+        /* Entries may only be evicted meanwhile, so the ones written are
+         * the ones checked here. */
+        for (seq = tail; seq < head && !escape; seq++) {
+            char *line = historyRingGet(r,seq);
+            escape = line && (line[0] == '#' || strpbrk(line,"\r\n"));
+        }
+        if (escape) fprintf(fp,"%s\n",HISTORY_HEADER);
+        for (seq = tail; seq < head; seq++) {
+            char *line = historyRingGet(r,seq);
+            uint32_t stamp = historyRingStamp(r,seq);
+            if (line == NULL) continue;
+            /* Timestamps go in a comment line before the entry. */
+            if (history_timestamps && stamp)
+                fprintf(fp,"#%lu\n",(unsigned long)stamp);
+            historySaveLine(fp,line,escape);
+        }
+    }
+    historyUnpin(rd);
+    fclose(fp);
+    return 0;
+}
+
+/* History files larger than LINENOISE_LOAD_CHUNK bytes are parsed in chunks
+ * of about that size on the thread pool. Chunks are split after a new line
+ * ending an entry, so that every chunk is parsed on its own, and their
+ * entries are merged in order. Only the last history_max_len entries of a
+ * file can be in the history once it is loaded, so this is all a chunk
+ * keeps, together with the first one, that may be a duplicate of the last
+ * entry of the chunk before. */
+#ifndef LINENOISE_LOAD_CHUNK
+#define LINENOISE_LOAD_CHUNK (1<<20)
+#endif
+
+struct loadEntry {
+    const char *s;          /* In the file, or allocated if 'owned'. */
+    size_t len;
+    uint32_t stamp;
+    int owned;
+};
+
+struct loadChunk {
+    size_t start, end;      /* Bytes of the file. */
+    size_t n;               /* Entries, duplicates excluded. */
+    struct loadEntry first;
+    int firstdup;           /* First entry duplicates the one before. */
+    struct loadEntry *ring; /* Last entries after the first one. */
+    size_t ringlen, ringcap, ringpos;
+    uint32_t evicted;       /* Newest timestamp evicted from the ring. */
+};
+
+struct loadJob {
+    struct poolJob pool;
+    const char *buf;
+    struct loadChunk *chunks;
+    size_t nchunks;
+    size_t keep;            /* Entries to keep. */
+    int escaped;            /* Entries are escaped, see HISTORY_HEADER. */
+    int fold;               /* Duplicates ignoring the case. */
+    int normalize;          /* Convert entries to NFC. */
+    int64_t now;
+    _Atomic size_t next;    /* Next chunk to claim. */
+    _Atomic int oom;
+};
+
+/* Return non zero if the 'len' bytes at 's' are a timestamp line. */
+static int loadIsStamp(const char *s, size_t len) {
+    size_t j;
+
+    if (len < 2 || s[0] != '#') return 0;
+    for (j = 1; j < len; j++) if (s[j] < '0' || s[j] > '9') return 0;
+    return 1;
+}
+
+/* Return the length of the header line if the 'size' bytes at 'buf' start
+ * with HISTORY_HEADER, otherwise 0. */
+static size_t loadHeader(const char *buf, size_t size) {
+    size_t len = strlen(HISTORY_HEADER);
+    const char *nl;
+
+    if (size < len || memcmp(buf,HISTORY_HEADER,len) != 0) return 0;
+    if (size > len && buf[len] != '\n' && buf[len] != '\r') return 0;
+    nl = memchr(buf+len,'\n',size-len);
+    return nl ? (size_t)(nl-buf+1) : size;
+}
+
+/* Return a copy of the escaped entry at 's', of 'len' bytes, with the
+ * escapes resolved, setting '*outlen' to its length. A backslash before
+ * any other character, or at the end, is dropped. Returns NULL on out of
+ * memory. */
+static char *loadUnescape(const char *s, size_t len, size_t *outlen) {
+    char *out = lnMalloc(LN_POOL_MISC,len+1), *p = out;
+    size_t j;
+
+    if (out == NULL) return NULL;
+    for (j = 0; j < len; j++) {
+        if (s[j] == '\\' && ++j < len) {
+            if (s[j] == 'n') *p++ = '\n';
+            else if (s[j] == 'r') *p++ = '\r';
+            else *p++ = s[j];
+        } else if (s[j] != '\\') {
+            *p++ = s[j];
+        }
+    }
+    *p = '\0';
+    *outlen = p-out;
+    return out;
+}
+
+/* Return the first offset from 'pos' where an entry starts, that is after
+ * a new line ending a line that is not a timestamp. Files not 'escaped'
+ * have no timestamps. */
+static size_t loadBoundary(const char *buf, size_t size, size_t pos, int escaped) {
+    const char *nl;
+
+    if (pos == 0) return 0;
+    for (pos--; pos < size && (nl = memchr(buf+pos,'\n',size-pos)); ) {
+        size_t end = nl-buf, start = end;
+        const char *cr;
+
+        while (start > 0 && buf[start-1] != '\n') start--;
+        if ((cr = memchr(buf+start,'\r',end-start)) != NULL) end = cr-buf;
+        if (!escaped || !loadIsStamp(buf+start,end-start)) return nl-buf+1;
+        pos = nl-buf+1;
+    }
+    return size;
+}
+
+static int loadSame(struct loadJob *job, const struct loadEntry *a, const char *b, size_t blen) {
+    if (job->fold) return caseFoldEqual(a->s,a->len,b,blen);
+    return a->len == blen && !memcmp(a->s,b,blen);
+}
+
+/* Last entry of the chunk 'c', that must not be empty. */
+static struct loadEntry *loadLast(struct loadJob *job, struct loadChunk *c) {
+    if (c->ringlen == 0) return &c->first;
+    return &c->ring[(c->ringpos+c->ringlen-1) % job->keep];
+}
+
+/* Add the entry 'e' to the chunk 'c'. Returns -1 on out of memory. */
+static int loadEntryAdd(struct loadJob *job, struct loadChunk *c, struct loadEntry *e, int64_t stamp) {
+    const char *nul = memchr(e->s,'\0',e->len);
+
+    /* Entries end at a null byte, and are never longer than a line. */
+    if (nul) e->len = nul-e->s;
+    if (e->len > LINENOISE_MAX_LINE-1) e->len = LINENOISE_MAX_LINE-1;
+    if (job->normalize && !nfcQuickCheck(e->s,e->len)) {
+        size_t len;
+        char *normalized = nfcNormalize(e->s,e->len,&len);
+
+        if (normalized == NULL) goto oom;
+        if (e->owned) lnFree((char *)e->s);
+        e->s = normalized;
+        e->len = len;
+        e->owned = 1;
+    }
+    if (stamp == 0) stamp = job->now;
+    if (stamp < 0) stamp = 0;
+    e->stamp = stamp > UINT32_MAX ? UINT32_MAX : stamp;
+
+    if (c->n && loadSame(job,loadLast(job,c),e->s,e->len)) {
+        if (e->owned) lnFree((char *)e->s);
+        return 0;
+    }
+    if (c->n++ == 0) {
+        c->first = *e;
+        return 0;
+    }
+    if (c->ringlen == job->keep) {
+        struct loadEntry *old = &c->ring[c->ringpos];
+
+        if (old->stamp > c->evicted) c->evicted = old->stamp;
+        if (old->owned) lnFree((char *)old->s);
+        *old = *e;
+        c->ringpos = (c->ringpos+1) % job->keep;
+        return 0;
+    }
+    if (c->ringlen == c->ringcap) {
+        size_t cap = c->ringcap ? c->ringcap*2 : 16;
+        struct loadEntry *ring;
+
+        if (cap > job->keep) cap = job->keep;
+        if ((ring = lnRealloc(LN_POOL_MISC,c->ring,sizeof(*ring)*cap)) == NULL) goto oom;
+        c->ring = ring;
+        c->ringcap = cap;
+    }
+    c->ring[c->ringlen++] = *e;
+    return 0;
+
+oom:
+    if (e->owned) lnFree((char *)e->s);
+    return -1;
+}
+
+/* Parse the chunk 'c', with the same rules as linenoiseHistoryLoad(). */
+static int loadParse(struct loadJob *job, struct loadChunk *c) {
+    const char *buf = job->buf;
+    size_t pos = c->start;
+    int64_t stamp = -1;
+    struct loadEntry e;
+
+    while (pos < c->end) {
+        const char *line = buf+pos, *nl, *cr;
+        size_t end, len;
+
+        nl = memchr(line,'\n',c->end-pos);
+        end = nl ? (size_t)(nl-buf) : c->end;
+        cr = memchr(line,'\r',end-pos);
+        len = (cr ? (size_t)(cr-buf) : end)-pos;
+        pos = nl ? end+1 : end;
+        if (job->escaped && loadIsStamp(line,len)) {
+            size_t j;
+
+            for (stamp = 0, j = 1; j < len; j++)
+                stamp = stamp > (INT64_MAX-9)/10 ? INT64_MAX :
+                        stamp*10+line[j]-'0';
+            continue;
+        }
+
+        if (job->escaped && memchr(line,'\\',len)) {
+            if ((e.s = loadUnescape(line,len,&e.len)) == NULL) return -1;
+            e.owned = 1;
+        } else {
+            e.s = line;
+            e.len = len;
+            e.owned = 0;
+        }
+        if (loadEntryAdd(job,c,&e,stamp) == -1) return -1;
+        stamp = -1;
+    }
+    return 0;
+}
+
+/* Parse chunks until there are no more. */
+static void loadRun(struct poolJob *pool) {
+    struct loadJob *job = (struct loadJob *)pool;
+    size_t k;
+
+    while ((k = atomic_fetch_add(&job->next,1)) < job->nchunks)
+        if (loadParse(job,&job->chunks[k]) == -1) job->oom = 1;
+}
+
+/* Add the entry 'e' to the history if 'add' is non zero, with a timestamp
+ * never older than '*stamp', that is updated. Returns -1 on out of memory.
+ * Must be called with history_lock held. */
+static int loadPush(struct historyRing *r, struct loadEntry *e, uint32_t *stamp, int add) {
+    char *line;
+
+    if (e->stamp > *stamp) *stamp = e->stamp;
+    if (!add) return 0;
+    if ((line = lnMalloc(LN_POOL_HISTORY,e->len+1)) == NULL) return -1;
+    memcpy(line,e->s,e->len);
+    line[e->len] = '\0';
+    historyRingPush(r,line,*stamp);
+    lntrace(LINENOISE_TRACE_HISTORY_ADD,atomic_load(&r->head)-1,e->len,0,0,0);
+    return 0;
+}
+
+/* Add the entries of the parsed chunks to the history, in order, as if
+ * added one by one: dropping duplicates of the entry before them, and
+ * with timestamps never going back. */
+static int loadMerge(struct loadJob *job) {
+    struct historyRing *r;
+    unsigned long head, total = 0, skip, idx = 0;
+    const char *last;
+    size_t lastlen, k, j;
+    uint32_t stamp;
+    int retval = -1;
+
+    pthread_mutex_lock(&history_lock);
+    if ((r = historyInit()) == NULL) goto done;
+    head = atomic_load(&r->head);
+    last = historyRingGet(r,head-1);
+    lastlen = last ? strlen(last) : 0;
+    stamp = historyRingStamp(r,head-1);
+    for (k = 0; k < job->nchunks; k++) {
+        struct loadChunk *c = &job->chunks[k];
+        struct loadEntry *e;
+
+        if (c->n == 0) continue;
+        c->firstdup = last && loadSame(job,&c->first,last,lastlen);
+        total += c->n-c->firstdup;
+        e = loadLast(job,c);
+        last = e->s;
+        lastlen = e->len;
+    }
+
+    /* Only the newest entries would stay in the history. */
+    skip = total > job->keep ? total-job->keep : 0;
+    for (k = 0; k < job->nchunks; k++) {
+        struct loadChunk *c = &job->chunks[k];
+
+        if (c->n == 0) continue;
+        if (!c->firstdup && loadPush(r,&c->first,&stamp,idx++ >= skip) == -1)
+            goto done;
+        if (c->evicted > stamp) stamp = c->evicted;
+        idx += c->n-1-c->ringlen;
+        for (j = 0; j < c->ringlen; j++) {
+            struct loadEntry *e = &c->ring[(c->ringpos+j) % job->keep];
+            if (loadPush(r,e,&stamp,idx++ >= skip) == -1) goto done;
+        }
+    }
+    retval = 0;
+
+done:
+    pthread_mutex_unlock(&history_lock);
+    return retval;
+}
+
+/* Read all the file 'fd' in a new allocated buffer, for the files that
+ * can't be mapped in memory. Returns -1 on error. */
+static int loadRead(int fd, char **buf, size_t *size) {
+    size_t cap = 0;
+    ssize_t n;
+
+    *buf = NULL;
+    *size = 0;
+    do {
+        if (*size == cap) {
+            char *p = lnRealloc(LN_POOL_MISC,*buf,cap = cap ? cap*2 : 65536);
+            if (p == NULL) return -1;
+            *buf = p;
+        }
+        n = read(fd,*buf+*size,cap-*size);
+        if (n > 0) *size += n;
+    } while (n > 0 || (n == -1 && errno == EINTR));
+    return n;
+}
+
+/* Load the history from the specified file. If the file does not exist
+ * -1 is returned and no operation is performed.
+ *
+ * Every line is an entry. When the file starts with HISTORY_HEADER, as
+ * written by linenoiseHistorySave() for multi line entries or timestamps,
+ * the entries are escaped, and a line made of '#' and digits is the
+ * timestamp of the next entry, like in the bash history files. Entries end
+ * at a carriage return or a null byte, and are cut at LINENOISE_MAX_LINE-1
+ * bytes.
+ *
+ * If the file exists and the operation succeeded 0 is returned, otherwise
+ * on error -1 is returned. */
+int linenoiseHistoryLoad(const char *filename) {
+    int fd = open(filename,O_RDONLY);
+    struct loadJob job;
+    struct stat st;
+    char *buf = NULL;
+    size_t size = 0, start, k, j;
+    int mapped = 0, retval = -1;
+
+    if (fd == -1) return -1;
+    memset(&job,0,sizeof(job));
+    if (fstat(fd,&st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        buf = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (buf != MAP_FAILED) {
+            mapped = 1;
+            size = st.st_size;
+        }
+    }
+    if (!mapped && loadRead(fd,&buf,&size) == -1) goto done;
+    if (history_max_len == 0 || size == 0) {
+        retval = 0;
+        goto done;
+    }
+
+    start = loadHeader(buf,size);
+    job.pool.run = loadRun;
+    job.buf = buf;
+    job.escaped = start != 0;
+    job.keep = history_max_len;
+    job.fold = history_ignorecase;
+    job.normalize = history_normalize;
+    job.now = time(NULL);
+    job.nchunks = (size+LINENOISE_LOAD_CHUNK-1)/LINENOISE_LOAD_CHUNK;
+    if ((job.chunks = lnCalloc(LN_POOL_MISC,job.nchunks,sizeof(*job.chunks))) == NULL)
+        goto done;
+    for (k = 0; k < job.nchunks; k++) {
+        struct loadChunk *c = &job.chunks[k];
+        size_t end = (k+1)*LINENOISE_LOAD_CHUNK;
+
+        c->start = k ? job.chunks[k-1].end : start;
+        c->end = loadBoundary(buf,size,end > c->start ? end : c->start,job.escaped);
+    }
+    atomic_init(&job.next,0);
+    atomic_init(&job.oom,0);
+    if (job.nchunks > 1) poolRun(&job.pool);
+    else loadRun(&job.pool);
+    if (!job.oom) retval = loadMerge(&job);
+
+done:
+    for (k = 0; job.chunks && k < job.nchunks; k++) {
+        struct loadChunk *c = &job.chunks[k];
+
+        if (c->n && c->first.owned) lnFree((char *)c->first.s);
+        for (j = 0; j < c->ringlen; j++)
+            if (c->ring[j].owned) lnFree((char *)c->ring[j].s);
+        lnFree(c->ring);
+    }
+    lnFree(job.chunks);
+    if (mapped) munmap(buf,size);
+    else lnFree(buf);
+    close(fd);
+    return retval;
+}
+
+/* Entry being imported by linenoiseHistoryImport(), and the entries
+ * imported so far. Only the last history_max_len of them can be in the
+ * history after the import, so they are kept in a ring of that size. */
+struct importEntry {
+    char *buf;
+    size_t len, cap;
+    int64_t stamp;
+    int open;               /* An entry was started. */
+    char **lines;           /* Imported entries, entry 'n' in n % max. */
+    uint32_t *stamps;       /* Their timestamps, never going back. */
+    size_t count, max;      /* Entries imported, slots of the ring. */
+    int oom;                /* Out of memory while keeping an entry? */
+};
+
+/* Append 'len' bytes at 's' to the entry, after a new line if 'nl' is non
+ * zero and the entry is not empty. Returns -1 on out of memory. */
+static int importAppend(struct importEntry *e, const char *s, size_t len, int nl) {
+    nl = nl && e->len;
+    if (e->len+len+nl+1 > e->cap) {
+        size_t cap = (e->len+len+nl+1)*2;
+        char *buf = lnRealloc(LN_POOL_MISC,e->buf,cap);
+
+        if (buf == NULL) return -1;
+        e->buf = buf;
+        e->cap = cap;
+    }
+    if (nl) e->buf[e->len++] = '\n';
+    memcpy(e->buf+e->len,s,len);
+    e->len += len;
+    e->buf[e->len] = '\0';
+    e->open = 1;
+    return 0;
+}
+
+/* Keep the entry 'line' imported at time 'stamp', or at an unknown time
+ * if negative, unless it duplicates the entry before it. Like historyAdd(),
+ * an entry older than the one before it gets its timestamp. */
+static void importKeep(struct importEntry *e, const char *line, int64_t stamp) {
+    char *normalized, *copy, **slot;
+    uint32_t prev = 0;
+
+    if ((line = historyNormalize(line,&normalized)) == NULL) {
+        e->oom = 1;
+        return;
+    }
+    if (stamp < 0) stamp = 0;
+    if (stamp > UINT32_MAX) stamp = UINT32_MAX;
+    if (e->count) {
+        size_t last = (e->count-1) % e->max;
+
+        if (historySame(e->lines[last],line)) goto done;
+        prev = e->stamps[last];
+    }
+    if ((copy = lnStrdup(LN_POOL_HISTORY,line)) == NULL) {
+        e->oom = 1;
+        goto done;
+    }
+    slot = &e->lines[e->count % e->max];
+    lnFree(*slot);
+    *slot = copy;
+    e->stamps[e->count % e->max] = stamp < prev ? prev : stamp;
+    e->count++;
+
+done:
+    lnFree(normalized);
+}
+
+/* Keep the entry, unless empty, and start a new one with an unknown
+ * timestamp. */
+static void importFlush(struct importEntry *e) {
+    if (e->len) importKeep(e,e->buf,e->stamp);
+    e->len = 0;
+    e->stamp = -1;
+    e->open = 0;
+}
+
+/* Merge the imported entries with the ones of the history by time, into a
+ * new ring replacing the current one. Entries older than the ones already
+ * in the history go before them, instead of being added at the end with
+ * their timestamps clamped. The entries get new sequence numbers, after the
+ * ones of the current ring. An imported entry is dropped if it duplicates
+ * the entry before it. Returns -1 on out of memory. */
+static int importMerge(struct importEntry *e) {
+    struct historyRing *r, *new;
+    unsigned long seq, head, tail;
+    size_t n, i;
+    const char *last = NULL;
+    int retval = -1;
+
+    pthread_mutex_lock(&history_lock);
+    if ((r = historyInit()) == NULL) goto done;
+    head = atomic_load(&r->head);
+    tail = atomic_load(&r->tail);
+    if ((new = historyRingNew(r->max_len,head)) == NULL) goto done;
+
+    /* The entries kept are counted again as they are pushed. */
+    for (seq = tail; seq < head; seq++) statsUpdate(historyRingGet(r,seq),-1);
+    n = e->count < e->max ? e->count : e->max;
+    i = e->count-n;
+    seq = tail;
+    while (seq < head || i < e->count) {
+        size_t slot = i % e->max;
+
+        if (i == e->count ||
+            (seq < head && historyRingStamp(r,seq) <= e->stamps[slot]))
+        {
+            last = historyRingGet(r,seq);
+            historyRingPush(new,(char *)last,historyRingStamp(r,seq));
+            seq++;
+            continue;
+        }
+        if (last == NULL || !historySame(last,e->lines[slot])) {
+            last = e->lines[slot];
+            historyRingPush(new,e->lines[slot],e->stamps[slot]);
+            lntrace(LINENOISE_TRACE_HISTORY_ADD,atomic_load(&new->head)-1,
+                    strlen(last),0,0,0);
+        } else {
+            lnFree(e->lines[slot]);
         }
+        e->lines[slot] = NULL;
+        i++;
     }
-    return l.len;
-}
+    atomic_store_explicit(&history,new,memory_order_release);
+    historyRetire(r);
+    retval = 0;
 
-/* This special mode is used by linenoise in order to print scan codes
- * on screen for debugging / development purposes. It is implemented
- * by the linenoise_example program using the --keycodes option. */
-void linenoisePrintKeyCodes(void) {
-    char quit[4];
+done:
+    pthread_mutex_unlock(&history_lock);
+    return retval;
+}
 
-    printf("Linenoise key codes debugging mode.\n"
-            "Press keys to see scan codes. Type 'quit' at any time to exit.\n");
-    if (enableRawMode(STDIN_FILENO) == -1) return;
-    memset(quit,' ',4);
-    while(1) {
-        char c;
-        int nread;
+/* Parse the digits at 's' into '*stamp'. Returns the bytes parsed. */
+static size_t importStamp(const char *s, int64_t *stamp) {
+    size_t j;
 
-        nread = read(STDIN_FILENO,&c,1);
-        if (nread <= 0) continue;
-        memmove(quit,quit+1,sizeof(quit)-1); /* shift string to left. */
-        quit[sizeof(quit)-1] = c; /* Insert current char on the right. */
-        if (memcmp(quit,"quit",sizeof(quit)) == 0) break;
+    for (*stamp = 0, j = 0; s[j] >= '0' && s[j] <= '9'; j++)
+        *stamp = *stamp > (INT64_MAX-9)/10 ? INT64_MAX : *stamp*10+s[j]-'0';
+    return j;
+}
 
-        printf("'%c' %02x (%d) (type quit to exit)\n",
-            isprint((int)c) ? c : '?', (int)c, (int)c);
-        printf("\r"); /* Go left edge manually, we are in raw mode. */
-        fflush(stdout);
+/* Bash: a line made of '#' and digits is the timestamp of the entry in the
+ * lines that follow, up to the next timestamp. Without timestamps every
+ * line is an entry. */
+static int importBash(struct importEntry *e, char *line, size_t len) {
+    int64_t stamp;
+
+    if (line[0] == '#' && len > 1 && importStamp(line+1,&stamp) == len-1) {
+        importFlush(e);
+        e->stamp = stamp;
+        e->open = 1;
+        return 0;
     }
-    disableRawMode(STDIN_FILENO);
+    if (!e->open) {
+        e->open = 1;
+        if (importAppend(e,line,len,0) == -1) return -1;
+        importFlush(e);
+        return 0;
+    }
+    return importAppend(e,line,len,1);
 }
 
-/* This function calls the line editing function linenoiseEdit() using
- * the STDIN file descriptor set in raw mode. */
-static int linenoiseRaw(char *buf, FILE *out, size_t buflen, const char *prompt) {
-    int outfd, count;
+/* Zsh: bytes the shell reserves are written as 0x83 followed by the byte
+ * XOR 32. With EXTENDED_HISTORY an entry starts with ': <time>:<duration>;'
+ * and a line ending with a backslash goes on in the next one. */
+static int importZsh(struct importEntry *e, char *line, size_t len) {
+    size_t i, j;
+    int more;
 
-    if (buflen == 0) {
-        errno = EINVAL;
-        return -1;
+    for (i = 0, j = 0; i < len; i++) {
+        if ((unsigned char)line[i] == 0x83 && i+1 < len) line[j++] = line[++i] ^ 32;
+        else line[j++] = line[i];
+    }
+    len = j;
+    line[len] = '\0';
+
+    more = len && line[len-1] == '\\';
+    if (!e->open && line[0] == ':' && line[1] == ' ') {
+        int64_t stamp;
+        size_t n = importStamp(line+2,&stamp);
+        char *cmd;
+
+        if (n && line[2+n] == ':' && (cmd = strchr(line+2+n,';')) != NULL) {
+            e->stamp = stamp;
+            len -= cmd+1-line;
+            line = cmd+1;
+        }
     }
+    if (importAppend(e,line,len-more,0) == -1) return -1;
+    if (more) {
+        if (importAppend(e,"\n",1,0) == -1) return -1;
+    } else {
+        importFlush(e);
+    }
+    return 0;
+}
 
-    if ((outfd = fileno(out)) == -1)
-        return -1;
+/* Fish: a YAML like list of '- cmd: <command>' items, with the time in a
+ * 'when: <time>' field. New lines and backslashes in the command are
+ * escaped with a backslash. */
+static int importFish(struct importEntry *e, char *line, size_t len) {
+    size_t i, j;
+
+    if (!strncmp(line,"- cmd: ",7)) {
+        importFlush(e);
+        for (i = 7, j = 0; i < len; i++) {
+            if (line[i] == '\\' && line[i+1] == 'n') line[j++] = '\n', i++;
+            else if (line[i] == '\\' && line[i+1] == '\\') line[j++] = '\\', i++;
+            else line[j++] = line[i];
+        }
+        return importAppend(e,line,j,0);
+    }
+    if (e->open && !strncmp(line,"  when: ",8)) importStamp(line+8,&e->stamp);
+    return 0;
+}
 
-    if (enableRawMode(STDIN_FILENO) == -1) return -1;
-    count = linenoiseEdit(STDIN_FILENO, outfd, buf, buflen, prompt);
-    disableRawMode(STDIN_FILENO);
-    fprintf(out, "\n");
-    return count;
+/* Read a line of any length from 'fp' into '*line', of '*cap' bytes, that
+ * grows as needed. Returns its length, -1 at the end of the file, or -2 on
+ * out of memory. */
+static ssize_t importReadLine(FILE *fp, char **line, size_t *cap) {
+    size_t len = 0;
+
+    while (1) {
+        if (*cap-len < 2) {
+            size_t newcap = *cap ? *cap*2 : 256;
+            char *p = lnRealloc(LN_POOL_MISC,*line,newcap);
+
+            if (p == NULL) return -2;
+            *line = p;
+            *cap = newcap;
+        }
+        if (fgets(*line+len,*cap-len,fp) == NULL) return len ? (ssize_t)len : -1;
+        len += strlen(*line+len);
+        if (len && (*line)[len-1] == '\n') return len;
+    }
 }
 
-/* This function is called when linenoise() is called with the standard
- * input file descriptor not attached to a TTY. So for example when the
- * program using linenoise is called in pipe or with a file redirected
- * to its standard input. In this case, we want to be able to return the
- * line regardless of its length (by default we are limited to 4k). */
-static char *linenoiseNoTTY(void) {
+/* Import the history file of another shell, in the format 'format', one of
+ * LINENOISE_HISTORY_BASH, LINENOISE_HISTORY_ZSH or LINENOISE_HISTORY_FISH.
+ * Entries are parsed one line at a time, keeping the last history_max_len
+ * of them, that are then merged with the history by time. Returns 0 on
+ * success, or -1 if the file can't be read, the format is unknown or on
+ * out of memory. */
+int linenoiseHistoryImport(const char *filename, int format) {
+    int (*parse)(struct importEntry *e, char *line, size_t len);
+    struct importEntry e = { NULL, 0, 0, -1, 0, NULL, NULL, 0, 0, 0 };
     char *line = NULL;
-    size_t len = 0, maxlen = 0;
+    size_t cap = 0, j;
+    ssize_t len;
+    int retval = 0;
+    FILE *fp;
 
-    while(1) {
-    	int c;
-        if (len == maxlen) {
-            char *oldval = line;
-            if (maxlen == 0) maxlen = 16;
-            maxlen *= 2;
-            line = realloc(line,maxlen);
-            if (line == NULL) {
-                if (oldval) free(oldval);
-                return NULL;
-            }
+    switch(format) {
+    case LINENOISE_HISTORY_BASH: parse = importBash; break;
+    case LINENOISE_HISTORY_ZSH: parse = importZsh; break;
+    case LINENOISE_HISTORY_FISH: parse = importFish; break;
+    default: errno = EINVAL; return -1;
+    }
+    if ((e.max = history_max_len) == 0) return 0;
+    if ((fp = fopen(filename,"r")) == NULL) return -1;
+    e.lines = lnCalloc(LN_POOL_MISC,e.max,sizeof(*e.lines));
+    e.stamps = lnMalloc(LN_POOL_MISC,sizeof(*e.stamps)*e.max);
+    if (e.lines == NULL || e.stamps == NULL) {
+        retval = -1;
+        goto done;
+    }
+    while ((len = importReadLine(fp,&line,&cap)) >= 0) {
+        if (len && line[len-1] == '\n') line[--len] = '\0';
+        if (len && line[len-1] == '\r') line[--len] = '\0';
+        if (parse(&e,line,len) == -1) {
+            retval = -1;
+            break;
         }
-        c = fgetc(stdin);
-        if (c == EOF || c == '\n') {
-            if (c == EOF && len == 0) {
-                free(line);
-                return NULL;
-            } else {
-                line[len] = '\0';
-                return line;
-            }
-        } else {
-            line[len] = c;
-            len++;
+    }
+    if (len == -2 || ferror(fp)) retval = -1;
+    if (retval == 0) importFlush(&e);
+    if (e.oom) retval = -1;
+    if (retval == 0) retval = importMerge(&e);
+
+done:
+    for (j = 0; e.lines && j < e.max; j++) lnFree(e.lines[j]);
+    lnFree(e.lines);
+    lnFree(e.stamps);
+    lnFree(line);
+    lnFree(e.buf);
+    fclose(fp);
+    return retval;
+}
+
+/* Copy the history into the specified array.
+ * it must already be allocated to have at least destlen spaces.
+ * The size of the history is returned. Since other threads may add lines
+ * meanwhile, when less than destlen entries were copied the number of
+ * copied entries is returned instead. */
+int linenoiseHistoryCopy(char** dest, int destlen) {
+    struct historyReader *rd = historyPin();
+    struct historyRing *r = atomic_load_explicit(&history,memory_order_acquire);
+    unsigned long seq, head, tail;
+    int i = 0, len = 0;
+
+    if (r) {
+        head = atomic_load_explicit(&r->head,memory_order_acquire);
+        tail = atomic_load(&r->tail);
+        len = head-tail;
+        for (seq = tail; seq < head && i < destlen; seq++) {
+            char *line = historyRingGet(r,seq);
+            if (line) dest[i++] = lnStrdup(LN_POOL_MISC,line);
         }
     }
+    historyUnpin(rd);
+    return i < destlen ? i : len;
 }
 
-/* The high level function that is the main API of the linenoise library.
- * This function checks if the terminal has basic capabilities, just checking
- * for a blacklist of stupid terminals, and later either calls the line
- * editing function or uses dummy fgets() so that you will be able to type
- * something even in the most desperate of the conditions. */
-char *linenoise(const char *prompt) {
-    char buf[LINENOISE_MAX_LINE];
-    FILE *stream;
-    int count;
+/* Save the timestamps of the entries with linenoiseHistorySave(), if
+ * 'enable' is non zero. Timestamps are always kept in memory. */
+void linenoiseHistorySetTimestamps(int enable) {
+    history_timestamps = enable;
+}
 
-    stream = isatty(STDOUT_FILENO) ? stdout : stderr;
-    if (!isatty(STDIN_FILENO)) {
-        /* Not a tty: read from file / pipe. In this mode we don't want any
-         * limit to the line size, so we call a function to handle that. */
-        return linenoiseNoTTY();
-    } else if (isUnsupportedTerm()) {
-        size_t len;
+/* Ignore the case, in every script, when looking for duplicated lines to
+ * add and in linenoiseHistorySearch(), if 'enable' is non zero. */
+void linenoiseHistorySetIgnoreCase(int enable) {
+    history_ignorecase = enable;
+}
 
-        fprintf(stream, "%s",prompt);
-        fflush(stream);
-        if (fgets(buf,LINENOISE_MAX_LINE,stdin) == NULL) return NULL;
-        len = strlen(buf);
-        while(len && (buf[len-1] == '\n' || buf[len-1] == '\r')) {
-            len--;
-            buf[len] = '\0';
+/* Convert the entries to the Unicode Normalization Form C before to add
+ * them, and the strings searched for in the history, if 'enable' is non
+ * zero. Entries already added are left as they are. */
+void linenoiseHistorySetNormalize(int enable) {
+    history_normalize = enable;
+}
+
+/* Copy the entries added from the time 'from' included to 'to' excluded,
+ * in seconds since the epoch, into 'lines', oldest first, up to 'max', and
+ * their timestamps into 'stamps' unless it is NULL. Timestamps never go
+ * back, so the first entry is found with a binary search. Returns the
+ * number of entries copied, or -1 on out of memory. */
+int linenoiseHistoryRange(int64_t from, int64_t to, char **lines, int64_t *stamps, int max) {
+    struct historyReader *rd = historyPin();
+    struct historyRing *r = atomic_load_explicit(&history,memory_order_acquire);
+    unsigned long lo, hi, seq;
+    int n = 0;
+
+    if (r == NULL) goto done;
+    lo = atomic_load(&r->tail);
+    hi = atomic_load_explicit(&r->head,memory_order_acquire);
+    /* Evicted entries read as 0, they were the oldest anyway. */
+    while (lo < hi) {
+        unsigned long mid = lo+(hi-lo)/2;
+        if ((int64_t)historyRingStamp(r,mid) < from) lo = mid+1;
+        else hi = mid;
+    }
+    hi = atomic_load_explicit(&r->head,memory_order_acquire);
+    for (seq = lo; seq < hi && n < max; seq++) {
+        uint32_t stamp = historyRingStamp(r,seq);
+        char *line = historyRingGet(r,seq);
+
+        if ((int64_t)stamp >= to) break;
+        if (line == NULL) continue;
+        if ((lines[n] = lnStrdup(LN_POOL_MISC,line)) == NULL) {
+            while (n) lnFree(lines[--n]);
+            n = -1;
+            break;
         }
-        return strdup(buf);
-    } else {
-        count = linenoiseRaw(buf,stream,LINENOISE_MAX_LINE,prompt);
-        if (count == -1) return NULL;
-        return strdup(buf);
+        if (stamps) stamps[n] = stamp;
+        n++;
     }
+
+done:
+    historyUnpin(rd);
+    return n;
 }
 
-/* This is just a wrapper the user may want to call in order to make sure
- * the linenoise returned buffer is freed with the same allocator it was
- * created with. Useful when the main program is using an alternative
- * allocator. */
-void linenoiseFree(void *ptr) {
-    free(ptr);
+/* ============================= History search ============================= */
+
+/* Large histories are searched in chunks of LINENOISE_SEARCH_CHUNK entries,
+ * claimed from the newest to the oldest by the calling thread and by the
+ * thread pool. Every chunk keeps its matches newest first, and as soon as
+ * the chunks completed in order from the newest hold enough matches, the
+ * older ones are not scanned at all.
+ *
+ * Only the calling thread is pinned as a history reader: it waits for the
+ * whole pool to be done with the job before to unpin, so nothing the
+ * threads reference can be freed meanwhile. */
+#ifndef LINENOISE_SEARCH_CHUNK
+#define LINENOISE_SEARCH_CHUNK 8192
+#endif
+
+typedef int (historyMatchFn)(const char *line, void *privdata);
+
+struct searchChunk {
+    unsigned long *seqs;    /* Sequence numbers of the matches. */
+    size_t len;
+    size_t cap;
+    int done;
+};
+
+struct searchJob {
+    struct poolJob pool;
+    struct historyRing *r;
+    unsigned long head, tail;
+    historyMatchFn *match;
+    void *privdata;
+    size_t max;             /* Matches wanted. */
+    struct searchChunk *chunks;
+    size_t nchunks;
+    _Atomic size_t next;    /* Next chunk to claim. */
+    _Atomic size_t limit;   /* Chunks from here on are not needed. */
+    size_t ordered;         /* Chunks done in order from the newest. */
+    size_t found;           /* Matches in the 'ordered' chunks. */
+    _Atomic int oom;        /* Out of memory while storing a match. */
+};
+
+/* Scan chunks until there are no more, or no more are needed. */
+static void searchRun(struct poolJob *pool) {
+    struct searchJob *job = (struct searchJob *)pool;
+    size_t k;
+
+    while ((k = atomic_fetch_add(&job->next,1)) < atomic_load(&job->limit)) {
+        struct searchChunk *c = &job->chunks[k];
+        unsigned long hi = job->head-k*LINENOISE_SEARCH_CHUNK, seq;
+        unsigned long lo = hi-job->tail > LINENOISE_SEARCH_CHUNK ?
+                           hi-LINENOISE_SEARCH_CHUNK : job->tail;
+
+        for (seq = hi; seq-- > lo && c->len < job->max; ) {
+            char *line = historyRingGet(job->r,seq);
+
+            if (line == NULL || !job->match(line,job->privdata)) continue;
+            if (c->len == c->cap) {
+                size_t cap = c->cap ? c->cap*2 : 16;
+                unsigned long *seqs = lnRealloc(LN_POOL_MISC,c->seqs,sizeof(*seqs)*cap);
+
+                if (seqs == NULL) {
+                    job->oom = 1;
+                    break;
+                }
+                c->seqs = seqs;
+                c->cap = cap;
+            }
+            c->seqs[c->len++] = seq;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        c->done = 1;
+        while (job->ordered < job->nchunks && job->chunks[job->ordered].done)
+            job->found += job->chunks[job->ordered++].len;
+        if (job->found >= job->max) atomic_store(&job->limit,job->ordered);
+        pthread_mutex_unlock(&pool_lock);
+    }
 }
 
-/* ================================ History ================================= */
+/* Store in 'results' copies of the newest 'max' history entries accepted
+ * by 'match', newest first. Returns the number of results, or -1 on out of
+ * memory. */
+static int historySearch(historyMatchFn *match, void *privdata, char **results, int max) {
+    struct historyReader *rd;
+    struct searchJob job;
+    size_t k;
+    int n = 0;
+
+    if (max <= 0) return 0;
+    memset(&job,0,sizeof(job));
+    rd = historyPin();
+    job.r = atomic_load_explicit(&history,memory_order_acquire);
+    if (job.r == NULL) goto done;
+    job.head = atomic_load_explicit(&job.r->head,memory_order_acquire);
+    job.tail = atomic_load(&job.r->tail);
+    job.match = match;
+    job.privdata = privdata;
+    job.max = max;
+    job.nchunks = (job.head-job.tail+LINENOISE_SEARCH_CHUNK-1) /
+                  LINENOISE_SEARCH_CHUNK;
+    job.chunks = lnCalloc(LN_POOL_MISC,job.nchunks ? job.nchunks : 1,sizeof(*job.chunks));
+    if (job.chunks == NULL) {
+        n = -1;
+        goto done;
+    }
+    atomic_init(&job.next,0);
+    atomic_init(&job.limit,job.nchunks);
+    atomic_init(&job.oom,0);
+
+    job.pool.run = searchRun;
+    if (job.nchunks > 1) poolRun(&job.pool);
+    else searchRun(&job.pool);
+
+    /* Merge the chunks from the newest. */
+    for (k = 0; k < job.nchunks && n < max; k++) {
+        struct searchChunk *c = &job.chunks[k];
+        size_t j;
+
+        for (j = 0; j < c->len && n < max; j++) {
+            char *line = historyRingGet(job.r,c->seqs[j]);
+
+            if (line == NULL) continue;
+            if ((results[n] = lnStrdup(LN_POOL_MISC,line)) == NULL) {
+                job.oom = 1;
+                break;
+            }
+            n++;
+        }
+    }
+    for (k = 0; k < job.nchunks; k++) lnFree(job.chunks[k].seqs);
+    lnFree(job.chunks);
+    if (job.oom) {
+        while (n) lnFree(results[--n]);
+        n = -1;
+    }
 
-#ifdef VALGRIND
-/* Free the history, but does not reset it. Only used when we have to
- * exit() to avoid memory leaks are reported by valgrind & co. */
-static void freeHistory(void) {
-    if (history) {
-        int j;
+done:
+    historyUnpin(rd);
+    return n;
+}
 
-        for (j = 0; j < history_len; j++)
-            free(history[j]);
-        free(history);
+/* Return non zero if 'needle' of 'm' bytes is found in 's' of 'len' bytes.
+ * Only the positions where both the first and the last byte of the needle
+ * match are compared in full. They are found eight at a time: the two
+ * bytes are broadcast to a word, XORed with the words starting at the
+ * position and at the position plus m-1, and a zero byte in the OR of the
+ * two is a candidate. The zero byte test may flag a few more bytes than
+ * the zero ones, never less, so every flagged word is checked byte by
+ * byte. */
+static int substrFind(const char *s, size_t len, const char *needle, size_t m) {
+    const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    unsigned char first, last;
+    uint64_t vfirst, vlast;
+    size_t i = 0, j;
+
+    if (m == 0) return 1;
+    if (m > len) return 0;
+    if (m == 1) return memchr(s,needle[0],len) != NULL;
+    first = needle[0];
+    last = needle[m-1];
+    vfirst = ones*first;
+    vlast = ones*last;
+    for (; i+m-1+8 <= len; i += 8) {
+        uint64_t a, b, v;
+
+        memcpy(&a,s+i,8);
+        memcpy(&b,s+i+m-1,8);
+        v = (a^vfirst) | (b^vlast);
+        if (((v-ones) & ~v & highs) == 0) continue;
+        for (j = i; j < i+8; j++) {
+            if ((unsigned char)s[j] == first &&
+                (unsigned char)s[j+m-1] == last &&
+                !memcmp(s+j+1,needle+1,m-2)) return 1;
+        }
     }
+    for (; i+m <= len; i++) {
+        if ((unsigned char)s[i] == first &&
+            (unsigned char)s[i+m-1] == last &&
+            !memcmp(s+i+1,needle+1,m-2)) return 1;
+    }
+    return 0;
 }
-#endif
 
-/* At exit we'll try to fix the terminal to the initial conditions. */
-static void linenoiseAtExit(void) {
-    disableRawMode(STDIN_FILENO);
-#ifdef VALGRIND
-    freeHistory();
-#endif
+struct substrMatch {
+    const char *needle;
+    size_t len;
+    int fold;               /* Needle folded, fold the lines too. */
+};
+
+static int substrMatchLine(const char *line, void *privdata) {
+    struct substrMatch *sm = privdata;
+    size_t len = strlen(line), flen;
+    char buf[1024], *folded = buf;
+    int match;
+
+    if (!sm->fold) return substrFind(line,len,sm->needle,sm->len);
+    if (len*2 > sizeof(buf) && (folded = lnMalloc(LN_POOL_MISC,len*2)) == NULL) return 0;
+    flen = caseFold(line,len,folded);
+    match = substrFind(folded,flen,sm->needle,sm->len);
+    if (folded != buf) lnFree(folded);
+    return match;
 }
 
-/* This is the API call to add a new entry in the linenoise history.
- * It uses a fixed array of char pointers that are shifted (memmoved)
- * when the history max length is reached in order to remove the older
- * entry and make room for the new one, so it is not exactly suitable for huge
- * histories, but will work well for a few hundred of entries.
+/* Store in 'results' copies of the newest 'max' history entries containing
+ * 'needle', newest first, to be released with linenoiseFree(). The case is
+ * ignored if enabled with linenoiseHistorySetIgnoreCase(). Returns the
+ * number of entries stored, or -1 on out of memory. */
+int linenoiseHistorySearch(const char *needle, char **results, int max) {
+    struct substrMatch sm;
+    char *folded = NULL, *normalized;
+    int found;
+
+    if ((needle = historyNormalize(needle,&normalized)) == NULL) return -1;
+    sm.needle = needle;
+    sm.len = strlen(needle);
+    sm.fold = history_ignorecase;
+    if (sm.fold) {
+        folded = caseFoldDup(needle,sm.len,&sm.len);
+        if (folded == NULL) {
+            lnFree(normalized);
+            return -1;
+        }
+        sm.needle = folded;
+    }
+    found = historySearch(substrMatchLine,&sm,results,max);
+    lnFree(folded);
+    lnFree(normalized);
+    return found;
+}
+
+static int regexMatchLine(const char *line, void *privdata) {
+    return linenoiseRegexMatch(privdata,line);
+}
+
+/* Like linenoiseHistorySearch(), for the entries matching the regular
+ * expression 're'. */
+int linenoiseHistorySearchRegex(const linenoiseRegex *re, char **results, int max) {
+    return historySearch(regexMatchLine,(void *)re,results,max);
+}
+
+/* =========================== History statistics =========================== */
+
+/* Once enabled, the number of times every distinct entry and every first
+ * token of an entry is in the history is kept up to date as entries are
+ * added and evicted, so that reporting them does not scan the history.
  *
- * Using a circular buffer is smarter, but a bit more complex to handle. */
-int linenoiseHistoryAdd(const char *line) {
-    char *linecopy;
+ * Counters live in a hash table, and in a rank array sorted by decreasing
+ * count. Counts only change by one, so a counter keeps the array sorted by
+ * swapping with the first (or last) counter of its count, found with a
+ * binary search, before to change it. The most frequent counters are then
+ * just the first ones of the array. All of this is protected by
+ * history_lock. */
+struct statsNode {
+    char *key;
+    size_t keylen;
+    unsigned long count;
+    size_t rank;                /* Position in the rank array. */
+    unsigned int hash;
+    struct statsNode *next;     /* Next in the hash bucket. */
+};
 
-    if (history_max_len == 0) return 0;
+struct statsTable {
+    struct statsNode **buckets;
+    size_t size;                /* Buckets, power of two. */
+    struct statsNode **rank;    /* Counters by decreasing count. */
+    size_t len;
+    size_t cap;
+};
 
-    /* Initialization on first call. */
-    if (history == NULL) {
-        history = malloc(sizeof(char*)*history_max_len);
-        if (history == NULL) return 0;
-        memset(history,0,(sizeof(char*)*history_max_len));
-    }
+static int stats_enabled = 0;
+static struct statsTable stats_entries, stats_tokens;
 
-    /* Don't add duplicated lines. */
-    if (history_len && !strcmp(history[history_len-1], line)) return 0;
-
-    /* Add an heap allocated copy of the line in the history.
-     * If we reached the max length, remove the older line. */
-    linecopy = strdup(line);
-    if (!linecopy) return 0;
-    if (history_len == history_max_len) {
-        free(history[0]);
-        memmove(history,history+1,sizeof(char*)*(history_max_len-1));
-        history_len--;
-    }
-    history[history_len] = linecopy;
-    history_len++;
-    return 1;
+static unsigned int statsHash(const char *key, size_t len) {
+    unsigned int h = 2166136261u;
+
+    while (len--) h = (h ^ (unsigned char)*key++) * 16777619u;
+    return h;
 }
 
-/* Set the maximum length for the history. This function can be called even
- * if there is already some history, the function will make sure to retain
- * just the latest 'len' elements if the new history length value is smaller
- * than the amount of items already inside the history. */
-int linenoiseHistorySetMaxLen(int len) {
-    char **new;
+static void statsSwap(struct statsTable *t, size_t a, size_t b) {
+    struct statsNode *n = t->rank[a];
 
-    if (len < 1) return 0;
-    if (history) {
-        int tocopy = history_len;
+    t->rank[a] = t->rank[b];
+    t->rank[b] = n;
+    t->rank[a]->rank = a;
+    t->rank[b]->rank = b;
+}
+
+/* Return the first rank whose count is lower than 'count'. */
+static size_t statsRankBelow(struct statsTable *t, unsigned long count) {
+    size_t lo = 0, hi = t->len;
 
-        new = malloc(sizeof(char*)*len);
-        if (new == NULL) return 0;
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if (t->rank[mid]->count >= count) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
 
-        /* If we can't copy everything, free the elements we'll not use. */
-        if (len < tocopy) {
-            int j;
+/* Double the buckets. Returns -1 on out of memory, the table stays valid. */
+static int statsGrow(struct statsTable *t) {
+    size_t size = t->size ? t->size*2 : 64, j;
+    struct statsNode **buckets = lnCalloc(LN_POOL_MISC,size,sizeof(*buckets));
 
-            for (j = 0; j < tocopy-len; j++) free(history[j]);
-            tocopy = len;
-        }
-        memset(new,0,sizeof(char*)*len);
-        memcpy(new,history+(history_len-tocopy), sizeof(char*)*tocopy);
-        free(history);
-        history = new;
+    if (buckets == NULL) return -1;
+    for (j = 0; j < t->len; j++) {
+        struct statsNode *n = t->rank[j];
+        n->next = buckets[n->hash & (size-1)];
+        buckets[n->hash & (size-1)] = n;
     }
-    history_max_len = len;
-    if (history_len > history_max_len)
-        history_len = history_max_len;
-    return 1;
+    lnFree(t->buckets);
+    t->buckets = buckets;
+    t->size = size;
+    return 0;
 }
 
-int linenoiseHistoryGetMaxLen(void) {
-    return history_max_len;
+/* Add 'delta', 1 or -1, to the counter of the 'len' bytes at 'key',
+ * creating or removing it as needed. */
+static void statsCount(struct statsTable *t, const char *key, size_t len, int delta) {
+    unsigned int hash = statsHash(key,len);
+    struct statsNode *n = NULL, **link = NULL;
+    size_t r;
+
+    if (t->size) {
+        link = &t->buckets[hash & (t->size-1)];
+        while ((n = *link) != NULL) {
+            if (n->hash == hash && n->keylen == len && !memcmp(n->key,key,len))
+                break;
+            link = &n->next;
+        }
+    }
+
+    if (delta > 0) {
+        if (n == NULL) {
+            if (t->len == t->cap) {
+                size_t cap = t->cap ? t->cap*2 : 64;
+                struct statsNode **rank = lnRealloc(LN_POOL_MISC,t->rank,sizeof(*rank)*cap);
+
+                if (rank == NULL) return;
+                t->rank = rank;
+                t->cap = cap;
+            }
+            if (t->len >= t->size && statsGrow(t) == -1 && t->size == 0)
+                return;
+            if ((n = lnMalloc(LN_POOL_MISC,sizeof(*n))) == NULL) return;
+            if ((n->key = lnMalloc(LN_POOL_MISC,len+1)) == NULL) {
+                lnFree(n);
+                return;
+            }
+            memcpy(n->key,key,len);
+            n->key[len] = '\0';
+            n->keylen = len;
+            n->hash = hash;
+            n->count = 0;
+            n->next = t->buckets[hash & (t->size-1)];
+            t->buckets[hash & (t->size-1)] = n;
+            n->rank = t->len;
+            t->rank[t->len++] = n;
+        }
+        /* Move in front of the counters with the same count. */
+        r = statsRankBelow(t,n->count+1);
+        statsSwap(t,r,n->rank);
+        n->count++;
+    } else if (n) {
+        /* Move behind the counters with the same count. */
+        r = statsRankBelow(t,n->count)-1;
+        statsSwap(t,r,n->rank);
+        if (--n->count == 0) {
+            /* It is the last of the array now. */
+            *link = n->next;
+            t->len--;
+            lnFree(n->key);
+            lnFree(n);
+        }
+    }
 }
 
-/* Save the history in the specified file. On success 0 is returned
- * otherwise -1 is returned. */
-int linenoiseHistorySave(const char *filename) {
-    mode_t old_umask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
-    FILE *fp;
-    int j;
+/* Count 'line' as added to the history, or evicted if 'delta' is -1.
+ * Must be called with history_lock held. */
+static void statsUpdate(const char *line, int delta) {
+    size_t start, end;
 
-    fp = fopen(filename,"w");
-    umask(old_umask);
-    if (fp == NULL) return -1;
-    (void)chmod(filename,S_IRUSR|S_IWUSR);
-    for (j = 0; j < history_len; j++)
-        fprintf(fp,"%s\n",history[j]);
-    fclose(fp);
-    return 0;
+    if (!stats_enabled || line == NULL) return;
+    statsCount(&stats_entries,line,strlen(line),delta);
+    start = strspn(line," \t\n");
+    end = start+strcspn(line+start," \t\n");
+    if (end > start) statsCount(&stats_tokens,line+start,end-start,delta);
 }
 
-/* Load the history from the specified file. If the file does not exist
- * -1 is returned and no operation is performed.
- *
- * If the file exists and the operation succeeded 0 is returned, otherwise
- * on error -1 is returned. */
-int linenoiseHistoryLoad(const char *filename) {
-    FILE *fp = fopen(filename,"r");
-    char buf[LINENOISE_MAX_LINE];
+static void statsFree(struct statsTable *t) {
+    size_t j;
 
-    if (fp == NULL) return -1;
+    for (j = 0; j < t->len; j++) {
+        lnFree(t->rank[j]->key);
+        lnFree(t->rank[j]);
+    }
+    lnFree(t->rank);
+    lnFree(t->buckets);
+    memset(t,0,sizeof(*t));
+}
+
+/* Start keeping the statistics of the history if 'enable' is non zero,
+ * counting the entries already there, or stop and free them. */
+void linenoiseHistoryStatsEnable(int enable) {
+    struct historyRing *r;
+    unsigned long seq;
+
+    pthread_mutex_lock(&history_lock);
+    if (enable && !stats_enabled) {
+        stats_enabled = 1;
+        r = atomic_load(&history);
+        if (r) {
+            for (seq = atomic_load(&r->tail); seq < atomic_load(&r->head); seq++)
+                statsUpdate(historyRingGet(r,seq),1);
+        }
+    } else if (!enable && stats_enabled) {
+        stats_enabled = 0;
+        statsFree(&stats_entries);
+        statsFree(&stats_tokens);
+    }
+    pthread_mutex_unlock(&history_lock);
+}
 
-    while (fgets(buf,LINENOISE_MAX_LINE,fp) != NULL) {
-        char *p;
+/* Copy the first '*len' counters of the rank array into 'vec', setting
+ * '*len' to the number copied. */
+static int statsCopy(struct statsTable *t, linenoiseHistoryCount *vec, int *len) {
+    int j;
 
-        p = strchr(buf,'\r');
-        if (!p) p = strchr(buf,'\n');
-        if (p) *p = '\0';
-        linenoiseHistoryAdd(buf);
+    if (vec == NULL || len == NULL) return 0;
+    if ((size_t)*len > t->len) *len = t->len;
+    for (j = 0; j < *len; j++) {
+        if ((vec[j].text = lnStrdup(LN_POOL_MISC,t->rank[j]->key)) == NULL) {
+            while (j) lnFree(vec[--j].text);
+            *len = 0;
+            return -1;
+        }
+        vec[j].count = t->rank[j]->count;
     }
-    fclose(fp);
     return 0;
 }
 
-/* Copy the history into the specified array.
- * it must already be allocated to have at least destlen spaces.
- * The size of the history is returned. */
-int linenoiseHistoryCopy(char** dest, int destlen) {
-    int i;
-    for(i = 0; i < destlen; ++i) {
-        if (i >= history_len) break;
-        dest[i] = strdup(history[i]);
+/* Report the statistics of the history: up to '*ncommands' most frequent
+ * entries in 'commands' and up to '*ntokens' most frequent first tokens in
+ * 'tokens', most frequent first, setting the counts to the number of items
+ * reported, and the number of distinct entries in '*distinct'. Any of the
+ * outputs may be NULL. The text of the items must be freed by the caller.
+ * Returns -1 if the statistics are not enabled, or on out of memory. */
+int linenoiseHistoryStats(linenoiseHistoryCount *commands, int *ncommands,
+                          linenoiseHistoryCount *tokens, int *ntokens,
+                          unsigned long *distinct)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&history_lock);
+    if (!stats_enabled) goto done;
+    if (distinct) *distinct = stats_entries.len;
+    if (statsCopy(&stats_entries,commands,ncommands) == -1) goto done;
+    if (statsCopy(&stats_tokens,tokens,ntokens) == -1) {
+        if (commands && ncommands)
+            while (*ncommands) lnFree(commands[--*ncommands].text);
+        goto done;
     }
+    ret = 0;
 
-    return history_len;
+done:
+    pthread_mutex_unlock(&history_lock);
+    return ret;
 }
@@ -1,4 +1,4 @@
-/* linenoise.h -- VERSION 1.0
+/* linenoise.h -- VERSION 1.1
  *
  * Guerrilla line editing library against the idea that a line editing lib
  * needs to be 20,000 lines of C code.
@@ -40,24 +40,41 @@
 #define __LINENOISE_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stddef.h>
+/* The candidates added by the completion callback are kept as parallel
+ * arrays, with their widths measured once, so that a menu can be laid out
+ * in a single pass. 'len' and 'cvec' come first like in the two fields
+ * structure of version 1.0, so callbacks reading them keep working, but
+ * the size changed: the structure is only allocated by linenoise. */
 typedef struct linenoiseCompletions {
   size_t len;
-  char **cvec;
+  char **cvec;          /* Candidate text. */
+  char **descvec;       /* Description of every candidate, or NULL. */
+  int *scorevec;        /* Score, candidates are shown highest first. */
+  int *kindvec;         /* Kind of candidate, defined by the application. */
+  size_t *widthvec;     /* Width in columns of the candidate text. */
+  size_t *descwidthvec; /* Width in columns of the description. */
+  size_t cap;           /* Allocated entries of every array. */
 } linenoiseCompletions;
 
 typedef void(linenoiseCompletionCallback)(const char *, linenoiseCompletions *);
 typedef char*(linenoiseHintsCallback)(const char *, int *color, int *bold);
 typedef void(linenoiseFreeHintsCallback)(void *);
+typedef int(linenoiseContinuationCallback)(const char *buf);
+typedef int(linenoiseContinuationLexer)(void *state, const char *line, size_t len);
 void linenoiseSetCompletionCallback(linenoiseCompletionCallback *);
 void linenoiseSetHintsCallback(linenoiseHintsCallback *);
 void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *);
+void linenoiseSetContinuationCallback(linenoiseContinuationCallback *);
+void linenoiseSetContinuationLexer(linenoiseContinuationLexer *, const void *init, size_t size);
 void linenoiseAddCompletion(linenoiseCompletions *, const char *);
+void linenoiseAddCompletionFull(linenoiseCompletions *, const char *str, const char *desc, int score, int kind);
 void linenoiseAddHistoryCompletions(const char*, linenoiseCompletions *);
 
 char *linenoise(const char *prompt);
@@ -67,9 +84,46 @@ int linenoiseHistorySetMaxLen(int len);
 int linenoiseHistoryGetMaxLen(void);
 int linenoiseHistorySave(const char *filename);
 int linenoiseHistoryLoad(const char *filename);
+
+/* History file formats of other shells, see linenoiseHistoryImport(). */
+enum linenoiseHistoryFormat {
+    LINENOISE_HISTORY_BASH,
+    LINENOISE_HISTORY_ZSH,
+    LINENOISE_HISTORY_FISH
+};
+int linenoiseHistoryImport(const char *filename, int format);
+
 int linenoiseHistoryCopy(char** dest, int destlen);
+void linenoiseHistorySetIgnoreCase(int enable);
+void linenoiseHistorySetNormalize(int enable);
+void linenoiseHistorySetTimestamps(int enable);
+int linenoiseHistoryRange(int64_t from, int64_t to, char **lines, int64_t *stamps, int max);
+
+typedef struct linenoiseHistoryCount {
+  char *text;
+  unsigned long count;
+} linenoiseHistoryCount;
+void linenoiseHistoryStatsEnable(int enable);
+int linenoiseHistoryStats(linenoiseHistoryCount *commands, int *ncommands,
+                          linenoiseHistoryCount *tokens, int *ntokens,
+                          unsigned long *distinct);
+int linenoiseHistorySearch(const char *needle, char **results, int max);
+
+typedef struct linenoiseRegex linenoiseRegex;
+linenoiseRegex *linenoiseRegexCompile(const char *pattern);
+int linenoiseRegexMatch(const linenoiseRegex *re, const char *str);
+void linenoiseRegexFree(linenoiseRegex *re);
+int linenoiseHistorySearchRegex(const linenoiseRegex *re, char **results, int max);
 void linenoiseClearScreen(void);
+int linenoisePrintf(const char *fmt, ...);
+
+typedef char *(linenoisePromptCallback)(void *privdata);
+int linenoiseAddPromptSegment(linenoisePromptCallback *fn, void *privdata, const char *placeholder, int async);
+int linenoiseInvalidatePromptSegment(int id);
 void linenoiseSetMultiLine(int ml);
+void linenoiseSetBracketMatching(int enable);
+void linenoiseSetRightPrompt(const char *text);
+void linenoiseSetStatusLine(const char *text);
 void linenoisePrintKeyCodes(void);
 
 typedef size_t (linenoisePrevCharLen)(const char *buf, size_t buf_len, size_t pos, size_t *col_len);
@@ -81,6 +135,42 @@ void linenoiseSetEncodingFunctions(
     linenoiseNextCharLen *nextCharLenFunc,
     linenoiseReadCode *readCodeFunc);
 
+#define LINENOISE_NOMORE -1
+typedef int(linenoiseTimerCallback)(long long id, void *privdata);
+typedef void(linenoiseIdleCallback)(void *privdata);
+long long linenoiseAddTimer(long long ms, linenoiseTimerCallback *fn, void *privdata);
+long long linenoiseAddIdleCallback(long long ms, linenoiseIdleCallback *fn, void *privdata);
+int linenoiseRemoveEvent(long long id);
+
+/* Trace events, see linenoiseTraceEnable(). The meaning of the arguments
+ * of each event is documented in tracedump.c. */
+enum linenoiseTraceEvent {
+    LINENOISE_TRACE_NONE = 0,
+    LINENOISE_TRACE_EDIT_START,
+    LINENOISE_TRACE_EDIT_END,
+    LINENOISE_TRACE_KEY,
+    LINENOISE_TRACE_REFRESH_SINGLE,
+    LINENOISE_TRACE_REFRESH_MULTI,
+    LINENOISE_TRACE_COMPLETE,
+    LINENOISE_TRACE_HISTORY_ADD,
+    LINENOISE_TRACE_HISTORY_EVICT,
+    LINENOISE_TRACE_HISTORY_BROWSE,
+    LINENOISE_TRACE_SPAN,
+    LINENOISE_TRACE_EVENTS
+};
+
+typedef struct linenoiseTraceRecord {
+    uint64_t ts;        /* Monotonic time in nanoseconds. */
+    uint16_t event;     /* One of enum linenoiseTraceEvent. */
+    uint16_t tid;       /* Thread that recorded the event. */
+    uint32_t arg[5];    /* Event specific arguments. */
+} linenoiseTraceRecord;
+
+int linenoiseTraceEnable(int enable);
+int linenoiseTraceSave(const char *filename);
+int linenoiseTraceSaveJSON(const char *filename);
+const char *linenoiseTraceEventName(int event);
+
 #ifdef __cplusplus
 }
 #endif
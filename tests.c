@@ -0,0 +1,514 @@
+/* tests.c -- regression tests for linenoise.
+ *
+ * Usage: tests
+ *
+ * Every test runs in its own process, so that it starts from an empty
+ * history, and prints its name and result. The exit status is non zero if
+ * some test failed. Run with "make check".
+ *
+ * linenoise.c is included rather than linked, so that its tables can be
+ * checked too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#if defined(__APPLE__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#include <util.h>
+#elif defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+#include "linenoise.c"
+
+#define TEST_FILE "tests-history.txt"
+
+static int failed = 0;
+
+/* Run 'fn' in a child process, reporting 'name' as failed if it does not
+ * exit with status 0. */
+static void run(const char *name, int (*fn)(void)) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) exit(fn());
+    waitpid(pid,&status,0);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("ok      %s\n", name);
+    } else {
+        printf("FAIL    %s\n", name);
+        failed++;
+    }
+}
+
+/* Run 'fn' in a child process, returning non zero if it failed. */
+static int child(int (*fn)(void)) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) == -1) return 1;
+    if (pid == 0) exit(fn());
+    waitpid(pid,&status,0);
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+/* Entries that can't be written as plain lines in the history file. */
+static const char *roundtrip_entries[] = {
+    "ls foo\\",
+    "echo bar",
+    "a \\\\ b \\n c",
+    "select *\nfrom t\\\nwhere x = 1",
+    "\\",
+    "trailing\\\n",
+    "cr\rinside",
+    "#42",
+    NULL
+};
+
+/* Entries that can be written as plain lines, the first looking like the
+ * header of escaped files. */
+static const char *header_entries[] = {
+    "#linenoise-history",
+    "a \\ b \\n c",
+    NULL
+};
+
+static int roundtripSaveStamps(void) {
+    linenoiseHistorySetTimestamps(1);
+    return linenoiseHistoryAdd("#42") != 1 ||
+           linenoiseHistoryAdd("# 42") != 1 ||
+           linenoiseHistorySave(TEST_FILE) != 0;
+}
+
+static int historySaveEntries(const char **entries) {
+    int j;
+
+    for (j = 0; entries[j]; j++)
+        if (linenoiseHistoryAdd(entries[j]) != 1) return 1;
+    return linenoiseHistorySave(TEST_FILE) != 0;
+}
+
+static int roundtripSave(void) {
+    return historySaveEntries(roundtrip_entries);
+}
+
+static int headerSave(void) {
+    return historySaveEntries(header_entries);
+}
+
+/* Load the history file and compare it with the 'n' entries 'expected'. */
+static int historyExpect(const char **expected, int n) {
+    char *lines[16];
+    int count, j, err = 0;
+
+    if (linenoiseHistoryLoad(TEST_FILE) != 0) return 1;
+    count = linenoiseHistoryCopy(lines,16);
+    for (j = 0; j < count; j++) {
+        if (j >= n || strcmp(lines[j],expected[j]) != 0) {
+            fprintf(stderr, "entry %d: '%s'\n", j, lines[j]);
+            err = 1;
+        }
+        linenoiseFree(lines[j]);
+    }
+    return err || count != n;
+}
+
+static int historyExpectEntries(const char **entries) {
+    int n = 0;
+
+    while (entries[n]) n++;
+    return historyExpect(entries,n);
+}
+
+static int roundtripLoad(void) {
+    return historyExpectEntries(roundtrip_entries);
+}
+
+static int headerLoad(void) {
+    return historyExpectEntries(header_entries);
+}
+
+static int roundtripLoadStamps(void) {
+    const char *expected[] = { "#42", "# 42" };
+
+    return historyExpect(expected,2);
+}
+
+/* Entries ending with a backslash or with new lines, or looking like the
+ * header, are loaded back as they were saved. */
+static int testHistoryRoundTrip(void) {
+    return child(roundtripSave) || child(roundtripLoad) ||
+           child(headerSave) || child(headerLoad);
+}
+
+/* Entries looking like timestamps are loaded back as they were saved with
+ * the timestamps. */
+static int testHistoryStamps(void) {
+    return child(roundtripSaveStamps) || child(roundtripLoadStamps);
+}
+
+/* Files written by older versions are plain lines, where '#' and digits
+ * is an entry, and a backslash at the end is part of the entry. */
+static int testHistoryPlainFile(void) {
+    const char *expected[] = { "#42", "ls foo\\", "echo \\n" };
+    FILE *fp = fopen(TEST_FILE,"w");
+
+    if (fp == NULL) return 1;
+    fprintf(fp,"#42\nls foo\\\necho \\n\n");
+    fclose(fp);
+    return historyExpect(expected,3);
+}
+
+/* Write 'content' to the test file and import it in the format 'format',
+ * then compare the history with the 'n' entries 'expected' and their
+ * timestamps 'stamps'. */
+static int importExpect(int format, const char *content, const char **expected, const int64_t *stamps, int n) {
+    char *lines[16];
+    int64_t got[16];
+    int count, j, err = 0;
+    FILE *fp = fopen(TEST_FILE,"w");
+
+    if (fp == NULL) return 1;
+    fputs(content,fp);
+    fclose(fp);
+    if (linenoiseHistoryImport(TEST_FILE,format) != 0) return 1;
+    count = linenoiseHistoryRange(0,INT64_MAX,lines,got,16);
+    for (j = 0; j < count; j++) {
+        if (j >= n || strcmp(lines[j],expected[j]) != 0 || got[j] != stamps[j]) {
+            fprintf(stderr, "entry %d: %lld '%s'\n", j, (long long)got[j],
+                lines[j]);
+            err = 1;
+        }
+        linenoiseFree(lines[j]);
+    }
+    return err || count != n;
+}
+
+/* Bash: '#' and digits lines are timestamps of the entry in the lines
+ * after them. */
+static int testHistoryImportBash(void) {
+    const char *expected[] = { "ls", "for i in 1 2\ndo echo $i\ndone", "pwd" };
+    const int64_t stamps[] = { 1000, 1001, 1002 };
+
+    return importExpect(LINENOISE_HISTORY_BASH,
+        "#1000\nls\n#1001\nfor i in 1 2\ndo echo $i\ndone\n#1002\npwd\n",
+        expected,stamps,3);
+}
+
+/* Zsh: ': time:duration;' prefixes, lines continued with a backslash, and
+ * metafied bytes, here the 0x84 of U+00C4 written as 0x83 0xA4. */
+static int testHistoryImportZsh(void) {
+    const char *expected[] = { "ls", "echo a\nb", "echo \xc3\x84" };
+    const int64_t stamps[] = { 1000, 1001, 1002 };
+
+    return importExpect(LINENOISE_HISTORY_ZSH,
+        ": 1000:0;ls\n: 1001:3;echo a\\\nb\n: 1002:0;echo \xc3\x83\xa4\n",
+        expected,stamps,3);
+}
+
+/* Fish: '- cmd:' items with a 'when:' field, and the other fields
+ * ignored. */
+static int testHistoryImportFish(void) {
+    const char *expected[] = { "ls", "echo a\nb \\ c" };
+    const int64_t stamps[] = { 1000, 1001 };
+
+    return importExpect(LINENOISE_HISTORY_FISH,
+        "- cmd: ls\n  when: 1000\n- cmd: echo a\\nb \\\\ c\n"
+        "  when: 1001\n  paths:\n    - foo\n",
+        expected,stamps,2);
+}
+
+/* Entries imported from an older file go before the ones already in the
+ * history, with their timestamps. */
+static int testHistoryImportMerge(void) {
+    const char *expected[] = { "ls", "pwd", "make", "git log" };
+    const int64_t stamps[] = { 1000, 1500, 2000, 2500 };
+
+    historyAdd("pwd",1500);
+    historyAdd("git log",2500);
+    return importExpect(LINENOISE_HISTORY_BASH,"#1000\nls\n#2000\nmake\n",
+                        expected,stamps,4);
+}
+
+/* Run 'fn' on the slave side of a new pseudo terminal, returning the file
+ * descriptor of the master side and setting '*pid', or -1 on error. */
+static int ptyStart(void (*fn)(void), pid_t *pid) {
+    struct winsize ws = { 24, 80, 0, 0 };
+    int fd;
+
+    if ((*pid = forkpty(&fd,NULL,NULL,&ws)) == -1) return -1;
+    if (*pid == 0) {
+        fn();
+        exit(0);
+    }
+    return fd;
+}
+
+/* Read from 'fd' until 'expected' is found, without writing anything, for
+ * at most 'ms' milliseconds. Returns 0 if it was found. */
+static int ptyExpect(int fd, const char *expected, int ms) {
+    char buf[4096];
+    size_t len = 0, elen = strlen(expected);
+    struct timespec ts;
+    long long deadline;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    deadline = ts.tv_sec*1000LL+ts.tv_nsec/1000000+ms;
+    while (1) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        long long now;
+        ssize_t n;
+
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        now = ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+        if (now >= deadline || poll(&pfd,1,(int)(deadline-now)) <= 0) return -1;
+        /* Keep the end of what was read, where the text may start. */
+        if (len == sizeof(buf)-1) {
+            memmove(buf,buf+len-elen,elen);
+            len = elen;
+        }
+        if ((n = read(fd,buf+len,sizeof(buf)-1-len)) <= 0) return -1;
+        len += n;
+        buf[len] = '\0';
+        if (strstr(buf,expected)) return 0;
+    }
+}
+
+static char *segmentSlow(void *privdata) {
+    (void)privdata;
+    usleep(200000);
+    return strdup("segment-ready");
+}
+
+static void segmentEditor(void) {
+    char *line;
+
+    linenoiseAddPromptSegment(segmentSlow,NULL,"segment-wait",1);
+    line = linenoise("> ");
+    linenoiseFree(line);
+}
+
+/* An asynchronous prompt segment is shown once computed, while the user
+ * does not type anything. */
+static int testAsyncSegmentRedraw(void) {
+    pid_t pid;
+    int fd = ptyStart(segmentEditor,&pid), err;
+
+    if (fd == -1) return 1;
+    err = ptyExpect(fd,"segment-wait",2000) ||
+          ptyExpect(fd,"segment-ready",2000);
+    kill(pid,SIGKILL);
+    waitpid(pid,NULL,0);
+    close(fd);
+    return err;
+}
+
+static void searchEditor(void) {
+    char *line;
+
+    linenoiseHistoryAdd("hello");
+    line = linenoise("> ");
+    printf("\r\nline=[%s]\r\n", line ? line : "(null)");
+    linenoiseFree(line);
+}
+
+/* Escape alone during a search restores the line typed before the search,
+ * instead of accepting the entry found. */
+static int testSearchEscape(void) {
+    pid_t pid;
+    int fd = ptyStart(searchEditor,&pid), err;
+
+    if (fd == -1) return 1;
+    err = ptyExpect(fd,"> ",2000) ||
+          write(fd,"ab\x12hel",6) != 6 ||
+          ptyExpect(fd,"hello",2000) ||
+          write(fd,"\x1b",1) != 1 ||
+          usleep(200000) ||
+          write(fd,"\r",1) != 1 ||
+          ptyExpect(fd,"line=[ab]",2000);
+    kill(pid,SIGKILL);
+    waitpid(pid,NULL,0);
+    close(fd);
+    return err;
+}
+
+/* Strings and their NFC form. */
+static const struct {
+    const char *s, *nfc;
+} nfc_cases[] = {
+    /* Composition. */
+    { "cafe\xcc\x81", "caf\xc3\xa9" },
+    { "A\xcc\x8a", "\xc3\x85" },
+    /* Canonical reordering, then composition of both marks. */
+    { "a\xcc\x82\xcc\xa3", "\xe1\xba\xad" },
+    { "x\xcc\x82\xcc\xa3", "x\xcc\xa3\xcc\x82" },
+    /* A mark of the same class blocks the composition. */
+    { "a\xcc\x85\xcc\x81", "a\xcc\x85\xcc\x81" },
+    { "a\xcc\x81\xcc\x81", "\xc3\xa1\xcc\x81" },
+    /* Hangul syllables. */
+    { "\xe1\x84\x80\xe1\x85\xa1", "\xea\xb0\x80" },
+    { "\xe1\x84\x80\xe1\x85\xa1\xe1\x86\xa8", "\xea\xb0\x81" },
+    { "\xea\xb0\x80\xe1\x86\xa8", "\xea\xb0\x81" },
+    /* U+0344 decomposes to non starters, U+0958 is excluded from the
+     * composition, U+212B is a singleton. */
+    { "\xcd\x84", "\xcc\x88\xcc\x81" },
+    { "\xe0\xa5\x98", "\xe0\xa4\x95\xe0\xa4\xbc" },
+    { "\xe2\x84\xab", "\xc3\x85" },
+    /* Invalid UTF-8 is left as it is. */
+    { "a\xff\xc3", "a\xff\xc3" },
+    { "e\xcc", "e\xcc" },
+    { "\xc3\xa9\x80\xcc\x81", "\xc3\xa9\x80\xcc\x81" },
+    { NULL, NULL }
+};
+
+/* Strings are converted to NFC, and entries differing only in their
+ * normalization are duplicates. */
+static int testNormalize(void) {
+    char *lines[4], *alloc;
+    const char *nfc;
+    int j, count, err = 0;
+
+    linenoiseHistorySetNormalize(1);
+    for (j = 0; nfc_cases[j].s; j++) {
+        if ((nfc = historyNormalize(nfc_cases[j].s,&alloc)) == NULL) return 1;
+        if (strcmp(nfc,nfc_cases[j].nfc) != 0) {
+            fprintf(stderr, "case %d: '%s'\n", j, nfc);
+            err = 1;
+        }
+        lnFree(alloc);
+    }
+    linenoiseHistoryAdd("caf\xc3\xa9");
+    linenoiseHistoryAdd("cafe\xcc\x81");
+    count = linenoiseHistoryCopy(lines,4);
+    for (j = 0; j < count; j++) linenoiseFree(lines[j]);
+    return err || count != 1;
+}
+
+/* Patterns with a subject they must match or not. */
+static const struct {
+    const char *pattern, *subject;
+    int match;
+} regex_cases[] = {
+    /* Anchors. */
+    { "^$", "", 1 },
+    { "^$", "a", 0 },
+    { "^ab", "abc", 1 },
+    { "^bc", "abc", 0 },
+    { "bc$", "abc", 1 },
+    { "ab$", "abc", 0 },
+    /* '.' matches a whole UTF-8 character. */
+    { "^a.c$", "a\xc3\xa9" "c", 1 },
+    { "^a..c$", "a\xc3\xa9" "c", 0 },
+    { "^.$", "\xe2\x82\xac", 1 },
+    { "^.$", "\xf0\x9f\x98\x80", 1 },
+    /* Bracket expressions. */
+    { "^[^a]$", "a", 0 },
+    { "^[^a]$", "b", 1 },
+    { "^[]a]+$", "]a]", 1 },
+    { "^[]a]+$", "b", 0 },
+    { "^[^]a]$", "]", 0 },
+    { "^[^]a]$", "b", 1 },
+    { "^[a-c[:digit:]]+$", "b2c", 1 },
+    /* The literal every match contains must not hide matches. */
+    { "ab+c", "abbbc", 1 },
+    { "ab+c", "ac", 0 },
+    { "ab?c", "ac", 1 },
+    { "colou?r", "color", 1 },
+    { "foo(bar)?baz", "foobaz", 1 },
+    { "x(ab)*y", "xy", 1 },
+    { "(ab)+c", "ababc", 1 },
+    { "abc|xyz", "xyz", 1 },
+    { "(abc|abd)e", "abde", 1 },
+    { "a(b|c)d", "acd", 1 },
+    { "abc|xyz", "abxy", 0 },
+    { NULL, NULL, 0 }
+};
+
+/* Compiled patterns match as POSIX extended regular expressions would, and
+ * invalid or too large patterns are refused with errno set. */
+static int testRegex(void) {
+    const char *invalid[] = { "(", "(a", "a)", "[abc", "[z-a]", "*a", "a\\",
+                              NULL };
+    linenoiseRegex *re;
+    int j, err = 0;
+
+    for (j = 0; regex_cases[j].pattern; j++) {
+        if ((re = linenoiseRegexCompile(regex_cases[j].pattern)) == NULL ||
+            !linenoiseRegexMatch(re,regex_cases[j].subject) != !regex_cases[j].match)
+        {
+            fprintf(stderr, "'%s' on '%s'\n", regex_cases[j].pattern,
+                regex_cases[j].subject);
+            err = 1;
+        }
+        linenoiseRegexFree(re);
+    }
+    for (j = 0; invalid[j]; j++) {
+        errno = 0;
+        if ((re = linenoiseRegexCompile(invalid[j])) != NULL || errno != EINVAL) {
+            fprintf(stderr, "'%s' not refused\n", invalid[j]);
+            linenoiseRegexFree(re);
+            err = 1;
+        }
+    }
+    /* The DFA has a state for each of the last 11 characters. The fixed
+     * pools of static builds may run out before. */
+    errno = 0;
+    re = linenoiseRegexCompile("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)"
+                               "(a|b)(a|b)(a|b)");
+#ifdef LINENOISE_STATIC
+    if (errno == ENOMEM) errno = E2BIG;
+#endif
+    if (re != NULL || errno != E2BIG) {
+        fprintf(stderr, "too many states not refused\n");
+        linenoiseRegexFree(re);
+        err = 1;
+    }
+    return err;
+}
+
+/* The word break ranges are sorted and disjoint, as the binary search in
+ * wordBreakClass() expects, and are all outside ASCII. */
+static int testWordBreakRanges(void) {
+    size_t n = sizeof(wbRanges)/sizeof(wbRanges[0]), j;
+
+    for (j = 0; j < n; j++) {
+        if (wbRanges[j].first > wbRanges[j].last ||
+            wbRanges[j].first < 0x80 ||
+            (j > 0 && wbRanges[j].first <= wbRanges[j-1].last))
+        {
+            fprintf(stderr, "bad range %04X-%04X\n", wbRanges[j].first,
+                wbRanges[j].last);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    run("history save and load round trip", testHistoryRoundTrip);
+    run("history timestamps round trip", testHistoryStamps);
+    run("history files of older versions", testHistoryPlainFile);
+    run("history import from bash", testHistoryImportBash);
+    run("history import from zsh", testHistoryImportZsh);
+    run("history import from fish", testHistoryImportFish);
+    run("history import merged by time", testHistoryImportMerge);
+    run("async prompt segment redrawn without input", testAsyncSegmentRedraw);
+    run("escape aborts the history search", testSearchEscape);
+    run("regular expressions", testRegex);
+    run("normalization to NFC", testNormalize);
+    run("word break ranges sorted and disjoint", testWordBreakRanges);
+    unlink(TEST_FILE);
+    return failed != 0;
+}
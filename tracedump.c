@@ -0,0 +1,83 @@
+/* tracedump.c -- decode a trace saved with linenoiseTraceSave().
+ *
+ * Usage: tracedump <file>
+ *
+ * Every record is printed on its own line, with the time relative to the
+ * first record and the event arguments:
+ *
+ *   edit-start      cols, prompt length, buffer size, history head
+ *   edit-end        returned length, errno
+ *   key             key code, bytes read, line length, cursor position,
+ *                   history index
+ *   refresh-single  line length, cursor position, cols, prompt columns,
+ *                   bytes scrolled out on the left
+ *   refresh-multi   rows, old rows, old cursor row, cursor row, cursor column
+ *   complete        candidates, selected candidate, key code
+ *   history-add     sequence number, line length
+ *   history-evict   sequence number, line length
+ *   history-browse  history index, history head
+ *   span            span kind, duration in microseconds, cols, line length,
+ *                   cursor position
+ *
+ * The time is the start time for spans. Span kinds are, in order: read,
+ * decode, dispatch, completeLine, completionCallback, hintsCallback,
+ * refreshSingleLine and refreshMultiLine.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "linenoise.h"
+
+static const char *trace_event_args[] = {
+    "",
+    "cols=%u plen=%u buflen=%u head=%u",
+    "len=%d errno=%u",
+    "code=%u nread=%u len=%u pos=%u index=%u",
+    "len=%u pos=%u cols=%u pcols=%u scroll=%u",
+    "rows=%u old_rows=%u rpos=%u rpos2=%u col=%u",
+    "candidates=%u selected=%u code=%u",
+    "seq=%u len=%u",
+    "seq=%u len=%u",
+    "index=%u head=%u",
+    "kind=%u us=%u cols=%u len=%u pos=%u",
+};
+
+int main(int argc, char **argv) {
+    linenoiseTraceRecord rec;
+    char magic[8];
+    uint32_t count, j;
+    uint64_t start = 0;
+    FILE *fp;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+        return 1;
+    }
+    if ((fp = fopen(argv[1],"r")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(magic,sizeof(magic),1,fp) != 1 ||
+        memcmp(magic,"LNTRACE1",sizeof(magic)) != 0 ||
+        fread(&count,sizeof(count),1,fp) != 1)
+    {
+        fprintf(stderr, "%s: not a linenoise trace\n", argv[1]);
+        return 1;
+    }
+
+    for (j = 0; j < count; j++) {
+        if (fread(&rec,sizeof(rec),1,fp) != 1) {
+            fprintf(stderr, "%s: truncated after %u records\n", argv[1], j);
+            return 1;
+        }
+        if (j == 0) start = rec.ts;
+        printf("%12.3f %5u %-15s ", (rec.ts-start)/1000.0, rec.tid,
+            linenoiseTraceEventName(rec.event));
+        if (rec.event < LINENOISE_TRACE_EVENTS)
+            printf(trace_event_args[rec.event], rec.arg[0], rec.arg[1],
+                rec.arg[2], rec.arg[3], rec.arg[4]);
+        printf("\n");
+    }
+    fclose(fp);
+    return 0;
+}